@@ -19,6 +19,17 @@ pub fn linkPcre(vendored_pcre: bool, libExe: *std.build.LibExeObjStep) void {
     }
 }
 
+pub fn linkCompression(zlib: bool, zstd: bool, libExe: *std.build.LibExeObjStep) void {
+    if (zlib) {
+        libExe.defineCMacro("HAS_ZLIB", null);
+        libExe.linkSystemLibrary("z");
+    }
+    if (zstd) {
+        libExe.defineCMacro("HAS_ZSTD", null);
+        libExe.linkSystemLibrary("zstd");
+    }
+}
+
 pub fn build(b: *std.Build) !void {
     const target = b.standardTargetOptions(.{});
     const optimize = b.standardOptimizeOption(.{
@@ -29,6 +40,8 @@ pub fn build(b: *std.Build) !void {
     const skip_lib: bool = b.option(bool, "skip-lib", "Skip compiling the library") orelse false;
     const wasm: bool = b.option(bool, "wasm", "Compile the wasm library") orelse false;
     const vendored_pcre: bool = b.option(bool, "vendored-pcre", "Use vendored pcre") orelse true;
+    const zlib: bool = b.option(bool, "zlib", "Link system zlib for gzip output") orelse false;
+    const zstd: bool = b.option(bool, "zstd", "Link system libzstd for zstd output") orelse false;
 
     // Main build step
     if (!lib_only and !wasm) {
@@ -42,6 +55,7 @@ pub fn build(b: *std.Build) !void {
 
         fastfec_cli.addCSourceFiles(&libSources, &buildOptions);
         linkPcre(vendored_pcre, fastfec_cli);
+        linkCompression(zlib, zstd, fastfec_cli);
         fastfec_cli.addCSourceFiles(&.{
             "src/cli.c",
             "src/main.c",
@@ -65,6 +79,7 @@ pub fn build(b: *std.Build) !void {
         fastfec_lib.linkLibC();
         fastfec_lib.addCSourceFiles(&libSources, &buildOptions);
         linkPcre(vendored_pcre, fastfec_lib);
+        linkCompression(zlib, zstd, fastfec_lib);
         b.installArtifact(fastfec_lib);
     } else if (wasm) {
         // Wasm library build step
@@ -94,6 +109,7 @@ pub fn build(b: *std.Build) !void {
         subtest_exe.linkLibC();
         subtest_exe.addCSourceFiles(&testIncludes, &buildOptions);
         linkPcre(vendored_pcre, subtest_exe);
+        linkCompression(zlib, zstd, subtest_exe);
         subtest_exe.addCSourceFile(.{
             .file = .{ .path = test_file },
             .flags = &buildOptions,
@@ -107,6 +123,27 @@ pub fn build(b: *std.Build) !void {
     const test_steps = prev_test_step.?;
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(test_steps);
+
+    // Benchmark step
+    const bench_step = b.step("bench", "Run benchmarks");
+    for (benchmarks) |bench_file| {
+        const base_file = std.fs.path.basename(bench_file);
+        const bench_exe = b.addExecutable(.{
+            .name = base_file,
+            .target = target,
+            .optimize = .ReleaseFast,
+        });
+        bench_exe.linkLibC();
+        bench_exe.addCSourceFiles(&testIncludes, &buildOptions);
+        linkPcre(vendored_pcre, bench_exe);
+        linkCompression(zlib, zstd, bench_exe);
+        bench_exe.addCSourceFile(.{
+            .file = .{ .path = bench_file },
+            .flags = &buildOptions,
+        });
+        const bench_cmd = b.addRunArtifact(bench_exe);
+        bench_step.dependOn(&bench_cmd.step);
+    }
 }
 
 const libSources = [_][]const u8{
@@ -115,7 +152,17 @@ const libSources = [_][]const u8{
     "src/encoding.c",
     "src/csv.c",
     "src/writer.c",
+    "src/sink.c",
+    "src/async.c",
+    "src/compress.c",
+    "src/uring.c",
+    "src/mappings.c",
+    "src/decimal.c",
     "src/fec.c",
+    "src/batch.c",
+    "src/parallel.c",
+    "src/parts.c",
+    "src/serve.c",
 };
 const pcreSources = [_][]const u8{
     "src/pcre/pcre_chartables.c",
@@ -140,8 +187,9 @@ const pcreSources = [_][]const u8{
     "src/pcre/pcre_version.c",
     "src/pcre/pcre_xclass.c",
 };
-const tests = [_][]const u8{ "src/buffer_test.c", "src/csv_test.c", "src/writer_test.c", "src/cli_test.c" };
-const testIncludes = [_][]const u8{ "src/buffer.c", "src/memory.c", "src/encoding.c", "src/csv.c", "src/writer.c", "src/cli.c" };
+const tests = [_][]const u8{ "src/buffer_test.c", "src/csv_test.c", "src/writer_test.c", "src/cli_test.c", "src/mappings_test.c", "src/encoding_test.c", "src/decimal_test.c", "src/sink_test.c", "src/async_test.c", "src/compress_test.c", "src/batch_test.c", "src/parallel_test.c", "src/parts_test.c", "src/serve_test.c" };
+const testIncludes = [_][]const u8{ "src/buffer.c", "src/memory.c", "src/encoding.c", "src/csv.c", "src/writer.c", "src/sink.c", "src/async.c", "src/compress.c", "src/uring.c", "src/mappings.c", "src/decimal.c", "src/fec.c", "src/batch.c", "src/parallel.c", "src/parts.c", "src/serve.c", "src/cli.c" };
+const benchmarks = [_][]const u8{ "src/batch_bench.c", "src/buffer_bench.c", "src/csv_bench.c", "src/decimal_bench.c", "src/encoding_bench.c", "src/fec_bench.c", "src/mappings_bench.c", "src/parallel_bench.c", "src/serve_bench.c" };
 const buildOptions = [_][]const u8{
     "-std=c11",
     "-pedantic",
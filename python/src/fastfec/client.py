@@ -9,9 +9,9 @@ This library provides methods to
 import contextlib
 import os
 import pathlib
-from ctypes import CDLL, c_char_p, c_int, c_void_p
+from ctypes import CDLL, c_char_p, c_int, c_long, c_size_t, c_void_p
 from queue import Queue
-from threading import Thread
+from threading import Lock, Thread, local
 
 from .utils import (
     BUFFER_READ,
@@ -29,20 +29,40 @@ from .utils import (
 class LibFastFEC:
     """
     Python wrapper for the fastfec library
+
+    One instance can parse filings on many threads at once (e.g. from a thread pool). The
+    instance's mapping catalog (the compiled regexes and resolved header mappings) is shared
+    by every thread, and each thread parses with its own scratch memory.
     """
 
     def __init__(self):
         self.__init_lib()
 
         # Initialize
-        self.persistent_memory_context = self.libfastfec.newPersistentMemoryContext()
+        self.mapping_catalog = self.libfastfec.newMappingCatalog()
+        self.thread_scratch = local()
+        self.scratch_contexts = []
+        self.scratch_lock = Lock()
+
+    @property
+    def persistent_memory_context(self):
+        """
+        The calling thread's scratch memory context, created on first use
+        """
+        context = getattr(self.thread_scratch, "context", None)
+        if context is None:
+            context = self.libfastfec.newScratchMemoryContext(self.mapping_catalog)
+            self.thread_scratch.context = context
+            with self.scratch_lock:
+                self.scratch_contexts.append(context)
+        return context
 
     def parse(self, file_handle, include_filing_id=None, should_parse_date=True):
         """
         Parses the input file line-by-line
 
         Arguments:
-            file_handle -- An input stream for reading a .fec file
+            file_handle -- An input stream for reading a .fec file, or the file's contents as bytes
             include_filing_id -- If set, prepend a column into each outputted csv for filing_id
                                  with the specified filing id (defaults to None)
             should_parse_date -- If true, yields parsed datetime.date objects for date fields; if
@@ -62,10 +82,13 @@ class LibFastFEC:
         filing_id_included = include_filing_id is not None
 
         # Provide a custom line callback
-        buffer_read_fn = provide_read_callback(file_handle)
+        buffer_read_fn = self.__provide_read_callback(file_handle)
         line_callback_fn = CUSTOM_LINE(provide_line_callback(queue, filing_id_included, should_parse_date))
+        # Lines are yielded mid-parse, so this thread may parse something else before the
+        # parse finishes; give it scratch memory of its own
+        scratch_context = self.libfastfec.newScratchMemoryContext(self.mapping_catalog)
         fec_context = self.libfastfec.newFecContext(
-            self.persistent_memory_context,
+            scratch_context,
             buffer_read_fn,
             BUFFER_SIZE,
             CUSTOM_WRITE(0),
@@ -79,6 +102,7 @@ class LibFastFEC:
             1,
             0,
         )
+        self.__set_input_region(fec_context, file_handle)
 
         # Run the parsing in a separate thread. It's essentially still single-threaded
         # but this provides a mechanism to yield the results of a callback function
@@ -100,18 +124,25 @@ class LibFastFEC:
 
         # Free FEC context
         self.libfastfec.freeFecContext(fec_context)
+        self.libfastfec.freePersistentMemoryContext(scratch_context)
 
-    def parse_as_files(self, file_handle, output_directory, include_filing_id=None):
+    def parse_as_files(
+        self, file_handle, output_directory, include_filing_id=None, compression=None, compression_level=0
+    ):
         """
         Parses the input file into output files in the output directory
 
         Parent directories will be automatically created as needed.
 
         Arguments:
-            file_handle -- An input stream for reading a .fec file
+            file_handle -- An input stream for reading a .fec file, or the file's contents as bytes
             output_directory -- A directory in which to place output parsed .csv files
             include_filing_id -- If set, prepend a column into each outputted csv for filing_id
                                  with the specified filing id (defaults to None)
+            compression -- If set to "gzip" or "zstd", compress each output file (adding .gz or
+                           .zst to its name) on a pool of worker threads (defaults to None)
+            compression_level -- The compression level (from 1 to 9 for gzip, or 22 for zstd), or 0
+                                 for the format's default
 
         Returns:
             A status code. 1 indicates a successful parse, 0 an unsuccessful one.
@@ -125,24 +156,38 @@ class LibFastFEC:
             # pylint: disable=consider-using-with,unspecified-encoding,bad-option-value
             return open(filename, *args, **kwargs)
 
-        return self.parse_as_files_custom(file_handle, open_output_file, include_filing_id=include_filing_id)
+        return self.parse_as_files_custom(
+            file_handle,
+            open_output_file,
+            include_filing_id=include_filing_id,
+            compression=compression,
+            compression_level=compression_level,
+        )
 
-    def parse_as_files_custom(self, file_handle, open_function, include_filing_id=None):
+    def parse_as_files_custom(
+        self, file_handle, open_function, include_filing_id=None, compression=None, compression_level=0
+    ):
         """
         Parses the input file into output files
 
         Arguments:
-            file_handle -- An input stream for reading a .fec file
+            file_handle -- An input stream for reading a .fec file, or the file's contents as bytes
             open_function -- A function to open an output file for writing. This can be set to
                              customize the output stream for each parsed .csv file
             include_filing_id -- If set, prepend a column into each outputted csv for filing_id
                                  with the specified filing id (defaults to None)
+            compression -- If set to "gzip" or "zstd", compress each output file (adding .gz or
+                           .zst to its name) on a pool of worker threads (defaults to None)
+            compression_level -- The compression level (from 1 to 9 for gzip, or 22 for zstd), or 0
+                                 for the format's default
 
         Returns:
             A status code. 1 indicates a successful parse, 0 an unsuccessful one.
         """
+        compression_format = self.__compression_format(compression, compression_level)
+
         # Set callbacks
-        buffer_read_fn = provide_read_callback(file_handle)
+        buffer_read_fn = self.__provide_read_callback(file_handle)
         write_callback_fn, free_file_descriptors = provide_write_callback(open_function)
 
         # Prepare the filing id to include, if specified
@@ -165,6 +210,10 @@ class LibFastFEC:
             1,
             0,
         )
+        self.__set_input_region(fec_context, file_handle)
+        self.libfastfec.setOutputCompression(
+            fec_context, compression_format, compression_level, self.libfastfec.defaultCompressionWorkers()
+        )
 
         # Parse
         result = self.libfastfec.parseFec(fec_context)
@@ -175,19 +224,82 @@ class LibFastFEC:
 
         return result
 
+    def mapping_cache_stats(self):
+        """
+        Returns the number of form type mapping lookups that were already resolved (hits) and
+        that had to be resolved (misses). The mapping cache persists across parses, so parsing
+        many filings with one instance only resolves each version and form type once.
+        """
+        return {
+            "hits": self.libfastfec.getMappingCatalogHits(self.mapping_catalog),
+            "misses": self.libfastfec.getMappingCatalogMisses(self.mapping_catalog),
+        }
+
+    def output_buffer_stats(self):
+        """
+        Returns the most memory output buffers have taken at once (peak_buffered_bytes) and
+        how many were flushed early to keep within the output buffer budget (early_flushes).
+        Output buffers start small and grow with how much is written to each output file.
+        Each thread has its own output buffers; these are the calling thread's.
+        """
+        return {
+            "peak_buffered_bytes": self.libfastfec.getPeakBufferedBytes(self.persistent_memory_context),
+            "early_flushes": self.libfastfec.getEarlyBufferFlushes(self.persistent_memory_context),
+        }
+
     def free(self):
         """
-        Frees all the allocated memory from the fastfec library
+        Frees all the allocated memory from the fastfec library (once no thread is parsing)
+        """
+        with self.scratch_lock:
+            for context in self.scratch_contexts:
+                self.libfastfec.freePersistentMemoryContext(context)
+            self.scratch_contexts = []
+        self.thread_scratch = local()
+        self.libfastfec.releaseMappingCatalog(self.mapping_catalog)
+
+    @staticmethod
+    def __provide_read_callback(file_handle):
+        # Contents already in memory are parsed in place, with no read callback
+        if isinstance(file_handle, bytes):
+            return BUFFER_READ(0)
+        return provide_read_callback(file_handle)
+
+    def __set_input_region(self, fec_context, file_handle):
+        if isinstance(file_handle, bytes):
+            self.libfastfec.setInputRegion(fec_context, file_handle, len(file_handle))
+
+    def compression_available(self, compression):
+        """
+        Returns whether output files can be compressed in a format ("gzip" or "zstd") with this
+        build of the library. Each format needs the library built with it (zig build -Dzlib=true
+        for gzip, -Dzstd=true for zstd).
         """
-        self.libfastfec.freePersistentMemoryContext(self.persistent_memory_context)
+        compression_format = self.libfastfec.compressionFormat(as_bytes(compression))
+        return compression_format >= 0 and bool(self.libfastfec.compressionAvailable(compression_format))
+
+    def __compression_format(self, compression, compression_level):
+        compression_format = self.libfastfec.compressionFormat(as_bytes(compression or "none"))
+        if compression_format < 0:
+            raise ValueError(f"Unknown compression format: {compression}")
+        if not self.libfastfec.compressionAvailable(compression_format):
+            raise ValueError(f"Compression format isn't available in this build: {compression}")
+        if compression:
+            max_level = self.libfastfec.maxCompressionLevel(compression_format)
+            if not isinstance(compression_level, int) or not 0 <= compression_level <= max_level:
+                raise ValueError(f"Compression level must be from 1 to {max_level} for {compression}: {compression_level}")
+        return compression_format
 
     def __init_lib(self):
         # Find the fastfec library
         self.libfastfec = CDLL(find_fastfec_lib())
 
         # Lay out arg/res types for C callbacks
-        self.libfastfec.newPersistentMemoryContext.argtypes = []
-        self.libfastfec.newPersistentMemoryContext.restype = c_void_p
+        self.libfastfec.newMappingCatalog.argtypes = []
+        self.libfastfec.newMappingCatalog.restype = c_void_p
+        self.libfastfec.releaseMappingCatalog.argtypes = [c_void_p]
+        self.libfastfec.newScratchMemoryContext.argtypes = [c_void_p]
+        self.libfastfec.newScratchMemoryContext.restype = c_void_p
 
         self.libfastfec.newFecContext.argtypes = [
             c_void_p,
@@ -205,10 +317,29 @@ class LibFastFEC:
             c_int,
         ]
         self.libfastfec.newFecContext.restype = c_void_p
+        self.libfastfec.setInputRegion.argtypes = [c_void_p, c_char_p, c_size_t]
         self.libfastfec.parseFec.argtypes = [c_void_p]
         self.libfastfec.parseFec.restype = c_int
         self.libfastfec.freeFecContext.argtypes = [c_void_p]
         self.libfastfec.freePersistentMemoryContext.argtypes = [c_void_p]
+        self.libfastfec.getMappingCatalogHits.argtypes = [c_void_p]
+        self.libfastfec.getMappingCatalogHits.restype = c_long
+        self.libfastfec.getMappingCatalogMisses.argtypes = [c_void_p]
+        self.libfastfec.getMappingCatalogMisses.restype = c_long
+        self.libfastfec.getPeakBufferedBytes.argtypes = [c_void_p]
+        self.libfastfec.getPeakBufferedBytes.restype = c_long
+        self.libfastfec.getEarlyBufferFlushes.argtypes = [c_void_p]
+        self.libfastfec.getEarlyBufferFlushes.restype = c_long
+        self.libfastfec.compressionFormat.argtypes = [c_char_p]
+        self.libfastfec.compressionFormat.restype = c_int
+        self.libfastfec.compressionAvailable.argtypes = [c_int]
+        self.libfastfec.compressionAvailable.restype = c_int
+        self.libfastfec.maxCompressionLevel.argtypes = [c_int]
+        self.libfastfec.maxCompressionLevel.restype = c_int
+        self.libfastfec.defaultCompressionWorkers.argtypes = []
+        self.libfastfec.defaultCompressionWorkers.restype = c_int
+        self.libfastfec.setOutputCompression.argtypes = [c_void_p, c_int, c_int, c_int]
+        self.libfastfec.setOutputCompression.restype = c_int
 
 
 @contextlib.contextmanager
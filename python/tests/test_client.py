@@ -1,8 +1,12 @@
 import datetime
+import gzip
 import os
+from concurrent.futures import ThreadPoolExecutor
+
 import pytest
 
 from fastfec import FastFEC
+from fastfec.utils import BUFFER_SIZE
 
 
 def test_filing_1550126_line_callback(filing_1550126):
@@ -88,6 +92,137 @@ def test_filing_1550548_parse_as_files(tmpdir, filing_1550548):
         assert len(filing.readlines()) == 36
 
 
+def test_filing_1550548_parse_bytes_as_files(tmpdir, filing_1550548):
+    """
+    Test that parsing a filing's contents from memory outputs the same
+    files as parsing it from a file handle.
+    """
+    with open(filing_1550548, "rb") as filing:
+        contents = filing.read()
+    with FastFEC() as fastfec:
+        assert fastfec.parse_as_files(contents, os.path.join(tmpdir, "bytes")) == 1
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "stream")) == 1
+
+    filenames = sorted(os.listdir(os.path.join(tmpdir, "stream")))
+    assert sorted(os.listdir(os.path.join(tmpdir, "bytes"))) == filenames
+    for filename in filenames:
+        with open(os.path.join(tmpdir, "bytes", filename), "rb") as from_bytes:
+            with open(os.path.join(tmpdir, "stream", filename), "rb") as from_stream:
+                assert from_bytes.read() == from_stream.read()
+
+
+def test_mapping_cache_persists_across_filings(tmpdir, filing_1550548):
+    """
+    Test that mappings resolved while parsing one filing are reused by
+    the next filing parsed with the same instance.
+    """
+    with FastFEC() as fastfec:
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "first")) == 1
+        first_stats = fastfec.mapping_cache_stats()
+        assert first_stats["misses"] > 0
+
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "second")) == 1
+        second_stats = fastfec.mapping_cache_stats()
+        assert second_stats["misses"] == first_stats["misses"]
+        assert second_stats["hits"] > first_stats["hits"]
+
+
+def test_parse_as_files_from_thread_pool(tmpdir, filing_1550548, filing_1550126):
+    """
+    Test that one instance parses filings on many threads at once, sharing
+    its mapping catalog, with the same output as parsing them in turn.
+    """
+    filings = [filing_1550548, filing_1550126] * 4
+
+    def parse(i):
+        with open(filings[i], "rb") as filing:
+            return fastfec.parse_as_files(filing, os.path.join(tmpdir, f"parallel{i}"))
+
+    with FastFEC() as fastfec:
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "serial0")) == 1
+        with open(filing_1550126, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "serial1")) == 1
+        misses = fastfec.mapping_cache_stats()["misses"]
+
+        with ThreadPoolExecutor(max_workers=4) as executor:
+            assert list(executor.map(parse, range(len(filings)))) == [1] * len(filings)
+        assert fastfec.mapping_cache_stats()["misses"] == misses
+
+    def read_outputs(directory):
+        outputs = {}
+        for root, _, filenames in os.walk(directory):
+            for filename in filenames:
+                with open(os.path.join(root, filename), "rb") as output:
+                    outputs[os.path.relpath(os.path.join(root, filename), directory)] = output.read()
+        return outputs
+
+    for i in range(len(filings)):
+        expected = read_outputs(os.path.join(tmpdir, f"serial{i % 2}"))
+        assert read_outputs(os.path.join(tmpdir, f"parallel{i}")) == expected
+
+
+def test_output_buffers_start_small(tmpdir, filing_1550548):
+    """
+    Test that output buffers only grow as their files are written, so a
+    small filing takes far less than a full buffer per output file.
+    """
+    with FastFEC() as fastfec:
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, tmpdir) == 1
+        stats = fastfec.output_buffer_stats()
+        assert 0 < stats["peak_buffered_bytes"] < BUFFER_SIZE
+        assert stats["early_flushes"] == 0
+
+
+def test_filing_1550548_parse_as_compressed_files(tmpdir, filing_1550548):
+    """
+    Test that compressed output files decompress to the same contents as
+    uncompressed ones.
+    """
+    with FastFEC() as fastfec:
+        if not fastfec.compression_available("gzip"):
+            pytest.skip("gzip compression isn't available in this build")
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "plain")) == 1
+        with open(filing_1550548, "rb") as filing:
+            assert fastfec.parse_as_files(filing, os.path.join(tmpdir, "gzip"), compression="gzip") == 1
+
+    filenames = sorted(os.listdir(os.path.join(tmpdir, "plain")))
+    assert sorted(os.listdir(os.path.join(tmpdir, "gzip"))) == [f"{filename}.gz" for filename in filenames]
+    for filename in filenames:
+        with open(os.path.join(tmpdir, "plain", filename), "rb") as plain:
+            with gzip.open(os.path.join(tmpdir, "gzip", f"{filename}.gz"), "rb") as compressed:
+                assert compressed.read() == plain.read()
+
+
+def test_unknown_compression_format(tmpdir, filing_1550548):
+    """
+    Test that asking for an unknown compression format raises an error
+    """
+    with FastFEC() as fastfec:
+        assert not fastfec.compression_available("lzma")
+        with open(filing_1550548, "rb") as filing:
+            with pytest.raises(ValueError):
+                fastfec.parse_as_files(filing, tmpdir, compression="lzma")
+
+
+def test_invalid_compression_level(tmpdir, filing_1550548):
+    """
+    Test that asking for a compression level outside the format's range raises an error
+    """
+    with FastFEC() as fastfec:
+        if not fastfec.compression_available("gzip"):
+            pytest.skip("gzip compression isn't available in this build")
+        for level in [-1, 10, "9"]:
+            with open(filing_1550548, "rb") as filing:
+                with pytest.raises(ValueError):
+                    fastfec.parse_as_files(filing, tmpdir, compression="gzip", compression_level=level)
+
+
 def test_filing_1606847_parse_as_files(tmpdir, filing_1606847):
     """
     Test that the FastFEC `parse_as_files` method outputs the correct files
@@ -3,12 +3,17 @@ A utility script to generate C code to get FEC headers and type information give
 
 This script utilizes information in mappings.json and types.json (in the same directory) to
 generate mappings_generated.h in the top-level src/ directory.
+
+Besides the raw regex tables, the script compiles the version and form type regexes into
+deterministic automata so that the C code can resolve a mapping without running any regexes.
 """
 
 import csv
 import io
 import json
 import os
+import random
+import re
 import sys
 
 script_dir = os.path.dirname(os.path.realpath(__file__))
@@ -59,6 +64,524 @@ def with_comment(comment, text):
     return f"{comment}{text}"
 
 
+# The regexes in mappings.json/types.json only use a small subset of regex syntax:
+# alternation, groups, character classes, `.`, `*`, `^` and `$`. They are matched
+# case-insensitively with search (not full match) semantics, just like `pcre_exec`
+# with PCRE_CASELESS. The classes below compile that subset into an NFA and then
+# into a single DFA per input kind (version or form type) that reports which
+# regexes match the input string.
+
+ALL_BYTES = frozenset(range(256))
+NEWLINE = ord("\n")
+
+
+def case_variants(byte):
+    """Returns the set of bytes matching a byte case-insensitively (ASCII only, like PCRE)"""
+    char = chr(byte)
+    if char.isascii() and char.isalpha():
+        return {ord(char.lower()), ord(char.upper())}
+    return {byte}
+
+
+class Nfa:
+    """A Thompson NFA with byte set transitions and ^/$ assertions"""
+
+    def __init__(self):
+        self.epsilon = []  # state -> list of states
+        self.transitions = []  # state -> list of (byte set, state)
+        self.start_assertions = []  # state -> list of states reachable only at the start
+        self.end_assertions = []  # state -> list of states reachable only at the end
+        self.accepts = {}  # accepting state -> regex index
+
+    def new_state(self):
+        """Allocates a new state"""
+        self.epsilon.append([])
+        self.transitions.append([])
+        self.start_assertions.append([])
+        self.end_assertions.append([])
+        return len(self.epsilon) - 1
+
+
+class RegexCompiler:  # pylint: disable=too-few-public-methods
+    """Recursive descent compiler from a regex string into NFA fragments"""
+
+    def __init__(self, nfa, pattern):
+        self.nfa = nfa
+        self.pattern = pattern
+        self.pos = 0
+
+    def compile(self):
+        """Compiles the full pattern, returning (start, end) states"""
+        fragment = self.alternation()
+        if self.pos != len(self.pattern):
+            raise ValueError(f"Unexpected character in regex {self.pattern!r} at {self.pos}")
+        return fragment
+
+    def peek(self):
+        return self.pattern[self.pos] if self.pos < len(self.pattern) else None
+
+    def alternation(self):
+        start = self.nfa.new_state()
+        end = self.nfa.new_state()
+        while True:
+            branch_start, branch_end = self.concatenation()
+            self.nfa.epsilon[start].append(branch_start)
+            self.nfa.epsilon[branch_end].append(end)
+            if self.peek() != "|":
+                return start, end
+            self.pos += 1
+
+    def concatenation(self):
+        start = self.nfa.new_state()
+        end = start
+        while self.peek() not in (None, "|", ")"):
+            atom_start, atom_end = self.repetition()
+            self.nfa.epsilon[end].append(atom_start)
+            end = atom_end
+        return start, end
+
+    def repetition(self):
+        atom_start, atom_end = self.atom()
+        quantifier = self.peek()
+        if quantifier not in ("*", "+", "?"):
+            return atom_start, atom_end
+        self.pos += 1
+        start = self.nfa.new_state()
+        end = self.nfa.new_state()
+        self.nfa.epsilon[start].append(atom_start)
+        self.nfa.epsilon[atom_end].append(end)
+        if quantifier in ("*", "?"):
+            self.nfa.epsilon[start].append(end)
+        if quantifier in ("*", "+"):
+            self.nfa.epsilon[atom_end].append(atom_start)
+        return start, end
+
+    def atom(self):
+        char = self.peek()
+        self.pos += 1
+        if char == "(":
+            fragment = self.alternation()
+            if self.peek() != ")":
+                raise ValueError(f"Unbalanced group in regex {self.pattern!r}")
+            self.pos += 1
+            return fragment
+        start = self.nfa.new_state()
+        end = self.nfa.new_state()
+        if char == "^":
+            self.nfa.start_assertions[start].append(end)
+        elif char == "$":
+            self.nfa.end_assertions[start].append(end)
+        elif char == ".":
+            self.nfa.transitions[start].append((ALL_BYTES - {NEWLINE}, end))
+        elif char == "[":
+            self.nfa.transitions[start].append((self.character_class(), end))
+        else:
+            if char == "\\":
+                char = self.peek()
+                self.pos += 1
+            if char is None or char in "*+?{}":
+                raise ValueError(f"Unsupported regex syntax in {self.pattern!r}")
+            self.nfa.transitions[start].append((frozenset(case_variants(ord(char))), end))
+        return start, end
+
+    def character_class(self):
+        negated = self.peek() == "^"
+        if negated:
+            self.pos += 1
+        members = set()
+        first = True
+        while first or self.peek() != "]":
+            first = False
+            char = self.peek()
+            if char is None:
+                raise ValueError(f"Unterminated character class in {self.pattern!r}")
+            self.pos += 1
+            if char == "\\":
+                char = self.peek()
+                self.pos += 1
+            if self.peek() == "-" and self.pos + 1 < len(self.pattern) and self.pattern[self.pos + 1] != "]":
+                range_end = self.pattern[self.pos + 1]
+                self.pos += 2
+                for byte in range(ord(char), ord(range_end) + 1):
+                    members |= case_variants(byte)
+            else:
+                members |= case_variants(ord(char))
+        self.pos += 1
+        return frozenset(ALL_BYTES - members if negated else members)
+
+
+class RegexSet:
+    """A set of regexes compiled into one NFA, with helpers for subset construction"""
+
+    def __init__(self, patterns):
+        self.patterns = patterns
+        self.nfa = Nfa()
+        self.starts = []
+        for i, pattern in enumerate(patterns):
+            start, end = RegexCompiler(self.nfa, pattern).compile()
+            self.nfa.accepts[end] = i
+            self.starts.append(start)
+        self.atoms = self.byte_atoms()
+
+    def closure(self, states, at_start, at_end):
+        """Returns the epsilon closure of states, following assertions that hold"""
+        stack = list(states)
+        seen = set(stack)
+        while stack:
+            state = stack.pop()
+            following = list(self.nfa.epsilon[state])
+            if at_start:
+                following += self.nfa.start_assertions[state]
+            if at_end:
+                following += self.nfa.end_assertions[state]
+            for nxt in following:
+                if nxt not in seen:
+                    seen.add(nxt)
+                    stack.append(nxt)
+        return frozenset(seen)
+
+    def matched(self, states):
+        """Returns the indices of the regexes accepted by a set of NFA states"""
+        return frozenset(self.nfa.accepts[s] for s in states if s in self.nfa.accepts)
+
+    def move(self, states, byte):
+        """Returns the NFA states reached by reading a byte"""
+        return [nxt for s in states for (byte_set, nxt) in self.nfa.transitions[s] if byte in byte_set]
+
+    def byte_atoms(self):
+        """Partitions all bytes into groups that every NFA transition treats the same way"""
+        signatures = {}
+        for byte in range(256):
+            signature = tuple(
+                byte in byte_set for transitions in self.nfa.transitions for (byte_set, _) in transitions
+            ) + (byte == NEWLINE,)
+            signatures.setdefault(signature, []).append(byte)
+        return list(signatures.values())
+
+    def construct(self, initial_keys, step):
+        """
+        Runs a subset construction from the initial DFA state keys, where step(key, byte)
+        returns the key reached by reading a byte. Returns the list of keys and sets
+        up byte classes and per-class transitions.
+        """
+        index = {key: i for i, key in enumerate(initial_keys)}
+        keys = list(initial_keys)
+        rows = []
+        i = 0
+        while i < len(keys):
+            row = [0] * 256
+            for atom in self.atoms:
+                key = step(keys[i], atom[0])
+                if key not in index:
+                    index[key] = len(keys)
+                    keys.append(key)
+                for byte in atom:
+                    row[byte] = index[key]
+            rows.append(row)
+            i += 1
+
+        # Group bytes that behave identically into classes to keep the tables small
+        columns = {}
+        self.byte_classes = []
+        for byte in range(256):
+            column = tuple(row[byte] for row in rows)
+            if column not in columns:
+                columns[column] = len(columns)
+            self.byte_classes.append(columns[column])
+        self.transitions = []
+        for row in rows:
+            by_class = [0] * len(columns)
+            for byte in range(256):
+                by_class[self.byte_classes[byte]] = row[byte]
+            self.transitions.append(by_class)
+        return keys
+
+
+class MatchDfa(RegexSet):
+    """
+    A DFA that reads an input string and reports the set of regexes that would
+    match it with search semantics (i.e. `pcre_exec` returning >= 0).
+
+    Each DFA state records the regexes that have already matched (a match can never
+    be undone by reading more input), so the answer for a string is simply the
+    result attached to the state reached after its last byte. This only stays small
+    when the regexes are anchored at the start, as the form type regexes are.
+    """
+
+    def __init__(self, patterns):
+        super().__init__(patterns)
+
+        # A DFA state is (NFA states, already matched, matched if the string ends after
+        # a trailing newline, whether we are at the start of the string). The trailing
+        # newline component mirrors PCRE, where `$` also matches before a final newline.
+        def step(key, byte):
+            states, matched, _, at_start = key
+            next_states = self.closure(self.move(states, byte) + self.starts, False, False)
+            return (
+                next_states,
+                matched | self.matched(next_states),
+                self.matched(self.closure(states, at_start, True)) if byte == NEWLINE else frozenset(),
+                False,
+            )
+
+        initial_states = self.closure(self.starts, True, False)
+        keys = self.construct([(initial_states, self.matched(initial_states), frozenset(), True)], step)
+
+        # The result for a string ending in each state
+        self.results = [
+            matched | newline_matched | self.matched(self.closure(states, at_start, True))
+            for states, matched, newline_matched, at_start in keys
+        ]
+
+    def match(self, text):
+        """Returns the set of pattern indices matching the text (bytes)"""
+        state = 0
+        for byte in text:
+            state = self.transitions[state][self.byte_classes[byte]]
+        return self.results[state]
+
+
+class AnchoredDfa(RegexSet):
+    """
+    A DFA that matches the regexes from a single start position. Searching means
+    running it from every position of the input and collecting the matches of each
+    run. Unlike MatchDfa this stays small when the regexes contain unanchored
+    alternatives (like the version regexes `^5.0|5.1`), at the cost of a short
+    loop over start positions.
+
+    State 0 is dead, state 1 starts at the beginning of the string and state 2
+    starts at any later position. `$` is not supported.
+    """
+
+    def __init__(self, patterns):
+        super().__init__(patterns)
+        for assertions in self.nfa.end_assertions:
+            if assertions:
+                raise ValueError("`$` is not supported in anchored DFAs")
+
+        def step(states, byte):
+            return self.closure(self.move(states, byte), False, False)
+
+        keys = self.construct(
+            [frozenset(), self.closure(self.starts, True, False), self.closure(self.starts, False, False)], step
+        )
+        self.accepts = [sorted(self.matched(states)) for states in keys]
+
+    def match(self, text):
+        """Returns the set of pattern indices matching the text (bytes)"""
+        matches = set()
+        for start in range(len(text) + 1):
+            state = 1 if start == 0 else 2
+            matches.update(self.accepts[state])
+            for byte in text[start:]:
+                state = self.transitions[state][self.byte_classes[byte]]
+                if state == 0:
+                    break
+                matches.update(self.accepts[state])
+        return frozenset(matches)
+
+
+def resolve_classes(dfa):
+    """
+    Groups DFA results into classes. Returns a list mapping each DFA state to a
+    class ID, alongside the list of distinct matched pattern sets (one per class).
+    """
+    class_ids = {}
+    state_classes = []
+    for result in dfa.results:
+        if result not in class_ids:
+            class_ids[result] = len(class_ids)
+        state_classes.append(class_ids[result])
+    return state_classes, list(class_ids)
+
+
+def generate_c_transitions(prefix, dfa):
+    """Generates the C byte class and transition tables for a DFA"""
+    upper = prefix.upper()
+    c_code = f"#define NUM_{upper}_BYTE_CLASSES {max(dfa.byte_classes) + 1}\n"
+    c_code += f"static const unsigned char {prefix}ByteClasses[256] = {{"
+    c_code += ",".join(str(c) for c in dfa.byte_classes)
+    c_code += "};\n"
+    c_code += f"static const unsigned short {prefix}Transitions[][NUM_{upper}_BYTE_CLASSES] = {{\n    "
+    c_code += ",\n    ".join("{" + ",".join(str(s) for s in row) + "}" for row in dfa.transitions)
+    c_code += "\n};\n"
+    return c_code
+
+
+def sample_strings(patterns, seed):
+    """
+    Builds a deterministic corpus of strings to cross-check a DFA against Python's
+    regex engine: every literal fragment of the patterns, mutations and
+    concatenations of them, and random strings over the characters the patterns use.
+    """
+    alphabet = sorted({c for p in patterns for c in p if c.isalnum() or c in "._-/ "} | set("\n\x1c\xe9"))
+    fragments = {""}
+    for pattern in patterns:
+        for fragment in re.split(r"[\^\$\(\)\|\[\]\*]", pattern):
+            fragments.add(fragment)
+            fragments.add(fragment.upper())
+    fragments = sorted(fragments)
+    rng = random.Random(seed)
+    samples = set(fragments)
+    for fragment in fragments:
+        for _ in range(8):
+            mutated = list(fragment)
+            for _ in range(rng.randint(1, 3)):
+                action = rng.randint(0, 2)
+                position = rng.randint(0, len(mutated))
+                if action == 0:
+                    mutated.insert(position, rng.choice(alphabet))
+                elif mutated and action == 1:
+                    del mutated[min(position, len(mutated) - 1)]
+                elif mutated:
+                    mutated[min(position, len(mutated) - 1)] = rng.choice(alphabet)
+            samples.add("".join(mutated))
+    for _ in range(2000):
+        samples.add("".join(rng.choice(fragments) for _ in range(rng.randint(2, 4))))
+        samples.add("".join(rng.choice(alphabet) for _ in range(rng.randint(1, 8))))
+    return sorted(s.encode("latin-1") for s in samples)
+
+
+def verify_dfa(dfa, seed):
+    """Asserts that the DFA agrees with Python's regex engine on a sample corpus"""
+    compiled = [re.compile(p.encode("latin-1"), re.IGNORECASE) for p in dfa.patterns]
+    for sample in sample_strings(dfa.patterns, seed):
+        expected = frozenset(i for i, regex in enumerate(compiled) if regex.search(sample))
+        assert dfa.match(sample) == expected, f"DFA mismatch for {sample!r}"
+
+
+def column_types(columns, form_matches, types, form_index):
+    """
+    Returns the type string for the header columns of a form class, where each char
+    is the type of the first row in types matching the column (or s for string)
+    """
+    if not columns:
+        # Rows without columns still have a (string) form type column
+        return "s"
+    result = ""
+    for column in columns:
+        result += next(
+            (
+                type_value
+                for (_, form_type, type_col, type_value) in types
+                if form_index[form_type] in form_matches and re.search(type_col, column, re.IGNORECASE)
+            ),
+            "s",
+        )
+    return result
+
+
+def generate_header_dispatch(headers, types):
+    """
+    Compiles the header version/form type regexes into DFAs and tabulates, for each
+    version regex and form class, the first header row they both match. A lookup
+    then takes the smallest row over the version regexes matching the version.
+
+    The column types of a header row only depend on the form class too (the type
+    version regexes match every version), so they are tabulated alongside.
+    """
+    for version, _, _, _ in types:
+        if not re.search(version, ""):
+            raise ValueError(f"Type version regexes must match every version, not {version!r}")
+
+    form_patterns = sorted({row[1] for row in headers} | {row[1] for row in types})
+    form_index = {pattern: i for i, pattern in enumerate(form_patterns)}
+    form_dfa = MatchDfa(form_patterns)
+    verify_dfa(form_dfa, 1)
+    form_state_classes, form_classes = resolve_classes(form_dfa)
+
+    version_patterns = sorted({row[0] for row in headers})
+    version_dfa = AnchoredDfa(version_patterns)
+    verify_dfa(version_dfa, 0)
+
+    dispatch = []
+    for pattern in version_patterns:
+        row = []
+        for form_matches in form_classes:
+            row.append(
+                next(
+                    (
+                        i
+                        for i, (version, form_type, _) in enumerate(headers)
+                        if version == pattern and form_index[form_type] in form_matches
+                    ),
+                    -1,
+                )
+            )
+        dispatch.append(row)
+
+    # Type strings for each header row and form class dispatching to it
+    type_strings = []
+    type_string_index = {}
+    header_types = []
+    for i, (_, _, columns_csv) in enumerate(headers):
+        columns = columns_csv.split(",") if columns_csv else []
+        row = []
+        for form_class, form_matches in enumerate(form_classes):
+            if not any(dispatch_row[form_class] == i for dispatch_row in dispatch):
+                row.append(0)
+                continue
+            type_string = column_types(columns, form_matches, types, form_index)
+            if type_string not in type_string_index:
+                type_string_index[type_string] = len(type_strings)
+                type_strings.append(type_string)
+            row.append(type_string_index[type_string])
+        header_types.append(row)
+
+    accept_offsets = [0]
+    for accepts in version_dfa.accepts:
+        accept_offsets.append(accept_offsets[-1] + len(accepts))
+
+    c_code = with_comment(
+        "Deterministic automaton matching the header version regexes from a single\n"
+        + "position of a version string. Starting in state 1 at the beginning of the\n"
+        + "string (or state 2 at any later position), move to\n"
+        + "versionTransitions[state][versionByteClasses[byte]] for each byte until\n"
+        + "reaching state 0. Each state visited matches the version regexes listed in\n"
+        + "versionAccepts[versionAcceptOffsets[state]..versionAcceptOffsets[state + 1]].",
+        f"\n#define NUM_VERSION_PATTERNS {len(version_patterns)}\n",
+    )
+    c_code += generate_c_transitions("version", version_dfa)
+    c_code += "static const unsigned short versionAcceptOffsets[] = {"
+    c_code += ",".join(str(i) for i in accept_offsets)
+    c_code += "};\n"
+    c_code += "static const unsigned char versionAccepts[] = {"
+    c_code += ",".join(str(i) for accepts in version_dfa.accepts for i in accepts)
+    c_code += "};\n\n"
+    c_code += with_comment(
+        "Deterministic automaton resolving a form type to a form class. Start at\n"
+        + "state 0 and, for each byte, move to formTransitions[state][formByteClasses[byte]].\n"
+        + "The class of the form type is then formStateClasses[state].",
+        f"\n#define NUM_FORM_CLASSES {len(form_classes)}\n",
+    )
+    c_code += generate_c_transitions("form", form_dfa)
+    c_code += "static const unsigned short formStateClasses[] = {"
+    c_code += ",".join(str(c) for c in form_state_classes)
+    c_code += "};\n\n"
+    c_code += with_comment(
+        "The first row in headers matching each header version regex (in the order\n"
+        + "of the version automaton) and form class, or -1 if there is none",
+        "\nstatic const short headerDispatch[NUM_VERSION_PATTERNS][NUM_FORM_CLASSES] = {\n    "
+        + ",\n    ".join("{" + ",".join(str(i) for i in row) + "}" for row in dispatch)
+        + "\n};\n\n",
+    )
+    c_code += with_comment(
+        "Column types of each row in headers, resolved from the types table: the\n"
+        + "type string for a row and form class is headerTypeStrings[headerTypes[row][class]]\n"
+        + "and has one char per column (headerNumFields[row] of them)",
+        "\nstatic const char *const headerTypeStrings[] = {\n    "
+        + ",\n    ".join(c_escape(t) for t in type_strings)
+        + "\n};\n"
+        + "static const unsigned short headerTypes[][NUM_FORM_CLASSES] = {\n    "
+        + ",\n    ".join("{" + ",".join(str(i) for i in row) + "}" for row in header_types)
+        + "\n};\n"
+        + "static const unsigned short headerNumFields[] = {"
+        + ",".join(str(max(1, len(columns_csv.split(",")) if columns_csv else 0)) for (_, _, columns_csv) in headers)
+        + "};\n",
+    )
+    return c_code
+
+
 type_enum = {
     "float": "f",
     "date": "d",
@@ -123,6 +646,8 @@ if __name__ == "__main__":
         + "assumed to be s (string).",
         type_table,
     )
+    result += "\n"
+    result += generate_header_dispatch(headers, types)
 
     if test_mode:
         with open(
@@ -0,0 +1,271 @@
+#include "async.h"
+#include "compat.h"
+#include <stdlib.h>
+
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+
+// A full buffer to write (or, with a null file, a signal to stop)
+struct write_job
+{
+  OUTPUT_FILE *file;
+  char *buffer;
+  int length;
+  int capacity;
+};
+typedef struct write_job WRITE_JOB;
+
+// A bounded single-producer/single-consumer queue. The producer only
+// writes tail and the consumer only writes head; each reads the other's
+// index to see how far it can go. The indices count up without wrapping.
+struct ring
+{
+  WRITE_JOB *slots;
+  unsigned long size;
+  unsigned long head;
+  unsigned long tail;
+};
+typedef struct ring RING;
+
+struct async_writer
+{
+  WRITE_CONTEXT *context;
+  RING queue; // full buffers, parsing thread to I/O thread
+  RING empty; // written buffers, I/O thread back to parsing thread
+  unsigned long queued;
+  unsigned long written;
+  pthread_t thread;
+
+  // Only used to sleep when a side has to wait for the other
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int producerWaiting;
+  int consumerWaiting;
+};
+
+void initRing(RING *ring, int size)
+{
+  ring->slots = (WRITE_JOB *)malloc(sizeof(WRITE_JOB) * size);
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+int ringCount(RING *ring)
+{
+  return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+}
+
+// Add a job to the ring (from its one producer). Return 0 if it's full.
+int ringPush(RING *ring, WRITE_JOB job)
+{
+  unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  if (tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == ring->size)
+  {
+    return 0;
+  }
+  ring->slots[tail % ring->size] = job;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+// Take the oldest job from the ring (from its one consumer). Return 0 if
+// it's empty.
+int ringPop(RING *ring, WRITE_JOB *job)
+{
+  unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+  {
+    return 0;
+  }
+  *job = ring->slots[head % ring->size];
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+int hasQueueSpace(ASYNC_WRITER *writer)
+{
+  return ringCount(&writer->queue) < (int)writer->queue.size;
+}
+
+int hasQueuedJob(ASYNC_WRITER *writer)
+{
+  return ringCount(&writer->queue) > 0;
+}
+
+int isDrained(ASYNC_WRITER *writer)
+{
+  return __atomic_load_n(&writer->written, __ATOMIC_SEQ_CST) == writer->queued;
+}
+
+// Sleep until the other side makes ready true. The flag is set before
+// ready is checked again, and the other side checks the flag after
+// making progress, so one of them always sees the other.
+void waitUntil(ASYNC_WRITER *writer, int *waiting, int (*ready)(ASYNC_WRITER *))
+{
+  if (ready(writer))
+  {
+    return;
+  }
+  pthread_mutex_lock(&writer->lock);
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  while (!ready(writer))
+  {
+    pthread_cond_wait(&writer->wake, &writer->lock);
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&writer->lock);
+}
+
+void wakeWaiter(ASYNC_WRITER *writer, int *waiting)
+{
+  if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+  {
+    pthread_mutex_lock(&writer->lock);
+    pthread_cond_broadcast(&writer->wake);
+    pthread_mutex_unlock(&writer->lock);
+  }
+}
+
+void *writeQueuedBuffers(void *data)
+{
+  ASYNC_WRITER *writer = (ASYNC_WRITER *)data;
+  while (1)
+  {
+    WRITE_JOB job;
+    waitUntil(writer, &writer->consumerWaiting, hasQueuedJob);
+    ringPop(&writer->queue, &job);
+    if (job.file == NULL)
+    {
+      break;
+    }
+    OUTPUT_SINK *sink = writer->context->sink;
+    if (sink->swap != NULL)
+    {
+      job.buffer = sink->swap(sink, job.file, job.buffer, job.length, job.capacity);
+    }
+    else
+    {
+      sink->write(sink, job.file, job.buffer, job.length);
+    }
+
+    // Hand the buffer back to be reused (there's always room unless
+    // the parsing thread has stopped taking them)
+    if (!ringPush(&writer->empty, job))
+    {
+      free(job.buffer);
+    }
+    __atomic_store_n(&writer->written, writer->written + 1, __ATOMIC_SEQ_CST);
+    wakeWaiter(writer, &writer->producerWaiting);
+  }
+  return NULL;
+}
+
+ASYNC_WRITER *newAsyncWriter(WRITE_CONTEXT *context, int queueLength)
+{
+  ASYNC_WRITER *writer = (ASYNC_WRITER *)malloc(sizeof(ASYNC_WRITER));
+  writer->context = context;
+  // The queue also holds the stop signal; buffers in flight are those
+  // queued and the one being written
+  initRing(&writer->queue, queueLength + 1);
+  initRing(&writer->empty, queueLength + 2);
+  writer->queued = 0;
+  writer->written = 0;
+  writer->producerWaiting = 0;
+  writer->consumerWaiting = 0;
+  pthread_mutex_init(&writer->lock, NULL);
+  pthread_cond_init(&writer->wake, NULL);
+  if (pthread_create(&writer->thread, NULL, writeQueuedBuffers, writer) != 0)
+  {
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->wake);
+    free(writer->queue.slots);
+    free(writer->empty.slots);
+    free(writer);
+    return NULL;
+  }
+  return writer;
+}
+
+char *asyncWrite(ASYNC_WRITER *writer, OUTPUT_FILE *file, char *buffer, int length, int capacity)
+{
+  WRITE_JOB job = {.file = file, .buffer = buffer, .length = length, .capacity = capacity};
+  waitUntil(writer, &writer->producerWaiting, hasQueueSpace);
+  ringPush(&writer->queue, job);
+  writer->queued++;
+  wakeWaiter(writer, &writer->consumerWaiting);
+
+  // Reuse a written buffer if there is one of the same size. Pooled
+  // buffers grow, so others go back to the pool for files of their size.
+  BUFFER_POOL *pool = writer->context->pool;
+  WRITE_JOB written;
+  if (ringPop(&writer->empty, &written))
+  {
+    if (written.capacity == capacity)
+    {
+      return written.buffer;
+    }
+    if (pool != NULL)
+    {
+      releaseIdleBuffer(pool, written.buffer, written.capacity);
+    }
+    else
+    {
+      free(written.buffer);
+    }
+  }
+  char *empty = pool != NULL ? takeIdleBuffer(pool, capacity) : NULL;
+  return empty != NULL ? empty : malloc(capacity);
+}
+
+void drainAsyncWriter(ASYNC_WRITER *writer)
+{
+  waitUntil(writer, &writer->producerWaiting, isDrained);
+}
+
+void freeAsyncWriter(ASYNC_WRITER *writer)
+{
+  // Signal the thread to stop once it's written everything queued
+  WRITE_JOB stop = {.file = NULL, .buffer = NULL, .length = 0, .capacity = 0};
+  waitUntil(writer, &writer->producerWaiting, hasQueueSpace);
+  ringPush(&writer->queue, stop);
+  wakeWaiter(writer, &writer->consumerWaiting);
+  pthread_join(writer->thread, NULL);
+
+  WRITE_JOB written;
+  while (ringPop(&writer->empty, &written))
+  {
+    if (writer->context->pool != NULL)
+    {
+      releaseIdleBuffer(writer->context->pool, written.buffer, written.capacity);
+    }
+    else
+    {
+      free(written.buffer);
+    }
+  }
+  pthread_mutex_destroy(&writer->lock);
+  pthread_cond_destroy(&writer->wake);
+  free(writer->queue.slots);
+  free(writer->empty.slots);
+  free(writer);
+}
+#else
+ASYNC_WRITER *newAsyncWriter(WRITE_CONTEXT *context, int queueLength)
+{
+  return NULL;
+}
+
+char *asyncWrite(ASYNC_WRITER *writer, OUTPUT_FILE *file, char *buffer, int length, int capacity)
+{
+  return buffer;
+}
+
+void drainAsyncWriter(ASYNC_WRITER *writer)
+{
+}
+
+void freeAsyncWriter(ASYNC_WRITER *writer)
+{
+}
+#endif
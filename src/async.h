@@ -0,0 +1,24 @@
+#pragma once
+
+#include "writer.h"
+
+// An I/O thread that writes full output buffers to the write context's
+// sink, so the parsing thread doesn't wait on writes. Buffers are handed
+// over through a lock-free single-producer/single-consumer ring in the
+// order they fill (keeping each file's writes in order), and handed back
+// empty through a second ring to be reused.
+typedef struct async_writer ASYNC_WRITER;
+
+// Start an I/O thread for the write context with room for queueLength
+// buffers in flight. Return NULL if threads aren't available.
+ASYNC_WRITER *newAsyncWriter(WRITE_CONTEXT *context, int queueLength);
+
+// Queue a full buffer (of capacity bytes) of an output file to be
+// written, and return an empty buffer of the same capacity to fill next
+char *asyncWrite(ASYNC_WRITER *writer, OUTPUT_FILE *file, char *buffer, int length, int capacity);
+
+// Wait until every queued buffer has been written
+void drainAsyncWriter(ASYNC_WRITER *writer);
+
+// Drain the queue, stop the thread and free its buffers
+void freeAsyncWriter(ASYNC_WRITER *writer);
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "writer.h"
+#include "sink.h"
+
+int tests_run = 0;
+
+const int NUM_FILES = 20;
+const int NUM_LINES = 2000;
+
+// Interleave lines across many files, with a buffer small enough that
+// each write fills one or more buffers
+void writeInterleaved(WRITE_CONTEXT *ctx)
+{
+  char filename[20];
+  char line[50];
+  int opened;
+  for (int i = 0; i < NUM_LINES; i++)
+  {
+    sprintf(filename, "file%d", (i * 7) % NUM_FILES);
+    sprintf(line, "line %d of %d\n", i, NUM_LINES);
+    writeFileString(ctx, openFile(ctx, filename, csvExtension, &opened), line);
+  }
+}
+
+OUTPUT_SINK *writeToMemory(int async, int bufferSize, int queueLength, BUFFER_POOL *pool)
+{
+  OUTPUT_SINK *sink = newMemorySink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, bufferSize, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  if (pool != NULL)
+  {
+    setWriteContextPool(ctx, pool);
+  }
+  if (async)
+  {
+    startAsyncWriter(ctx, queueLength);
+  }
+  writeInterleaved(ctx);
+  freeWriteContext(ctx);
+  return sink;
+}
+
+// Check that two memory sinks got the same files with the same contents
+char *compareSinks(OUTPUT_SINK *expected, OUTPUT_SINK *actual)
+{
+  mu_assert("Expected the same number of files", getMemorySinkNumFiles(expected) == getMemorySinkNumFiles(actual));
+  for (int i = 0; i < getMemorySinkNumFiles(expected); i++)
+  {
+    char *expectedName, *actualName, *extension, *expectedContents, *actualContents;
+    int expectedLength = getMemorySinkFile(expected, i, &expectedName, &extension, &expectedContents);
+    int actualLength = getMemorySinkFile(actual, i, &actualName, &extension, &actualContents);
+    mu_assert("Expected the same file", strcmp(expectedName, actualName) == 0);
+    mu_assert("Expected the same contents in order", expectedLength == actualLength && memcmp(expectedContents, actualContents, expectedLength) == 0);
+  }
+  return 0;
+}
+
+static char *testAsyncMatchesSync()
+{
+  int bufferSizes[] = {1, 7, 64, 4096};
+  int queueLengths[] = {1, 2, 16};
+  for (int b = 0; b < 4; b++)
+  {
+    OUTPUT_SINK *expected = writeToMemory(0, bufferSizes[b], 0, NULL);
+    for (int q = 0; q < 3; q++)
+    {
+      OUTPUT_SINK *actual = writeToMemory(1, bufferSizes[b], queueLengths[q], NULL);
+      char *result = compareSinks(expected, actual);
+      freeOutputSink(actual);
+      if (result != 0)
+      {
+        freeOutputSink(expected);
+        return result;
+      }
+    }
+    freeOutputSink(expected);
+  }
+  return 0;
+}
+
+// Pooled buffers double as files fill, so written buffers come back in
+// many sizes; output is the same, and they're kept in the pool
+static char *testAsyncPool()
+{
+  OUTPUT_SINK *expected = writeToMemory(0, 4096, 0, NULL);
+  BUFFER_POOL *pool = newBufferPool(1 << 20, 4);
+  OUTPUT_SINK *actual = writeToMemory(1, 4096, 4, pool);
+  char *result = compareSinks(expected, actual);
+  int kept = pool->numIdle > 0;
+  freeOutputSink(expected);
+  freeOutputSink(actual);
+  freeBufferPool(pool);
+  if (result != 0)
+  {
+    return result;
+  }
+  mu_assert("Expected written buffers to be kept in the pool", kept);
+  return 0;
+}
+
+static char *testAsyncFlush()
+{
+  OUTPUT_SINK *sink = newMemorySink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 4, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  mu_assert("Expected the I/O thread to start", startAsyncWriter(ctx, 2));
+
+  // Output is complete once flushed, and more can be written after
+  int opened;
+  OUTPUT_FILE *file = openFile(ctx, "F3", csvExtension, &opened);
+  writeFileString(ctx, file, "form_type,amount\n");
+  flushWriteContext(ctx);
+  char *filename, *extension, *contents;
+  getMemorySinkFile(sink, 0, &filename, &extension, &contents);
+  mu_assert("Expected the header once flushed", strcmp(contents, "form_type,amount\n") == 0);
+  writeFileString(ctx, file, "F3,100.00\n");
+  freeWriteContext(ctx);
+  getMemorySinkFile(sink, 0, &filename, &extension, &contents);
+  mu_assert("Expected all rows once freed", strcmp(contents, "form_type,amount\nF3,100.00\n") == 0);
+  freeOutputSink(sink);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testAsyncMatchesSync);
+  mu_run_test(testAsyncPool);
+  mu_run_test(testAsyncFlush);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nAsync writer tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", tests_run);
+
+  return result != 0;
+}
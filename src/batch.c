@@ -0,0 +1,589 @@
+#include "batch.h"
+#include "compat.h"
+#include "compress.h"
+#include "sink.h"
+#include "uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define BATCH_BUFFER_SIZE 65536
+
+// Return a sink compressing into the given one (which it then owns) on
+// the given number of workers if compression is on, else the given sink
+OUTPUT_SINK *compressedSink(OUTPUT_SINK *sink, int compression, int compressionLevel, int workers)
+{
+  OUTPUT_SINK *compressed = newCompressingSink(sink, 1, compression, compressionLevel, workers);
+  return compressed != NULL ? compressed : sink;
+}
+
+// Parse a filing from its input file, writing through the sink if not
+// NULL. Return its outcome.
+int parseBatchFiling(PERSISTENT_MEMORY_CONTEXT *persistentMemory, char *path, char *filingId, char *outputDirectory, int includeFilingId, int silent, int warn, OUTPUT_SINK *sink)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Couldn't open file: %s\n", path);
+    return BATCH_UNREADABLE;
+  }
+  FEC_CONTEXT *fec = newFecContext(persistentMemory, ((BufferRead)(&readBuffer)), BATCH_BUFFER_SIZE, NULL, BATCH_BUFFER_SIZE, NULL, 1, file, filingId, outputDirectory, includeFilingId, silent, warn);
+  if (sink != NULL)
+  {
+    setOutputSink(fec, sink);
+  }
+  int status = parseFec(fec) ? BATCH_PARSED : BATCH_FAILED;
+  freeFecContext(fec);
+  fclose(file);
+  return status;
+}
+
+void setStatus(int *statuses, int index, int status)
+{
+  if (statuses != NULL)
+  {
+    statuses[index] = status;
+  }
+}
+
+#ifdef HAS_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// How many filings past the one being parsed to keep reads in flight for
+#define BATCH_READ_DEPTH 8
+// How much input to hold read ahead of the filing being parsed
+#define BATCH_READ_BYTES (256 * 1024 * 1024)
+// Filings larger than this are streamed when parsed rather than read whole
+#define BATCH_MAX_READ (64 * 1024 * 1024)
+// The most to ask for in one read
+#define BATCH_READ_CHUNK (1 << 30)
+
+struct batch_input
+{
+  char *data;
+  size_t length;
+  size_t filled;
+  int fd;
+  int done;
+  int failed;
+  int streamed; // too large to read whole, so streamed when parsed
+};
+typedef struct batch_input BATCH_INPUT;
+
+struct batch_reader
+{
+  URING *ring;
+  char **paths;
+  BATCH_INPUT *inputs;
+  int numInputs;
+  int nextToStart;
+  size_t heldBytes; // held by inputs read (or being read) but not parsed
+};
+typedef struct batch_reader BATCH_READER;
+
+void finishInput(BATCH_INPUT *input)
+{
+  input->done = 1;
+  if (input->fd >= 0)
+  {
+    close(input->fd);
+    input->fd = -1;
+  }
+}
+
+// Read the rest of an input directly (if the ring can't)
+void readRemaining(BATCH_INPUT *input)
+{
+  while (input->filled < input->length)
+  {
+    ssize_t n = pread(input->fd, input->data + input->filled, input->length - input->filled, input->filled);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0)
+    {
+      input->failed = 1;
+      break;
+    }
+    if (n == 0)
+    {
+      // The file got shorter
+      input->length = input->filled;
+      break;
+    }
+    input->filled += n;
+  }
+  finishInput(input);
+}
+
+void queueInputRead(BATCH_READER *reader, int index)
+{
+  BATCH_INPUT *input = &reader->inputs[index];
+  size_t remaining = input->length - input->filled;
+  uringRead(reader->ring, input->fd, input->data + input->filled, remaining < BATCH_READ_CHUNK ? remaining : BATCH_READ_CHUNK, input->filled, index);
+}
+
+// Open an input and queue its first read
+void startInput(BATCH_READER *reader, int index)
+{
+  BATCH_INPUT *input = &reader->inputs[index];
+  struct stat info;
+  input->fd = open(reader->paths[index], O_RDONLY);
+  if (input->fd < 0 || fstat(input->fd, &info) != 0)
+  {
+    input->failed = 1;
+    finishInput(input);
+    return;
+  }
+  input->length = info.st_size;
+  if (input->length > BATCH_MAX_READ)
+  {
+    input->streamed = 1;
+    finishInput(input);
+    return;
+  }
+  input->data = malloc(input->length + 1);
+  if (input->data == NULL)
+  {
+    input->failed = 1;
+    finishInput(input);
+    return;
+  }
+  reader->heldBytes += input->length;
+  if (input->length == 0)
+  {
+    finishInput(input);
+    return;
+  }
+  queueInputRead(reader, index);
+}
+
+void completeInputRead(BATCH_READER *reader, int index, int result)
+{
+  BATCH_INPUT *input = &reader->inputs[index];
+  if (result < 0)
+  {
+    // Fall back to reading directly (as on kernels without io_uring reads)
+    readRemaining(input);
+    return;
+  }
+  if (result == 0)
+  {
+    input->length = input->filled;
+  }
+  input->filled += result;
+  if (input->filled < input->length)
+  {
+    queueInputRead(reader, index);
+    uringSubmit(reader->ring);
+  }
+  else
+  {
+    finishInput(input);
+  }
+}
+
+// Free an input's data once it's been parsed
+void releaseInput(BATCH_READER *reader, BATCH_INPUT *input)
+{
+  if (input->data != NULL)
+  {
+    reader->heldBytes -= input->length;
+    free(input->data);
+    input->data = NULL;
+  }
+}
+
+// Wait until an input has been read in full, keeping reads in flight
+// for the inputs after it (as long as they fit in the read-ahead budget)
+BATCH_INPUT *nextInput(BATCH_READER *reader, int index)
+{
+  while (reader->nextToStart < reader->numInputs && reader->nextToStart <= index + BATCH_READ_DEPTH &&
+         (reader->nextToStart <= index || reader->heldBytes < BATCH_READ_BYTES))
+  {
+    startInput(reader, reader->nextToStart++);
+  }
+  uringSubmit(reader->ring);
+
+  BATCH_INPUT *input = &reader->inputs[index];
+  while (!input->done)
+  {
+    uint64_t tag;
+    int result;
+    if (!uringWait(reader->ring, &tag, &result))
+    {
+      readRemaining(input);
+      break;
+    }
+    completeInputRead(reader, (int)tag, result);
+  }
+  return input;
+}
+
+BATCH_READER *newBatchReader(char **paths, int numInputs)
+{
+  // Room for one read per input in flight
+  URING *ring = newUring(2 * (BATCH_READ_DEPTH + 1));
+  if (ring == NULL)
+  {
+    return NULL;
+  }
+  BATCH_READER *reader = (BATCH_READER *)malloc(sizeof(BATCH_READER));
+  reader->ring = ring;
+  reader->paths = paths;
+  reader->numInputs = numInputs;
+  reader->nextToStart = 0;
+  reader->heldBytes = 0;
+  reader->inputs = (BATCH_INPUT *)calloc(numInputs, sizeof(BATCH_INPUT));
+  for (int i = 0; i < numInputs; i++)
+  {
+    reader->inputs[i].fd = -1;
+  }
+  return reader;
+}
+
+void freeBatchReader(BATCH_READER *reader)
+{
+  // Let reads still in flight land before freeing their buffers
+  uint64_t tag;
+  int result;
+  while (uringWait(reader->ring, &tag, &result))
+  {
+  }
+  for (int i = 0; i < reader->numInputs; i++)
+  {
+    if (reader->inputs[i].fd >= 0)
+    {
+      close(reader->inputs[i].fd);
+    }
+    free(reader->inputs[i].data);
+  }
+  free(reader->inputs);
+  freeUring(reader->ring);
+  free(reader);
+}
+
+int parseBatchUring(PERSISTENT_MEMORY_CONTEXT *persistentMemory, char **paths, char **filingIds, int numFilings, char *outputDirectory, int includeFilingId, int silent, int warn, int compression, int compressionLevel, int *statuses)
+{
+  BATCH_READER *reader = newBatchReader(paths, numFilings);
+  if (reader == NULL)
+  {
+    return -1;
+  }
+  OUTPUT_SINK *sink = compressedSink(newUringSink(), compression, compressionLevel, defaultCompressionWorkers());
+  int failures = 0;
+  for (int i = 0; i < numFilings; i++)
+  {
+    BATCH_INPUT *input = nextInput(reader, i);
+    if (input->failed)
+    {
+      fprintf(stderr, "Couldn't read file: %s\n", paths[i]);
+      releaseInput(reader, input);
+      setStatus(statuses, i, BATCH_UNREADABLE);
+      failures++;
+      continue;
+    }
+    int status;
+    if (input->streamed)
+    {
+      status = parseBatchFiling(persistentMemory, paths[i], filingIds[i], outputDirectory, includeFilingId, silent, warn, sink);
+    }
+    else
+    {
+      FEC_CONTEXT *fec = newFecContext(persistentMemory, NULL, 0, NULL, BATCH_BUFFER_SIZE, NULL, 1, NULL, filingIds[i], outputDirectory, includeFilingId, silent, warn);
+      setOutputSink(fec, sink);
+      setWritableInputRegion(fec, input->data, input->length, 0);
+      status = parseFec(fec) ? BATCH_PARSED : BATCH_FAILED;
+      freeFecContext(fec);
+      releaseInput(reader, input);
+    }
+    setStatus(statuses, i, status);
+    if (status != BATCH_PARSED)
+    {
+      failures++;
+    }
+  }
+  freeOutputSink(sink);
+  freeBatchReader(reader);
+  return failures;
+}
+#endif
+
+#ifdef HAS_PTHREADS
+// A worker's filings, largest first. The worker takes filings from the
+// front, and other workers with none left take them from the back.
+struct batch_queue
+{
+  int *filings;
+  int front;
+  int back;
+  pthread_mutex_t lock;
+};
+typedef struct batch_queue BATCH_QUEUE;
+
+struct batch_run
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+  char **paths;
+  char **filingIds;
+  char *outputDirectory;
+  int includeFilingId;
+  int silent;
+  int warn;
+  int compression;
+  int compressionLevel;
+  int *statuses;
+
+  BATCH_QUEUE *queues;
+  int numWorkers;
+};
+typedef struct batch_run BATCH_RUN;
+
+struct batch_worker
+{
+  BATCH_RUN *run;
+  int index;
+  pthread_t thread;
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+  int failures;
+};
+typedef struct batch_worker BATCH_WORKER;
+
+struct batch_filing_size
+{
+  int index;
+  long long size;
+};
+
+int compareFilingSizes(const void *a, const void *b)
+{
+  long long sizeA = ((const struct batch_filing_size *)a)->size;
+  long long sizeB = ((const struct batch_filing_size *)b)->size;
+  return sizeA < sizeB ? 1 : (sizeA > sizeB ? -1 : 0);
+}
+
+// Take the next filing from a queue, from the front (largest) for its
+// own worker or the back (smallest) for another. Return -1 if it's empty.
+int takeFiling(BATCH_QUEUE *queue, int fromFront)
+{
+  int filing = -1;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->front < queue->back)
+  {
+    filing = fromFront ? queue->filings[queue->front++] : queue->filings[--queue->back];
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return filing;
+}
+
+// Take the next filing for a worker, from its own queue or else any other
+// worker's. Return -1 once every filing has been taken.
+int nextFiling(BATCH_WORKER *worker)
+{
+  BATCH_RUN *run = worker->run;
+  int filing = takeFiling(&run->queues[worker->index], 1);
+  for (int i = 1; filing < 0 && i < run->numWorkers; i++)
+  {
+    filing = takeFiling(&run->queues[(worker->index + i) % run->numWorkers], 0);
+  }
+  return filing;
+}
+
+void *parseBatchFilings(void *data)
+{
+  BATCH_WORKER *worker = (BATCH_WORKER *)data;
+  BATCH_RUN *run = worker->run;
+  // Each worker compresses its own output, as the filings are parsed in
+  // parallel already
+  OUTPUT_SINK *sink = run->compression != COMPRESSION_NONE ? compressedSink(newFileSink(), run->compression, run->compressionLevel, 0) : NULL;
+  int filing;
+  while ((filing = nextFiling(worker)) >= 0)
+  {
+    int status = parseBatchFiling(worker->persistentMemory, run->paths[filing], run->filingIds[filing], run->outputDirectory, run->includeFilingId, run->silent, run->warn, sink);
+    setStatus(run->statuses, filing, status);
+    if (status != BATCH_PARSED)
+    {
+      worker->failures++;
+    }
+  }
+  if (sink != NULL)
+  {
+    freeOutputSink(sink);
+  }
+  return NULL;
+}
+
+int parseBatchParallel(PERSISTENT_MEMORY_CONTEXT *persistentMemory, char **paths, char **filingIds, int numFilings, char *outputDirectory, int includeFilingId, int silent, int warn, int compression, int compressionLevel, int jobs, int *statuses)
+{
+  // Order the filings largest first, so the slowest start soonest
+  struct batch_filing_size *sizes = malloc(sizeof(struct batch_filing_size) * numFilings);
+  for (int i = 0; i < numFilings; i++)
+  {
+    struct stat info;
+    sizes[i].index = i;
+    sizes[i].size = stat(paths[i], &info) == 0 ? (long long)info.st_size : 0;
+  }
+  qsort(sizes, numFilings, sizeof(struct batch_filing_size), compareFilingSizes);
+
+  // Deal the filings out in turn so every worker starts on a large one
+  BATCH_RUN run = {persistentMemory, paths, filingIds, outputDirectory, includeFilingId, silent, warn, compression, compressionLevel, statuses, NULL, jobs};
+  run.queues = malloc(sizeof(BATCH_QUEUE) * jobs);
+  for (int i = 0; i < jobs; i++)
+  {
+    run.queues[i].filings = malloc(sizeof(int) * (numFilings / jobs + 1));
+    run.queues[i].front = 0;
+    run.queues[i].back = 0;
+    pthread_mutex_init(&run.queues[i].lock, NULL);
+  }
+  for (int i = 0; i < numFilings; i++)
+  {
+    BATCH_QUEUE *queue = &run.queues[i % jobs];
+    queue->filings[queue->back++] = sizes[i].index;
+  }
+  free(sizes);
+
+  BATCH_WORKER *workers = malloc(sizeof(BATCH_WORKER) * jobs);
+  int started = 0;
+  for (int i = 0; i < jobs; i++)
+  {
+    workers[i].run = &run;
+    workers[i].index = i;
+    workers[i].failures = 0;
+    workers[i].persistentMemory = newScratchMemoryContext(persistentMemory->catalog);
+    setOutputBufferBudget(workers[i].persistentMemory, persistentMemory->bufferPool->budget / jobs);
+    if (pthread_create(&workers[i].thread, NULL, parseBatchFilings, &workers[i]) != 0)
+    {
+      // Any filings of workers that didn't start are taken by those that did
+      freePersistentMemoryContext(workers[i].persistentMemory);
+      break;
+    }
+    started++;
+  }
+  int failures = 0;
+  if (started == 0)
+  {
+    // Parse on this thread instead
+    workers[0].persistentMemory = persistentMemory;
+    parseBatchFilings(&workers[0]);
+    failures = workers[0].failures;
+  }
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    failures += workers[i].failures;
+    // Count every worker's output buffers in the shared context's stats
+    BUFFER_POOL *pool = workers[i].persistentMemory->bufferPool;
+    persistentMemory->bufferPool->peakBufferedBytes += pool->peakBufferedBytes;
+    persistentMemory->bufferPool->earlyFlushes += pool->earlyFlushes;
+    freePersistentMemoryContext(workers[i].persistentMemory);
+  }
+  free(workers);
+  for (int i = 0; i < jobs; i++)
+  {
+    free(run.queues[i].filings);
+    pthread_mutex_destroy(&run.queues[i].lock);
+  }
+  free(run.queues);
+  return failures;
+}
+#endif
+
+int parseBatch(PERSISTENT_MEMORY_CONTEXT *persistentMemory, char **paths, char **filingIds, int numFilings, char *outputDirectory, int includeFilingId, int silent, int warn, int useUring, int compression, int compressionLevel, int jobs, int *statuses)
+{
+#ifdef HAS_PTHREADS
+  if (jobs > 1 && numFilings > 1)
+  {
+    return parseBatchParallel(persistentMemory, paths, filingIds, numFilings, outputDirectory, includeFilingId, silent, warn, compression, compressionLevel, jobs, statuses);
+  }
+#endif
+#ifdef HAS_IO_URING
+  if (useUring)
+  {
+    int failures = parseBatchUring(persistentMemory, paths, filingIds, numFilings, outputDirectory, includeFilingId, silent, warn, compression, compressionLevel, statuses);
+    if (failures >= 0)
+    {
+      return failures;
+    }
+  }
+#endif
+
+  // The standard path, a filing at a time (sharing one set of compression
+  // workers, if compressing)
+  OUTPUT_SINK *sink = compression != COMPRESSION_NONE ? compressedSink(newFileSink(), compression, compressionLevel, defaultCompressionWorkers()) : NULL;
+  int failures = 0;
+  for (int i = 0; i < numFilings; i++)
+  {
+    int status = parseBatchFiling(persistentMemory, paths[i], filingIds[i], outputDirectory, includeFilingId, silent, warn, sink);
+    setStatus(statuses, i, status);
+    if (status != BATCH_PARSED)
+    {
+      failures++;
+    }
+  }
+  if (sink != NULL)
+  {
+    freeOutputSink(sink);
+  }
+  return failures;
+}
+
+int defaultBatchJobs()
+{
+#if defined(HAS_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (int)cores : 1;
+#else
+  return 1;
+#endif
+}
+
+// Write a field, quoted if it has any commas, quotes or newlines
+void writeSummaryField(FILE *file, const char *field)
+{
+  if (strpbrk(field, ",\"\r\n") == NULL)
+  {
+    fputs(field, file);
+    return;
+  }
+  fputc('"', file);
+  for (const char *c = field; *c; c++)
+  {
+    if (*c == '"')
+    {
+      fputc('"', file);
+    }
+    fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+int writeBatchSummary(const char *path, char **paths, char **filingIds, int *statuses, int numFilings)
+{
+  const char *STATUS_NAMES[] = {"parsed", "failed", "unreadable"};
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Couldn't write batch summary: %s\n", path);
+    return 0;
+  }
+  fputs("filing_id,path,status\n", file);
+  for (int i = 0; i < numFilings; i++)
+  {
+    writeSummaryField(file, filingIds[i]);
+    fputc(',', file);
+    writeSummaryField(file, paths[i]);
+    fputc(',', file);
+    fputs(STATUS_NAMES[statuses[i]], file);
+    fputc('\n', file);
+  }
+  return fclose(file) == 0;
+}
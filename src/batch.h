@@ -0,0 +1,34 @@
+#pragma once
+
+#include "export.h"
+#include "fec.h"
+
+// The outcome of each filing in a batch
+#define BATCH_PARSED 0
+#define BATCH_FAILED 1     // the filing couldn't be parsed
+#define BATCH_UNREADABLE 2 // the filing's input file couldn't be read
+
+// Parse many filings in one run, each from its own input file into its
+// own directory (named by filing ID) under the output directory, sharing
+// the persistent memory context. With jobs above 1 (and threads
+// available), filings are parsed on that many worker threads, each with
+// its own scratch memory and a share of the output buffer budget but
+// sharing the mapping catalog; the largest filings are started first, and
+// workers that run out of filings take the rest of others'. Otherwise,
+// with useUring set and io_uring available, the next few filings' input
+// files are read ahead through an io_uring (up to a memory budget, with
+// very large filings streamed instead) and parsed in place from memory,
+// and output goes through a uring sink; else each filing is read
+// and written like a single filing run. Output files are compressed in
+// the given format (see compress.h) at the given level, if it isn't
+// COMPRESSION_NONE. If statuses isn't NULL, the outcome of each filing
+// (BATCH_PARSED, ...) is set in it. Return the number of filings that
+// couldn't be parsed.
+EXPORT int parseBatch(PERSISTENT_MEMORY_CONTEXT *persistentMemory, char **paths, char **filingIds, int numFilings, char *outputDirectory, int includeFilingId, int silent, int warn, int useUring, int compression, int compressionLevel, int jobs, int *statuses);
+
+// Return a number of batch jobs to keep every core busy
+EXPORT int defaultBatchJobs();
+
+// Write a CSV with each filing's ID, input path and outcome (parsed,
+// failed or unreadable) to the path. Return 0 if it couldn't be written.
+EXPORT int writeBatchSummary(const char *path, char **paths, char **filingIds, int *statuses, int numFilings);
@@ -0,0 +1,138 @@
+#define _XOPEN_SOURCE 500
+#include <dirent.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "batch.h"
+#include "compress.h"
+
+// Benchmarks a many-filing run: 10k filings copied from the small test
+// fixtures into a scratch directory, parsed into another, a filing at a
+// time through stdio vs with io_uring batching reads and writes, and on
+// increasing numbers of worker threads (up to one per core)
+
+const int NUM_FILINGS = 10000;
+const int MAX_FIXTURE_SIZE = 65536;
+const char *FIXTURES_DIRECTORY = "python/tests/fixtures";
+const char *INPUT_DIRECTORY = "batch_bench_input";
+const char *OUTPUT_DIRECTORY = "batch_bench_output/";
+
+double wallTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+void removeDirectory(const char *path)
+{
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Read the small, valid fixtures into memory. Return how many there are.
+int readFixtures(char **contents, size_t *lengths, int max)
+{
+  DIR *dir = opendir(FIXTURES_DIRECTORY);
+  if (dir == NULL)
+  {
+    return 0;
+  }
+  int n = 0;
+  struct dirent *entry;
+  char path[512];
+  while (n < max && (entry = readdir(dir)) != NULL)
+  {
+    if (strstr(entry->d_name, ".fec") == NULL || strstr(entry->d_name, "invalid") != NULL)
+    {
+      continue;
+    }
+    sprintf(path, "%s/%s", FIXTURES_DIRECTORY, entry->d_name);
+    FILE *file = fopen(path, "rb");
+    contents[n] = malloc(MAX_FIXTURE_SIZE);
+    lengths[n] = fread(contents[n], 1, MAX_FIXTURE_SIZE, file);
+    // Skip fixtures too big to count as small-to-medium filings
+    if (fgetc(file) == EOF)
+    {
+      n++;
+    }
+    else
+    {
+      free(contents[n]);
+    }
+    fclose(file);
+  }
+  closedir(dir);
+  return n;
+}
+
+void benchmark(const char *name, char **paths, char **filingIds, long long bytes, int useUring, int jobs)
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  double start = wallTime();
+  int failures = parseBatch(persistentMemory, paths, filingIds, NUM_FILINGS, (char *)OUTPUT_DIRECTORY, 0, 1, 0, useUring, COMPRESSION_NONE, 0, jobs, NULL);
+  double seconds = wallTime() - start;
+  printf("%-8s %7.0f filings/s %6.1f MB/s (%d failed, %ld KB peak output buffers)\n", name, NUM_FILINGS / seconds, bytes / seconds / 1e6, failures, getPeakBufferedBytes(persistentMemory) / 1024);
+  freePersistentMemoryContext(persistentMemory);
+  removeDirectory(OUTPUT_DIRECTORY);
+}
+
+int main()
+{
+  char *fixtures[16];
+  size_t fixtureLengths[16];
+  int numFixtures = readFixtures(fixtures, fixtureLengths, 16);
+  if (numFixtures == 0)
+  {
+    fprintf(stderr, "No fixtures found in %s (run from the repository root)\n", FIXTURES_DIRECTORY);
+    return 1;
+  }
+
+  // Write out the filings
+  mkdir(INPUT_DIRECTORY, 0777);
+  char **paths = malloc(sizeof(char *) * NUM_FILINGS);
+  char **filingIds = malloc(sizeof(char *) * NUM_FILINGS);
+  long long bytes = 0;
+  for (int i = 0; i < NUM_FILINGS; i++)
+  {
+    filingIds[i] = malloc(16);
+    sprintf(filingIds[i], "%d", 1000000 + i);
+    paths[i] = malloc(strlen(INPUT_DIRECTORY) + 32);
+    sprintf(paths[i], "%s/%s.fec", INPUT_DIRECTORY, filingIds[i]);
+    FILE *file = fopen(paths[i], "wb");
+    fwrite(fixtures[i % numFixtures], 1, fixtureLengths[i % numFixtures], file);
+    fclose(file);
+    bytes += fixtureLengths[i % numFixtures];
+  }
+
+  printf("\nBatch parsing benchmark (%d filings from %d fixtures)\n", NUM_FILINGS, numFixtures);
+  benchmark("stdio", paths, filingIds, bytes, 0, 1);
+  benchmark("io_uring", paths, filingIds, bytes, 1, 1);
+  char name[32];
+  for (int jobs = 2; jobs <= defaultBatchJobs(); jobs *= 2)
+  {
+    sprintf(name, "%d jobs", jobs);
+    benchmark(name, paths, filingIds, bytes, 0, jobs);
+  }
+
+  removeDirectory(INPUT_DIRECTORY);
+  for (int i = 0; i < NUM_FILINGS; i++)
+  {
+    free(paths[i]);
+    free(filingIds[i]);
+  }
+  free(paths);
+  free(filingIds);
+  for (int i = 0; i < numFixtures; i++)
+  {
+    free(fixtures[i]);
+  }
+  return 0;
+}
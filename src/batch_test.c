@@ -0,0 +1,172 @@
+#define _XOPEN_SOURCE 500
+#include <dirent.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "batch.h"
+#include "compress.h"
+
+int tests_run = 0;
+
+// Run from the repository root, like the benchmarks
+#define NUM_FILINGS 7
+char *PATHS[NUM_FILINGS] = {
+    "python/tests/fixtures/13360.fec",
+    "python/tests/fixtures/1527862.fec",
+    "python/tests/fixtures/1544132.fec",
+    "python/tests/fixtures/1550126.fec",
+    "python/tests/fixtures/1550548.fec",
+    "python/tests/fixtures/filing_invalid_version.fec",
+    "python/tests/fixtures/missing.fec",
+};
+char *FILING_IDS[NUM_FILINGS] = {"13360", "1527862", "1544132", "1550126", "1550548", "invalid", "missing"};
+int EXPECTED_STATUSES[NUM_FILINGS] = {BATCH_PARSED, BATCH_PARSED, BATCH_PARSED, BATCH_PARSED, BATCH_PARSED, BATCH_FAILED, BATCH_UNREADABLE};
+
+int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+void removeDirectory(const char *path)
+{
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Read a whole file into a new buffer. Return its length, or -1 if it
+// can't be read.
+long readWhole(const char *path, char **contents)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  *contents = malloc(length + 1);
+  length = fread(*contents, 1, length, file);
+  fclose(file);
+  return length;
+}
+
+// Check that every output file of every filing is the same in both
+// output directories. Return the number of files compared, or -1 if any
+// differ or are missing.
+int compareOutputs(const char *expectedDirectory, const char *actualDirectory)
+{
+  int compared = 0;
+  char expectedPath[512];
+  char actualPath[512];
+  for (int i = 0; i < NUM_FILINGS; i++)
+  {
+    sprintf(expectedPath, "%s%s", expectedDirectory, FILING_IDS[i]);
+    DIR *dir = opendir(expectedPath);
+    if (dir == NULL)
+    {
+      continue;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+      if (entry->d_name[0] == '.')
+      {
+        continue;
+      }
+      sprintf(expectedPath, "%s%s/%s", expectedDirectory, FILING_IDS[i], entry->d_name);
+      sprintf(actualPath, "%s%s/%s", actualDirectory, FILING_IDS[i], entry->d_name);
+      char *expected = NULL;
+      char *actual = NULL;
+      long expectedLength = readWhole(expectedPath, &expected);
+      long actualLength = readWhole(actualPath, &actual);
+      int same = expectedLength == actualLength && actualLength >= 0 && memcmp(expected, actual, expectedLength) == 0;
+      free(expected);
+      free(actual);
+      if (!same)
+      {
+        closedir(dir);
+        return -1;
+      }
+      compared++;
+    }
+    closedir(dir);
+  }
+  return compared;
+}
+
+static char *testParallelBatch()
+{
+  const char *SERIAL = "batch_test_serial/";
+  const char *PARALLEL = "batch_test_parallel/";
+  int serialStatuses[NUM_FILINGS];
+  int parallelStatuses[NUM_FILINGS];
+
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  int serialFailures = parseBatch(persistentMemory, PATHS, FILING_IDS, NUM_FILINGS, (char *)SERIAL, 0, 1, 0, 0, COMPRESSION_NONE, 0, 1, serialStatuses);
+  freePersistentMemoryContext(persistentMemory);
+
+  persistentMemory = newPersistentMemoryContext();
+  int parallelFailures = parseBatch(persistentMemory, PATHS, FILING_IDS, NUM_FILINGS, (char *)PARALLEL, 0, 1, 0, 0, COMPRESSION_NONE, 0, 3, parallelStatuses);
+  long misses = getMappingCacheMisses(persistentMemory);
+  freePersistentMemoryContext(persistentMemory);
+
+  int compared = compareOutputs(SERIAL, PARALLEL);
+  removeDirectory(SERIAL);
+  removeDirectory(PARALLEL);
+
+  mu_assert("Expected two failures serially", serialFailures == 2);
+  mu_assert("Expected two failures in parallel", parallelFailures == 2);
+  for (int i = 0; i < NUM_FILINGS; i++)
+  {
+    mu_assert("Expected each serial outcome", serialStatuses[i] == EXPECTED_STATUSES[i]);
+    mu_assert("Expected each parallel outcome", parallelStatuses[i] == EXPECTED_STATUSES[i]);
+  }
+  mu_assert("Expected workers to share the mapping cache", misses > 0);
+  mu_assert("Expected the same output files in parallel", compared != -1);
+  mu_assert("Expected output files to compare", compared > 0);
+  return 0;
+}
+
+static char *testBatchSummary()
+{
+  const char *SUMMARY = "batch_test_summary.csv";
+  char *paths[] = {"a.fec", "dir/b,c.fec"};
+  char *filingIds[] = {"a", "b"};
+  int statuses[] = {BATCH_PARSED, BATCH_UNREADABLE};
+  mu_assert("Expected the summary to be written", writeBatchSummary(SUMMARY, paths, filingIds, statuses, 2));
+
+  char *contents = NULL;
+  long length = readWhole(SUMMARY, &contents);
+  remove(SUMMARY);
+  const char *expected = "filing_id,path,status\na,a.fec,parsed\nb,\"dir/b,c.fec\",unreadable\n";
+  int same = length == (long)strlen(expected) && memcmp(contents, expected, length) == 0;
+  free(contents);
+  mu_assert("Expected a row per filing, with paths quoted as needed", same);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testParallelBatch);
+  mu_run_test(testBatchSummary);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nBatch tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n\n", tests_run);
+
+  return result != 0;
+}
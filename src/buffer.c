@@ -1,19 +1,207 @@
 #include "buffer.h"
+#include "compat.h"
 #include <string.h>
+#ifdef HAS_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// How much of a mapped region is read past before its pages are dropped
+#define REGION_DROP_SIZE (4 * 1024 * 1024)
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+
+struct read_ahead
+{
+  char *buffer; // the spare buffer, being filled while requested
+  int bytesRead;
+  void *data;
+  int requested; // a fill is in progress (set by the reader, cleared by the thread)
+  int pending;   // a fill was requested and its buffer not yet used
+  int finished;  // the input is exhausted
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+void *readAheadLoop(void *data)
+{
+  BUFFER *buffer = (BUFFER *)data;
+  READ_AHEAD *readAhead = buffer->readAhead;
+  pthread_mutex_lock(&readAhead->lock);
+  while (1)
+  {
+    while (!readAhead->requested && !readAhead->stop)
+    {
+      pthread_cond_wait(&readAhead->changed, &readAhead->lock);
+    }
+    if (readAhead->stop)
+    {
+      break;
+    }
+    pthread_mutex_unlock(&readAhead->lock);
+    int bytesRead = buffer->bufferRead(readAhead->buffer, buffer->bufferCapacity, readAhead->data);
+    pthread_mutex_lock(&readAhead->lock);
+    readAhead->bytesRead = bytesRead;
+    readAhead->requested = 0;
+    pthread_cond_signal(&readAhead->changed);
+  }
+  pthread_mutex_unlock(&readAhead->lock);
+  return NULL;
+}
+
+int startReadAhead(BUFFER *buffer)
+{
+  if (buffer->region != NULL)
+  {
+    // Nothing to read
+    return 0;
+  }
+  READ_AHEAD *readAhead = (READ_AHEAD *)malloc(sizeof(READ_AHEAD));
+  readAhead->buffer = malloc(buffer->bufferCapacity + 1);
+  readAhead->bytesRead = 0;
+  readAhead->data = NULL;
+  readAhead->requested = 0;
+  readAhead->pending = 0;
+  readAhead->finished = 0;
+  readAhead->stop = 0;
+  pthread_mutex_init(&readAhead->lock, NULL);
+  pthread_cond_init(&readAhead->changed, NULL);
+  buffer->readAhead = readAhead;
+  if (pthread_create(&readAhead->thread, NULL, readAheadLoop, buffer) != 0)
+  {
+    pthread_mutex_destroy(&readAhead->lock);
+    pthread_cond_destroy(&readAhead->changed);
+    free(readAhead->buffer);
+    free(readAhead);
+    buffer->readAhead = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+// Swap in the buffer read in the background (reading the first one
+// directly), then start reading the one after it into the old buffer
+size_t fillBufferAhead(BUFFER *buffer, void *data)
+{
+  READ_AHEAD *readAhead = buffer->readAhead;
+  buffer->bufferPos = 0;
+  if (readAhead->finished)
+  {
+    buffer->bufferSize = 0;
+    return 0;
+  }
+
+  int bytesRead;
+  pthread_mutex_lock(&readAhead->lock);
+  if (readAhead->pending)
+  {
+    while (readAhead->requested)
+    {
+      pthread_cond_wait(&readAhead->changed, &readAhead->lock);
+    }
+    char *filled = readAhead->buffer;
+    readAhead->buffer = buffer->buffer;
+    buffer->buffer = filled;
+    bytesRead = readAhead->bytesRead;
+    readAhead->pending = 0;
+  }
+  else
+  {
+    pthread_mutex_unlock(&readAhead->lock);
+    bytesRead = buffer->bufferRead(buffer->buffer, buffer->bufferCapacity, data);
+    pthread_mutex_lock(&readAhead->lock);
+  }
+
+  if (bytesRead == 0)
+  {
+    readAhead->finished = 1;
+  }
+  else
+  {
+    readAhead->data = data;
+    readAhead->requested = 1;
+    readAhead->pending = 1;
+    pthread_cond_signal(&readAhead->changed);
+  }
+  pthread_mutex_unlock(&readAhead->lock);
+  buffer->bufferSize = bytesRead;
+  return bytesRead;
+}
+
+void freeReadAhead(READ_AHEAD *readAhead)
+{
+  // Let a read in progress finish before stopping
+  pthread_mutex_lock(&readAhead->lock);
+  while (readAhead->requested)
+  {
+    pthread_cond_wait(&readAhead->changed, &readAhead->lock);
+  }
+  readAhead->stop = 1;
+  pthread_cond_signal(&readAhead->changed);
+  pthread_mutex_unlock(&readAhead->lock);
+  pthread_join(readAhead->thread, NULL);
+
+  pthread_mutex_destroy(&readAhead->lock);
+  pthread_cond_destroy(&readAhead->changed);
+  free(readAhead->buffer);
+  free(readAhead);
+}
+#else
+int startReadAhead(BUFFER *buffer)
+{
+  return 0;
+}
+#endif
 
 BUFFER *newBuffer(int bufferSize, BufferRead bufferRead)
 {
   BUFFER *buffer = malloc(sizeof(BUFFER));
+  buffer->bufferCapacity = bufferSize;
   buffer->bufferSize = bufferSize;
   buffer->bufferPos = 0;
-  buffer->buffer = malloc(bufferSize);
+  // Leave room to null-terminate a line view at the end of the buffer
+  buffer->buffer = malloc(bufferSize + 1);
   buffer->streamStarted = 0;
   buffer->bufferRead = bufferRead;
+  buffer->readAhead = NULL;
+  buffer->region = NULL;
+  buffer->regionLength = 0;
+  buffer->regionPos = 0;
+  buffer->regionWritable = 0;
+  buffer->regionMapped = 0;
+  buffer->regionDropped = 0;
+  buffer->sentinelAt = NULL;
+  return buffer;
+}
+
+BUFFER *newRegionBuffer(const char *data, size_t length)
+{
+  BUFFER *buffer = newBuffer(0, NULL);
+  buffer->streamStarted = 1;
+  buffer->region = data;
+  buffer->regionLength = length;
+  return buffer;
+}
+
+BUFFER *newWritableRegionBuffer(char *data, size_t length, int mapped)
+{
+  BUFFER *buffer = newRegionBuffer(data, length);
+  buffer->regionWritable = 1;
+  buffer->regionMapped = mapped;
   return buffer;
 }
 
 void freeBuffer(BUFFER *buffer)
 {
+  releaseLineView(buffer);
+#ifdef HAS_PTHREADS
+  if (buffer->readAhead != NULL)
+  {
+    freeReadAhead(buffer->readAhead);
+  }
+#endif
   free(buffer->buffer);
   free(buffer);
 }
@@ -25,71 +213,264 @@ size_t readBuffer(char *buffer, int want, FILE *file)
 
 size_t fillBuffer(BUFFER *buffer, void *data)
 {
-  // Fill the buffer
+#ifdef HAS_PTHREADS
+  if (buffer->readAhead != NULL)
+  {
+    return fillBufferAhead(buffer, data);
+  }
+#endif
+  // Fill the buffer (asking for its full capacity even after a short read,
+  // as from a pipe)
   buffer->bufferPos = 0;
-  int bytesRead = buffer->bufferRead(buffer->buffer, buffer->bufferSize, data);
+  int bytesRead = buffer->bufferRead(buffer->buffer, buffer->bufferCapacity, data);
   buffer->bufferSize = bytesRead;
   return bytesRead;
 }
 
+const char *findNewlineScalar(const char *start, const char *end)
+{
+  for (const char *c = start; c < end; c++)
+  {
+    if (*c == '\n')
+    {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+#ifdef SIMD_SSE2
+const char *findNewlineSse2(const char *start, const char *end)
+{
+  const __m128i newline = _mm_set1_epi8('\n');
+  const char *c = start;
+  for (; c + 16 <= end; c += 16)
+  {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)c), newline));
+    if (mask != 0)
+    {
+      return c + __builtin_ctz(mask);
+    }
+  }
+  return findNewlineScalar(c, end);
+}
+#endif
+
+#ifdef SIMD_AVX2
+AVX2_TARGET const char *findNewlineAvx2(const char *start, const char *end)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const char *c = start;
+  for (; c + 32 <= end; c += 32)
+  {
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)c), newline));
+    if (mask != 0)
+    {
+      return c + __builtin_ctz(mask);
+    }
+  }
+  return findNewlineScalar(c, end);
+}
+#endif
+
+#ifdef SIMD_NEON
+const char *findNewlineNeon(const char *start, const char *end)
+{
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  const char *c = start;
+  for (; c + 16 <= end; c += 16)
+  {
+    uint8x16_t matches = vceqq_u8(vld1q_u8((const uint8_t *)c), newline);
+    if (vmaxvq_u8(matches) != 0)
+    {
+      // Narrow each byte of the comparison to a nibble to get a bit mask
+      uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+      return c + (__builtin_ctzll(mask) >> 2);
+    }
+  }
+  return findNewlineScalar(c, end);
+}
+#endif
+
+typedef const char *(*FindNewline)(const char *start, const char *end);
+
+FindNewline selectFindNewline()
+{
+#ifdef SIMD_AVX2
+  if (cpuSupportsAvx2())
+  {
+    return findNewlineAvx2;
+  }
+#endif
+#if defined(SIMD_SSE2)
+  return findNewlineSse2;
+#elif defined(SIMD_NEON)
+  return findNewlineNeon;
+#else
+  return findNewlineScalar;
+#endif
+}
+
+const char *findNewline(const char *start, const char *end)
+{
+  static FindNewline cachedFindNewline = NULL;
+  FindNewline implementation;
+  RESOLVE_ONCE(implementation, cachedFindNewline, selectFindNewline);
+  return implementation(start, end);
+}
+
+void releaseLineView(BUFFER *buffer)
+{
+  if (buffer->sentinelAt != NULL)
+  {
+    *buffer->sentinelAt = buffer->sentinel;
+    buffer->sentinelAt = NULL;
+  }
+}
+
+// Null-terminate a line view in place, keeping the byte it replaces
+void holdLineView(BUFFER *buffer, char *at)
+{
+  buffer->sentinelAt = at;
+  buffer->sentinel = *at;
+  *at = '\0';
+}
+
+#ifdef HAS_MMAP
+// Drop the pages of a mapped region that have been read past (once there
+// are enough of them), which frees their private copies and leaves them
+// reading as the file again
+void dropReadPages(BUFFER *buffer)
+{
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t readTo = buffer->regionPos / pageSize * pageSize;
+  if (readTo > buffer->regionDropped && readTo - buffer->regionDropped >= REGION_DROP_SIZE)
+  {
+    madvise((char *)buffer->region + buffer->regionDropped, readTo - buffer->regionDropped, MADV_DONTNEED);
+    buffer->regionDropped = readTo;
+  }
+}
+#endif
+
+// Copy the next line of a region into string (lines are parsed
+// null-terminated and modified in place, which a read-only region can't be)
+int readRegionLine(BUFFER *buffer, STRING *string)
+{
+  const char *start = buffer->region + buffer->regionPos;
+  const char *end = buffer->region + buffer->regionLength;
+  const char *newline = findNewline(start, end);
+  int length = (newline != NULL ? newline + 1 : end) - start;
+  if (length + 1 > (int)string->n)
+  {
+    growStringTo(string, length + 1);
+  }
+  memcpy(string->str, start, length);
+  string->str[length] = '\0';
+  buffer->regionPos += length;
+  return length;
+}
+
 int readLine(BUFFER *buffer, STRING *string, void *data)
 {
-  int eof = 0;
+  releaseLineView(buffer);
+  if (buffer->region != NULL)
+  {
+    return readRegionLine(buffer, string);
+  }
+
   // Start stream if necessary
   if (!buffer->streamStarted)
   {
-    if (fillBuffer(buffer, data) == 0)
-    {
-      // Check for eof
-      eof = 1;
-    }
+    fillBuffer(buffer, data);
     buffer->streamStarted = 1;
   }
 
-  // Read through the buffer character by character to fill a line.
+  // Copy the buffer into the line a segment at a time, where a line spans
+  // multiple segments if it straddles buffer refills
   int n = 0;
-  int stringStart = 0;
-  int start = buffer->bufferPos;
   while (1)
   {
     if (buffer->bufferPos >= buffer->bufferSize)
     {
-      // Flush memcpy to string buffer
-      memcpy(string->str + stringStart, buffer->buffer + start, buffer->bufferPos - start);
-      stringStart += buffer->bufferPos - start;
-
       // Buffer needs to be refilled
       if (fillBuffer(buffer, data) == 0)
       {
         // End of file
-        eof = 1;
+        break;
       }
-      start = buffer->bufferPos;
     }
-    char c = eof ? '\0' : buffer->buffer[buffer->bufferPos];
-    buffer->bufferPos++;
-    // Set the string
-    while (n + 2 > string->n)
+
+    const char *start = buffer->buffer + buffer->bufferPos;
+    const char *end = buffer->buffer + buffer->bufferSize;
+    const char *newline = findNewline(start, end);
+    int length = (newline != NULL ? newline + 1 : end) - start;
+
+    // Ensure the string is large enough for the segment and null terminator
+    while (n + length + 1 > (int)string->n)
     {
-      // Ensure the string is large enough
       growString(string);
     }
-    int end = c == '\n';
-    if (end)
+    memcpy(string->str + n, start, length);
+    n += length;
+    buffer->bufferPos += length;
+
+    if (newline != NULL)
     {
-      n++;
+      break;
     }
-    if (end || eof)
+  }
+
+  string->str[n] = '\0';
+  return n;
+}
+
+int readLineView(BUFFER *buffer, STRING *string, STRING *view, void *data)
+{
+  releaseLineView(buffer);
+
+  if (buffer->regionWritable)
+  {
+#ifdef HAS_MMAP
+    if (buffer->regionMapped)
     {
-      string->str[n] = '\0';
+      dropReadPages(buffer);
     }
-    n++;
+#endif
+    char *start = (char *)buffer->region + buffer->regionPos;
+    const char *end = buffer->region + buffer->regionLength;
+    const char *newline = findNewline(start, end);
+    // The last line is copied, as there's nothing after it to overwrite
+    if (newline != NULL && newline + 1 < end)
+    {
+      int length = newline + 1 - start;
+      buffer->regionPos += length;
+      holdLineView(buffer, start + length);
 
-    if (end || eof)
+      view->str = start;
+      view->n = length + 1;
+      return length;
+    }
+  }
+  else if (buffer->streamStarted && buffer->bufferPos < buffer->bufferSize)
+  {
+    char *start = buffer->buffer + buffer->bufferPos;
+    const char *newline = findNewline(start, buffer->buffer + buffer->bufferSize);
+    if (newline != NULL)
     {
-      memcpy(string->str + stringStart, buffer->buffer + start, buffer->bufferPos - start - 1 + (end ? 1 : 0));
-      break;
+      // The whole line is in the buffer: null-terminate it in place
+      int length = newline + 1 - start;
+      buffer->bufferPos += length;
+      holdLineView(buffer, buffer->buffer + buffer->bufferPos);
+
+      view->str = start;
+      view->n = length + 1;
+      return length;
     }
   }
-  return n - 1;
+
+  // The line straddles a refill (or the stream needs starting), so copy it
+  int length = readLine(buffer, string, data);
+  view->str = string->str;
+  view->n = string->n;
+  return length;
 }
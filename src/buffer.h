@@ -1,24 +1,87 @@
 #pragma once
 #include "memory.h"
+#include "simd.h"
 
 typedef size_t (*BufferRead)(char *buffer, int want, void *data);
 
+typedef struct read_ahead READ_AHEAD;
+
 struct buffer
 {
   char *buffer;
-  int bufferSize;
+  int bufferCapacity; // how much each read asks for
+  int bufferSize;     // how much the last read filled
   int bufferPos;
   int streamStarted;
   BufferRead bufferRead;
+  READ_AHEAD *readAhead; // fills the next buffer in the background, if started
+
+  // Input already in memory, read in place instead of through bufferRead
+  const char *region; // NULL unless reading a region
+  size_t regionLength;
+  size_t regionPos;
+  int regionWritable;   // whether line views may point into the region
+  int regionMapped;     // whether it's a private mapping of a file
+  size_t regionDropped; // where the pages read past have been dropped up to
+
+  // The byte replaced by the null terminator of the last line view, if any
+  char *sentinelAt; // NULL if there's no line view
+  char sentinel;
 };
 typedef struct buffer BUFFER;
 
 BUFFER *newBuffer(int bufferSize, BufferRead bufferRead);
 
+// Create a buffer that reads lines straight out of a region of memory
+// holding the whole input (owned by the caller, and not modified), with
+// no refills
+BUFFER *newRegionBuffer(const char *data, size_t length);
+
+// Create a region buffer whose lines are viewed (and parsed) in place
+// rather than copied, so the region is modified as it's read. If it's a
+// private mapping of a file (mapped is set), pages read past are dropped
+// as it's read, so their changed copies don't all stay in memory.
+BUFFER *newWritableRegionBuffer(char *data, size_t length, int mapped);
+
 size_t readBuffer(char *buffer, int want, FILE *file);
 
 size_t fillBuffer(BUFFER *buffer, void *data);
 
+// Read the next buffer on a background thread while the current one is
+// used, so the caller doesn't wait on reads (with the same calls to
+// bufferRead, made from that thread). Must be called before the first
+// read. Return 0 (and keep reading in the foreground) if threads aren't
+// available.
+int startReadAhead(BUFFER *buffer);
+
+// Read the next line (including its newline, if any) into string and return
+// its length, or 0 once the input is exhausted
 int readLine(BUFFER *buffer, STRING *string, void *data);
 
+// Read the next line like readLine, but without copying it when the line lies
+// entirely within the buffer (or a writable region): view then points into
+// it, null-terminated in place until the next read. Otherwise the line is
+// copied into string and view points to its contents.
+int readLineView(BUFFER *buffer, STRING *string, STRING *view, void *data);
+
+// Restore the byte overwritten to null-terminate the last line view, so the
+// input after it can be read directly
+void releaseLineView(BUFFER *buffer);
+
+// Return a pointer to the first newline in [start, end), or NULL if there is
+// none. Dispatches to the fastest implementation the CPU supports.
+const char *findNewline(const char *start, const char *end);
+
+// The implementations findNewline dispatches to (exposed for testing)
+const char *findNewlineScalar(const char *start, const char *end);
+#ifdef SIMD_SSE2
+const char *findNewlineSse2(const char *start, const char *end);
+#endif
+#ifdef SIMD_AVX2
+const char *findNewlineAvx2(const char *start, const char *end);
+#endif
+#ifdef SIMD_NEON
+const char *findNewlineNeon(const char *start, const char *end);
+#endif
+
 void freeBuffer(BUFFER *buffer);
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "buffer.h"
+#include "memory.h"
+
+// Benchmarks reading lines from a large synthetic filing, generated on the fly
+// by repeating representative lines so nothing touches the disk
+
+const long long SYNTHETIC_SIZE = 2LL * 1024 * 1024 * 1024;
+const int BENCH_BUFFER_SIZE = 64 * 1024;
+
+const char *syntheticLines =
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4265\x1c\x1c\x1c" "IND\x1c\x1c" "Smith\x1c" "Jane\x1c\x1c\x1c\x1c" "123 Main St\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "P2022\x1c\x1c" "20210805\x1c" "1000.00\x1c" "1000.00\x1c\x1c" "Engineer\x1c" "Acme Corporation\n"
+    "SB23\x1c" "C00123456\x1c" "SB23.1187\x1c\x1c\x1c" "ORG\x1c" "Printing Co\x1c\x1c\x1c\x1c\x1c" "1 Industrial Way\x1c\x1c" "Arlington\x1c" "VA\x1c" "22201\x1c" "Printing\x1c\x1c\x1c\x1c\x1c\x1c\x1c" "20210910\x1c" "2000.00\n"
+    "SA17\x1c" "C00123456\x1c" "SA17.12\x1c\x1c\x1c" "ORG\x1c" "Bank\x1c\x1c\x1c\x1c\x1c\x1c\x1c" "Interest\x1c" "20210930\x1c" "1.23\n";
+
+typedef struct
+{
+  long long produced;
+  int offset;
+} SYNTHETIC;
+
+size_t syntheticRead(char *buffer, int want, SYNTHETIC *synthetic)
+{
+  int linesLength = strlen(syntheticLines);
+  if (synthetic->produced + want > SYNTHETIC_SIZE)
+  {
+    want = SYNTHETIC_SIZE - synthetic->produced;
+  }
+  for (int i = 0; i < want;)
+  {
+    int chunk = linesLength - synthetic->offset;
+    if (chunk > want - i)
+    {
+      chunk = want - i;
+    }
+    memcpy(buffer + i, syntheticLines + synthetic->offset, chunk);
+    synthetic->offset = (synthetic->offset + chunk) % linesLength;
+    i += chunk;
+  }
+  synthetic->produced += want;
+  return want;
+}
+
+// The previous implementation of readLine, walking the buffer a byte at a time
+int readLineBytewise(BUFFER *buffer, STRING *string, void *data)
+{
+  int eof = 0;
+  if (!buffer->streamStarted)
+  {
+    if (fillBuffer(buffer, data) == 0)
+    {
+      eof = 1;
+    }
+    buffer->streamStarted = 1;
+  }
+
+  int n = 0;
+  int stringStart = 0;
+  int start = buffer->bufferPos;
+  while (1)
+  {
+    if (buffer->bufferPos >= buffer->bufferSize)
+    {
+      memcpy(string->str + stringStart, buffer->buffer + start, buffer->bufferPos - start);
+      stringStart += buffer->bufferPos - start;
+      if (fillBuffer(buffer, data) == 0)
+      {
+        eof = 1;
+      }
+      start = buffer->bufferPos;
+    }
+    char c = eof ? '\0' : buffer->buffer[buffer->bufferPos];
+    buffer->bufferPos++;
+    while (n + 2 > string->n)
+    {
+      growString(string);
+    }
+    int end = c == '\n';
+    if (end)
+    {
+      n++;
+    }
+    if (end || eof)
+    {
+      string->str[n] = '\0';
+    }
+    n++;
+    if (end || eof)
+    {
+      memcpy(string->str + stringStart, buffer->buffer + start, buffer->bufferPos - start - 1 + (end ? 1 : 0));
+      break;
+    }
+  }
+  return n - 1;
+}
+
+// The time to generate the synthetic filing, to subtract from readLine timings
+double generateSeconds()
+{
+  SYNTHETIC synthetic = {0, 0};
+  char *buffer = malloc(BENCH_BUFFER_SIZE);
+  clock_t start = clock();
+  while (syntheticRead(buffer, BENCH_BUFFER_SIZE, &synthetic) > 0)
+  {
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  free(buffer);
+  return seconds;
+}
+
+void benchmark(const char *name, int (*read)(BUFFER *, STRING *, void *), double overhead)
+{
+  SYNTHETIC synthetic = {0, 0};
+  BUFFER *buffer = newBuffer(BENCH_BUFFER_SIZE, (BufferRead)syntheticRead);
+  STRING *line = newString(DEFAULT_STRING_SIZE);
+  long long lines = 0;
+  long long bytes = 0;
+
+  clock_t start = clock();
+  int length;
+  while ((length = read(buffer, line, &synthetic)) > 0)
+  {
+    lines++;
+    bytes += length;
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC - overhead;
+
+  printf("%-10s %6.2f GB/s (%lld lines, %lld bytes)\n", name, bytes / seconds / 1e9, lines, bytes);
+  freeBuffer(buffer);
+  freeString(line);
+}
+
+int main()
+{
+  printf("\nreadLine benchmark (%.1f GB synthetic filing)\n", SYNTHETIC_SIZE / 1e9);
+  double overhead = generateSeconds();
+  benchmark("bytewise", readLineBytewise, overhead);
+  benchmark("readLine", readLine, overhead);
+  return 0;
+}
@@ -172,6 +172,324 @@ static char *testStringExpansion()
   return 0;
 }
 
+// Generated contents for testing lines of many lengths
+char generated[4096];
+int generatedLength = 0;
+int generatedPos = 0;
+
+int generatedRead(char *buffer, int want)
+{
+  int remaining = generatedLength - generatedPos;
+  if (remaining < want)
+  {
+    want = remaining;
+  }
+  memcpy(buffer, generated + generatedPos, want);
+  generatedPos += want;
+  return want;
+}
+
+// Fill the generated contents with lines of length 1, 2, ..., numLines
+// (including newlines), optionally leaving off the final newline
+void generateLines(int numLines, int trailingNewline)
+{
+  generatedLength = 0;
+  generatedPos = 0;
+  for (int line = 1; line <= numLines; line++)
+  {
+    for (int i = 0; i < line - 1; i++)
+    {
+      generated[generatedLength++] = 'a' + (line + i) % 26;
+    }
+    generated[generatedLength++] = '\n';
+  }
+  if (!trailingNewline)
+  {
+    generatedLength--;
+  }
+}
+
+static char *testFindNewline()
+{
+  char text[128];
+  const char *(*implementations[])(const char *, const char *) = {
+    findNewline,
+#ifdef SIMD_SSE2
+    findNewlineSse2,
+#endif
+#ifdef SIMD_AVX2
+    findNewlineAvx2,
+#endif
+#ifdef SIMD_NEON
+    findNewlineNeon,
+#endif
+  };
+  int numImplementations = sizeof(implementations) / sizeof(implementations[0]);
+#ifdef SIMD_AVX2
+  if (!cpuSupportsAvx2())
+  {
+    // Skip the AVX2 implementation (the last one) on CPUs that can't run it
+    numImplementations--;
+  }
+#endif
+
+  // Try a newline (or none) at every position of every start/end range
+  for (int newline = -1; newline < 100; newline++)
+  {
+    memset(text, 'x', sizeof(text));
+    if (newline >= 0)
+    {
+      text[newline] = '\n';
+    }
+    for (int start = 0; start < 40; start++)
+    {
+      for (int end = start; end < 100; end++)
+      {
+        const char *expected = findNewlineScalar(text + start, text + end);
+        mu_assert("Expected scalar to find the newline in range", expected == ((newline >= start && newline < end) ? text + newline : NULL));
+        for (int i = 0; i < numImplementations; i++)
+        {
+          mu_assert("Expected implementations to agree", implementations[i](text + start, text + end) == expected);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static char *testLinesSpanningRefills()
+{
+  // Buffer sizes shorter and longer than the lines
+  int bufferSizes[] = {1, 2, 7, 16, 31, 33, 64, 1000};
+  for (int trailingNewline = 0; trailingNewline <= 1; trailingNewline++)
+  {
+    for (size_t b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); b++)
+    {
+      generateLines(80, trailingNewline);
+      BUFFER *buffer = newBuffer(bufferSizes[b], (BufferRead)generatedRead);
+      STRING *s = newString(1);
+
+      int position = 0;
+      for (int line = 1; line <= 80; line++)
+      {
+        int expectedLength = line == 80 && !trailingNewline ? line - 1 : line;
+        mu_assert("Expected line length", readLine(buffer, s, NULL) == expectedLength);
+        mu_assert("Expected line contents", memcmp(s->str, generated + position, expectedLength) == 0);
+        mu_assert("Expected null terminator", s->str[expectedLength] == 0);
+        position += expectedLength;
+      }
+      mu_assert("Expected line length 0", readLine(buffer, s, NULL) == 0);
+      mu_assert("Expected line \"\"", strcmp(s->str, "") == 0);
+
+      freeBuffer(buffer);
+      freeString(s);
+    }
+  }
+  return 0;
+}
+
+static char *testLineViews()
+{
+  int bufferSizes[] = {1, 7, 64, 1000, 4096};
+  for (int trailingNewline = 0; trailingNewline <= 1; trailingNewline++)
+  {
+    for (size_t b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); b++)
+    {
+      generateLines(80, trailingNewline);
+      BUFFER *buffer = newBuffer(bufferSizes[b], (BufferRead)generatedRead);
+      STRING *s = newString(1);
+      STRING view;
+      int numViews = 0;
+
+      int position = 0;
+      for (int line = 1; line <= 80; line++)
+      {
+        int expectedLength = line == 80 && !trailingNewline ? line - 1 : line;
+        mu_assert("Expected line length", readLineView(buffer, s, &view, NULL) == expectedLength);
+        mu_assert("Expected line contents", memcmp(view.str, generated + position, expectedLength) == 0);
+        mu_assert("Expected null terminator", view.str[expectedLength] == 0);
+        if (view.str != s->str)
+        {
+          // Views point into the buffer
+          mu_assert("Expected view in buffer", view.str >= buffer->buffer && view.str + expectedLength <= buffer->buffer + buffer->bufferSize);
+          numViews++;
+        }
+        position += expectedLength;
+      }
+      mu_assert("Expected line length 0", readLineView(buffer, s, &view, NULL) == 0);
+      mu_assert("Expected line \"\"", strcmp(view.str, "") == 0);
+
+      // With a large buffer only the first line (which starts the stream)
+      // and a last line without a newline are copied
+      if (bufferSizes[b] == 4096)
+      {
+        mu_assert("Expected the other lines to be views", numViews == (trailingNewline ? 79 : 78));
+      }
+
+      freeBuffer(buffer);
+      freeString(s);
+    }
+  }
+  return 0;
+}
+
+static char *testLineViewsRestoreBuffer()
+{
+  // Terminating a view must not clobber the start of the next line
+  generateLines(3, 1);
+  BUFFER *buffer = newBuffer(100, (BufferRead)generatedRead);
+  STRING *s = newString(100);
+  STRING view;
+  readLineView(buffer, s, &view, NULL);
+  readLineView(buffer, s, &view, NULL);
+  mu_assert("Expected view \"c\\n\"", strcmp(view.str, "c\n") == 0);
+  mu_assert("Expected readLine \"de\\n\" after a view", readLine(buffer, s, NULL) == 3 && strcmp(s->str, "de\n") == 0);
+
+  freeBuffer(buffer);
+  freeString(s);
+  return 0;
+}
+
+int shortReadWant = 0;
+
+// Read at most 5 bytes at a time, like a pipe that's slow to fill
+int shortRead(char *buffer, int want)
+{
+  shortReadWant = want;
+  return generatedRead(buffer, want < 5 ? want : 5);
+}
+
+static char *testShortReads()
+{
+  generateLines(20, 1);
+  BUFFER *buffer = newBuffer(64, (BufferRead)shortRead);
+  STRING *s = newString(1);
+  int position = 0;
+  for (int line = 1; line <= 20; line++)
+  {
+    mu_assert("Expected line length", readLine(buffer, s, NULL) == line);
+    mu_assert("Expected line contents", memcmp(s->str, generated + position, line) == 0);
+    // Short reads don't shrink what later reads ask for
+    mu_assert("Expected reads to ask for the whole buffer", shortReadWant == 64);
+    position += line;
+  }
+  mu_assert("Expected line length 0", readLine(buffer, s, NULL) == 0);
+  freeBuffer(buffer);
+  freeString(s);
+  return 0;
+}
+
+static char *testReadAhead()
+{
+  int bufferSizes[] = {1, 7, 64, 1000, 4096};
+  for (int trailingNewline = 0; trailingNewline <= 1; trailingNewline++)
+  {
+    for (size_t b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); b++)
+    {
+      generateLines(80, trailingNewline);
+      BUFFER *buffer = newBuffer(bufferSizes[b], (BufferRead)generatedRead);
+      startReadAhead(buffer);
+      STRING *s = newString(1);
+      STRING view;
+
+      // Alternate views and copies, with lines spanning the two buffers
+      int position = 0;
+      for (int line = 1; line <= 80; line++)
+      {
+        int expectedLength = line == 80 && !trailingNewline ? line - 1 : line;
+        if (line % 2 == 0)
+        {
+          mu_assert("Expected line length", readLineView(buffer, s, &view, NULL) == expectedLength);
+        }
+        else
+        {
+          mu_assert("Expected line length", readLine(buffer, s, NULL) == expectedLength);
+          view.str = s->str;
+        }
+        mu_assert("Expected line contents", memcmp(view.str, generated + position, expectedLength) == 0);
+        mu_assert("Expected null terminator", view.str[expectedLength] == 0);
+        position += expectedLength;
+      }
+      mu_assert("Expected line length 0", readLine(buffer, s, NULL) == 0);
+      mu_assert("Expected line length 0 again", readLineView(buffer, s, &view, NULL) == 0);
+
+      freeBuffer(buffer);
+      freeString(s);
+    }
+  }
+
+  // The buffer can be freed before the input is exhausted
+  generateLines(80, 1);
+  BUFFER *buffer = newBuffer(16, (BufferRead)generatedRead);
+  startReadAhead(buffer);
+  STRING *s = newString(1);
+  mu_assert("Expected line length 1", readLine(buffer, s, NULL) == 1);
+  freeBuffer(buffer);
+  freeString(s);
+  return 0;
+}
+
+static char *testRegion()
+{
+  for (int trailingNewline = 0; trailingNewline <= 1; trailingNewline++)
+  {
+    generateLines(80, trailingNewline);
+    BUFFER *buffer = newRegionBuffer(generated, generatedLength);
+    STRING *s = newString(1);
+    STRING view;
+    int position = 0;
+    for (int line = 1; line <= 80; line++)
+    {
+      int expectedLength = line == 80 && !trailingNewline ? line - 1 : line;
+      mu_assert("Expected line length", readLineView(buffer, s, &view, NULL) == expectedLength);
+      mu_assert("Expected line contents", memcmp(view.str, generated + position, expectedLength) == 0);
+      mu_assert("Expected null terminator", view.str[expectedLength] == 0);
+      position += expectedLength;
+    }
+    mu_assert("Expected line length 0", readLine(buffer, s, NULL) == 0);
+    mu_assert("Expected line \"\"", strcmp(s->str, "") == 0);
+    mu_assert("Expected no read-ahead", startReadAhead(buffer) == 0);
+    mu_assert("Expected the region unmodified", generated[1] == 'c' && generated[2] == '\n');
+    freeBuffer(buffer);
+    freeString(s);
+  }
+  return 0;
+}
+
+static char *testWritableRegion()
+{
+  for (int trailingNewline = 0; trailingNewline <= 1; trailingNewline++)
+  {
+    generateLines(80, trailingNewline);
+    BUFFER *buffer = newWritableRegionBuffer(generated, generatedLength, 0);
+    STRING *s = newString(1);
+    STRING view;
+    int position = 0;
+    for (int line = 1; line <= 80; line++)
+    {
+      int expectedLength = line == 80 && !trailingNewline ? line - 1 : line;
+      mu_assert("Expected line length", readLineView(buffer, s, &view, NULL) == expectedLength);
+      // Every line but the last is viewed where it lies in the region
+      mu_assert("Expected line in place", (view.str == generated + position) == (line < 80));
+      mu_assert("Expected line contents", memcmp(view.str, generated + position, expectedLength) == 0);
+      mu_assert("Expected null terminator", view.str[expectedLength] == 0);
+      position += expectedLength;
+    }
+    mu_assert("Expected line length 0", readLineView(buffer, s, &view, NULL) == 0);
+
+    // Releasing a line view restores the byte after it
+    buffer->regionPos = 0;
+    mu_assert("Expected line length 1", readLineView(buffer, s, &view, NULL) == 1);
+    mu_assert("Expected the next line terminated", generated[1] == 0);
+    releaseLineView(buffer);
+    mu_assert("Expected the next line restored", generated[1] == 'c');
+    mu_assert("Expected a copied line", readLine(buffer, s, NULL) == 2 && strcmp(s->str, "c\n") == 0);
+    freeBuffer(buffer);
+    freeString(s);
+  }
+  return 0;
+}
+
 static char *all_tests()
 {
   mu_run_test(testShortBuffer);
@@ -180,6 +498,14 @@ static char *all_tests()
   mu_run_test(testDivisibleBuffer);
   mu_run_test(testByteBuffer);
   mu_run_test(testStringExpansion);
+  mu_run_test(testFindNewline);
+  mu_run_test(testLinesSpanningRefills);
+  mu_run_test(testLineViews);
+  mu_run_test(testLineViewsRestoreBuffer);
+  mu_run_test(testShortReads);
+  mu_run_test(testReadAhead);
+  mu_run_test(testRegion);
+  mu_run_test(testWritableRegion);
   return 0;
 }
 
@@ -1,5 +1,8 @@
 #include "cli.h"
 #include "compat.h"
+#include "compress.h"
+
+const char *COMMAND_SERVE = "serve";
 
 const char *FLAG_FILING_ID = "--include-filing-id";
 const char FLAG_FILING_ID_SHORT = 'i';
@@ -9,6 +12,17 @@ const char *FLAG_WARN = "--warn";
 const char FLAG_WARN_SHORT = 'w';
 const char *FLAG_DISABLE_STDIN = "--no-stdin";
 const char FLAG_DISABLE_STDIN_SHORT = 'x';
+const char *FLAG_ASYNC_OUTPUT = "--async-output";
+const char FLAG_ASYNC_OUTPUT_SHORT = 'a';
+const char *FLAG_READ_AHEAD = "--read-ahead";
+const char FLAG_READ_AHEAD_SHORT = 'r';
+const char *FLAG_BATCH = "--batch";
+const char FLAG_BATCH_SHORT = 'b';
+const char *FLAG_JOBS = "--jobs=";
+const char *FLAG_THREADS = "--threads=";
+const char *FLAG_RANGE = "--range=";
+const char *FLAG_MERGE = "--merge";
+const char *FLAG_COMPRESS = "--compress=";
 const char *FLAG_URL = "--print-url";
 const char FLAG_URL_SHORT = 'p';
 
@@ -19,10 +33,31 @@ CLI_CONTEXT *newCliContext()
   ctx->includeFilingId = 0;
   ctx->silent = 0;
   ctx->warn = 0;
+  ctx->asyncOutput = 0;
+  ctx->readAhead = 0;
+  ctx->batch = 0;
+  ctx->jobs = 1;
+  ctx->threads = 1;
+  ctx->range = 0;
+  ctx->rangeStart = 0;
+  ctx->rangeEnd = 0;
+  ctx->rangeVersion = NULL;
+  ctx->merge = 0;
+  ctx->serve = 0;
+  ctx->compression = COMPRESSION_NONE;
+  ctx->compressionLevel = 0;
   ctx->printUrl = 0;
   ctx->shouldPrintUsage = 0;
   ctx->shouldPrintSpecifyFilingId = 0;
   ctx->shouldPrintUrlOnly = 0;
+  ctx->name = NULL;
+  ctx->outputDirectory = NULL;
+  ctx->fecId = NULL;
+  ctx->fecName = NULL;
+  ctx->fecUrl = NULL;
+  ctx->fecBackupUrl = NULL;
+  ctx->filingIdOnly = NULL;
+  ctx->extractNumber = NULL;
   return ctx;
 }
 
@@ -55,6 +90,13 @@ void parseArgs(CLI_CONTEXT *ctx, int isPiped, int argc, char *argv[])
     exit(1);
   }
 
+  // A server takes its flags after the command
+  if (strcmp(argv[1], COMMAND_SERVE) == 0)
+  {
+    ctx->serve = 1;
+    flagOffset++;
+  }
+
   // Try to extract flags
   while (1 + flagOffset < argc && argv[1 + flagOffset][0] == '-')
   {
@@ -78,6 +120,109 @@ void parseArgs(CLI_CONTEXT *ctx, int isPiped, int argc, char *argv[])
       ctx->piped = 0;
       flagOffset++;
     }
+    else if (strcmp(argv[1 + flagOffset], FLAG_ASYNC_OUTPUT) == 0)
+    {
+      ctx->asyncOutput = 1;
+      flagOffset++;
+    }
+    else if (strcmp(argv[1 + flagOffset], FLAG_READ_AHEAD) == 0)
+    {
+      ctx->readAhead = 1;
+      flagOffset++;
+    }
+    else if (strcmp(argv[1 + flagOffset], FLAG_BATCH) == 0)
+    {
+      ctx->batch = 1;
+      flagOffset++;
+    }
+    else if (strncmp(argv[1 + flagOffset], FLAG_JOBS, strlen(FLAG_JOBS)) == 0)
+    {
+      char *end;
+      const char *value = argv[1 + flagOffset] + strlen(FLAG_JOBS);
+      ctx->jobs = strtol(value, &end, 10);
+      if (end == value || *end != '\0' || ctx->jobs < 0)
+      {
+        ctx->shouldPrintUsage = 1;
+        return;
+      }
+      flagOffset++;
+    }
+    else if (strncmp(argv[1 + flagOffset], FLAG_THREADS, strlen(FLAG_THREADS)) == 0)
+    {
+      char *end;
+      const char *value = argv[1 + flagOffset] + strlen(FLAG_THREADS);
+      ctx->threads = strtol(value, &end, 10);
+      if (end == value || *end != '\0' || ctx->threads < 0)
+      {
+        ctx->shouldPrintUsage = 1;
+        return;
+      }
+      flagOffset++;
+    }
+    else if (strncmp(argv[1 + flagOffset], FLAG_RANGE, strlen(FLAG_RANGE)) == 0)
+    {
+      // The start and end offsets, then optionally a colon and version
+      char *end;
+      const char *value = argv[1 + flagOffset] + strlen(FLAG_RANGE);
+      ctx->rangeStart = strtoull(value, &end, 10);
+      if (end == value || *end != ':')
+      {
+        ctx->shouldPrintUsage = 1;
+        return;
+      }
+      value = end + 1;
+      ctx->rangeEnd = strtoull(value, &end, 10);
+      if (end == value || (*end != '\0' && *end != ':') || ctx->rangeEnd < ctx->rangeStart)
+      {
+        ctx->shouldPrintUsage = 1;
+        return;
+      }
+      if (*end == ':' && end[1] != '\0')
+      {
+        ctx->rangeVersion = malloc(strlen(end + 1) + 1);
+        strcpy(ctx->rangeVersion, end + 1);
+      }
+      ctx->range = 1;
+      flagOffset++;
+    }
+    else if (strcmp(argv[1 + flagOffset], FLAG_MERGE) == 0)
+    {
+      ctx->merge = 1;
+      flagOffset++;
+    }
+    else if (strncmp(argv[1 + flagOffset], FLAG_COMPRESS, strlen(FLAG_COMPRESS)) == 0)
+    {
+      // The format, then optionally a colon and level
+      const char *value = argv[1 + flagOffset] + strlen(FLAG_COMPRESS);
+      const char *level = strchr(value, ':');
+      size_t formatLength = level != NULL ? (size_t)(level - value) : strlen(value);
+      char format[16] = "";
+      if (formatLength < sizeof(format))
+      {
+        memcpy(format, value, formatLength);
+        format[formatLength] = '\0';
+      }
+      ctx->compression = compressionFormat(format);
+      if (ctx->compression < 0)
+      {
+        ctx->shouldPrintUsage = 1;
+        return;
+      }
+      if (level != NULL)
+      {
+        // Levels go from 1 to the format's highest (checked once the
+        // format is known to be available)
+        char *end;
+        ctx->compressionLevel = strtol(level + 1, &end, 10);
+        int available = compressionAvailable(ctx->compression);
+        if (end == level + 1 || *end != '\0' || ctx->compressionLevel < 1 || (available && ctx->compressionLevel > maxCompressionLevel(ctx->compression)))
+        {
+          ctx->shouldPrintUsage = 1;
+          return;
+        }
+      }
+      flagOffset++;
+    }
     else if (strcmp(argv[1 + flagOffset], FLAG_URL) == 0)
     {
       ctx->printUrl = 1;
@@ -109,6 +254,21 @@ void parseArgs(CLI_CONTEXT *ctx, int isPiped, int argc, char *argv[])
           ctx->piped = 0;
           matched = 1;
         }
+        else if (argv[1 + flagOffset][i] == FLAG_ASYNC_OUTPUT_SHORT)
+        {
+          ctx->asyncOutput = 1;
+          matched = 1;
+        }
+        else if (argv[1 + flagOffset][i] == FLAG_READ_AHEAD_SHORT)
+        {
+          ctx->readAhead = 1;
+          matched = 1;
+        }
+        else if (argv[1 + flagOffset][i] == FLAG_BATCH_SHORT)
+        {
+          ctx->batch = 1;
+          matched = 1;
+        }
         else if (argv[1 + flagOffset][i] == FLAG_URL_SHORT)
         {
           ctx->printUrl = 1;
@@ -133,6 +293,21 @@ void parseArgs(CLI_CONTEXT *ctx, int isPiped, int argc, char *argv[])
     }
   }
 
+  // A batch reads its files from a directory (or list), and a merge reads
+  // parts already written, never stdin
+  if (ctx->batch || ctx->merge)
+  {
+    ctx->piped = 0;
+  }
+
+  // A server only takes the path of its socket, if any
+  if (ctx->serve)
+  {
+    ctx->piped = 0;
+    ctx->name = 1 + flagOffset < argc ? argv[1 + flagOffset] : NULL;
+    return;
+  }
+
   // Set the name
   if (flagOffset + 1 >= argc)
   {
@@ -160,6 +335,20 @@ void parseArgs(CLI_CONTEXT *ctx, int isPiped, int argc, char *argv[])
     }
   }
 
+  // Filing IDs in a batch come from each file's name
+  if (ctx->batch)
+  {
+    return;
+  }
+
+  // A merge names the filing whose parts to merge
+  if (ctx->merge)
+  {
+    ctx->fecId = malloc(strlen(ctx->name) + 1);
+    strcpy(ctx->fecId, ctx->name);
+    return;
+  }
+
   // Pull out ID/override ID parameter, depending on how input is piped
   if (ctx->piped)
   {
@@ -272,6 +461,11 @@ void freeCliContext(CLI_CONTEXT *ctx)
     free(ctx->fecUrl);
     ctx->fecUrl = NULL;
   }
+  if (ctx->rangeVersion)
+  {
+    free(ctx->rangeVersion);
+    ctx->rangeVersion = NULL;
+  }
   if (ctx->fecBackupUrl)
   {
     free(ctx->fecBackupUrl);
@@ -19,6 +19,31 @@ struct cli_context
   int silent;
   // Whether to show warning messages
   int warn;
+  // Whether to write output files on a separate I/O thread
+  int asyncOutput;
+  // Whether to read input on a separate thread
+  int readAhead;
+  // Whether to parse every filing in a directory (or listed in a file)
+  int batch;
+  // How many filings in a batch to parse at once (0 for one per core)
+  int jobs;
+  // How many threads to split one filing's parsing across (0 for one per
+  // core)
+  int threads;
+  // Whether to parse only a byte range of the filing into a part, from
+  // rangeStart to rangeEnd, with the filing's version if given
+  int range;
+  unsigned long long rangeStart;
+  unsigned long long rangeEnd;
+  char *rangeVersion;
+  // Whether to merge the parts of a filing's output
+  int merge;
+  // Whether to serve parse jobs (on a socket named by name, or from
+  // stdin if there's no name)
+  int serve;
+  // The format to compress output files in (see compress.h), and level
+  int compression;
+  int compressionLevel;
   // Whether to print URLs from docquery instead of running commands
   int printUrl;
   // Whether usage should be printed
@@ -27,7 +52,7 @@ struct cli_context
   int shouldPrintSpecifyFilingId;
   // Whether usage should be clarified with specifying print url exclusively
   int shouldPrintUrlOnly;
-  // The name of the file to download
+  // The name of the file to download (or directory of files, in a batch)
   const char *name;
   // The output directory
   char *outputDirectory;
@@ -51,6 +76,9 @@ void parseArgs(CLI_CONTEXT *context, int piped, int argc, char *argv[]);
 
 void freeCliContext(CLI_CONTEXT *context);
 
+// CLI commands
+extern const char *COMMAND_SERVE;
+
 // CLI flags
 extern const char *FLAG_FILING_ID;
 extern const char FLAG_FILING_ID_SHORT;
@@ -60,5 +88,16 @@ extern const char *FLAG_WARN;
 extern const char FLAG_WARN_SHORT;
 extern const char *FLAG_DISABLE_STDIN;
 extern const char FLAG_DISABLE_STDIN_SHORT;
+extern const char *FLAG_ASYNC_OUTPUT;
+extern const char FLAG_ASYNC_OUTPUT_SHORT;
+extern const char *FLAG_READ_AHEAD;
+extern const char FLAG_READ_AHEAD_SHORT;
+extern const char *FLAG_BATCH;
+extern const char FLAG_BATCH_SHORT;
+extern const char *FLAG_JOBS;
+extern const char *FLAG_THREADS;
+extern const char *FLAG_RANGE;
+extern const char *FLAG_MERGE;
+extern const char *FLAG_COMPRESS;
 extern const char *FLAG_URL;
 extern const char FLAG_URL_SHORT;
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "cli.h"
 #include "minunit.h"
+#include "compat.h"
+#include "compress.h"
 
 int tests_run = 0;
 
@@ -154,6 +156,183 @@ static char *testCliPipedNoStdin()
   return 0;
 }
 
+static char *testCliBatch()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "-bs", "filings", "parsed"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 1, argc, argv);
+
+  mu_assert("Expected batch", cli->batch == 1);
+  mu_assert("Expected no piped", cli->piped == 0);
+  mu_assert("Expected silent", cli->silent == 1);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  mu_assert("Expect name to equal \"filings\"", strcmp(cli->name, "filings") == 0);
+  mu_assert("Expect output directory to equal \"parsed/\"", strcmp(cli->outputDirectory, "parsed" DIR_SEPARATOR) == 0);
+  mu_assert("Expect no id", cli->fecId == NULL);
+
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliBatchJobs()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "--batch", "--jobs=8", "filings.txt"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 0, argc, argv);
+
+  mu_assert("Expected batch", cli->batch == 1);
+  mu_assert("Expected 8 jobs", cli->jobs == 8);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  mu_assert("Expect name to equal \"filings.txt\"", strcmp(cli->name, "filings.txt") == 0);
+  freeCliContext(cli);
+
+  const char *invalidArgv[] = {"fastfec", "--batch", "--jobs=many", "filings"};
+  cli = newCliContext();
+  parseArgs(cli, 0, 4, invalidArgv);
+  mu_assert("Expected print usage for an invalid number of jobs", cli->shouldPrintUsage == 1);
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliThreads()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "--threads=4", "13360.fec"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 0, argc, argv);
+
+  mu_assert("Expected 4 threads", cli->threads == 4);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  const char *invalidArgv[] = {"fastfec", "--threads=-2", "13360.fec"};
+  cli = newCliContext();
+  parseArgs(cli, 0, 3, invalidArgv);
+  mu_assert("Expected print usage for a negative number of threads", cli->shouldPrintUsage == 1);
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliRange()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "--range=1048576:2097152:8.3", "13360.fec"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 0, argc, argv);
+
+  mu_assert("Expected a range", cli->range == 1);
+  mu_assert("Expected the range start", cli->rangeStart == 1048576);
+  mu_assert("Expected the range end", cli->rangeEnd == 2097152);
+  mu_assert("Expected the range version", strcmp(cli->rangeVersion, "8.3") == 0);
+  mu_assert("Expected the filing ID", strcmp(cli->fecId, "13360") == 0);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  const char *noVersionArgv[] = {"fastfec", "--range=0:100", "13360.fec"};
+  cli = newCliContext();
+  parseArgs(cli, 0, 3, noVersionArgv);
+  mu_assert("Expected no range version", cli->rangeVersion == NULL);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  const char *invalidArgv[] = {"fastfec", "--range=100:0", "13360.fec"};
+  cli = newCliContext();
+  parseArgs(cli, 0, 3, invalidArgv);
+  mu_assert("Expected print usage for a range ending before it starts", cli->shouldPrintUsage == 1);
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliMerge()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "--merge", "13360", "parsed"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 1, argc, argv);
+
+  mu_assert("Expected a merge", cli->merge == 1);
+  mu_assert("Expected no piped input", cli->piped == 0);
+  mu_assert("Expected the filing ID", strcmp(cli->fecId, "13360") == 0);
+  mu_assert("Expected the output directory", strcmp(cli->outputDirectory, "parsed/") == 0);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliServe()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "serve", "--jobs=4", "-w", "/tmp/fastfec.sock"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 1, argc, argv);
+
+  mu_assert("Expected to serve", cli->serve == 1);
+  mu_assert("Expected 4 jobs", cli->jobs == 4);
+  mu_assert("Expected warnings", cli->warn == 1);
+  mu_assert("Expected the socket path", strcmp(cli->name, "/tmp/fastfec.sock") == 0);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  const char *stdinArgv[] = {"fastfec", "serve"};
+  cli = newCliContext();
+  parseArgs(cli, 1, 2, stdinArgv);
+  mu_assert("Expected to serve", cli->serve == 1);
+  mu_assert("Expected jobs from stdin", cli->name == NULL);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  freeCliContext(cli);
+
+  return 0;
+}
+
+static char *testCliCompress()
+{
+  CLI_CONTEXT *cli = newCliContext();
+
+  const char *argv[] = {"fastfec", "--compress=zstd:9", "-x", "100.fec", "parsed"};
+  const int argc = sizeof(argv) / sizeof(argv[0]);
+  parseArgs(cli, 1, argc, argv);
+
+  mu_assert("Expected zstd compression", cli->compression == COMPRESSION_ZSTD);
+  mu_assert("Expected compression level 9", cli->compressionLevel == 9);
+  mu_assert("Expected no print usage", cli->shouldPrintUsage == 0);
+  mu_assert("Expect file name to equal \"100.fec\"", strcmp(cli->fecName, "100.fec") == 0);
+  freeCliContext(cli);
+
+  const char *unknownArgv[] = {"fastfec", "--compress=lzma", "100.fec"};
+  cli = newCliContext();
+  parseArgs(cli, 0, 3, unknownArgv);
+  mu_assert("Expected print usage for an unknown format", cli->shouldPrintUsage == 1);
+  freeCliContext(cli);
+
+  // Levels must be numbers from 1 (to the format's highest, if it's in
+  // the build)
+  const char *badLevels[] = {"--compress=gzip:abc", "--compress=gzip:0", "--compress=zstd:-3", "--compress=gzip:", "--compress=gzip:20", "--compress=zstd:1000"};
+  for (int i = 0; i < 6; i++)
+  {
+    const char *levelArgv[] = {"fastfec", badLevels[i], "100.fec"};
+    cli = newCliContext();
+    parseArgs(cli, 0, 3, levelArgv);
+    int usage = cli->shouldPrintUsage;
+    freeCliContext(cli);
+    mu_assert("Expected print usage for an invalid level", usage == 1 || (i >= 4 && !compressionAvailable(i == 4 ? COMPRESSION_GZIP : COMPRESSION_ZSTD)));
+  }
+
+  return 0;
+}
+
 static char *all_tests()
 {
   mu_run_test(testCliIncludeFilingId);
@@ -164,6 +343,13 @@ static char *all_tests()
   mu_run_test(testCliShowSpecifyFilingId);
   mu_run_test(testCliSilentWarnPipedIncludeFilingId);
   mu_run_test(testCliPipedNoStdin);
+  mu_run_test(testCliBatch);
+  mu_run_test(testCliBatchJobs);
+  mu_run_test(testCliThreads);
+  mu_run_test(testCliRange);
+  mu_run_test(testCliMerge);
+  mu_run_test(testCliServe);
+  mu_run_test(testCliCompress);
   return 0;
 }
 
@@ -9,3 +9,8 @@
 #define DIR_SEPARATOR "/"
 #define DIR_SEPARATOR_CHAR '/'
 #endif
+
+#if !defined(_WIN32) && !defined(__wasm__)
+#define HAS_PTHREADS
+#define HAS_MMAP
+#endif
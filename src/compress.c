@@ -0,0 +1,500 @@
+#include "compress.h"
+#include "compat.h"
+#include "sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// The most blocks to have compressing or waiting to be written, per
+// worker, before waiting for the oldest
+#define JOBS_PER_WORKER 2
+// How much output to compress as it's written before starting workers,
+// so small filings never pay for starting them
+#define INLINE_BYTES (256 * 1024)
+
+// A block of an output file to compress, then write
+struct compress_job
+{
+  OUTPUT_FILE *file;
+  char *input;
+  int inputLength;
+  char *output;
+  int outputLength; // -1 if it couldn't be compressed
+  int done;
+  struct compress_job *next; // the next block written (of any file)
+};
+typedef struct compress_job COMPRESS_JOB;
+
+// What a thread needs to compress blocks, kept to reuse between them
+struct compressor
+{
+  int format;
+  int level;
+#ifdef HAS_ZLIB
+  z_stream stream;
+  int streamReady;
+#endif
+#ifdef HAS_ZSTD
+  ZSTD_CCtx *zstd;
+#endif
+};
+typedef struct compressor COMPRESSOR;
+
+struct compressing_sink
+{
+  OUTPUT_SINK *inner;
+  int ownsInner;
+  int format;
+  int level;
+  COMPRESSOR compressor; // for compressing blocks as they're written
+  long inlineBytes;      // compressed as they were written
+  int maxWorkers;        // to start once past INLINE_BYTES
+  int numWorkers;
+#ifdef HAS_PTHREADS
+  pthread_t *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t jobQueued; // wakes workers
+  pthread_cond_t jobDone;   // wakes the thread writing to the sink
+  int stopping;
+#endif
+
+  // Blocks not yet written, in the order they were written to the sink
+  COMPRESS_JOB *head;
+  COMPRESS_JOB *tail;
+  COMPRESS_JOB *nextToCompress;
+  int numJobs;
+};
+typedef struct compressing_sink COMPRESSING_SINK;
+
+int compressionFormat(const char *name)
+{
+  if (strcmp(name, "none") == 0)
+  {
+    return COMPRESSION_NONE;
+  }
+  if (strcmp(name, "gzip") == 0)
+  {
+    return COMPRESSION_GZIP;
+  }
+  if (strcmp(name, "zstd") == 0)
+  {
+    return COMPRESSION_ZSTD;
+  }
+  return -1;
+}
+
+int compressionAvailable(int format)
+{
+  if (format == COMPRESSION_NONE)
+  {
+    return 1;
+  }
+#ifdef HAS_ZLIB
+  if (format == COMPRESSION_GZIP)
+  {
+    return 1;
+  }
+#endif
+#ifdef HAS_ZSTD
+  if (format == COMPRESSION_ZSTD)
+  {
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+int maxCompressionLevel(int format)
+{
+#ifdef HAS_ZLIB
+  if (format == COMPRESSION_GZIP)
+  {
+    return 9;
+  }
+#endif
+#ifdef HAS_ZSTD
+  if (format == COMPRESSION_ZSTD)
+  {
+    return ZSTD_maxCLevel();
+  }
+#endif
+  (void)format;
+  return 0;
+}
+
+int defaultCompressionWorkers()
+{
+#if defined(HAS_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (int)cores : 0;
+#else
+  return 0;
+#endif
+}
+
+void initCompressor(COMPRESSOR *compressor, int format, int level)
+{
+  compressor->format = format;
+  compressor->level = level;
+#ifdef HAS_ZLIB
+  compressor->streamReady = 0;
+#endif
+#ifdef HAS_ZSTD
+  compressor->zstd = NULL;
+#endif
+}
+
+void freeCompressor(COMPRESSOR *compressor)
+{
+  (void)compressor; // with neither library, there's nothing to free
+#ifdef HAS_ZLIB
+  if (compressor->streamReady)
+  {
+    deflateEnd(&compressor->stream);
+  }
+#endif
+#ifdef HAS_ZSTD
+  if (compressor->zstd != NULL)
+  {
+    ZSTD_freeCCtx(compressor->zstd);
+  }
+#endif
+}
+
+#ifdef HAS_ZLIB
+// Compress a block into a new buffer as a whole gzip member
+void compressGzip(COMPRESSOR *compressor, COMPRESS_JOB *job)
+{
+  z_stream *stream = &compressor->stream;
+  if (!compressor->streamReady)
+  {
+    memset(stream, 0, sizeof(z_stream));
+    // A window of 15 bits, plus 16 for a gzip header and trailer
+    if (deflateInit2(stream, compressor->level == 0 ? Z_DEFAULT_COMPRESSION : compressor->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      return;
+    }
+    compressor->streamReady = 1;
+  }
+  else
+  {
+    deflateReset(stream);
+  }
+  uLong bound = deflateBound(stream, job->inputLength);
+  job->output = malloc(bound);
+  stream->next_in = (Bytef *)job->input;
+  stream->avail_in = job->inputLength;
+  stream->next_out = (Bytef *)job->output;
+  stream->avail_out = bound;
+  if (deflate(stream, Z_FINISH) == Z_STREAM_END)
+  {
+    job->outputLength = bound - stream->avail_out;
+  }
+}
+#endif
+
+#ifdef HAS_ZSTD
+// Compress a block into a new buffer as a whole zstd frame
+void compressZstd(COMPRESSOR *compressor, COMPRESS_JOB *job)
+{
+  if (compressor->zstd == NULL)
+  {
+    compressor->zstd = ZSTD_createCCtx();
+    if (compressor->zstd == NULL)
+    {
+      return;
+    }
+  }
+  size_t bound = ZSTD_compressBound(job->inputLength);
+  job->output = malloc(bound);
+  size_t length = ZSTD_compressCCtx(compressor->zstd, job->output, bound, job->input, job->inputLength, compressor->level);
+  if (!ZSTD_isError(length))
+  {
+    job->outputLength = length;
+  }
+}
+#endif
+
+void compressJob(COMPRESSOR *compressor, COMPRESS_JOB *job)
+{
+  (void)compressor; // with neither library, every block fails
+  job->output = NULL;
+  job->outputLength = -1;
+#ifdef HAS_ZLIB
+  if (compressor->format == COMPRESSION_GZIP)
+  {
+    compressGzip(compressor, job);
+  }
+#endif
+#ifdef HAS_ZSTD
+  if (compressor->format == COMPRESSION_ZSTD)
+  {
+    compressZstd(compressor, job);
+  }
+#endif
+}
+
+void writeJob(COMPRESSING_SINK *state, COMPRESS_JOB *job)
+{
+  if (job->outputLength < 0)
+  {
+    fprintf(stderr, "Couldn't compress output file: %s%s\n", job->file->filename, job->file->extension);
+    job->file->context->writeFailed = 1;
+  }
+  else
+  {
+    state->inner->write(state->inner, job->file, job->output, job->outputLength);
+  }
+  free(job->output);
+}
+
+#ifdef HAS_PTHREADS
+void *compressQueuedJobs(void *data)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)data;
+  COMPRESSOR compressor;
+  initCompressor(&compressor, state->format, state->level);
+  pthread_mutex_lock(&state->lock);
+  while (1)
+  {
+    while (state->nextToCompress == NULL && !state->stopping)
+    {
+      pthread_cond_wait(&state->jobQueued, &state->lock);
+    }
+    COMPRESS_JOB *job = state->nextToCompress;
+    if (job == NULL)
+    {
+      break;
+    }
+    state->nextToCompress = job->next;
+    pthread_mutex_unlock(&state->lock);
+
+    compressJob(&compressor, job);
+
+    pthread_mutex_lock(&state->lock);
+    job->done = 1;
+    pthread_cond_signal(&state->jobDone);
+  }
+  pthread_mutex_unlock(&state->lock);
+  freeCompressor(&compressor);
+  return NULL;
+}
+
+// Write compressed blocks to the inner sink from the oldest, until there
+// are at most maxJobs left or the oldest is still being compressed
+void writeFinishedJobs(COMPRESSING_SINK *state, int maxJobs)
+{
+  pthread_mutex_lock(&state->lock);
+  while (state->head != NULL && (state->head->done || state->numJobs > maxJobs))
+  {
+    if (!state->head->done)
+    {
+      pthread_cond_wait(&state->jobDone, &state->lock);
+      continue;
+    }
+    COMPRESS_JOB *job = state->head;
+    state->head = job->next;
+    if (state->head == NULL)
+    {
+      state->tail = NULL;
+    }
+    state->numJobs--;
+    pthread_mutex_unlock(&state->lock);
+
+    writeJob(state, job);
+    free(job->input);
+    free(job);
+
+    pthread_mutex_lock(&state->lock);
+  }
+  pthread_mutex_unlock(&state->lock);
+}
+
+void queueJob(COMPRESSING_SINK *state, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  COMPRESS_JOB *job = (COMPRESS_JOB *)malloc(sizeof(COMPRESS_JOB));
+  job->file = file;
+  job->input = malloc(numBytes);
+  memcpy(job->input, contents, numBytes);
+  job->inputLength = numBytes;
+  job->done = 0;
+  job->next = NULL;
+
+  pthread_mutex_lock(&state->lock);
+  if (state->tail != NULL)
+  {
+    state->tail->next = job;
+  }
+  else
+  {
+    state->head = job;
+  }
+  state->tail = job;
+  if (state->nextToCompress == NULL)
+  {
+    state->nextToCompress = job;
+  }
+  state->numJobs++;
+  pthread_cond_signal(&state->jobQueued);
+  pthread_mutex_unlock(&state->lock);
+
+  writeFinishedJobs(state, state->numWorkers * JOBS_PER_WORKER);
+}
+
+// Start the workers. Return how many started.
+int startWorkers(COMPRESSING_SINK *state, int workers)
+{
+  state->workers = (pthread_t *)malloc(sizeof(pthread_t) * workers);
+  state->stopping = 0;
+  pthread_mutex_init(&state->lock, NULL);
+  pthread_cond_init(&state->jobQueued, NULL);
+  pthread_cond_init(&state->jobDone, NULL);
+  int started = 0;
+  while (started < workers && pthread_create(&state->workers[started], NULL, compressQueuedJobs, state) == 0)
+  {
+    started++;
+  }
+  return started;
+}
+
+void stopWorkers(COMPRESSING_SINK *state)
+{
+  pthread_mutex_lock(&state->lock);
+  state->stopping = 1;
+  pthread_cond_broadcast(&state->jobQueued);
+  pthread_mutex_unlock(&state->lock);
+  for (int i = 0; i < state->numWorkers; i++)
+  {
+    pthread_join(state->workers[i], NULL);
+  }
+  pthread_mutex_destroy(&state->lock);
+  pthread_cond_destroy(&state->jobQueued);
+  pthread_cond_destroy(&state->jobDone);
+  free(state->workers);
+}
+#endif
+
+// Write out every block written so far
+void writeAllJobs(COMPRESSING_SINK *state)
+{
+#ifdef HAS_PTHREADS
+  if (state->numWorkers > 0)
+  {
+    writeFinishedJobs(state, 0);
+  }
+#endif
+}
+
+int compressingSinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)sink->state;
+  const char *suffix = state->format == COMPRESSION_GZIP ? ".gz" : ".zst";
+  file->extension = realloc(file->extension, strlen(file->extension) + strlen(suffix) + 1);
+  strcat(file->extension, suffix);
+  return state->inner->open(state->inner, context, file);
+}
+
+void compressingSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)sink->state;
+#ifdef HAS_PTHREADS
+  if (state->numWorkers == 0 && state->maxWorkers > 0 && state->inlineBytes >= INLINE_BYTES)
+  {
+    // Blocks compressed so far are already written, so the workers'
+    // blocks still follow them in order
+    state->numWorkers = startWorkers(state, state->maxWorkers);
+    if (state->numWorkers == 0)
+    {
+      stopWorkers(state);
+    }
+    state->maxWorkers = 0;
+  }
+  if (state->numWorkers > 0)
+  {
+    queueJob(state, file, contents, numBytes);
+    return;
+  }
+#endif
+  state->inlineBytes += numBytes;
+  COMPRESS_JOB job = {.file = file, .input = contents, .inputLength = numBytes};
+  compressJob(&state->compressor, &job);
+  writeJob(state, &job);
+}
+
+void compressingSinkFlush(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)sink->state;
+  writeAllJobs(state);
+  if (state->inner->flush != NULL)
+  {
+    state->inner->flush(state->inner, file);
+  }
+}
+
+void compressingSinkClose(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)sink->state;
+  writeAllJobs(state);
+  if (state->inner->close != NULL)
+  {
+    state->inner->close(state->inner, file);
+  }
+}
+
+void compressingSinkFree(OUTPUT_SINK *sink)
+{
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)sink->state;
+  writeAllJobs(state);
+#ifdef HAS_PTHREADS
+  if (state->numWorkers > 0)
+  {
+    stopWorkers(state);
+  }
+#endif
+  freeCompressor(&state->compressor);
+  if (state->ownsInner)
+  {
+    freeOutputSink(state->inner);
+  }
+  free(state);
+}
+
+OUTPUT_SINK *newCompressingSink(OUTPUT_SINK *inner, int ownsInner, int format, int level, int workers)
+{
+  if (format == COMPRESSION_NONE || !compressionAvailable(format) || level < 0 || level > maxCompressionLevel(format))
+  {
+    return NULL;
+  }
+  COMPRESSING_SINK *state = (COMPRESSING_SINK *)malloc(sizeof(COMPRESSING_SINK));
+  state->inner = inner;
+  state->ownsInner = ownsInner;
+  state->format = format;
+  state->level = level;
+  initCompressor(&state->compressor, format, level);
+  state->head = NULL;
+  state->tail = NULL;
+  state->nextToCompress = NULL;
+  state->numJobs = 0;
+  state->inlineBytes = 0;
+  state->maxWorkers = workers;
+  state->numWorkers = 0;
+
+  OUTPUT_SINK *sink = newSink();
+  sink->open = compressingSinkOpen;
+  sink->write = compressingSinkWrite;
+  sink->flush = compressingSinkFlush;
+  sink->close = compressingSinkClose;
+  sink->free = compressingSinkFree;
+  sink->state = state;
+  return sink;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "export.h"
+#include "writer.h"
+
+// Compression formats for output files. Each is available if the library
+// was built with it (zig build -Dzlib=true for gzip, -Dzstd=true for zstd).
+#define COMPRESSION_NONE 0
+#define COMPRESSION_GZIP 1
+#define COMPRESSION_ZSTD 2
+
+// Return the compression format with the given name ("gzip" or "zstd",
+// or "none"), or -1 if there's no such format
+EXPORT int compressionFormat(const char *name);
+
+// Return whether output can be compressed in a format in this build
+EXPORT int compressionAvailable(int format);
+
+// Return the highest level a format compresses at (9 for gzip, and
+// ZSTD_maxCLevel() for zstd), or 0 if it isn't available. Levels start
+// at 1, with 0 for the format's default.
+EXPORT int maxCompressionLevel(int format);
+
+// Return a number of compression workers to keep every core busy
+EXPORT int defaultCompressionWorkers();
+
+// Create a sink that compresses each buffer written to an output file as
+// an independent block (a gzip member or zstd frame, which concatenated
+// decompress as one stream) before writing it to the inner sink, adding
+// the format's extension (.gz or .zst) to the file's. Blocks are
+// compressed as they're written until there's enough output to need
+// workers, then on up to workers threads (if available), and written to
+// the inner sink in order, from the thread writing to this sink. A level of 0 uses the format's default.
+// A block that can't be compressed fails its write context (see
+// flushWriteContext). Return NULL if the format isn't available or the
+// level is outside 0 to its highest.
+OUTPUT_SINK *newCompressingSink(OUTPUT_SINK *inner, int ownsInner, int format, int level, int workers);
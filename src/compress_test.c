@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "writer.h"
+#include "sink.h"
+#include "compress.h"
+#ifdef HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+int tests_run = 0;
+
+const int NUM_FILES = 5;
+const int NUM_LINES = 20000;
+
+// Interleave lines across a few files, with buffers small enough that
+// each file is compressed in many blocks
+OUTPUT_SINK *writeToMemory(int format, int workers)
+{
+  OUTPUT_SINK *sink = newMemorySink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 4096, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  if (format != COMPRESSION_NONE && !setWriteContextCompression(ctx, format, 0, workers))
+  {
+    freeWriteContext(ctx);
+    freeOutputSink(sink);
+    return NULL;
+  }
+  char filename[20];
+  char line[50];
+  int opened;
+  for (int i = 0; i < NUM_LINES; i++)
+  {
+    sprintf(filename, "file%d", (i * 3) % NUM_FILES);
+    sprintf(line, "line %d of %d,SA11AI,C00123456\n", i, NUM_LINES);
+    writeFileString(ctx, openFile(ctx, filename, csvExtension, &opened), line);
+  }
+  freeWriteContext(ctx);
+  return sink;
+}
+
+static char *testFormats()
+{
+  mu_assert("Expected gzip to be a format", compressionFormat("gzip") == COMPRESSION_GZIP);
+  mu_assert("Expected zstd to be a format", compressionFormat("zstd") == COMPRESSION_ZSTD);
+  mu_assert("Expected none to be a format", compressionFormat("none") == COMPRESSION_NONE);
+  mu_assert("Expected an unknown format", compressionFormat("lzma") == -1);
+  mu_assert("Expected no compression to always be available", compressionAvailable(COMPRESSION_NONE));
+
+  mu_assert("Expected no levels for no compression", maxCompressionLevel(COMPRESSION_NONE) == 0);
+#ifdef HAS_ZLIB
+  mu_assert("Expected gzip levels up to 9", maxCompressionLevel(COMPRESSION_GZIP) == 9);
+#endif
+
+  // Formats missing from the build leave output uncompressed
+  int formats[] = {COMPRESSION_GZIP, COMPRESSION_ZSTD};
+  for (int i = 0; i < 2; i++)
+  {
+    OUTPUT_SINK *sink = writeToMemory(formats[i], 0);
+    mu_assert("Expected a sink only for available formats", (sink != NULL) == compressionAvailable(formats[i]));
+    if (sink != NULL)
+    {
+      freeOutputSink(sink);
+    }
+  }
+  return 0;
+}
+
+// Check that a memory sink got the same files as an uncompressed one, with
+// the extension added and contents that decompress to the same
+char *compareDecompressed(OUTPUT_SINK *expected, OUTPUT_SINK *actual, const char *extension, int (*decompress)(char *, int, char *, int))
+{
+  mu_assert("Expected the same number of files", getMemorySinkNumFiles(expected) == getMemorySinkNumFiles(actual));
+  for (int i = 0; i < getMemorySinkNumFiles(expected); i++)
+  {
+    char *expectedName, *actualName, *expectedExtension, *actualExtension, *expectedContents, *actualContents;
+    int expectedLength = getMemorySinkFile(expected, i, &expectedName, &expectedExtension, &expectedContents);
+    int actualLength = getMemorySinkFile(actual, i, &actualName, &actualExtension, &actualContents);
+    mu_assert("Expected the same file", strcmp(expectedName, actualName) == 0);
+    mu_assert("Expected the compressed extension", strncmp(actualExtension, ".csv", 4) == 0 && strcmp(actualExtension + 4, extension) == 0);
+    mu_assert("Expected the contents to be compressed", actualLength < expectedLength / 2);
+
+    char *decompressed = malloc(expectedLength + 1);
+    int decompressedLength = decompress(actualContents, actualLength, decompressed, expectedLength + 1);
+    int same = decompressedLength == expectedLength && memcmp(decompressed, expectedContents, expectedLength) == 0;
+    free(decompressed);
+    mu_assert("Expected the contents to decompress to the same", same);
+  }
+  return 0;
+}
+
+// Check that compressing with workers gives exactly the same output as without
+char *compareSinks(OUTPUT_SINK *expected, OUTPUT_SINK *actual)
+{
+  mu_assert("Expected the same number of files", getMemorySinkNumFiles(expected) == getMemorySinkNumFiles(actual));
+  for (int i = 0; i < getMemorySinkNumFiles(expected); i++)
+  {
+    char *name, *extension, *expectedContents, *actualContents;
+    int expectedLength = getMemorySinkFile(expected, i, &name, &extension, &expectedContents);
+    int actualLength = getMemorySinkFile(actual, i, &name, &extension, &actualContents);
+    mu_assert("Expected the same blocks in order", expectedLength == actualLength && memcmp(expectedContents, actualContents, expectedLength) == 0);
+  }
+  return 0;
+}
+
+char *testRoundTrip(int format, const char *extension, int (*decompress)(char *, int, char *, int))
+{
+  OUTPUT_SINK *plain = writeToMemory(COMPRESSION_NONE, 0);
+  OUTPUT_SINK *inline_ = writeToMemory(format, 0);
+  char *result = compareDecompressed(plain, inline_, extension, decompress);
+  int workers[] = {1, 3, 8};
+  for (int i = 0; result == 0 && i < 3; i++)
+  {
+    OUTPUT_SINK *parallel = writeToMemory(format, workers[i]);
+    result = compareSinks(inline_, parallel);
+    freeOutputSink(parallel);
+  }
+  freeOutputSink(plain);
+  freeOutputSink(inline_);
+  return result;
+}
+
+#ifdef HAS_ZLIB
+// Decompress every gzip member in turn. Return the decompressed length.
+int gunzip(char *contents, int length, char *output, int capacity)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  inflateInit2(&stream, 15 + 16);
+  stream.next_in = (Bytef *)contents;
+  stream.avail_in = length;
+  stream.next_out = (Bytef *)output;
+  stream.avail_out = capacity;
+  while (stream.avail_in > 0)
+  {
+    int result = inflate(&stream, Z_NO_FLUSH);
+    if (result == Z_STREAM_END)
+    {
+      inflateReset(&stream);
+    }
+    else if (result != Z_OK)
+    {
+      break;
+    }
+  }
+  int decompressed = capacity - stream.avail_out;
+  inflateEnd(&stream);
+  return decompressed;
+}
+
+static char *testGzip()
+{
+  return testRoundTrip(COMPRESSION_GZIP, ".gz", gunzip);
+}
+#endif
+
+#ifdef HAS_ZSTD
+// Decompress every zstd frame. Return the decompressed length.
+int unzstd(char *contents, int length, char *output, int capacity)
+{
+  size_t decompressed = ZSTD_decompress(output, capacity, contents, length);
+  return ZSTD_isError(decompressed) ? -1 : (int)decompressed;
+}
+
+static char *testZstd()
+{
+  return testRoundTrip(COMPRESSION_ZSTD, ".zst", unzstd);
+}
+#endif
+
+// Levels past a format's highest (or below its default) aren't used
+static char *testLevels()
+{
+  int formats[] = {COMPRESSION_GZIP, COMPRESSION_ZSTD};
+  for (int i = 0; i < 2; i++)
+  {
+    if (!compressionAvailable(formats[i]))
+    {
+      continue;
+    }
+    int levels[] = {0, maxCompressionLevel(formats[i]), maxCompressionLevel(formats[i]) + 1, -1};
+    for (int j = 0; j < 4; j++)
+    {
+      WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 4096, NULL, NULL);
+      OUTPUT_SINK *sink = newMemorySink();
+      setWriteContextSink(ctx, sink);
+      int compressing = setWriteContextCompression(ctx, formats[i], levels[j], 0);
+      freeWriteContext(ctx);
+      freeOutputSink(sink);
+      mu_assert("Expected only levels up to the format's highest to compress", compressing == (j < 2));
+    }
+  }
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testFormats);
+  mu_run_test(testLevels);
+#ifdef HAS_ZLIB
+  mu_run_test(testGzip);
+#endif
+#ifdef HAS_ZSTD
+  mu_run_test(testZstd);
+#endif
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nCompression tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n\n", tests_run);
+
+  return result != 0;
+}
@@ -2,6 +2,9 @@
 #include "memory.h"
 #include "csv.h"
 #include "writer.h"
+#include "simd.h"
+#include <stdint.h>
+#include <string.h>
 
 void processFieldChar(char c, FIELD_INFO *info)
 {
@@ -18,14 +21,14 @@ void processFieldChar(char c, FIELD_INFO *info)
   }
 }
 
-void writeDelimeter(WRITE_CONTEXT *context, char *filename, const char *extension)
+void writeDelimeter(WRITE_CONTEXT *context, OUTPUT_FILE *file)
 {
-  writeChar(context, filename, extension, ',');
+  writeFileChar(context, file, ',');
 }
 
-void writeNewline(WRITE_CONTEXT *context, char *filename, const char *extension)
+void writeNewline(WRITE_CONTEXT *context, OUTPUT_FILE *file)
 {
-  writeChar(context, filename, extension, '\n');
+  writeFileChar(context, file, '\n');
 }
 
 static inline int endOfField(char c)
@@ -35,7 +38,8 @@ static inline int endOfField(char c)
 
 void stripQuotes(PARSE_CONTEXT *parseContext)
 {
-  if ((parseContext->start != parseContext->end) && (parseContext->line->str[parseContext->start] == '"') && (parseContext->line->str[parseContext->end - 1] == '"'))
+  // A lone quote is both the first and last character, so isn't a pair
+  if ((parseContext->end - parseContext->start >= 2) && (parseContext->line->str[parseContext->start] == '"') && (parseContext->line->str[parseContext->end - 1] == '"'))
   {
     // Bump the field positions to avoid the quotes
     (parseContext->start)++;
@@ -134,49 +138,376 @@ void readCsvField(PARSE_CONTEXT *parseContext)
   stripQuotes(parseContext);
 }
 
+LINE_INDEX *newLineIndex()
+{
+  LINE_INDEX *index = malloc(sizeof(LINE_INDEX));
+  index->capacity = 64;
+  index->numFields = 0;
+  index->fields = malloc(sizeof(FIELD_SPAN) * index->capacity);
+  return index;
+}
+
+void freeLineIndex(LINE_INDEX *index)
+{
+  free(index->fields);
+  free(index);
+}
+
+// Bitmasks of the structural characters in a 64-byte block
+typedef struct
+{
+  uint64_t quotes;
+  uint64_t commas;
+  uint64_t separators; // ascii 28
+  uint64_t newlines;
+} BLOCK_MASKS;
+
+#ifdef SIMD_NEON
+static inline uint64_t neonMovemask(uint8x16_t matches)
+{
+  const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t masked = vandq_u8(matches, bits);
+  return vaddv_u8(vget_low_u8(masked)) | ((uint64_t)vaddv_u8(vget_high_u8(masked)) << 8);
+}
+#endif
+
+static inline void classifyBlock(const unsigned char *block, BLOCK_MASKS *masks)
+{
+  masks->quotes = 0;
+  masks->commas = 0;
+  masks->separators = 0;
+  masks->newlines = 0;
+#if defined(SIMD_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i separator = _mm_set1_epi8(28);
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (int i = 0; i < 64; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(block + i));
+    masks->quotes |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)) << i;
+    masks->commas |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, comma)) << i;
+    masks->separators |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, separator)) << i;
+    masks->newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)) << i;
+  }
+#elif defined(SIMD_NEON)
+  for (int i = 0; i < 64; i += 16)
+  {
+    uint8x16_t chunk = vld1q_u8(block + i);
+    masks->quotes |= neonMovemask(vceqq_u8(chunk, vdupq_n_u8('"'))) << i;
+    masks->commas |= neonMovemask(vceqq_u8(chunk, vdupq_n_u8(','))) << i;
+    masks->separators |= neonMovemask(vceqq_u8(chunk, vdupq_n_u8(28))) << i;
+    masks->newlines |= neonMovemask(vceqq_u8(chunk, vdupq_n_u8('\n'))) << i;
+  }
+#else
+  for (int i = 0; i < 64; i++)
+  {
+    uint64_t bit = 1ULL << i;
+    masks->quotes |= block[i] == '"' ? bit : 0;
+    masks->commas |= block[i] == ',' ? bit : 0;
+    masks->separators |= block[i] == 28 ? bit : 0;
+    masks->newlines |= block[i] == '\n' ? bit : 0;
+  }
+#endif
+}
+
+// Set each bit to the parity of the bits at or below it, which
+// for a quote mask marks the quoted regions (opening quote included)
+static inline uint64_t prefixXor(uint64_t bits)
+{
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+// The bits below the given bit
+static inline uint64_t bitsBelow(int bit)
+{
+  return (1ULL << bit) - 1;
+}
+
+static inline void addFieldSpan(LINE_INDEX *index, int start, int end, int numQuotes, int numCommas, int ascii28)
+{
+  if (index->numFields == index->capacity)
+  {
+    index->capacity *= 2;
+    index->fields = realloc(index->fields, sizeof(FIELD_SPAN) * index->capacity);
+  }
+  FIELD_SPAN *span = &index->fields[index->numFields++];
+  span->start = start;
+  span->end = end;
+  span->terminator = end;
+  span->unescape = 0;
+  span->info.num_quotes = numQuotes;
+  span->info.num_commas = numCommas;
+  if (!ascii28 && numQuotes > 0)
+  {
+    // A quoted CSV field. Without escaped quotes, it's just the text
+    // inside the quotes; otherwise it's unescaped when read.
+    if (numQuotes == 2)
+    {
+      span->start++;
+      span->end--;
+      span->info.num_quotes = 0;
+    }
+    else
+    {
+      span->unescape = 1;
+    }
+  }
+}
+
+int indexLine(LINE_INDEX *index, const char *line, int length, int ascii28)
+{
+  unsigned char padded[64];
+  index->numFields = 0;
+
+  int fieldStart = 0;
+  int fieldQuotes = 0; // quotes and commas in the current field so far
+  int fieldCommas = 0;
+
+  // State carried between blocks for CSV quoting
+  uint64_t inQuotes = 0;       // all ones if the last block ended inside quotes
+  uint64_t carryFieldStart = 1; // whether bit 0 starts a field
+  uint64_t carryClose = 0;      // whether bit 0 follows a closing quote
+
+  for (int blockStart = 0; blockStart < length; blockStart += 64)
+  {
+    const unsigned char *block = (const unsigned char *)line + blockStart;
+    uint64_t pastEnd = 0;
+    if (length - blockStart < 64)
+    {
+      // Pad the final block with null bytes
+      memset(padded, 0, sizeof(padded));
+      memcpy(padded, block, length - blockStart);
+      block = padded;
+      pastEnd = ~bitsBelow(length - blockStart);
+    }
+    BLOCK_MASKS masks;
+    classifyBlock(block, &masks);
+
+    uint64_t delimiters;
+    uint64_t newlines;
+    if (ascii28)
+    {
+      delimiters = masks.separators;
+      newlines = masks.newlines;
+    }
+    else
+    {
+      uint64_t quoted = prefixXor(masks.quotes) ^ inQuotes;
+      inQuotes = (uint64_t)((int64_t)quoted >> 63);
+      uint64_t opens = masks.quotes & quoted;
+      uint64_t closes = masks.quotes & ~quoted;
+      delimiters = masks.commas & ~quoted;
+      newlines = masks.newlines & ~quoted;
+
+      // Reading char by char, a quote only opens a quoted field at the
+      // start of the field, and a quote inside one either ends the field
+      // or is escaped by the next quote. Other quotes are literal there
+      // but would start or end quoted regions here.
+      uint64_t fieldStarts = (delimiters << 1) | carryFieldStart;
+      uint64_t afterCloses = (closes << 1) | carryClose;
+      if ((opens & ~(fieldStarts | afterCloses)) != 0)
+      {
+        return 0;
+      }
+      if ((afterCloses & ~(delimiters | newlines | opens | pastEnd)) != 0)
+      {
+        return 0;
+      }
+      carryFieldStart = delimiters >> 63;
+      carryClose = closes >> 63;
+    }
+
+    // Add the fields ending in the block. Fields rarely have quotes
+    // or commas, so only count them when there are some.
+    uint64_t boundaries = delimiters | newlines;
+    uint64_t previousFields = 0; // the bits of fields already added
+    while (boundaries != 0)
+    {
+      int bit = __builtin_ctzll(boundaries);
+      uint64_t field = bitsBelow(bit) & ~previousFields;
+      if ((masks.quotes & field) != 0)
+      {
+        fieldQuotes += __builtin_popcountll(masks.quotes & field);
+      }
+      if ((masks.commas & field) != 0)
+      {
+        fieldCommas += __builtin_popcountll(masks.commas & field);
+      }
+      addFieldSpan(index, fieldStart, blockStart + bit, fieldQuotes, fieldCommas, ascii28);
+      if ((newlines >> bit) & 1)
+      {
+        // The line ends at the first (unquoted) newline
+        return 1;
+      }
+      fieldStart = blockStart + bit + 1;
+      fieldQuotes = 0;
+      fieldCommas = 0;
+      previousFields = (bitsBelow(bit) << 1) | 1;
+      boundaries &= boundaries - 1;
+    }
+    if ((masks.quotes & ~previousFields) != 0)
+    {
+      fieldQuotes += __builtin_popcountll(masks.quotes & ~previousFields);
+    }
+    if ((masks.commas & ~previousFields) != 0)
+    {
+      fieldCommas += __builtin_popcountll(masks.commas & ~previousFields);
+    }
+  }
+
+  if (!ascii28 && inQuotes)
+  {
+    // Unterminated quoted field
+    return 0;
+  }
+  addFieldSpan(index, fieldStart, length, fieldQuotes, fieldCommas, ascii28);
+  return 1;
+}
+
+void readIndexedField(PARSE_CONTEXT *parseContext)
+{
+  FIELD_SPAN *span = &parseContext->index->fields[parseContext->columnIndex];
+  if (span->unescape)
+  {
+    parseContext->position = span->start;
+    readCsvField(parseContext);
+    return;
+  }
+  parseContext->start = span->start;
+  parseContext->end = span->end;
+  parseContext->position = span->terminator;
+  if (parseContext->fieldInfo)
+  {
+    *parseContext->fieldInfo = span->info;
+  }
+  if (span->info.num_quotes > 0)
+  {
+    stripQuotes(parseContext);
+  }
+}
+
 void advanceField(PARSE_CONTEXT *context)
 {
   context->columnIndex++;
   context->position++;
 }
 
-void writeField(WRITE_CONTEXT *context, char *filename, const char *extension, STRING *line, int start, int end, FIELD_INFO *info)
+// Copy a 16-byte chunk that contains quotes (set in mask), doubling them
+static inline char *escapeChunk(const char *in, uint32_t mask, char *out)
+{
+  int runStart = 0;
+  while (mask != 0)
+  {
+    int quote = __builtin_ctz(mask);
+    memcpy(out, in + runStart, quote + 1 - runStart);
+    out += quote + 1 - runStart;
+    *out++ = '"';
+    runStart = quote + 1;
+    mask &= mask - 1;
+  }
+  memcpy(out, in + runStart, 16 - runStart);
+  return out + 16 - runStart;
+}
+
+int escapeQuotes(const char *in, int length, char *out)
+{
+  char *start = out;
+  int i = 0;
+#if defined(SIMD_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(in + i));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote));
+    if (mask == 0)
+    {
+      _mm_storeu_si128((__m128i *)out, chunk);
+      out += 16;
+    }
+    else
+    {
+      out = escapeChunk(in + i, mask, out);
+    }
+  }
+#elif defined(SIMD_NEON)
+  for (; i + 16 <= length; i += 16)
+  {
+    uint8x16_t chunk = vld1q_u8((const uint8_t *)(in + i));
+    uint32_t mask = neonMovemask(vceqq_u8(chunk, vdupq_n_u8('"')));
+    if (mask == 0)
+    {
+      vst1q_u8((uint8_t *)out, chunk);
+      out += 16;
+    }
+    else
+    {
+      out = escapeChunk(in + i, mask, out);
+    }
+  }
+#endif
+  for (; i < length; i++)
+  {
+    *out++ = in[i];
+    if (in[i] == '"')
+    {
+      *out++ = '"';
+    }
+  }
+  return out - start;
+}
+
+void writeField(WRITE_CONTEXT *context, OUTPUT_FILE *file, STRING *line, int start, int end, FIELD_INFO *info)
 {
   int escaped = (info->num_commas > 0) || (info->num_quotes > 0);
   int copyDirectly = !(info->num_quotes > 0);
 
+  if (!copyDirectly && context->local)
+  {
+    // Escape straight into the local buffer (at most doubling the field)
+    char *out = reserveLocal(context, 2 * (end - start) + 2);
+    out[0] = '"';
+    int length = escapeQuotes(line->str + start, end - start, out + 1);
+    out[length + 1] = '"';
+    commitLocal(context, length + 2);
+    return;
+  }
+
   if (escaped)
   {
     // Start of escape quote
-    writeChar(context, filename, extension, '"');
+    writeFileChar(context, file, '"');
   }
   if (copyDirectly)
   {
     // No need for char-by-char writing
-    writeN(context, filename, extension, line->str + start, end - start);
+    writeFileN(context, file, line->str + start, end - start);
   }
   else
   {
-    // Copy string in char-by-char
+    // Copy the runs between quotes directly, doubling each quote
+    int runStart = start;
     for (int i = start; i < end; i++)
     {
-      char c = line->str[i];
-      if (c == '"')
-      {
-        // Double quotes
-        writeString(context, filename, extension, "\"\"");
-      }
-      else
+      if (line->str[i] == '"')
       {
-        // Normal character
-        writeChar(context, filename, extension, c);
+        writeFileN(context, file, line->str + runStart, i + 1 - runStart);
+        writeFileChar(context, file, '"');
+        runStart = i + 1;
       }
     }
+    writeFileN(context, file, line->str + runStart, end - runStart);
   }
   if (escaped)
   {
     // End of escape quote
-    writeChar(context, filename, extension, '"');
+    writeFileChar(context, file, '"');
   }
 }
 
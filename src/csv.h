@@ -10,9 +10,30 @@ struct field_info
 };
 typedef struct field_info FIELD_INFO;
 
+// A field located by indexLine: its bounds, the position of the
+// delimiter (or end of line) after it, and its field info
+struct field_span
+{
+  int start;
+  int end;
+  int terminator;
+  int unescape; // whether escaped quotes need reading char by char
+  FIELD_INFO info;
+};
+typedef struct field_span FIELD_SPAN;
+
+struct line_index
+{
+  FIELD_SPAN *fields;
+  int numFields;
+  int capacity;
+};
+typedef struct line_index LINE_INDEX;
+
 struct parse_context
 {
   STRING *line;
+  LINE_INDEX *index; // null if fields are read char by char
   FIELD_INFO *fieldInfo;
   int position;
   int start;
@@ -23,12 +44,16 @@ typedef struct parse_context PARSE_CONTEXT;
 
 void processFieldChar(char c, FIELD_INFO *info);
 
-void writeDelimeter(WRITE_CONTEXT *context, char *filename, const char *extension);
+void writeDelimeter(WRITE_CONTEXT *context, OUTPUT_FILE *file);
 
-void writeNewline(WRITE_CONTEXT *context, char *filename, const char *extension);
+void writeNewline(WRITE_CONTEXT *context, OUTPUT_FILE *file);
 
 static inline int endOfField(char c);
 
+// If both the start and end of the field are `"`, narrow the
+// field to the contents inside the quotes
+void stripQuotes(PARSE_CONTEXT *parseContext);
+
 // Read a field from a file delimited by the character with the
 // ascii code 28. If both the start and end of the field are `"`
 // then return the field contents inside the quotes.
@@ -39,10 +64,31 @@ void readAscii28Field(PARSE_CONTEXT *parseContext);
 // longer escaped than not, this will always work in-place.
 void readCsvField(PARSE_CONTEXT *parseContext);
 
+LINE_INDEX *newLineIndex();
+
+void freeLineIndex(LINE_INDEX *index);
+
+// Build a structural index of the fields in a line (of the given
+// length, ending early at a newline) from bitmasks of its quotes,
+// delimiters and newlines over 64-byte blocks. Return 0 if CSV
+// quoting in the line isn't the standard kind that bitmasks can
+// follow, in which case it needs to be read char by char.
+int indexLine(LINE_INDEX *index, const char *line, int length, int ascii28);
+
+// Read the next field of a line from its index, with the same
+// results (including unescaping in place) as reading it directly
+void readIndexedField(PARSE_CONTEXT *parseContext);
+
 // Advance past the delimeter and increase the column index
 void advanceField(PARSE_CONTEXT *parseContext);
 
-void writeField(WRITE_CONTEXT *context, char *filename, const char *extension, STRING *line, int start, int end, FIELD_INFO *info);
+// Copy length chars to out (which has room for twice as many), doubling
+// any quotes as CSV escaping does. Return the number of chars written.
+int escapeQuotes(const char *in, int length, char *out);
+
+// Write a field, quoted if it has quotes or commas. Writes to a local
+// write context escape the whole field in one pass.
+void writeField(WRITE_CONTEXT *context, OUTPUT_FILE *file, STRING *line, int start, int end, FIELD_INFO *info);
 
 int isWhitespaceChar(char c);
 
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "csv.h"
+#include "memory.h"
+
+// Benchmarks splitting Schedule A-heavy filings into fields, both
+// ascii28 delimited and (older) comma delimited with quoted fields,
+// and writing memo-heavy rows and F99 text back out as CSV
+
+const int ROUNDS = 2000000;
+
+const char *ascii28Lines[] = {
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4265\x1c\x1c\x1c" "IND\x1c\x1c" "Smith\x1c" "Jane\x1c\x1c\x1c\x1c" "123 Main St\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "P2022\x1c\x1c" "20210805\x1c" "1000.00\x1c" "1000.00\x1c\x1c" "Engineer\x1c" "Acme Corporation\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\n",
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4266\x1c\x1c\x1c" "IND\x1c\x1c" "Johnson-Whitaker\x1c" "Christopher\x1c" "A\x1c\x1c\x1c" "4500 Connecticut Avenue NW\x1c" "Apt 1201\x1c" "Washington\x1c" "DC\x1c" "20008\x1c" "P2022\x1c\x1c" "20210812\x1c" "250.00\x1c" "750.00\x1c\x1c" "Attorney\x1c" "Covington, Burling and Partners LLP\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\x1c\n",
+};
+
+const char *csvLines[] = {
+    "\"SA11AI\",\"C00123456\",\"SA11AI.4265\",,,\"IND\",,\"Smith\",\"Jane\",,,,\"123 Main St\",,\"Springfield\",\"VA\",\"22150\",\"P2022\",,\"20210805\",1000.00,1000.00,,\"Engineer\",\"Acme Corporation\",,,,,,,,,,,,,,,,,,,\n",
+    "\"SA11AI\",\"C00123456\",\"SA11AI.4266\",,,\"IND\",,\"Johnson-Whitaker\",\"Christopher\",\"A\",,,\"4500 Connecticut Avenue NW\",\"Apt 1201\",\"Washington\",\"DC\",\"20008\",\"P2022\",,\"20210812\",250.00,750.00,,\"Attorney\",\"Covington, Burling and Partners LLP\",,,,,,,,,,,,,,,,,,,\n",
+};
+
+// Fields of a Schedule B row with long memos and quoted text
+const char *memoFields[] = {
+    "SB23",
+    "C00123456",
+    "Johnson-Whitaker, Christopher",
+    "Reimbursement for \"Get Out The Vote\" canvassing supplies, travel and meals for volunteers (see memo)",
+    "20210812",
+    "Payment to the \"Committee to Elect\" for shared office rent, utilities and staff time, Q3 2021",
+    "X",
+    "Earmarked through ActBlue; contributor's employer listed as \"Self-employed\" on original form",
+};
+
+// Lines of F99 text, always written as one quoted field
+const char *f99Lines[] = {
+    "The committee received a letter dated \"September 14, 2021\" requesting additional information\n",
+    "regarding contributions that appear to exceed the limits. The \"excessive\" portions were refunded\n",
+    "within 60 days as required; see the attached Schedule B entries for the refund details and dates.\n",
+};
+
+// The previous field writer, a char at a time when there are quotes
+void writeFieldBytewise(WRITE_CONTEXT *context, OUTPUT_FILE *file, STRING *line, int start, int end, FIELD_INFO *info)
+{
+  int escaped = (info->num_commas > 0) || (info->num_quotes > 0);
+  if (escaped)
+  {
+    writeFileChar(context, file, '"');
+  }
+  for (int i = start; i < end; i++)
+  {
+    if (line->str[i] == '"')
+    {
+      writeFileString(context, file, "\"\"");
+    }
+    else
+    {
+      writeFileChar(context, file, line->str[i]);
+    }
+  }
+  if (escaped)
+  {
+    writeFileChar(context, file, '"');
+  }
+}
+
+void discardOutput(char *filename, char *extension, char *contents, int numBytes)
+{
+}
+
+// Write rows of fields (or F99 text) to an output file, either a piece at
+// a time or serialized into a local row buffer and written all at once
+void benchmarkWriting(const char *name, const char **fields, int numFields, int f99, int serialize)
+{
+  STRING *lines[8];
+  FIELD_INFO infos[8];
+  long long bytes = 0;
+  for (int i = 0; i < numFields; i++)
+  {
+    lines[i] = fromString(fields[i]);
+    infos[i].num_quotes = 0;
+    infos[i].num_commas = 0;
+    for (int j = 0; fields[i][j]; j++)
+    {
+      processFieldChar(fields[i][j], &infos[i]);
+    }
+  }
+  WRITE_CONTEXT *writeContext = newWriteContext(NULL, NULL, 0, 65536, discardOutput, NULL);
+  int opened;
+  OUTPUT_FILE *file = openFile(writeContext, "SB23", ".csv", &opened);
+  STRING *row = newString(DEFAULT_STRING_SIZE);
+  WRITE_CONTEXT rowContext;
+  initializeLocalWriteContext(&rowContext, row);
+  WRITE_CONTEXT *context = serialize ? &rowContext : writeContext;
+  OUTPUT_FILE *rowFile = serialize ? NULL : file;
+
+  clock_t start = clock();
+  for (int round = 0; round < ROUNDS / 4; round++)
+  {
+    if (f99)
+    {
+      writeFileChar(context, rowFile, '"');
+    }
+    for (int i = 0; i < numFields; i++)
+    {
+      int length = lines[i]->n - 1;
+      if (f99)
+      {
+        // F99 text is quoted regardless of its contents
+        FIELD_INFO quoted = {.num_quotes = 1, .num_commas = 0};
+        if (serialize)
+        {
+          commitLocal(&rowContext, escapeQuotes(lines[i]->str, length, reserveLocal(&rowContext, 2 * length)));
+        }
+        else
+        {
+          writeFieldBytewise(context, rowFile, lines[i], 0, length, &quoted);
+        }
+      }
+      else
+      {
+        writeDelimeter(context, rowFile);
+        if (serialize)
+        {
+          writeField(context, rowFile, lines[i], 0, length, &infos[i]);
+        }
+        else
+        {
+          writeFieldBytewise(context, rowFile, lines[i], 0, length, &infos[i]);
+        }
+      }
+      bytes += length;
+    }
+    writeFileChar(context, rowFile, f99 ? '"' : '\n');
+    if (serialize)
+    {
+      writeFileN(writeContext, file, row->str, rowContext.localBufferPosition);
+      initializeLocalWriteContext(&rowContext, row);
+    }
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%-16s %6.2f GB/s (%lld bytes)\n", name, bytes / seconds / 1e9, bytes);
+  freeWriteContext(writeContext);
+  freeString(row);
+  for (int i = 0; i < numFields; i++)
+  {
+    freeString(lines[i]);
+  }
+}
+
+// Read every field of the line, returning the number of fields
+int readFields(STRING *line, LINE_INDEX *index, int ascii28)
+{
+  PARSE_CONTEXT parseContext;
+  FIELD_INFO fieldInfo;
+  parseContext.line = line;
+  parseContext.index = index;
+  parseContext.fieldInfo = &fieldInfo;
+  parseContext.position = 0;
+  parseContext.columnIndex = 0;
+  while (1)
+  {
+    fieldInfo.num_quotes = 0;
+    fieldInfo.num_commas = 0;
+    if (index)
+    {
+      readIndexedField(&parseContext);
+    }
+    else if (ascii28)
+    {
+      readAscii28Field(&parseContext);
+    }
+    else
+    {
+      readCsvField(&parseContext);
+    }
+    char c = line->str[parseContext.position];
+    if (c == 0 || c == '\n')
+    {
+      break;
+    }
+    advanceField(&parseContext);
+  }
+  return parseContext.columnIndex + 1;
+}
+
+void benchmark(const char *name, const char **lines, int ascii28, int useIndex)
+{
+  STRING *strings[2];
+  int lengths[2];
+  for (int i = 0; i < 2; i++)
+  {
+    strings[i] = fromString(lines[i]);
+    lengths[i] = strlen(lines[i]);
+  }
+  LINE_INDEX *index = newLineIndex();
+  long long bytes = 0;
+  long long fields = 0;
+
+  clock_t start = clock();
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    int i = round % 2;
+    LINE_INDEX *lineIndex = NULL;
+    if (useIndex && indexLine(index, strings[i]->str, lengths[i], ascii28))
+    {
+      lineIndex = index;
+    }
+    fields += readFields(strings[i], lineIndex, ascii28);
+    bytes += lengths[i];
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%-16s %6.2f GB/s (%lld fields, %lld bytes)\n", name, bytes / seconds / 1e9, fields, bytes);
+  freeLineIndex(index);
+  freeString(strings[0]);
+  freeString(strings[1]);
+}
+
+int main()
+{
+  printf("\nField splitting benchmark (%d lines)\n", ROUNDS);
+  benchmark("ascii28 bytewise", ascii28Lines, 1, 0);
+  benchmark("ascii28 indexed", ascii28Lines, 1, 1);
+  benchmark("csv bytewise", csvLines, 0, 0);
+  benchmark("csv indexed", csvLines, 0, 1);
+
+  printf("\nRow writing benchmark (%d rows)\n", ROUNDS / 4);
+  benchmarkWriting("memo bytewise", memoFields, 8, 0, 0);
+  benchmarkWriting("memo serialized", memoFields, 8, 0, 1);
+  benchmarkWriting("f99 bytewise", f99Lines, 3, 1, 0);
+  benchmarkWriting("f99 serialized", f99Lines, 3, 1, 1);
+  return 0;
+}
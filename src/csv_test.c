@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "minunit.h"
 #include "memory.h"
@@ -10,6 +11,7 @@ int tests_run = 0;
 void initParseContextWithLine(PARSE_CONTEXT *parseContext, FIELD_INFO *fieldInfo, STRING *line)
 {
   parseContext->line = line;
+  parseContext->index = NULL;
   parseContext->fieldInfo = NULL;
   parseContext->position = 0;
   parseContext->columnIndex = 0;
@@ -162,6 +164,27 @@ static char *testAscii28Reading()
   mu_assert("num quotes != 1", fieldInfo.num_quotes == 1);
   mu_assert("num commas != 0", fieldInfo.num_commas == 0);
 
+  // Lone quote (both the first and last character, but not a pair)
+  setString(line, "\"");
+  initParseContextWithLine(&parseContext, &fieldInfo, line);
+  readAscii28Field(&parseContext);
+  mu_assert("error, start != 0", parseContext.start == 0);
+  mu_assert("error, end != 1", parseContext.end == 1);
+  mu_assert("error, position != 1", parseContext.position == 1);
+  mu_assert("num quotes != 1", fieldInfo.num_quotes == 1);
+
+  // It's written as a quoted, escaped quote
+  STRING *row = newString(DEFAULT_STRING_SIZE);
+  WRITE_CONTEXT rowContext;
+  initializeLocalWriteContext(&rowContext, row);
+  writeField(&rowContext, NULL, line, parseContext.start, parseContext.end, &fieldInfo);
+  mu_assert("Expected an escaped quote", strcmp(row->str, "\"\"\"\"") == 0);
+
+  // Writing a negative number of characters writes nothing
+  writeFileN(&rowContext, NULL, line->str, -1);
+  mu_assert("Expected nothing written", rowContext.localBufferPosition == 4);
+  freeString(row);
+
   // Ascii 28 delimiter
   setString(line, "\"ab\034c\"");
   initParseContextWithLine(&parseContext, &fieldInfo, line);
@@ -200,11 +223,229 @@ static char *testStripWhitespace()
   return 0;
 }
 
+// Generate a line of random fields: mostly plain or properly quoted,
+// but sometimes messy with stray quotes (and always messy for ascii28)
+int randomFieldsLine(char *line, int ascii28)
+{
+  const char *pieces[] = {"a", "bc", " ", "\034", "defghijklmnopqrstuvwxyz", ",", "\"\"", "\""};
+  int numPieces = sizeof(pieces) / sizeof(pieces[0]);
+  int messy = ascii28 || rand() % 4 == 0;
+  int length = 0;
+  int numFields = rand() % 40;
+  for (int field = 0; field < numFields; field++)
+  {
+    int quoted = rand() % 3 == 0;
+    if (quoted)
+    {
+      line[length++] = '"';
+    }
+    int numParts = rand() % 6;
+    for (int part = 0; part < numParts; part++)
+    {
+      // Properly quoted fields can have commas and escaped quotes
+      int piece = rand() % (messy ? numPieces : quoted ? numPieces - 1 : numPieces - 3);
+      strcpy(line + length, pieces[piece]);
+      length += strlen(pieces[piece]);
+    }
+    if (quoted)
+    {
+      line[length++] = '"';
+    }
+    if (field + 1 < numFields)
+    {
+      line[length++] = ascii28 ? 28 : ',';
+    }
+  }
+  if (rand() % 2)
+  {
+    line[length++] = '\n';
+  }
+  if (rand() % 10 == 0)
+  {
+    line[length++] = '\n';
+    line[length++] = 'z';
+  }
+  line[length] = 0;
+  return length;
+}
+
+// Read all fields of a line, as parseLine does, into an array of
+// start, end, quotes and commas
+int readAllFields(STRING *line, LINE_INDEX *index, int ascii28, int *fields)
+{
+  PARSE_CONTEXT parseContext;
+  FIELD_INFO fieldInfo;
+  initParseContextWithLine(&parseContext, &fieldInfo, line);
+  parseContext.index = index;
+  int numFields = 0;
+  while (1)
+  {
+    fieldInfo.num_quotes = 0;
+    fieldInfo.num_commas = 0;
+    if (index)
+    {
+      readIndexedField(&parseContext);
+    }
+    else if (ascii28)
+    {
+      readAscii28Field(&parseContext);
+    }
+    else
+    {
+      readCsvField(&parseContext);
+    }
+    fields[numFields * 4] = parseContext.start;
+    fields[numFields * 4 + 1] = parseContext.end;
+    fields[numFields * 4 + 2] = fieldInfo.num_quotes;
+    fields[numFields * 4 + 3] = fieldInfo.num_commas;
+    numFields++;
+    char c = line->str[parseContext.position];
+    if (c == 0 || c == '\n')
+    {
+      break;
+    }
+    advanceField(&parseContext);
+  }
+  return numFields;
+}
+
+static char *testIndexedReading()
+{
+  char text[2000];
+  int expected[2000];
+  int actual[2000];
+  STRING *direct = newString(2000);
+  STRING *indexed = newString(2000);
+  LINE_INDEX *index = newLineIndex();
+  int numIndexed = 0;
+
+  srand(64);
+  for (int iteration = 0; iteration < 20000; iteration++)
+  {
+    int ascii28 = iteration % 2;
+    int length = randomFieldsLine(text, ascii28);
+    memcpy(direct->str, text, length + 1);
+    memcpy(indexed->str, text, length + 1);
+
+    int expectedFields = readAllFields(direct, NULL, ascii28, expected);
+    if (!indexLine(index, indexed->str, length, ascii28))
+    {
+      mu_assert("Expected ascii28 lines to always be indexed", !ascii28);
+      continue;
+    }
+    numIndexed++;
+    int actualFields = readAllFields(indexed, index, ascii28, actual);
+    mu_assert("Expected the same number of fields", actualFields == expectedFields);
+    mu_assert("Expected the same fields", memcmp(actual, expected, sizeof(int) * 4 * expectedFields) == 0);
+    mu_assert("Expected the same unescaping in place", memcmp(direct->str, indexed->str, length + 1) == 0);
+  }
+  mu_assert("Expected most lines to be indexed", numIndexed > 15000);
+
+  // Irregular quoting is left to the char by char reader
+  mu_assert("Expected a quote mid field to not be indexed", indexLine(index, "ab\"c,d", 6, 0) == 0);
+  mu_assert("Expected text after a closing quote to not be indexed", indexLine(index, "\"ab\"c,d", 7, 0) == 0);
+  mu_assert("Expected an unterminated quote to not be indexed", indexLine(index, "a,\"bc", 5, 0) == 0);
+  mu_assert("Expected escaped quotes to be indexed", indexLine(index, "a,\"b\"\"c\",d\n", 11, 0) == 1);
+  mu_assert("Expected three fields", index->numFields == 3);
+  mu_assert("Expected the escaped field to be unescaped when read", index->fields[1].unescape == 1);
+
+  freeString(direct);
+  freeString(indexed);
+  freeLineIndex(index);
+  return 0;
+}
+
+// Escape a field for CSV output a char at a time
+int expectedCsvField(const char *field, int length, char *out)
+{
+  FIELD_INFO info = {.num_quotes = 0, .num_commas = 0};
+  for (int i = 0; i < length; i++)
+  {
+    processFieldChar(field[i], &info);
+  }
+  int escaped = info.num_quotes > 0 || info.num_commas > 0;
+  int n = 0;
+  if (escaped)
+  {
+    out[n++] = '"';
+  }
+  for (int i = 0; i < length; i++)
+  {
+    out[n++] = field[i];
+    if (field[i] == '"')
+    {
+      out[n++] = '"';
+    }
+  }
+  if (escaped)
+  {
+    out[n++] = '"';
+  }
+  out[n] = 0;
+  return n;
+}
+
+static char *testFieldWriting()
+{
+  const char chars[] = {'a', 'b', ' ', '"', ','};
+  char field[200];
+  char expected[500];
+  char escaped[400];
+  STRING *line = newString(200);
+  STRING *row = newString(DEFAULT_STRING_SIZE);
+  WRITE_CONTEXT rowContext;
+
+  srand(12);
+  for (int iteration = 0; iteration < 5000; iteration++)
+  {
+    // Fields around the vector width, with quotes sparse or dense
+    int length = rand() % 100;
+    int numChars = iteration % 2 ? 3 : 5;
+    for (int i = 0; i < length; i++)
+    {
+      field[i] = chars[rand() % numChars];
+      if (rand() % 40 == 0)
+      {
+        field[i] = '"';
+      }
+    }
+    int expectedLength = expectedCsvField(field, length, expected);
+
+    // Escaping just the quotes
+    int quotes = 0;
+    for (int i = 0; i < length; i++)
+    {
+      quotes += field[i] == '"';
+    }
+    mu_assert("Expected quotes to be doubled", escapeQuotes(field, length, escaped) == length + quotes);
+
+    // Writing the field to a row after a delimiter
+    memcpy(line->str, field, length);
+    line->str[length] = 0;
+    FIELD_INFO info = {.num_quotes = 0, .num_commas = 0};
+    for (int i = 0; i < length; i++)
+    {
+      processFieldChar(field[i], &info);
+    }
+    initializeLocalWriteContext(&rowContext, row);
+    writeDelimeter(&rowContext, NULL);
+    writeField(&rowContext, NULL, line, 0, length, &info);
+    mu_assert("Expected the field after the delimiter", rowContext.localBufferPosition == expectedLength + 1);
+    mu_assert("Expected the field to be escaped", strcmp(row->str + 1, expected) == 0);
+  }
+
+  freeString(line);
+  freeString(row);
+  return 0;
+}
+
 static char *all_tests()
 {
   mu_run_test(testCsvReading);
   mu_run_test(testAscii28Reading);
   mu_run_test(testStripWhitespace);
+  mu_run_test(testIndexedReading);
+  mu_run_test(testFieldWriting);
   return 0;
 }
 
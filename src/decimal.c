@@ -0,0 +1,100 @@
+#include "decimal.h"
+
+int parseDecimal(const char *str, int length, int scale, DECIMAL *decimal)
+{
+  int i = 0;
+  int64_t value = 0;
+  int digits = 0;
+  decimal->negative = 0;
+  decimal->scale = scale;
+
+  // Sign
+  if (i < length && (str[i] == '-' || str[i] == '+'))
+  {
+    decimal->negative = str[i] == '-';
+    i++;
+  }
+
+  // Whole number part
+  for (; i < length && str[i] >= '0' && str[i] <= '9'; i++, digits++)
+  {
+    value = value * 10 + (str[i] - '0');
+    if (value > MAX_DECIMAL_VALUE)
+    {
+      return 0;
+    }
+  }
+
+  // Fractional part (digits past the scale must be zeros)
+  int fractionDigits = 0;
+  if (i < length && str[i] == '.')
+  {
+    i++;
+    for (; i < length && str[i] >= '0' && str[i] <= '9'; i++, digits++, fractionDigits++)
+    {
+      if (fractionDigits >= scale)
+      {
+        if (str[i] != '0')
+        {
+          return 0;
+        }
+        continue;
+      }
+      value = value * 10 + (str[i] - '0');
+      if (value > MAX_DECIMAL_VALUE)
+      {
+        return 0;
+      }
+    }
+  }
+  if (i != length || digits == 0)
+  {
+    // Trailing characters, or no digits at all
+    return 0;
+  }
+
+  // Scale up by the fractional digits that weren't written
+  for (; fractionDigits < scale; fractionDigits++)
+  {
+    value *= 10;
+    if (value > MAX_DECIMAL_VALUE)
+    {
+      return 0;
+    }
+  }
+  decimal->value = value;
+  return 1;
+}
+
+int formatDecimal(const DECIMAL *decimal, char *out)
+{
+  // Write the digits backwards, with at least one before the point
+  char digits[MAX_DECIMAL_LENGTH];
+  int numDigits = 0;
+  int64_t value = decimal->value;
+  while (value > 0 || numDigits <= decimal->scale)
+  {
+    digits[numDigits++] = '0' + value % 10;
+    value /= 10;
+  }
+
+  int n = 0;
+  if (decimal->negative)
+  {
+    out[n++] = '-';
+  }
+  while (numDigits > decimal->scale)
+  {
+    out[n++] = digits[--numDigits];
+  }
+  if (decimal->scale > 0)
+  {
+    out[n++] = '.';
+    while (numDigits > 0)
+    {
+      out[n++] = digits[--numDigits];
+    }
+  }
+  out[n] = 0;
+  return n;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// The largest scaled value handled exactly: 15 significant digits,
+// which a double (and so printf's "%.2f") also holds exactly
+#define MAX_DECIMAL_VALUE 999999999999999LL
+
+// Room for a formatted decimal: sign, digits, point and null terminator
+#define MAX_DECIMAL_LENGTH 24
+
+// A decimal amount as a whole number of 10^-scale units (e.g. cents),
+// with a scale of at most 18
+struct decimal
+{
+  int64_t value; // absolute value, scaled
+  int negative;  // kept apart from the value so "-0" formats as "-0.00"
+  int scale;
+};
+typedef struct decimal DECIMAL;
+
+// Parse a plain decimal number of the given length: an optional sign,
+// digits, and an optional decimal point and digits (no whitespace or
+// exponents). Return 1 if it's held exactly at the given scale, or 0
+// if it isn't a plain decimal, has nonzero digits past the scale, or
+// has more than 15 significant digits at the scale.
+int parseDecimal(const char *str, int length, int scale, DECIMAL *decimal);
+
+// Write a parsed decimal with exactly scale digits after the point,
+// as printf's "%.*f" would write the same amount. Return the number of
+// chars written (out needs room for MAX_DECIMAL_LENGTH).
+int formatDecimal(const DECIMAL *decimal, char *out);
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "decimal.h"
+
+// Benchmarks normalizing the amount fields of itemized receipts and
+// disbursements (contribution amounts and aggregates) to cents
+
+const int ROUNDS = 20000000;
+
+const char *amounts[] = {
+    "1000.00", "250", "2900.00", "25.5", "-150.00", "5800", "100.00", "47.38",
+    "0", "12500.00", "3.00", "1350.75", "500", "-25.00", "75.00", "19.99",
+};
+
+// The previous normalization: strtod, then printf
+int normalizePrintf(const char *str, int length, char *out)
+{
+  (void)length;
+  return sprintf(out, "%.2f", strtod(str, NULL));
+}
+
+int normalizeDecimal(const char *str, int length, char *out)
+{
+  DECIMAL decimal;
+  parseDecimal(str, length, 2, &decimal);
+  return formatDecimal(&decimal, out);
+}
+
+void benchmark(const char *name, int (*normalize)(const char *, int, char *))
+{
+  int numAmounts = sizeof(amounts) / sizeof(amounts[0]);
+  int lengths[sizeof(amounts) / sizeof(amounts[0])];
+  for (int i = 0; i < numAmounts; i++)
+  {
+    lengths[i] = strlen(amounts[i]);
+  }
+  char out[100];
+  long long bytes = 0;
+
+  clock_t start = clock();
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    int i = round % numAmounts;
+    bytes += normalize(amounts[i], lengths[i], out);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%-10s %6.1f ns/field (%lld bytes out)\n", name, seconds * 1e9 / ROUNDS, bytes);
+}
+
+int main()
+{
+  printf("\nAmount normalization benchmark (%d fields)\n", ROUNDS);
+  benchmark("printf", normalizePrintf);
+  benchmark("decimal", normalizeDecimal);
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "decimal.h"
+
+int tests_run = 0;
+
+// Parse and format a decimal at a scale, returning whether it was exact
+int normalize(const char *str, int scale, char *out)
+{
+  DECIMAL decimal;
+  if (!parseDecimal(str, strlen(str), scale, &decimal))
+  {
+    return 0;
+  }
+  formatDecimal(&decimal, out);
+  return 1;
+}
+
+static char *testPlainDecimals()
+{
+  char out[MAX_DECIMAL_LENGTH];
+  mu_assert("Expected whole amounts to get cents", normalize("1000", 2, out) && strcmp(out, "1000.00") == 0);
+  mu_assert("Expected cents to be kept", normalize("1000.50", 2, out) && strcmp(out, "1000.50") == 0);
+  mu_assert("Expected one fractional digit to be padded", normalize("12.5", 2, out) && strcmp(out, "12.50") == 0);
+  mu_assert("Expected a trailing point to be allowed", normalize("12.", 2, out) && strcmp(out, "12.00") == 0);
+  mu_assert("Expected a leading point to get a zero", normalize(".5", 2, out) && strcmp(out, "0.50") == 0);
+  mu_assert("Expected leading zeros to be dropped", normalize("00042.10", 2, out) && strcmp(out, "42.10") == 0);
+  mu_assert("Expected negative amounts", normalize("-250.75", 2, out) && strcmp(out, "-250.75") == 0);
+  mu_assert("Expected negative zero to keep its sign", normalize("-0", 2, out) && strcmp(out, "-0.00") == 0);
+  mu_assert("Expected a plus sign to be dropped", normalize("+3", 2, out) && strcmp(out, "3.00") == 0);
+  mu_assert("Expected zeros past the scale to be exact", normalize("7.2500", 2, out) && strcmp(out, "7.25") == 0);
+  mu_assert("Expected a larger scale", normalize("7.125", 4, out) && strcmp(out, "7.1250") == 0);
+  mu_assert("Expected no point at scale 0", normalize("7", 0, out) && strcmp(out, "7") == 0);
+  mu_assert("Expected 15 significant digits", normalize("9999999999999.99", 2, out) && strcmp(out, "9999999999999.99") == 0);
+
+  DECIMAL decimal;
+  mu_assert("Expected the scaled value", parseDecimal("-1234.5", 7, 2, &decimal) && decimal.value == 123450 && decimal.negative);
+  return 0;
+}
+
+static char *testInexactDecimals()
+{
+  char out[MAX_DECIMAL_LENGTH];
+  mu_assert("Expected digits past the scale to be inexact", !normalize("1.005", 2, out));
+  mu_assert("Expected too many digits to be inexact", !normalize("10000000000000", 2, out));
+  mu_assert("Expected an empty string to be rejected", !normalize("", 2, out));
+  mu_assert("Expected a bare sign to be rejected", !normalize("-", 2, out));
+  mu_assert("Expected a bare point to be rejected", !normalize(".", 2, out));
+  mu_assert("Expected exponents to be rejected", !normalize("1e5", 2, out));
+  mu_assert("Expected whitespace to be rejected", !normalize(" 12", 2, out));
+  mu_assert("Expected trailing text to be rejected", !normalize("12 ", 2, out));
+  mu_assert("Expected thousands separators to be rejected", !normalize("1,000", 2, out));
+  mu_assert("Expected two points to be rejected", !normalize("1.2.3", 2, out));
+  return 0;
+}
+
+static char *testMatchesPrintf()
+{
+  // Every exact decimal should format as strtod and "%.2f" would
+  char str[40];
+  char out[MAX_DECIMAL_LENGTH];
+  char expected[100];
+  int numExact = 0;
+  srand(25);
+  for (int iteration = 0; iteration < 200000; iteration++)
+  {
+    int n = 0;
+    int r = rand() % 10;
+    if (r == 0)
+    {
+      str[n++] = '-';
+    }
+    int wholeDigits = rand() % 16;
+    for (int i = 0; i < wholeDigits; i++)
+    {
+      str[n++] = '0' + rand() % 10;
+    }
+    if (rand() % 4)
+    {
+      str[n++] = '.';
+      int fractionDigits = rand() % 4;
+      for (int i = 0; i < fractionDigits; i++)
+      {
+        str[n++] = '0' + (rand() % 3 ? rand() % 10 : 0);
+      }
+    }
+    str[n] = 0;
+
+    if (!normalize(str, 2, out))
+    {
+      continue;
+    }
+    numExact++;
+    sprintf(expected, "%.2f", strtod(str, NULL));
+    mu_assert("Expected the same output as printf", strcmp(out, expected) == 0);
+  }
+  mu_assert("Expected most decimals to be exact", numExact > 100000);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testPlainDecimals);
+  mu_run_test(testInexactDecimals);
+  mu_run_test(testMatchesPrintf);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nDecimal tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", tests_run);
+
+  return result != 0;
+}
@@ -1,6 +1,7 @@
 
 #include "encoding.h"
 #include <stdint.h>
+#include <string.h>
 
 // UTF-8 decoder notice
 // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
@@ -26,84 +27,385 @@ static const uint8_t utf8d[] = {
     1, 3, 1, 1, 1, 1, 1, 3, 1, 3, 1, 1, 1, 1, 1, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // s7..s8
 };
 
-void collectLineInfo(STRING *line, LINE_INFO *info)
+// Scan a line a vector at a time, stopping at the first vector containing a
+// null byte or (if stopAtNonAscii) a non-ASCII byte. If detectAscii28, set
+// ascii28 when a scanned vector contains a separator. Return the number of
+// bytes scanned.
+int scanLineScalar(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28)
 {
+  // No vectors; the caller classifies every byte
+  (void)line;
+  (void)length;
+  (void)stopAtNonAscii;
+  (void)detectAscii28;
+  (void)ascii28;
+  return 0;
+}
+
+#ifdef SIMD_SSE2
+int scanLineSse2(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i separator = _mm_set1_epi8(28);
+  __m128i separators = zero;
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(line + i));
+    int stop = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+    if (stopAtNonAscii)
+    {
+      stop |= _mm_movemask_epi8(chunk);
+    }
+    if (stop != 0)
+    {
+      break;
+    }
+    if (detectAscii28)
+    {
+      separators = _mm_or_si128(separators, _mm_cmpeq_epi8(chunk, separator));
+    }
+  }
+  if (_mm_movemask_epi8(separators) != 0)
+  {
+    *ascii28 = 1;
+  }
+  return i;
+}
+#endif
+
+#ifdef SIMD_AVX2
+AVX2_TARGET int scanLineAvx2(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i separator = _mm256_set1_epi8(28);
+  __m256i separators = zero;
+  int i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(line + i));
+    unsigned int stop = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+    if (stopAtNonAscii)
+    {
+      stop |= _mm256_movemask_epi8(chunk);
+    }
+    if (stop != 0)
+    {
+      break;
+    }
+    if (detectAscii28)
+    {
+      separators = _mm256_or_si256(separators, _mm256_cmpeq_epi8(chunk, separator));
+    }
+  }
+  if (_mm256_movemask_epi8(separators) != 0)
+  {
+    *ascii28 = 1;
+  }
+  return i;
+}
+#endif
+
+#ifdef SIMD_NEON
+int scanLineNeon(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28)
+{
+  const uint8x16_t separator = vdupq_n_u8(28);
+  uint8x16_t separators = vdupq_n_u8(0);
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    uint8x16_t chunk = vld1q_u8(line + i);
+    if (vminvq_u8(chunk) == 0 || (stopAtNonAscii && vmaxvq_u8(chunk) >= 0x80))
+    {
+      break;
+    }
+    if (detectAscii28)
+    {
+      separators = vorrq_u8(separators, vceqq_u8(chunk, separator));
+    }
+  }
+  if (vmaxvq_u8(separators) != 0)
+  {
+    *ascii28 = 1;
+  }
+  return i;
+}
+#endif
+
+typedef int (*ScanLine)(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28);
+
+ScanLine selectScanLine()
+{
+#ifdef SIMD_AVX2
+  if (cpuSupportsAvx2())
+  {
+    return scanLineAvx2;
+  }
+#endif
+#if defined(SIMD_SSE2)
+  return scanLineSse2;
+#elif defined(SIMD_NEON)
+  return scanLineNeon;
+#else
+  return scanLineScalar;
+#endif
+}
+
+// The number of bytes classified one at a time after a vector scan stops
+#define SCALAR_RUN 32
+
+void collectLineInfo(const char *line, int length, int detectAscii28, LINE_INFO *info)
+{
+  static ScanLine cachedScanLine = NULL;
+  ScanLine scanLine;
+  RESOLVE_ONCE(scanLine, cachedScanLine, selectScanLine);
+
   // Initialize info
   info->ascii28 = 0;
   info->asciiOnly = 1;
   info->validUtf8 = 1;
-  info->length = 0;
+  info->length = length;
   uint32_t state = UTF8_ACCEPT;
   uint32_t type;
 
+  const unsigned char *s = (const unsigned char *)line;
   int i = 0;
-  while (1)
+  while (i < length)
   {
-    char c = line->str[i];
-    i++;
-    if (c == 0)
+    // Between UTF-8 sequences, skip ahead through ASCII a vector at a time
+    // (or through anything once the line is known to be invalid UTF-8)
+    if (state == UTF8_ACCEPT || state == UTF8_REJECT)
     {
-      break;
+      i += scanLine(s + i, length - i, state == UTF8_ACCEPT, detectAscii28 && !info->ascii28, &info->ascii28);
     }
-    info->length++;
-    if (c == 28)
+
+    // Classify the rest of the stopping vector (or the tail) byte by byte
+    int end = length - i > SCALAR_RUN ? i + SCALAR_RUN : length;
+    for (; i < end; i++)
     {
-      // Has char 28 (separator)
-      info->ascii28 = 1;
+      unsigned char c = s[i];
+      if (c == 0)
+      {
+        // The line ends at a null byte
+        info->length = i;
+        return;
+      }
+      if (c == 28 && detectAscii28)
+      {
+        // Has char 28 (separator)
+        info->ascii28 = 1;
+      }
+      if (c > 127)
+      {
+        // Not ascii only anymore
+        info->asciiOnly = 0;
+      }
+      // Check for valid UTF-8 using DFA
+      type = utf8d[c];
+      state = utf8d[256 + state * 16 + type];
+      if (state == UTF8_REJECT)
+      {
+        // Invalid UTF-8
+        info->validUtf8 = 0;
+      }
     }
-    if (c > 127)
+  }
+}
+
+// The UTF-8 encodings (length first) of Windows-1252 0x80-0x9F. Bytes
+// Windows-1252 leaves undefined map to C1 controls, as in ISO-8859-1.
+static const uint8_t windows1252Utf8[32][4] = {
+    {3, 0xe2, 0x82, 0xac}, // 80 U+20AC
+    {2, 0xc2, 0x81}, // 81 U+0081
+    {3, 0xe2, 0x80, 0x9a}, // 82 U+201A
+    {2, 0xc6, 0x92}, // 83 U+0192
+    {3, 0xe2, 0x80, 0x9e}, // 84 U+201E
+    {3, 0xe2, 0x80, 0xa6}, // 85 U+2026
+    {3, 0xe2, 0x80, 0xa0}, // 86 U+2020
+    {3, 0xe2, 0x80, 0xa1}, // 87 U+2021
+    {2, 0xcb, 0x86}, // 88 U+02C6
+    {3, 0xe2, 0x80, 0xb0}, // 89 U+2030
+    {2, 0xc5, 0xa0}, // 8a U+0160
+    {3, 0xe2, 0x80, 0xb9}, // 8b U+2039
+    {2, 0xc5, 0x92}, // 8c U+0152
+    {2, 0xc2, 0x8d}, // 8d U+008D
+    {2, 0xc5, 0xbd}, // 8e U+017D
+    {2, 0xc2, 0x8f}, // 8f U+008F
+    {2, 0xc2, 0x90}, // 90 U+0090
+    {3, 0xe2, 0x80, 0x98}, // 91 U+2018
+    {3, 0xe2, 0x80, 0x99}, // 92 U+2019
+    {3, 0xe2, 0x80, 0x9c}, // 93 U+201C
+    {3, 0xe2, 0x80, 0x9d}, // 94 U+201D
+    {3, 0xe2, 0x80, 0xa2}, // 95 U+2022
+    {3, 0xe2, 0x80, 0x93}, // 96 U+2013
+    {3, 0xe2, 0x80, 0x94}, // 97 U+2014
+    {2, 0xcb, 0x9c}, // 98 U+02DC
+    {3, 0xe2, 0x84, 0xa2}, // 99 U+2122
+    {2, 0xc5, 0xa1}, // 9a U+0161
+    {3, 0xe2, 0x80, 0xba}, // 9b U+203A
+    {2, 0xc5, 0x93}, // 9c U+0153
+    {2, 0xc2, 0x9d}, // 9d U+009D
+    {2, 0xc5, 0xbe}, // 9e U+017E
+    {2, 0xc5, 0xb8}, // 9f U+0178
+};
+
+// Write the UTF-8 encoding of a non-ASCII Windows-1252 byte, returning
+// the position after it. Always writes three bytes.
+static inline uint8_t *expandHighByte(uint8_t *out, uint8_t c)
+{
+  if (c < 0xa0)
+  {
+    const uint8_t *utf8 = windows1252Utf8[c - 0x80];
+    memcpy(out, utf8 + 1, 3);
+    return out + utf8[0];
+  }
+  // Same code point as the byte (ISO-8859-1); adapted from https://stackoverflow.com/a/4059934
+  out[0] = 0xc2 + (c > 0xbf);
+  out[1] = (c & 0x3f) + 0x80;
+  return out + 2;
+}
+
+int windows1252ToUtf8Scalar(const uint8_t *in, int length, uint8_t *out)
+{
+  uint8_t *start = out;
+  for (int i = 0; i < length; i++)
+  {
+    if (in[i] < 128)
     {
-      // Not ascii only anymore
-      info->asciiOnly = 0;
+      *out++ = in[i];
     }
-    // Check for valid UTF-8 using DFA
-    type = utf8d[(uint8_t)c];
-    state = utf8d[256 + state * 16 + type];
-    if (state == UTF8_REJECT)
+    else
     {
-      // Invalid UTF-8
-      info->validUtf8 = 0;
+      out = expandHighByte(out, in[i]);
     }
   }
+  return out - start;
 }
 
-// Adapted from https://stackoverflow.com/a/4059934
-// Ensure the output buffer is twice as long as the input
-int iso_8859_1_to_utf_8(STRING *in, STRING *output)
+// The vectorized transcoders copy a vector at a time, then expand the first
+// non-ASCII byte (if any) and continue after it. Output is at least three
+// times the length of the input, so whole vector stores always fit.
+
+#ifdef SIMD_SSE2
+int windows1252ToUtf8Sse2(const uint8_t *in, int length, uint8_t *out)
 {
-  growStringTo(output, in->n * 2 + 1);
+  uint8_t *start = out;
+  int i = 0;
+  while (i + 16 <= length)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(in + i));
+    _mm_storeu_si128((__m128i *)out, chunk);
+    int highBytes = _mm_movemask_epi8(chunk);
+    if (highBytes == 0)
+    {
+      out += 16;
+      i += 16;
+      continue;
+    }
+    int ascii = __builtin_ctz(highBytes);
+    out = expandHighByte(out + ascii, in[i + ascii]);
+    i += ascii + 1;
+  }
+  return (out - start) + windows1252ToUtf8Scalar(in + i, length - i, out);
+}
+#endif
 
-  uint8_t *line = (uint8_t *)in->str;
-  uint8_t *out = (uint8_t *)output->str;
-  int length = 0;
-  while (*line)
+#ifdef SIMD_AVX2
+AVX2_TARGET int windows1252ToUtf8Avx2(const uint8_t *in, int length, uint8_t *out)
+{
+  uint8_t *start = out;
+  int i = 0;
+  while (i + 32 <= length)
   {
-    if (*line < 128)
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(in + i));
+    _mm256_storeu_si256((__m256i *)out, chunk);
+    unsigned int highBytes = _mm256_movemask_epi8(chunk);
+    if (highBytes == 0)
     {
-      *out++ = *line++;
+      out += 32;
+      i += 32;
+      continue;
     }
-    else
+    int ascii = __builtin_ctz(highBytes);
+    out = expandHighByte(out + ascii, in[i + ascii]);
+    i += ascii + 1;
+  }
+  return (out - start) + windows1252ToUtf8Scalar(in + i, length - i, out);
+}
+#endif
+
+#ifdef SIMD_NEON
+int windows1252ToUtf8Neon(const uint8_t *in, int length, uint8_t *out)
+{
+  uint8_t *start = out;
+  int i = 0;
+  while (i + 16 <= length)
+  {
+    uint8x16_t chunk = vld1q_u8(in + i);
+    vst1q_u8(out, chunk);
+    // Narrow the high bit of each byte to a nibble of a 64-bit mask
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_s8(vshrq_n_s8(vreinterpretq_s8_u8(chunk), 7)), 4);
+    uint64_t highBytes = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+    if (highBytes == 0)
     {
-      *out++ = 0xc2 + (*line > 0xbf), *out++ = (*line++ & 0x3f) + 0x80;
-      length += 2;
+      out += 16;
+      i += 16;
+      continue;
     }
+    int ascii = __builtin_ctzll(highBytes) >> 2;
+    out = expandHighByte(out + ascii, in[i + ascii]);
+    i += ascii + 1;
   }
-  return length;
+  return (out - start) + windows1252ToUtf8Scalar(in + i, length - i, out);
+}
+#endif
+
+typedef int (*Transcode)(const uint8_t *in, int length, uint8_t *out);
+
+Transcode selectWindows1252ToUtf8()
+{
+#ifdef SIMD_AVX2
+  if (cpuSupportsAvx2())
+  {
+    return windows1252ToUtf8Avx2;
+  }
+#endif
+#if defined(SIMD_SSE2)
+  return windows1252ToUtf8Sse2;
+#elif defined(SIMD_NEON)
+  return windows1252ToUtf8Neon;
+#else
+  return windows1252ToUtf8Scalar;
+#endif
+}
+
+int windows1252ToUtf8(const char *in, int length, STRING *output)
+{
+  static Transcode cachedTranscode = NULL;
+  Transcode transcode;
+  RESOLVE_ONCE(transcode, cachedTranscode, selectWindows1252ToUtf8);
+
+  growStringTo(output, length * 3 + 1);
+  int n = transcode((const uint8_t *)in, length, (uint8_t *)output->str);
+  output->str[n] = 0;
+  return n;
 }
 
-int decodeLine(LINE_INFO *info, STRING *in, STRING *output)
+int decodeLine(LINE_INFO *info, STRING *in, int length, int detectAscii28, STRING *output, STRING **decoded)
 {
   // Check line info
-  collectLineInfo(in, info);
+  collectLineInfo(in->str, length, detectAscii28, info);
 
   if (!info->validUtf8)
   {
-    return iso_8859_1_to_utf_8(in, output);
+    // Assume Windows-1252 (a superset of ISO-8859-1's printable characters)
+    *decoded = output;
+    return windows1252ToUtf8(in->str, info->length, output);
   }
   else
   {
-    // Copy memory buffer over
-    copyString(in, output);
+    // Already valid; use the line as is
+    *decoded = in;
     return info->length;
   }
 }
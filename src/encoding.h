@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "memory.h"
+#include "simd.h"
 
 struct lineInfo
 {
@@ -13,12 +14,45 @@ struct lineInfo
 };
 typedef struct lineInfo LINE_INFO;
 
-// Create a line info object by iterating the line
-// and getting the line info for each character
-void collectLineInfo(STRING *line, LINE_INFO *info);
+// Create a line info object by classifying the characters of
+// the line (of the given length, though a null byte ends it
+// early) in a single pass. Separators are only looked for if
+// detectAscii28 is set.
+void collectLineInfo(const char *line, int length, int detectAscii28, LINE_INFO *info);
 
-// Ensure the passed in line is encoded in UTF-8 by transforming
-// it to UTF-8 if necessary. The only other possible encodings
-// are ASCII (no transformation necessary) and ISO-8859-1.
+// The line scanning kernels collectLineInfo dispatches to (exposed for testing)
+int scanLineScalar(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28);
+#ifdef SIMD_SSE2
+int scanLineSse2(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28);
+#endif
+#ifdef SIMD_AVX2
+int scanLineAvx2(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28);
+#endif
+#ifdef SIMD_NEON
+int scanLineNeon(const unsigned char *line, int length, int stopAtNonAscii, int detectAscii28, int *ascii28);
+#endif
+
+// Transcode Windows-1252 (or ISO-8859-1) text of the given length
+// to UTF-8, returning the length of the null-terminated output
+int windows1252ToUtf8(const char *in, int length, STRING *output);
+
+// The transcoders windows1252ToUtf8 dispatches to (exposed for testing).
+// The output must have room for three times the length of the input.
+int windows1252ToUtf8Scalar(const uint8_t *in, int length, uint8_t *out);
+#ifdef SIMD_SSE2
+int windows1252ToUtf8Sse2(const uint8_t *in, int length, uint8_t *out);
+#endif
+#ifdef SIMD_AVX2
+int windows1252ToUtf8Avx2(const uint8_t *in, int length, uint8_t *out);
+#endif
+#ifdef SIMD_NEON
+int windows1252ToUtf8Neon(const uint8_t *in, int length, uint8_t *out);
+#endif
+
+// Ensure the passed in line (of the given length) is encoded in
+// UTF-8 by transforming it to UTF-8 if necessary. The only other possible encodings
+// are ASCII (no transformation necessary) and ISO-8859-1/Windows-1252.
+// Set decoded to the resulting line, which is the input line
+// itself (uncopied) unless it was transformed into output.
 // Return the length of the resulting line.
-int decodeLine(LINE_INFO *info, STRING *in, STRING *output);
+int decodeLine(LINE_INFO *info, STRING *in, int length, int detectAscii28, STRING *output, STRING **decoded);
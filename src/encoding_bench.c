@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "encoding.h"
+#include "memory.h"
+
+// Benchmarks transcoding a Latin-1-heavy corpus (names, addresses and
+// employers with accented characters and Windows-1252 punctuation) to UTF-8
+
+const int CORPUS_LINES = 2000000;
+const int ROUNDS = 5;
+
+const char *latin1Lines[] = {
+    "SA11AI\x1c" "C00413955\x1c" "SA11AI.4107\x1c\x1c\x1c" "IND\x1c\x1c" "Ash\x93ur\x1c" "R\xe9msey\x1c" "R\x1c\x1c\x1c" "1601 Trinity St #704\x1c\x1c" "Austin\x1c" "TX\x1c" "78712\x1c\x1c\x1c" "20210426\x1c" "512.82\x1c" "512.82\x1c\x1c" "Self\x1c" "Neurosurgeon\n",
+    "SA11AI\x1c" "C00413955\x1c" "SA11AI.4115\x1c\x1c\x1c" "IND\x1c\x1c" "Br\xe9xt\x93n\x1c" "Ernest\x1c" "E\x1c\x1c" "Jr.\x1c" "108 S Frontage Rd W\x1c" "Ste 206\x1c" "Vail\x1c" "CO\x1c" "81657\x1c\x1c\x1c" "20210424\x1c" "1000.00\x1c" "1000.00\x1c\x1c" "Self\x1c" "Neurosurgeon\n",
+    "SB23\x1c" "C00123456\x1c" "SB23.1187\x1c\x1c\x1c" "ORG\x1c" "Caf\xe9 M\xfcller \x96 Stra\xdfe\x1c\x1c\x1c\x1c\x1c" "1 Industrial Way\x1c\x1c" "Espa\xf1ola\x1c" "NM\x1c" "87532\x1c" "Catering \x85 \x80" "2,000\x1c\x1c\x1c\x1c\x1c\x1c\x1c" "20210910\x1c" "2000.00\n",
+};
+
+// The previous transcoder, a byte at a time (with its length fixed)
+int latin1ToUtf8Bytewise(const char *in, int length, STRING *output)
+{
+  growStringTo(output, length * 2 + 1);
+  const uint8_t *line = (const uint8_t *)in;
+  uint8_t *out = (uint8_t *)output->str;
+  for (int i = 0; i < length; i++)
+  {
+    if (line[i] < 128)
+    {
+      *out++ = line[i];
+    }
+    else
+    {
+      *out++ = 0xc2 + (line[i] > 0xbf), *out++ = (line[i] & 0x3f) + 0x80;
+    }
+  }
+  *out = 0;
+  return out - (uint8_t *)output->str;
+}
+
+void benchmark(const char *name, int (*transcode)(const char *, int, STRING *))
+{
+  int numLines = sizeof(latin1Lines) / sizeof(latin1Lines[0]);
+  int lengths[sizeof(latin1Lines) / sizeof(latin1Lines[0])];
+  for (int i = 0; i < numLines; i++)
+  {
+    lengths[i] = strlen(latin1Lines[i]);
+  }
+  STRING *output = newString(DEFAULT_STRING_SIZE);
+  long long bytes = 0;
+  long long outputBytes = 0;
+
+  clock_t start = clock();
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    for (int i = 0; i < CORPUS_LINES; i++)
+    {
+      int line = i % numLines;
+      outputBytes += transcode(latin1Lines[line], lengths[line], output);
+      bytes += lengths[line];
+    }
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%-10s %6.2f GB/s (%lld bytes in, %lld bytes out)\n", name, bytes / seconds / 1e9, bytes, outputBytes);
+  freeString(output);
+}
+
+int main()
+{
+  printf("\nLatin-1 to UTF-8 benchmark (%d lines x %d rounds)\n", CORPUS_LINES, ROUNDS);
+  benchmark("bytewise", latin1ToUtf8Bytewise);
+  benchmark("vector", windows1252ToUtf8);
+  return 0;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "encoding.h"
+
+int tests_run = 0;
+
+// Classify a line one byte at a time (the reference collectLineInfo must agree with)
+void referenceLineInfo(const char *line, int length, int detectAscii28, LINE_INFO *info)
+{
+  LINE_INFO expected = {0, 1, 1, length};
+  // Hoehrmann's DFA by hand: the number of continuation bytes still expected
+  int pending = 0;
+  for (int i = 0; i < length; i++)
+  {
+    unsigned char c = line[i];
+    if (c == 0)
+    {
+      expected.length = i;
+      break;
+    }
+    if (c == 28 && detectAscii28)
+    {
+      expected.ascii28 = 1;
+    }
+    if (c > 127)
+    {
+      expected.asciiOnly = 0;
+    }
+    if (!expected.validUtf8)
+    {
+      continue;
+    }
+    if (pending > 0)
+    {
+      if ((c & 0xC0) != 0x80)
+      {
+        expected.validUtf8 = 0;
+      }
+      pending--;
+    }
+    else if (c >= 0xC2 && c <= 0xDF)
+    {
+      pending = 1;
+    }
+    else if (c >= 0xE1 && c <= 0xEC)
+    {
+      // Only the simple three byte lead bytes are generated below
+      pending = 2;
+    }
+    else if (c > 127)
+    {
+      expected.validUtf8 = 0;
+    }
+  }
+  *info = expected;
+}
+
+// Fill a line with ASCII, optionally sprinkling in separators, null
+// bytes and valid or invalid UTF-8 sequences
+void randomLine(char *line, int length, int mix)
+{
+  for (int i = 0; i < length; i++)
+  {
+    line[i] = 'a' + rand() % 26;
+  }
+  for (int i = 0; i < mix && length > 3; i++)
+  {
+    int pos = rand() % (length - 3);
+    switch (rand() % 5)
+    {
+    case 0:
+      line[pos] = 28;
+      break;
+    case 1:
+      line[pos] = 0;
+      break;
+    case 2:
+      // é
+      line[pos] = (char)0xC3;
+      line[pos + 1] = (char)0xA9;
+      break;
+    case 3:
+      // ☃
+      line[pos] = (char)0xE2;
+      line[pos + 1] = (char)0x98;
+      line[pos + 2] = (char)0x83;
+      break;
+    default:
+      // Latin-1 é
+      line[pos] = (char)0xE9;
+      break;
+    }
+  }
+}
+
+static char *testCollectLineInfo()
+{
+  char line[300];
+  srand(28);
+  for (int iteration = 0; iteration < 20000; iteration++)
+  {
+    int length = rand() % 300;
+    randomLine(line, length, rand() % 4);
+    for (int detectAscii28 = 0; detectAscii28 <= 1; detectAscii28++)
+    {
+      LINE_INFO expected;
+      LINE_INFO actual;
+      referenceLineInfo(line, length, detectAscii28, &expected);
+      collectLineInfo(line, length, detectAscii28, &actual);
+      mu_assert("Expected matching length", actual.length == expected.length);
+      mu_assert("Expected matching ascii28", actual.ascii28 == expected.ascii28);
+      mu_assert("Expected matching asciiOnly", actual.asciiOnly == expected.asciiOnly);
+      mu_assert("Expected matching validUtf8", actual.validUtf8 == expected.validUtf8);
+    }
+  }
+  return 0;
+}
+
+static char *testKnownLines()
+{
+  LINE_INFO info;
+  const char *ascii28 = "HDR\034FEC\0348.3\034fastfec\n";
+  collectLineInfo(ascii28, strlen(ascii28), 1, &info);
+  mu_assert("Expected separator", info.ascii28 == 1 && info.asciiOnly == 1 && info.validUtf8 == 1);
+  collectLineInfo(ascii28, strlen(ascii28), 0, &info);
+  mu_assert("Expected separator detection to be skipped", info.ascii28 == 0);
+
+  const char *nullByte = "0123456789abcdef0123456789abcdef0123456789\0abcdef\n";
+  collectLineInfo(nullByte, 50, 1, &info);
+  mu_assert("Expected the line to end at the null byte", info.length == 42);
+
+  const char *latin1 = "0123456789abcdef0123456789abcdef Caf\351\n";
+  collectLineInfo(latin1, strlen(latin1), 1, &info);
+  mu_assert("Expected invalid UTF-8", info.validUtf8 == 0 && info.asciiOnly == 0);
+
+  const char *utf8 = "0123456789abcdef0123456789abcdef Caf\303\251\n";
+  collectLineInfo(utf8, strlen(utf8), 1, &info);
+  mu_assert("Expected valid UTF-8", info.validUtf8 == 1 && info.asciiOnly == 0);
+  return 0;
+}
+
+static char *testScanLineKernels()
+{
+  int (*implementations[])(const unsigned char *, int, int, int, int *) = {
+#ifdef SIMD_SSE2
+    scanLineSse2,
+#endif
+#ifdef SIMD_NEON
+    scanLineNeon,
+#endif
+#ifdef SIMD_AVX2
+    scanLineAvx2,
+#endif
+    scanLineScalar,
+  };
+  int numImplementations = sizeof(implementations) / sizeof(implementations[0]);
+  unsigned char line[128];
+
+  // Put one interesting byte at each position and check where each kernel stops
+  unsigned char specials[] = {0, 28, 0xE9};
+  for (int s = 0; s < 3; s++)
+  {
+    for (int pos = 0; pos < 100; pos++)
+    {
+      memset(line, 'x', sizeof(line));
+      line[pos] = specials[s];
+      for (int i = 0; i < numImplementations; i++)
+      {
+#ifdef SIMD_AVX2
+        if (implementations[i] == scanLineAvx2 && !cpuSupportsAvx2())
+        {
+          continue;
+        }
+#endif
+        for (int stopAtNonAscii = 0; stopAtNonAscii <= 1; stopAtNonAscii++)
+        {
+          int ascii28 = 0;
+          int scanned = implementations[i](line, 100, stopAtNonAscii, 1, &ascii28);
+          int stops = specials[s] == 0 || (specials[s] > 127 && stopAtNonAscii);
+          mu_assert("Expected whole vectors to be scanned", scanned <= 100);
+          mu_assert("Expected to stop at or before the stopping byte", !stops || scanned <= pos);
+          mu_assert("Expected to stop within a vector of the stopping byte", !stops || scanned > pos - 32 || implementations[i] == scanLineScalar);
+          mu_assert("Expected separators only when scanned", ascii28 == (specials[s] == 28 && pos < scanned));
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// The code points of Windows-1252 0x80-0x9F (from the Unicode mapping tables)
+const int windows1252CodePoints[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+// Transcode one byte at a time (the reference the transcoders must agree with)
+int referenceTranscode(const unsigned char *in, int length, unsigned char *out)
+{
+  int n = 0;
+  for (int i = 0; i < length; i++)
+  {
+    int codePoint = in[i] >= 0x80 && in[i] < 0xa0 ? windows1252CodePoints[in[i] - 0x80] : in[i];
+    if (codePoint < 0x80)
+    {
+      out[n++] = codePoint;
+    }
+    else if (codePoint < 0x800)
+    {
+      out[n++] = 0xc0 | (codePoint >> 6);
+      out[n++] = 0x80 | (codePoint & 0x3f);
+    }
+    else
+    {
+      out[n++] = 0xe0 | (codePoint >> 12);
+      out[n++] = 0x80 | ((codePoint >> 6) & 0x3f);
+      out[n++] = 0x80 | (codePoint & 0x3f);
+    }
+  }
+  return n;
+}
+
+static char *testWindows1252ToUtf8()
+{
+  int (*implementations[])(const uint8_t *, int, uint8_t *) = {
+    windows1252ToUtf8Scalar,
+#ifdef SIMD_SSE2
+    windows1252ToUtf8Sse2,
+#endif
+#ifdef SIMD_NEON
+    windows1252ToUtf8Neon,
+#endif
+#ifdef SIMD_AVX2
+    windows1252ToUtf8Avx2,
+#endif
+  };
+  int numImplementations = sizeof(implementations) / sizeof(implementations[0]);
+#ifdef SIMD_AVX2
+  if (!cpuSupportsAvx2())
+  {
+    // Skip the AVX2 implementation (the last one) on CPUs that can't run it
+    numImplementations--;
+  }
+#endif
+  unsigned char in[200];
+  unsigned char expected[600];
+  unsigned char actual[600];
+
+  srand(1252);
+  for (int iteration = 0; iteration < 20000; iteration++)
+  {
+    // Mostly ASCII with a varying density of high bytes
+    int length = rand() % 200;
+    int density = rand() % 8;
+    for (int i = 0; i < length; i++)
+    {
+      in[i] = rand() % 8 < density ? 0x80 + rand() % 128 : 1 + rand() % 127;
+    }
+    int expectedLength = referenceTranscode(in, length, expected);
+    for (int i = 0; i < numImplementations; i++)
+    {
+      int actualLength = implementations[i](in, length, actual);
+      mu_assert("Expected matching output length", actualLength == expectedLength);
+      mu_assert("Expected matching output", memcmp(actual, expected, expectedLength) == 0);
+    }
+  }
+  return 0;
+}
+
+static char *testDecodeLine()
+{
+  STRING *in = newString(100);
+  STRING *output = newString(1);
+  STRING *decoded;
+  LINE_INFO info;
+
+  // Latin-1 and Windows-1252 punctuation, with the full length reported
+  setString(in, "\223Caf\351\224 \200100\n");
+  int length = decodeLine(&info, in, strlen(in->str), 1, output, &decoded);
+  const char *expected = "\342\200\234Caf\303\251\342\200\235 \342\202\254100\n";
+  mu_assert("Expected the output string", decoded == output);
+  mu_assert("Expected the full decoded length", length == (int)strlen(expected));
+  mu_assert("Expected the decoded line", strcmp(decoded->str, expected) == 0);
+
+  // Valid UTF-8 is used as is
+  setString(in, expected);
+  length = decodeLine(&info, in, strlen(in->str), 1, output, &decoded);
+  mu_assert("Expected the input string", decoded == in && length == (int)strlen(expected));
+
+  freeString(in);
+  freeString(output);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testCollectLineInfo);
+  mu_run_test(testKnownLines);
+  mu_run_test(testScanLineKernels);
+  mu_run_test(testWindows1252ToUtf8);
+  mu_run_test(testDecodeLine);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nEncoding tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", tests_run);
+
+  return result != 0;
+}
@@ -4,13 +4,18 @@
 #include "csv.h"
 #include "mappings.h"
 #include "buffer.h"
+#include "decimal.h"
 #include <string.h>
+#include <stdint.h>
 
 char *HEADER = "header";
 char *SCHEDULE_COUNTS = "SCHEDULE_COUNTS_";
 char *FEC_VERSION_NUMBER = "fec_ver_#";
 char *FEC = "FEC";
 
+// Digits written after the decimal point of amounts (as NUMBER_FORMAT)
+const int AMOUNT_SCALE = 2;
+
 char *COMMA_FEC_VERSIONS[] = {"1", "2", "3", "5"};
 int NUM_COMMA_FEC_VERSIONS = sizeof(COMMA_FEC_VERSIONS) / sizeof(char *);
 
@@ -21,14 +26,20 @@ FEC_CONTEXT *newFecContext(PERSISTENT_MEMORY_CONTEXT *persistentMemory, BufferRe
   ctx->buffer = newBuffer(inputBufferSize, bufferRead);
   ctx->file = file;
   ctx->writeContext = newWriteContext(outputDirectory, filingId, writeToFile, outputBufferSize, customWriteFunction, customLineFunction);
+  setWriteContextPool(ctx->writeContext, persistentMemory->bufferPool);
   ctx->filingId = filingId;
   ctx->version = 0;
   ctx->versionLength = 0;
+  initVersionMappings(&ctx->versionMappings, NULL, 0);
   ctx->useAscii28 = 0; // default to using comma parsing unless a version is set
   ctx->summary = 0;
   ctx->f99Text = 0;
+  ctx->line = persistentMemory->line;
   ctx->currentLineHasAscii28 = 0;
   ctx->currentLineLength = 0;
+  ctx->lineStart = 0;
+  ctx->lineIndex = newLineIndex();
+  initializeLocalWriteContext(&ctx->rowContext, persistentMemory->row);
   ctx->formType = NULL;
   ctx->numFields = 0;
   ctx->headers = NULL;
@@ -37,26 +48,50 @@ FEC_CONTEXT *newFecContext(PERSISTENT_MEMORY_CONTEXT *persistentMemory, BufferRe
   ctx->silent = silent;
   ctx->warn = warn;
 
-  // Compile regexes
-  const char *error;
-  int errorOffset;
-
-  ctx->f99TextStart = pcre_compile("^\\s*\\[BEGIN ?TEXT\\]\\s*$", PCRE_CASELESS, &error, &errorOffset, NULL);
-  if (ctx->f99TextStart == NULL)
-  {
-    fprintf(stderr, "Regex f99 text start compilation failed at offset %d: %s\n", errorOffset, error);
-    exit(1);
-  }
-  ctx->f99TextEnd = pcre_compile("^\\s*\\[END ?TEXT\\]\\s*$", PCRE_CASELESS, &error, &errorOffset, NULL);
-  if (ctx->f99TextEnd == NULL)
-  {
-    fprintf(stderr, "Regex f99 text end compilation failed at offset %d: %s\n", errorOffset, error);
-    exit(1);
-  }
+  // Share the catalog's compiled regexes
+  ctx->f99TextStart = persistentMemory->catalog->f99TextStart;
+  ctx->f99TextEnd = persistentMemory->catalog->f99TextEnd;
 
   return ctx;
 }
 
+void setOutputSink(FEC_CONTEXT *ctx, OUTPUT_SINK *sink)
+{
+  setWriteContextSink(ctx->writeContext, sink);
+}
+
+void setOutputDirectoryName(FEC_CONTEXT *ctx, char *directory)
+{
+  ctx->writeContext->filingId = directory;
+}
+
+int setOutputCompression(FEC_CONTEXT *ctx, int format, int level, int workers)
+{
+  return setWriteContextCompression(ctx->writeContext, format, level, workers);
+}
+
+int startAsyncOutput(FEC_CONTEXT *ctx, int queueLength)
+{
+  return startAsyncWriter(ctx->writeContext, queueLength);
+}
+
+void setInputRegion(FEC_CONTEXT *ctx, const char *data, size_t length)
+{
+  freeBuffer(ctx->buffer);
+  ctx->buffer = newRegionBuffer(data, length);
+}
+
+void setWritableInputRegion(FEC_CONTEXT *ctx, char *data, size_t length, int mapped)
+{
+  freeBuffer(ctx->buffer);
+  ctx->buffer = newWritableRegionBuffer(data, length, mapped);
+}
+
+int startInputReadAhead(FEC_CONTEXT *ctx)
+{
+  return startReadAhead(ctx->buffer);
+}
+
 void freeFecContext(FEC_CONTEXT *ctx)
 {
   freeBuffer(ctx->buffer);
@@ -72,12 +107,7 @@ void freeFecContext(FEC_CONTEXT *ctx)
   {
     free(ctx->formType);
   }
-  if (ctx->types != NULL)
-  {
-    free(ctx->types);
-  }
-  pcre_free(ctx->f99TextStart);
-  pcre_free(ctx->f99TextEnd);
+  freeLineIndex(ctx->lineIndex);
   freeWriteContext(ctx->writeContext);
   free(ctx);
 }
@@ -107,122 +137,71 @@ int lookupMappings(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext, int formStart,
   strncpy(ctx->formType, parseContext->line->str + formStart, formEnd - formStart);
   ctx->formType[formEnd - formStart] = 0;
 
-  // Grab the field mapping given the form version
-  for (int i = 0; i < numHeaders; i++)
+  // Use the mapping resolved earlier (possibly by another filing) if present
+  MAPPING_CACHE *cache = ctx->persistentMemory->catalog->cache;
+  lockMappingCache(cache);
+  MAPPING_CACHE_ENTRY *entry = lookupMappingCache(cache, ctx->version, ctx->versionLength, parseContext->line->str + formStart, formEnd - formStart);
+  if (entry == NULL)
   {
-    // Try to match the regex to version
-    if (pcre_exec(ctx->persistentMemory->headerVersions[i], NULL, ctx->version, ctx->versionLength, 0, 0, NULL, 0) >= 0)
-    {
-      // Match! Test regex against form type
-      if (pcre_exec(ctx->persistentMemory->headerFormTypes[i], NULL, parseContext->line->str + formStart, formEnd - formStart, 0, 0, NULL, 0) >= 0)
-      {
-        // Matched form type
-        ctx->headers = (char *)(headers[i][2]);
-        STRING *headersCsv = fromString(ctx->headers);
-        if (ctx->types != NULL)
-        {
-          free(ctx->types);
-        }
-        ctx->numFields = 0;
-        ctx->types = malloc(strlen(ctx->headers) + 1); // at least as big as it needs to be
-
-        // Initialize a parse context for reading each header field
-        PARSE_CONTEXT headerFields;
-        headerFields.line = headersCsv;
-        headerFields.fieldInfo = NULL;
-        headerFields.position = 0;
-        headerFields.start = 0;
-        headerFields.end = 0;
-        headerFields.columnIndex = 0;
-
-        // Iterate each field and build up the type info
-        while (!isParseDone(&headerFields))
-        {
-          readCsvField(&headerFields);
+    entry = addMappingCache(cache, ctx->version, ctx->versionLength, parseContext->line->str + formStart, formEnd - formStart);
 
-          // Match type info
-          int matched = 0;
-          for (int j = 0; j < numTypes; j++)
-          {
-            // Try to match the type regex to version
-            if (pcre_exec(ctx->persistentMemory->typeVersions[j], NULL, ctx->version, ctx->versionLength, 0, 0, NULL, 0) >= 0)
-            {
-              // Try to match type regex to form type
-              if (pcre_exec(ctx->persistentMemory->typeFormTypes[j], NULL, parseContext->line->str + formStart, formEnd - formStart, 0, 0, NULL, 0) >= 0)
-              {
-                // Try to match type regex to header
-                if (pcre_exec(ctx->persistentMemory->typeHeaders[j], NULL, headerFields.line->str + headerFields.start, headerFields.end - headerFields.start, 0, 0, NULL, 0) >= 0)
-                {
-                  // Match! Print out type information
-                  ctx->types[headerFields.columnIndex] = types[j][3][0];
-                  matched = 1;
-                  break;
-                }
-              }
-            }
-          }
-
-          if (!matched)
-          {
-            // Unmatched type — default to 's' for string type
-            ctx->types[headerFields.columnIndex] = 's';
-          }
-
-          if (isParseDone(&headerFields))
-          {
-            break;
-          }
-          advanceField(&headerFields);
-        }
-
-        // Add null terminator
-        ctx->types[headerFields.columnIndex + 1] = 0;
-        ctx->numFields = headerFields.columnIndex + 1;
-
-        // Free up unnecessary line memory
-        freeString(headersCsv);
-
-        // Done; return
-        return 1;
-      }
+    // Grab the field mapping given the form version. If nothing matches, the
+    // entry is left unmatched so the form type isn't looked up again.
+    int row = lookupVersionMapping(&ctx->versionMappings, parseContext->line->str + formStart, formEnd - formStart, &entry->types);
+    if (row != -1)
+    {
+      entry->found = 1;
+      entry->headers = headers[row][2];
+      entry->numFields = headerNumFields[row];
     }
   }
+  // Read the entry before unlocking, as it may be evicted after
+  int found = entry->found;
+  const char *entryHeaders = entry->headers;
+  const char *entryTypes = entry->types;
+  int numFields = entry->numFields;
+  unlockMappingCache(cache);
 
-  // Unmatched — error
-  fprintf(stderr, "Error: Unmatched for version %s and form type %s\n", ctx->version, ctx->formType);
-  return 0;
+  if (!found)
+  {
+    // Unmatched — error
+    fprintf(stderr, "Error: Unmatched for version %s and form type %s\n", ctx->version, ctx->formType);
+    return 0;
+  }
+
+  ctx->headers = (char *)entryHeaders;
+  ctx->types = (char *)entryTypes;
+  ctx->numFields = numFields;
+  return 1;
 }
 
-void writeSubstrToWriter(FEC_CONTEXT *ctx, WRITE_CONTEXT *writeContext, char *filename, const char *extension, int start, int end, FIELD_INFO *field)
+// Append the row written so far to its output file in one write and
+// start the next row
+void endRow(FEC_CONTEXT *ctx, OUTPUT_FILE *file)
 {
-  writeField(writeContext, filename, extension, ctx->persistentMemory->line, start, end, field);
+  writeFileN(ctx->writeContext, file, ctx->rowContext.localBuffer->str, ctx->rowContext.localBufferPosition);
+  initializeLocalWriteContext(&ctx->rowContext, ctx->persistentMemory->row);
 }
 
-void writeSubstr(FEC_CONTEXT *ctx, char *filename, const char *extension, int start, int end, FIELD_INFO *field)
+void writeSubstrToWriter(FEC_CONTEXT *ctx, WRITE_CONTEXT *writeContext, int start, int end, FIELD_INFO *field)
 {
-  writeSubstrToWriter(ctx, ctx->writeContext, filename, extension, start, end, field);
+  writeField(writeContext, NULL, ctx->line, start, end, field);
 }
 
-void writeQuotedCsvField(FEC_CONTEXT *ctx, char *filename, const char *extension, char *line, int length)
+void writeSubstr(FEC_CONTEXT *ctx, int start, int end, FIELD_INFO *field)
 {
-  for (int i = 0; i < length; i++)
-  {
-    char c = line[i];
-    if (c == '"')
-    {
-      // Write two quotes since the field is quoted
-      writeChar(ctx->writeContext, filename, extension, '"');
-      writeChar(ctx->writeContext, filename, extension, '"');
-    }
-    else
-    {
-      writeChar(ctx->writeContext, filename, extension, c);
-    }
-  }
+  writeSubstrToWriter(ctx, &ctx->rowContext, start, end, field);
+}
+
+void writeQuotedCsvField(FEC_CONTEXT *ctx, char *line, int length)
+{
+  // Write two quotes for each quote since the field is quoted
+  char *out = reserveLocal(&ctx->rowContext, 2 * length);
+  commitLocal(&ctx->rowContext, escapeQuotes(line, length, out));
 }
 
 // Write a date field by separating the output with dashes
-void writeDateField(FEC_CONTEXT *ctx, char *filename, const char *extension, int start, int end, FIELD_INFO *field)
+void writeDateField(FEC_CONTEXT *ctx, int start, int end, FIELD_INFO *field)
 {
   if (start == end)
   {
@@ -236,21 +215,33 @@ void writeDateField(FEC_CONTEXT *ctx, char *filename, const char *extension, int
     {
       fprintf(stderr, "Warning: Date fields must be exactly 8 chars long, not %d\n", end - start);
     }
-    writeSubstr(ctx, filename, extension, start, end, field);
+    writeSubstr(ctx, start, end, field);
     return;
   }
 
-  writeSubstrToWriter(ctx, ctx->writeContext, filename, extension, start, start + 4, field);
-  writeChar(ctx->writeContext, filename, extension, '-');
-  writeSubstrToWriter(ctx, ctx->writeContext, filename, extension, start + 4, start + 6, field);
-  writeChar(ctx->writeContext, filename, extension, '-');
-  writeSubstrToWriter(ctx, ctx->writeContext, filename, extension, start + 6, start + 8, field);
+  writeSubstrToWriter(ctx, &ctx->rowContext, start, start + 4, field);
+  writeFileChar(&ctx->rowContext, NULL, '-');
+  writeSubstrToWriter(ctx, &ctx->rowContext, start + 4, start + 6, field);
+  writeFileChar(&ctx->rowContext, NULL, '-');
+  writeSubstrToWriter(ctx, &ctx->rowContext, start + 6, start + 8, field);
 }
 
-void writeFloatField(FEC_CONTEXT *ctx, char *filename, const char *extension, int start, int end, FIELD_INFO *field)
+void writeFloatField(FEC_CONTEXT *ctx, int start, int end, FIELD_INFO *field)
 {
+  // Amounts are almost always plain decimals, which are normalized
+  // directly from their digits
+  DECIMAL amount;
+  if (parseDecimal(ctx->line->str + start, end - start, AMOUNT_SCALE, &amount))
+  {
+    char *out = reserveLocal(&ctx->rowContext, MAX_DECIMAL_LENGTH);
+    commitLocal(&ctx->rowContext, formatDecimal(&amount, out));
+    return;
+  }
+
+  // Otherwise (exponents, whitespace, extra precision) convert the field
+  // as a double, rounding it as before
   char *doubleStr;
-  char *conversionFloat = ctx->persistentMemory->line->str + start;
+  char *conversionFloat = ctx->line->str + start;
   double value = strtod(conversionFloat, &doubleStr);
 
   if (doubleStr == conversionFloat)
@@ -260,29 +251,33 @@ void writeFloatField(FEC_CONTEXT *ctx, char *filename, const char *extension, in
     {
       fprintf(stderr, "Warning: Could not parse float field\n");
     }
-    writeSubstr(ctx, filename, extension, start, end, field);
+    writeSubstr(ctx, start, end, field);
     return;
   }
 
   // Write the value
-  writeDouble(ctx->writeContext, filename, extension, value);
+  writeFileDouble(&ctx->rowContext, NULL, value);
 }
 
 // Grab a line from the input file.
 // Return 0 if there are no lines left.
-// If there is a line, decode it into
-// ctx->persistentMemory->line.
+// If there is a line, point ctx->line to it: in place in
+// the input buffer where possible, or copied into persistent
+// memory if it straddles a refill or needs decoding.
 int grabLine(FEC_CONTEXT *ctx)
 {
-  int bytesRead = readLine(ctx->buffer, ctx->persistentMemory->rawLine, ctx->file);
+  ctx->lineStart = ctx->buffer->regionPos;
+  int bytesRead = readLineView(ctx->buffer, ctx->persistentMemory->rawLine, &ctx->lineView, ctx->file);
   if (bytesRead <= 0)
   {
     return 0;
   }
 
-  // Decode the line
+  // Decode the line. Only look for ascii28 separators if the version
+  // doesn't rule them out (comma versions never use them).
   LINE_INFO info;
-  ctx->currentLineLength = decodeLine(&info, ctx->persistentMemory->rawLine, ctx->persistentMemory->line);
+  int detectAscii28 = ctx->version == NULL || ctx->useAscii28;
+  ctx->currentLineLength = decodeLine(&info, &ctx->lineView, bytesRead, detectAscii28, ctx->persistentMemory->line, &ctx->line);
   // Store whether the current line has ascii separators
   // (determines whether we use CSV or ascii28 split line parsing)
   ctx->currentLineHasAscii28 = info.ascii28;
@@ -310,7 +305,7 @@ char lowercaseTable[256] = {
 void lineToLowerCase(FEC_CONTEXT *ctx)
 {
   // Convert the line to lower case
-  char *c = ctx->persistentMemory->line->str;
+  char *c = ctx->line->str;
   while (*c)
   {
     *c = lowercaseTable[(int)*c];
@@ -321,7 +316,7 @@ void lineToLowerCase(FEC_CONTEXT *ctx)
 // Check if the line starts with the prefix
 int lineStartsWith(FEC_CONTEXT *ctx, const char *prefix, const int prefixLength)
 {
-  return ctx->persistentMemory->line->n >= prefixLength && strncmp(ctx->persistentMemory->line->str, prefix, prefixLength) == 0;
+  return ctx->line->n >= prefixLength && strncmp(ctx->line->str, prefix, prefixLength) == 0;
 }
 
 // Return whether the line starts with "/*"
@@ -340,30 +335,30 @@ int lineStartsWithScheduleCounts(FEC_CONTEXT *ctx)
 int lineMightStartWithF99(FEC_CONTEXT *ctx)
 {
   int i = 0;
-  while (i < ctx->persistentMemory->line->n && isWhitespaceChar(ctx->persistentMemory->line->str[i]))
+  while (i < ctx->line->n && isWhitespaceChar(ctx->line->str[i]))
   {
     i++;
   }
-  return ctx->persistentMemory->line->str[i] == '[';
+  return ctx->line->str[i] == '[';
 }
 
 // Return whether the line contains non-whitespace characters
 int lineContainsNonwhitespace(FEC_CONTEXT *ctx)
 {
   int i = 0;
-  while (i < ctx->persistentMemory->line->n && isWhitespaceChar(ctx->persistentMemory->line->str[i]))
+  while (i < ctx->line->n && isWhitespaceChar(ctx->line->str[i]))
   {
     i++;
   }
-  return ctx->persistentMemory->line->str[i] != 0;
+  return ctx->line->str[i] != 0;
 }
 
 // Consume whitespace, advancing a position pointer at the same time
 void consumeWhitespace(FEC_CONTEXT *ctx, int *position)
 {
-  while (*position < ctx->persistentMemory->line->n)
+  while (*position < ctx->line->n)
   {
-    if ((ctx->persistentMemory->line->str[*position] == ' ') || (ctx->persistentMemory->line->str[*position] == '\t'))
+    if ((ctx->line->str[*position] == ' ') || (ctx->line->str[*position] == '\t'))
     {
       (*position)++;
     }
@@ -381,10 +376,10 @@ int consumeUntil(FEC_CONTEXT *ctx, int *position, char c)
 {
   // Store the last non-whitespace character
   int finalNonwhitespace = *position;
-  while (*position < ctx->persistentMemory->line->n)
+  while (*position < ctx->line->n)
   {
     // Grab the current character
-    char current = ctx->persistentMemory->line->str[*position];
+    char current = ctx->line->str[*position];
     if ((current == c) || (current == 0))
     {
       // If the character is the one we're looking for, break
@@ -402,7 +397,8 @@ int consumeUntil(FEC_CONTEXT *ctx, int *position, char c)
 
 void initParseContext(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext, FIELD_INFO *fieldInfo)
 {
-  parseContext->line = ctx->persistentMemory->line;
+  parseContext->line = ctx->line;
+  parseContext->index = NULL;
   parseContext->fieldInfo = fieldInfo;
   parseContext->position = 0;
   parseContext->start = 0;
@@ -410,13 +406,27 @@ void initParseContext(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext, FIELD_INFO
   parseContext->columnIndex = 0;
 }
 
+// Index the fields of the current line up front so they can be read
+// without rescanning it, unless its quoting has to be read char by char
+void indexFields(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
+{
+  if (indexLine(ctx->lineIndex, ctx->line->str, ctx->currentLineLength, ctx->currentLineHasAscii28))
+  {
+    parseContext->index = ctx->lineIndex;
+  }
+}
+
 void readField(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
 {
   // Reset field info
   parseContext->fieldInfo->num_quotes = 0;
   parseContext->fieldInfo->num_commas = 0;
 
-  if (ctx->currentLineHasAscii28)
+  if (parseContext->index)
+  {
+    readIndexedField(parseContext);
+  }
+  else if (ctx->currentLineHasAscii28)
   {
     readAscii28Field(parseContext);
   }
@@ -426,30 +436,30 @@ void readField(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
   }
 }
 
-void startHeaderRow(FEC_CONTEXT *ctx, char *filename, const char *extension)
+void startHeaderRow(FEC_CONTEXT *ctx)
 {
   // Write the filing ID header, if includeFilingId is specified
   if (ctx->includeFilingId)
   {
-    writeString(ctx->writeContext, filename, extension, "filing_id");
-    writeDelimeter(ctx->writeContext, filename, extension);
+    writeFileString(&ctx->rowContext, NULL, "filing_id");
+    writeDelimeter(&ctx->rowContext, NULL);
   }
 }
 
-void startDataRow(FEC_CONTEXT *ctx, char *filename, const char *extension)
+void startDataRow(FEC_CONTEXT *ctx)
 {
   // Write the filing ID value, if includeFilingId is specified
   if (ctx->includeFilingId)
   {
-    writeString(ctx->writeContext, filename, extension, ctx->filingId);
-    writeDelimeter(ctx->writeContext, filename, extension);
+    writeFileString(&ctx->rowContext, NULL, ctx->filingId);
+    writeDelimeter(&ctx->rowContext, NULL);
   }
 }
 
 // Parse F99 text from a filing, writing the text to the specified
 // file in escaped CSV form if successful. Returns 1 if successful,
 // 0 otherwise.
-int parseF99Text(FEC_CONTEXT *ctx, char *filename)
+int parseF99Text(FEC_CONTEXT *ctx)
 {
   int f99Mode = 0;
   int first = 1;
@@ -466,7 +476,7 @@ int parseF99Text(FEC_CONTEXT *ctx, char *filename)
     if (f99Mode)
     {
       // See if we have reached the end boundary
-      if (pcre_exec(ctx->f99TextEnd, NULL, ctx->persistentMemory->line->str, ctx->currentLineLength, 0, 0, NULL, 0) >= 0)
+      if (pcre_exec(ctx->f99TextEnd, NULL, ctx->line->str, ctx->currentLineLength, 0, 0, NULL, 0) >= 0)
       {
         f99Mode = 0;
         break;
@@ -478,12 +488,12 @@ int parseF99Text(FEC_CONTEXT *ctx, char *filename)
         // Write the delimeter at the beginning and a quote character
         // (the csv field will always be escaped so we can stream write
         // without having to calculate whether it's escaped later).
-        writeDelimeter(ctx->writeContext, filename, csvExtension);
-        writeChar(ctx->writeContext, filename, csvExtension, '"');
+        writeDelimeter(&ctx->rowContext, NULL);
+        writeFileChar(&ctx->rowContext, NULL, '"');
         first = 0;
       }
 
-      writeQuotedCsvField(ctx, filename, csvExtension, ctx->persistentMemory->line->str, ctx->currentLineLength);
+      writeQuotedCsvField(ctx, ctx->line->str, ctx->currentLineLength);
       continue;
     }
 
@@ -491,7 +501,7 @@ int parseF99Text(FEC_CONTEXT *ctx, char *filename)
     if (lineMightStartWithF99(ctx))
     {
       // Now, execute the proper regex (we don't want to do this for every line, as it's slow)
-      if (pcre_exec(ctx->f99TextStart, NULL, ctx->persistentMemory->line->str, ctx->currentLineLength, 0, 0, NULL, 0) >= 0)
+      if (pcre_exec(ctx->f99TextStart, NULL, ctx->line->str, ctx->currentLineLength, 0, 0, NULL, 0) >= 0)
       {
         // Set f99 mode
         f99Mode = 1;
@@ -511,10 +521,161 @@ int parseF99Text(FEC_CONTEXT *ctx, char *filename)
     }
   }
   // Successful extraction, end the quote delimiter
-  writeChar(ctx->writeContext, filename, csvExtension, '"');
+  writeFileChar(&ctx->rowContext, NULL, '"');
   return 1;
 }
 
+// Line formats with their own row loops
+#define ASCII28_ROW 0     // ascii28 delimited (always indexed)
+#define INDEXED_CSV_ROW 1 // comma delimited, indexed
+#define CSV_ROW 2         // comma delimited, read char by char
+
+// Read the next field of a row in the given format
+static inline void readRowField(PARSE_CONTEXT *parseContext, int format)
+{
+  if (format == CSV_ROW)
+  {
+    parseContext->fieldInfo->num_quotes = 0;
+    parseContext->fieldInfo->num_commas = 0;
+    readCsvField(parseContext);
+    return;
+  }
+
+  FIELD_SPAN *span = &parseContext->index->fields[parseContext->columnIndex];
+  if (format == INDEXED_CSV_ROW && span->unescape)
+  {
+    // Escaped quotes are unescaped char by char
+    parseContext->fieldInfo->num_quotes = 0;
+    parseContext->fieldInfo->num_commas = 0;
+    parseContext->position = span->start;
+    readCsvField(parseContext);
+    return;
+  }
+  parseContext->start = span->start;
+  parseContext->end = span->end;
+  parseContext->position = span->terminator;
+  *parseContext->fieldInfo = span->info;
+  if (span->info.num_quotes > 0)
+  {
+    stripQuotes(parseContext);
+  }
+}
+
+static inline void writeTypedField(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext, char type)
+{
+  switch (type)
+  {
+  case 's':
+    // String
+    writeSubstr(ctx, parseContext->start, parseContext->end, parseContext->fieldInfo);
+    break;
+  case 'd':
+    // Date
+    writeDateField(ctx, parseContext->start, parseContext->end, parseContext->fieldInfo);
+    break;
+  case 'f':
+    // Float
+    writeFloatField(ctx, parseContext->start, parseContext->end, parseContext->fieldInfo);
+    break;
+  default:
+    // Unknown type
+    fprintf(stderr, "Unknown type (%c) in %s\n", type, ctx->formType);
+    exit(1);
+  }
+}
+
+// Open the output file for a fully specified row (writing its header
+// row if the file is new) and start the row with the form type.
+// Return the file, which the row is appended to once it's written.
+OUTPUT_FILE *startRow(FEC_CONTEXT *ctx, char *filename)
+{
+  int opened;
+  OUTPUT_FILE *file = openFile(ctx->writeContext, filename, csvExtension, &opened);
+  if (opened)
+  {
+    // File is newly opened, write headers
+    startHeaderRow(ctx);
+    writeFileString(&ctx->rowContext, NULL, ctx->headers);
+    writeNewline(&ctx->rowContext, NULL);
+    endRow(ctx, file);
+    endLine(ctx->writeContext, ctx->types);
+  }
+
+  // Write form type
+  startDataRow(ctx);
+  writeFileString(&ctx->rowContext, NULL, ctx->formType);
+  file->rows++;
+  return file;
+}
+
+// Write the fields of a row after the form type (starting at a field
+// that isn't the end of the line), leaving the parse context at the end.
+// Inlined into a loop per line format (below), so reading a field only
+// does what the format needs.
+static inline void parseRow(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext, int format)
+{
+  // Write the fields the mappings have types for
+  const char *types = ctx->types;
+  int numFields = ctx->numFields;
+  while (parseContext->columnIndex < numFields)
+  {
+    readRowField(parseContext, format);
+    writeDelimeter(&ctx->rowContext, NULL);
+    writeTypedField(ctx, parseContext, types[parseContext->columnIndex]);
+    if (isParseDone(parseContext))
+    {
+      return;
+    }
+    advanceField(parseContext);
+    if (isParseDone(parseContext))
+    {
+      // A trailing empty field isn't read
+      return;
+    }
+  }
+
+  // Warning: columns exceeding row length, written as strings
+  while (1)
+  {
+    readRowField(parseContext, format);
+    writeDelimeter(&ctx->rowContext, NULL);
+    if (ctx->warn)
+    {
+      fprintf(stderr, "Unexpected column in %s (%d): ", ctx->formType, parseContext->columnIndex);
+      for (int i = parseContext->start; i < parseContext->end; i++)
+      {
+        fprintf(stderr, "%c", ctx->line->str[i]);
+      }
+      fprintf(stderr, "\n");
+    }
+    writeSubstr(ctx, parseContext->start, parseContext->end, parseContext->fieldInfo);
+    if (isParseDone(parseContext))
+    {
+      return;
+    }
+    advanceField(parseContext);
+    if (isParseDone(parseContext))
+    {
+      return;
+    }
+  }
+}
+
+void parseAscii28Row(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
+{
+  parseRow(ctx, parseContext, ASCII28_ROW);
+}
+
+void parseIndexedCsvRow(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
+{
+  parseRow(ctx, parseContext, INDEXED_CSV_ROW);
+}
+
+void parseCsvRow(FEC_CONTEXT *ctx, PARSE_CONTEXT *parseContext)
+{
+  parseRow(ctx, parseContext, CSV_ROW);
+}
+
 // Parse a line from a filing, using FEC and form version
 // information to map fields to headers and types.
 // Return 1 if successful, or 0 if the line is not fully
@@ -527,147 +688,101 @@ int parseLine(FEC_CONTEXT *ctx, char *filename, int headerRow)
   PARSE_CONTEXT parseContext;
   FIELD_INFO fieldInfo;
   initParseContext(ctx, &parseContext, &fieldInfo);
+  indexFields(ctx, &parseContext);
+  if (isParseDone(&parseContext))
+  {
+    // Empty line
+    return 0;
+  }
 
-  // Log the indices on the line where the form version is specified
-  int formStart;
-  int formEnd;
+  // Set the form version to the first column
+  // (with whitespace removed)
+  readField(ctx, &parseContext);
+  stripWhitespace(&parseContext);
+  if (!lookupMappings(ctx, &parseContext, parseContext.start, parseContext.end))
+  {
+    return 3;
+  }
 
-  // Iterate through fields
-  while (!isParseDone(&parseContext))
+  // Set filename if null to form type
+  if (filename == NULL)
   {
-    readField(ctx, &parseContext);
-    if (parseContext.columnIndex == 0)
-    {
-      // Set the form version to the first column
-      // (with whitespace removed)
-      stripWhitespace(&parseContext);
-      formStart = parseContext.start;
-      formEnd = parseContext.end;
-      if (!lookupMappings(ctx, &parseContext, formStart, formEnd))
-      {
-        return 3;
-      }
+    filename = ctx->formType;
+  }
 
-      // Set filename if null to form type
-      if (filename == NULL)
-      {
-        filename = ctx->formType;
-      }
+  // Parse the rest of the row with the loop for the line's format
+  OUTPUT_FILE *file = NULL;
+  if (!isParseDone(&parseContext))
+  {
+    advanceField(&parseContext);
+  }
+  if (!isParseDone(&parseContext))
+  {
+    // There are at least two columns, so the line is fully specified
+    file = startRow(ctx, filename);
+    if (parseContext.index == NULL)
+    {
+      parseCsvRow(ctx, &parseContext);
     }
-    else
+    else if (ctx->currentLineHasAscii28)
     {
-      // If column index is 1, then there are at least two columns
-      // and the line is fully specified, so write header/line info
-      if (parseContext.columnIndex == 1)
-      {
-        // Write header if necessary
-        if (getFile(ctx->writeContext, filename, csvExtension) == 1)
-        {
-          // File is newly opened, write headers
-          startHeaderRow(ctx, filename, csvExtension);
-          writeString(ctx->writeContext, filename, csvExtension, ctx->headers);
-          writeNewline(ctx->writeContext, filename, csvExtension);
-          endLine(ctx->writeContext, ctx->types);
-        }
-
-        // Write form type
-        startDataRow(ctx, filename, csvExtension);
-        writeString(ctx->writeContext, filename, csvExtension, ctx->formType);
-      }
-
-      // Write delimeter
-      writeDelimeter(ctx->writeContext, filename, csvExtension);
-
-      // Get the type of the current field and write accordingly
-      char type;
-      if (parseContext.columnIndex < ctx->numFields)
-      {
-        // Ensure the column index is in bounds
-        type = ctx->types[parseContext.columnIndex];
-      }
-      else
-      {
-        // Warning: column exceeding row length
-        if (ctx->warn)
-        {
-          fprintf(stderr, "Unexpected column in %s (%d): ", ctx->formType, parseContext.columnIndex);
-          for (int i = parseContext.start; i < parseContext.end; i++)
-          {
-            fprintf(stderr, "%c", ctx->persistentMemory->line->str[i]);
-          }
-          fprintf(stderr, "\n");
-        }
-        // Default to string type
-        type = 's';
-      }
-
-      // Iterate possible types
-      if (type == 's')
-      {
-        // String
-        writeSubstr(ctx, filename, csvExtension, parseContext.start, parseContext.end, parseContext.fieldInfo);
-      }
-      else if (type == 'd')
-      {
-        // Date
-        writeDateField(ctx, filename, csvExtension, parseContext.start, parseContext.end, parseContext.fieldInfo);
-      }
-      else if (type == 'f')
-      {
-        // Float
-        writeFloatField(ctx, filename, csvExtension, parseContext.start, parseContext.end, parseContext.fieldInfo);
-      }
-      else
-      {
-        // Unknown type
-        fprintf(stderr, "Unknown type (%c) in %s\n", type, ctx->formType);
-        exit(1);
-      }
+      parseAscii28Row(ctx, &parseContext);
     }
-
-    if (isParseDone(&parseContext))
+    else
     {
-      break;
+      parseIndexedCsvRow(ctx, &parseContext);
     }
-    advanceField(&parseContext);
   }
 
   if (parseContext.columnIndex < 2)
   {
     // Fewer than two fields? The line isn't fully specified
+    // (though a row with two is written, without a newline)
+    if (file != NULL)
+    {
+      endRow(ctx, file);
+    }
     return 0;
   }
 
   if (parseContext.columnIndex + 1 != ctx->numFields && !headerRow)
   {
     // Try to read F99 text
-    if (!parseF99Text(ctx, filename))
+    if (!parseF99Text(ctx))
     {
       if (ctx->warn)
       {
-        fprintf(stderr, "Warning: mismatched number of fields (%d vs %d) (%s)\nLine: %s\n", parseContext.columnIndex + 1, ctx->numFields, ctx->formType, parseContext.line->str);
+        fprintf(stderr, "Warning: mismatched number of fields (%d vs %d) (%s)\nLine: %s\n", parseContext.columnIndex + 1, ctx->numFields, ctx->formType, ctx->line->str);
       }
       // 2 indicates we won't grab the line again
-      writeNewline(ctx->writeContext, filename, csvExtension);
+      writeNewline(&ctx->rowContext, NULL);
+      endRow(ctx, file);
       endLine(ctx->writeContext, ctx->types);
       return 2;
     }
   }
 
   // Parsing successful
-  writeNewline(ctx->writeContext, filename, csvExtension);
+  writeNewline(&ctx->rowContext, NULL);
+  endRow(ctx, file);
   endLine(ctx->writeContext, ctx->types);
   return 1;
 }
 
-// Set the FEC context version based on a substring of the current line
-void setVersion(FEC_CONTEXT *ctx, int start, int end)
+void setVersionString(FEC_CONTEXT *ctx, const char *version, int length)
 {
-  ctx->version = malloc(end - start + 1);
-  strncpy(ctx->version, ctx->persistentMemory->line->str + start, end - start);
+  if (ctx->version != NULL)
+  {
+    free(ctx->version);
+  }
+  ctx->version = malloc(length + 1);
+  strncpy(ctx->version, version, length);
   // Add null terminator
-  ctx->version[end - start] = 0;
-  ctx->versionLength = end - start;
+  ctx->version[length] = 0;
+  ctx->versionLength = length;
+
+  // Narrow the mappings down to the ones for this version
+  initVersionMappings(&ctx->versionMappings, ctx->version, ctx->versionLength);
 
   // Calculate whether to use ascii28 or not based on version
   char *dot = strchr(ctx->version, '.');
@@ -690,13 +805,21 @@ void setVersion(FEC_CONTEXT *ctx, int start, int end)
   ctx->useAscii28 = !useCommaVersion;
 }
 
+// Set the FEC context version based on a substring of the current line
+void setVersion(FEC_CONTEXT *ctx, int start, int end)
+{
+  setVersionString(ctx, ctx->line->str + start, end - start);
+}
+
 int parseHeader(FEC_CONTEXT *ctx)
 {
   // Check if the line starts with "/*"
   if (lineStartsWithLegacyHeader(ctx))
   {
     // Parse legacy header
-    startHeaderRow(ctx, HEADER, csvExtension);
+    int opened;
+    OUTPUT_FILE *header = openFile(ctx->writeContext, HEADER, csvExtension, &opened);
+    startHeaderRow(ctx);
     int scheduleCounts = 0; // init scheduleCounts to be false
     int firstField = 1;
 
@@ -741,45 +864,48 @@ int parseHeader(FEC_CONTEXT *ctx)
         FIELD_INFO headerField = {.num_quotes = 0, .num_commas = 0};
         for (int i = keyStart; i < keyEnd; i++)
         {
-          processFieldChar(ctx->persistentMemory->line->str[i], &headerField);
+          processFieldChar(ctx->line->str[i], &headerField);
         }
         FIELD_INFO valueField = {.num_quotes = 0, .num_commas = 0};
         for (int i = valueStart; i < valueEnd; i++)
         {
-          processFieldChar(ctx->persistentMemory->line->str[i], &valueField);
+          processFieldChar(ctx->line->str[i], &valueField);
         }
 
         // Write commas as needed (only before fields that aren't first)
         if (!firstField)
         {
-          writeDelimeter(ctx->writeContext, HEADER, csvExtension);
-          writeDelimeter(&bufferWriteContext, NULL, NULL);
+          writeDelimeter(&ctx->rowContext, NULL);
+          writeDelimeter(&bufferWriteContext, NULL);
         }
         firstField = 0;
 
         // Write schedule counts prefix if set
         if (scheduleCounts)
         {
-          writeString(ctx->writeContext, HEADER, csvExtension, SCHEDULE_COUNTS);
+          writeFileString(&ctx->rowContext, NULL, SCHEDULE_COUNTS);
         }
 
         // If we match the FEC version column, set the version
-        if (strncmp(ctx->persistentMemory->line->str + keyStart, FEC_VERSION_NUMBER, strlen(FEC_VERSION_NUMBER)) == 0)
+        if (strncmp(ctx->line->str + keyStart, FEC_VERSION_NUMBER, strlen(FEC_VERSION_NUMBER)) == 0)
         {
           setVersion(ctx, valueStart, valueEnd);
         }
 
         // Write the key/value pair
-        writeSubstr(ctx, HEADER, csvExtension, keyStart, keyEnd, &headerField);
+        writeSubstr(ctx, keyStart, keyEnd, &headerField);
         // Write the value to a buffer to be written later
-        writeSubstrToWriter(ctx, &bufferWriteContext, NULL, NULL, valueStart, valueEnd, &valueField);
+        writeSubstrToWriter(ctx, &bufferWriteContext, valueStart, valueEnd, &valueField);
       }
     }
-    writeNewline(ctx->writeContext, HEADER, csvExtension);
+    writeNewline(&ctx->rowContext, NULL);
+    endRow(ctx, header);
     endLine(ctx->writeContext, ctx->types);
-    startDataRow(ctx, HEADER, csvExtension); // output the filing id if we have it
-    writeString(ctx->writeContext, HEADER, csvExtension, bufferWriteContext.localBuffer->str);
-    writeNewline(ctx->writeContext, HEADER, csvExtension); // end with newline
+    startDataRow(ctx); // output the filing id if we have it
+    writeFileString(&ctx->rowContext, NULL, bufferWriteContext.localBuffer->str);
+    header->rows++;
+    writeNewline(&ctx->rowContext, NULL); // end with newline
+    endRow(ctx, header);
     endLine(ctx->writeContext, ctx->types);
   }
   else
@@ -801,7 +927,7 @@ int parseHeader(FEC_CONTEXT *ctx)
       if (parseContext.columnIndex == 1)
       {
         // Check if the second column is "FEC"
-        if (strncmp(ctx->persistentMemory->line->str + parseContext.start, FEC, strlen(FEC)) == 0)
+        if (strncmp(ctx->line->str + parseContext.start, FEC, strlen(FEC)) == 0)
         {
           isFecSecondColumn = 1;
         }
@@ -836,20 +962,18 @@ int parseHeader(FEC_CONTEXT *ctx)
   return 1;
 }
 
-int parseFec(FEC_CONTEXT *ctx)
+int parseFecHeader(FEC_CONTEXT *ctx)
 {
-  int skipGrabLine = 0;
-
   if (grabLine(ctx) == 0)
   {
     return 0;
   }
+  return parseHeader(ctx);
+}
 
-  // Parse the header
-  if (!parseHeader(ctx))
-  {
-    return 0;
-  }
+void parseFecBody(FEC_CONTEXT *ctx, size_t end)
+{
+  int skipGrabLine = 0;
 
   // Loop through parsing the entire file, line by
   // line.
@@ -861,11 +985,27 @@ int parseFec(FEC_CONTEXT *ctx)
       // End of file
       break;
     }
+    if (ctx->lineStart >= end)
+    {
+      break;
+    }
 
     // Parse the line and write its parsed output
     // to CSV files depending on version/form type
     skipGrabLine = parseLine(ctx, NULL, 0) == 2;
   }
+}
 
-  return 1;
+int parseFec(FEC_CONTEXT *ctx)
+{
+  // Parse the header
+  if (!parseFecHeader(ctx))
+  {
+    return 0;
+  }
+
+  parseFecBody(ctx, SIZE_MAX);
+
+  // Write out everything buffered, so the sink has the whole output
+  return flushWriteContext(ctx->writeContext);
 }
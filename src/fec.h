@@ -1,10 +1,13 @@
 #pragma once
 
 #include "export.h"
+#include "pcre/pcre.h"
 #include "buffer.h"
 #include "memory.h"
 #include "writer.h"
 #include "buffer.h"
+#include "csv.h"
+#include "sink.h"
 
 struct fec_context
 {
@@ -18,14 +21,20 @@ struct fec_context
   char *filingId;
   char *version; // default null
   int versionLength;
+  VERSION_MAPPINGS versionMappings; // header rows for the version
   int useAscii28;
   int summary; // default false
   char *f99Text;
 
   // Supporting line information
   PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+  STRING *line;     // the current line: lineView, or a line in persistentMemory
+  STRING lineView;  // the current line in place in the input buffer, if possible
   int currentLineHasAscii28;
   int currentLineLength;
+  size_t lineStart; // where the current line starts in a region input
+  LINE_INDEX *lineIndex; // the fields of the line being parsed
+  WRITE_CONTEXT rowContext; // the output row being written, in persistentMemory
 
   // Flags
   int includeFilingId;
@@ -38,7 +47,7 @@ struct fec_context
   char *headers; // pointer to static CSV header row info
   char *types;   // dynamically allocated string where each char indicates types
 
-  // Special regex
+  // Special regex (the persistent memory's catalog's)
   pcre *f99TextStart;
   pcre *f99TextEnd;
 };
@@ -46,6 +55,57 @@ typedef struct fec_context FEC_CONTEXT;
 
 EXPORT FEC_CONTEXT *newFecContext(PERSISTENT_MEMORY_CONTEXT *persistentMemory, BufferRead bufferRead, int inputBufferSize, CustomWriteFunction customWriteFunction, int outputBufferSize, CustomLineFunction customLineFunction, int writeToFile, void *file, char *filingId, char *outputDirectory, int includeFilingId, int silent, int warn);
 
+// Write output files to a sink (see sink.h) instead of the default for the
+// arguments to newFecContext. The sink must outlive the context.
+EXPORT void setOutputSink(FEC_CONTEXT *ctx, OUTPUT_SINK *sink);
+
+// Write output files to a directory under the output directory named
+// other than by the filing ID (which is still used in rows), e.g. for a
+// part of a filing. The name must outlive the context. Must be called
+// before any file is opened.
+EXPORT void setOutputDirectoryName(FEC_CONTEXT *ctx, char *directory);
+
+// Compress output files in a format (see compress.h) at a level (0 for
+// the format's default), with blocks compressed on up to workers threads.
+// Call after any setOutputSink. Return 0 if the format isn't available
+// in this build or the level is past its maxCompressionLevel (output is
+// then left uncompressed). A block that can't be compressed fails the
+// parse.
+EXPORT int setOutputCompression(FEC_CONTEXT *ctx, int format, int level, int workers);
+
+// Write output files on a separate I/O thread, with up to queueLength
+// full buffers waiting to be written. Return 0 if threads aren't
+// available (output is then written as it's parsed).
+EXPORT int startAsyncOutput(FEC_CONTEXT *ctx, int queueLength);
+
+// Parse input already in memory (which must outlive the context) in
+// place of the bufferRead callback given to newFecContext
+EXPORT void setInputRegion(FEC_CONTEXT *ctx, const char *data, size_t length);
+
+// Parse input already in memory like setInputRegion, but parsing lines in
+// place rather than copying each, which modifies the data. Set mapped if
+// it's a private (MAP_PRIVATE) mapping of a file, to drop the pages parsed
+// past as it goes rather than keep a changed copy of the whole file.
+EXPORT void setWritableInputRegion(FEC_CONTEXT *ctx, char *data, size_t length, int mapped);
+
+// Read input on a separate thread, a buffer ahead of parsing. Return 0
+// if threads aren't available (input is then read as it's parsed).
+EXPORT int startInputReadAhead(FEC_CONTEXT *ctx);
+
 EXPORT void freeFecContext(FEC_CONTEXT *context);
 
 EXPORT int parseFec(FEC_CONTEXT *ctx);
+
+// Parse the header of a filing, setting its version. Return 0 if it
+// couldn't be parsed.
+int parseFecHeader(FEC_CONTEXT *ctx);
+
+// Parse the lines after the header, stopping before the first line that
+// starts at or past end in a region input (SIZE_MAX for all of them).
+// Lines of F99 text after the last line are still read, as they belong
+// to its row.
+void parseFecBody(FEC_CONTEXT *ctx, size_t end);
+
+// Use a version (for another context, which has parsed the header)
+// without parsing a header
+void setVersionString(FEC_CONTEXT *ctx, const char *version, int length);
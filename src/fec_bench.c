@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fec.h"
+#include "sink.h"
+
+// Benchmarks parsing a whole (synthetic, Schedule A-heavy) filing from
+// memory, with output discarded or kept in memory, so no time is spent
+// on disk I/O. A throttled sink stands in for a slow (e.g. networked)
+// filesystem, and a throttled input for a slow pipe, to show how much
+// writing and reading on separate threads overlaps with parsing.
+
+const int NUM_ROWS = 400000;
+const int ROUNDS = 3;
+const double THROTTLED_BYTES_PER_SECOND = 100e6;
+const double THROTTLED_INPUT_BYTES_PER_SECOND = 200e6;
+const int ASYNC_QUEUE_LENGTH = 8;
+
+const char *filingHeader = "HDR\x1c" "FEC\x1c" "8.3\x1c" "NGP8\x1c\x1c\x1c\x1c\n"
+                           "F3N\x1c" "C00123456\x1c" "Committee to Elect\x1c" "PO Box 4146\x1c\x1c" "Saint Paul\x1c" "MN\x1c" "55104\x1c" "MN\x1c\x1c" "Q3\x1c\x1c" "20210701\x1c" "20210930\x1c" "Clark\x1c" "Samuel\n";
+
+const char *filingRows[] = {
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4265\x1c\x1c\x1c" "IND\x1c\x1c" "Smith\x1c" "Jane\x1c\x1c\x1c\x1c" "123 Main St\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "P2022\x1c\x1c" "20210805\x1c" "1000.00\x1c" "1000.00\x1c\x1c" "Engineer\x1c" "Acme Corporation\n",
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4266\x1c\x1c\x1c" "IND\x1c\x1c" "Johnson-Whitaker\x1c" "Christopher\x1c" "A\x1c\x1c\x1c" "4500 Connecticut Avenue NW\x1c" "Apt 1201\x1c" "Washington\x1c" "DC\x1c" "20008\x1c" "P2022\x1c\x1c" "20210812\x1c" "250.00\x1c" "750.00\x1c\x1c" "Attorney\x1c" "Covington, Burling and Partners LLP\n",
+    "SB17\x1c" "C00123456\x1c" "SB17.1187\x1c\x1c\x1c" "ORG\x1c" "Print Shop \"Express\"\x1c\x1c\x1c\x1c\x1c" "1 Industrial Way\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "20210910\x1c" "2000.00\x1c\x1c" "Yard signs, \"Vote\" banners\n",
+};
+
+struct memory_input
+{
+  char *data;
+  size_t length;
+  size_t position;
+};
+typedef struct memory_input MEMORY_INPUT;
+
+size_t readMemoryInput(char *buffer, int want, void *data)
+{
+  MEMORY_INPUT *input = (MEMORY_INPUT *)data;
+  size_t remaining = input->length - input->position;
+  size_t n = remaining < (size_t)want ? remaining : (size_t)want;
+  memcpy(buffer, input->data + input->position, n);
+  input->position += n;
+  return n;
+}
+
+void sleepFor(double seconds)
+{
+  struct timespec delay = {.tv_sec = (time_t)seconds, .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9)};
+  nanosleep(&delay, NULL);
+}
+
+// Read from memory, but take as long as reading at a fixed rate would
+size_t readThrottledInput(char *buffer, int want, void *data)
+{
+  size_t n = readMemoryInput(buffer, want, data);
+  sleepFor(n / THROTTLED_INPUT_BYTES_PER_SECOND);
+  return n;
+}
+
+// Discard output, but take as long as writing it at a fixed rate would
+void throttledSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  sleepFor(numBytes / THROTTLED_BYTES_PER_SECOND);
+}
+
+OUTPUT_SINK *newThrottledSink()
+{
+  OUTPUT_SINK *sink = newNullSink();
+  sink->write = throttledSinkWrite;
+  return sink;
+}
+
+double wallTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Read input through a callback, or straight from memory with a null one
+void benchmark(const char *name, MEMORY_INPUT *input, BufferRead read, OUTPUT_SINK *(*newSinkForRound)(), int asyncOutput, int readAhead)
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  long long bytes = 0;
+  double seconds = 0;
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    input->position = 0;
+    OUTPUT_SINK *sink = newSinkForRound();
+    double start = wallTime();
+    FEC_CONTEXT *fec = newFecContext(persistentMemory, read, 65536, NULL, 65536, NULL, 0, input, "1", NULL, 0, 1, 0);
+    setOutputSink(fec, sink);
+    if (read == NULL)
+    {
+      setInputRegion(fec, input->data, input->length);
+    }
+    if (asyncOutput)
+    {
+      startAsyncOutput(fec, ASYNC_QUEUE_LENGTH);
+    }
+    if (readAhead)
+    {
+      startInputReadAhead(fec);
+    }
+    parseFec(fec);
+    freeFecContext(fec);
+    seconds += wallTime() - start;
+    freeOutputSink(sink);
+    bytes += input->length;
+  }
+  printf("%-16s %6.1f MB/s (%lld bytes)\n", name, bytes / seconds / 1e6, bytes);
+  freePersistentMemoryContext(persistentMemory);
+}
+
+int main()
+{
+  // Generate the filing
+  int numRowTypes = sizeof(filingRows) / sizeof(filingRows[0]);
+  size_t length = strlen(filingHeader);
+  for (int i = 0; i < NUM_ROWS; i++)
+  {
+    length += strlen(filingRows[i % numRowTypes]);
+  }
+  MEMORY_INPUT input = {.data = malloc(length + 1), .length = length, .position = 0};
+  char *end = input.data;
+  end = stpcpy(end, filingHeader);
+  for (int i = 0; i < NUM_ROWS; i++)
+  {
+    end = stpcpy(end, filingRows[i % numRowTypes]);
+  }
+
+  printf("\nFiling parsing benchmark (%d rows)\n", NUM_ROWS);
+  benchmark("null", &input, readMemoryInput, newNullSink, 0, 0);
+  benchmark("region", &input, NULL, newNullSink, 0, 0);
+  benchmark("memory", &input, readMemoryInput, newMemorySink, 0, 0);
+  benchmark("memory async", &input, readMemoryInput, newMemorySink, 1, 0);
+  benchmark("throttled", &input, readMemoryInput, newThrottledSink, 0, 0);
+  benchmark("throttled async", &input, readMemoryInput, newThrottledSink, 1, 0);
+  benchmark("slow input", &input, readThrottledInput, newNullSink, 0, 0);
+  benchmark("slow read-ahead", &input, readThrottledInput, newNullSink, 0, 1);
+  free(input.data);
+  return 0;
+}
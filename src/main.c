@@ -1,18 +1,40 @@
 #include "encoding.h"
 #include "fec.h"
 #include "cli.h"
+#include "batch.h"
+#include "compress.h"
+#include "parallel.h"
+#include "parts.h"
+#include "serve.h"
+#include "compat.h"
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAS_MMAP
+#include <sys/mman.h>
+#endif
 
 #define BUFFERSIZE 65536
+#define ASYNC_QUEUE_LENGTH 8
+#define BATCH_SUMMARY "summary.csv"
 
 void printUsage(char *argv[])
 {
-  fprintf(stderr, "\nUsage:\n    %s [flags] <id, file> [output directory=output] [override id]\nor: [some command] | %s [flags] <id> [output directory=output]\n", argv[0], argv[0]);
+  fprintf(stderr, "\nUsage:\n    %s [flags] <id, file> [output directory=output] [override id]\nor: [some command] | %s [flags] <id> [output directory=output]\nor: %s --batch [flags] <directory of files, or file listing them> [output directory=output]\nor: %s --merge <id> [output directory=output]\nor: %s serve [flags] [socket path, else jobs from stdin]\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
   fprintf(stderr, "\nOptional flags:\n");
   fprintf(stderr, "  %s, -%c: include a filing_id column at the beginning of\n                        every output CSV\n", FLAG_FILING_ID, FLAG_FILING_ID_SHORT);
   fprintf(stderr, "  %s, -%c        : suppress all stdout messages\n\n", FLAG_SILENT, FLAG_SILENT_SHORT);
   fprintf(stderr, "  %s, -%c        : show warning messages\n\n", FLAG_WARN, FLAG_WARN_SHORT);
   fprintf(stderr, "  %s, -%c        : disable piped input\n\n", FLAG_DISABLE_STDIN, FLAG_DISABLE_STDIN_SHORT);
+  fprintf(stderr, "  %s, -%c  : write output files on a separate thread\n\n", FLAG_ASYNC_OUTPUT, FLAG_ASYNC_OUTPUT_SHORT);
+  fprintf(stderr, "  %s, -%c    : read input on a separate thread\n\n", FLAG_READ_AHEAD, FLAG_READ_AHEAD_SHORT);
+  fprintf(stderr, "  %s, -%c         : parse every file in a directory (or listed\n                        in a file), each named by its filing id\n\n", FLAG_BATCH, FLAG_BATCH_SHORT);
+  fprintf(stderr, "  %s<n>      : parse n filings in a batch (or jobs served)\n                        at once (0 for one per core)\n\n", FLAG_JOBS);
+  fprintf(stderr, "  %s<n>   : split parsing one large filing across n\n                        threads (0 for one per core)\n\n", FLAG_THREADS);
+  fprintf(stderr, "  %s<start>:<end>[:<version>]\n                      : parse only the rows in a byte range into a\n                        part directory, reading the version from the\n                        header if not given\n\n", FLAG_RANGE);
+  fprintf(stderr, "  %s             : merge a filing's parts into whole files\n\n", FLAG_MERGE);
+  fprintf(stderr, "  %s<gzip|zstd>[:level]\n                      : compress output files (.csv.gz or .csv.zst)\n                        at a level from 1 (to 9 for gzip, 22 for\n                        zstd)\n\n", FLAG_COMPRESS);
   fprintf(stderr, "  %s, -%c        : print URLs from docquery.fec.gov\n\n", FLAG_URL, FLAG_URL_SHORT);
 }
 
@@ -26,6 +48,236 @@ void printUrl(CLI_CONTEXT *ctx, char *argv[])
   fprintf(stderr, "\n  curl %s | %s %s\n\n", ctx->fecUrl, argv[0], ctx->fecId);
 }
 
+#ifdef HAS_MMAP
+// Map a regular file into memory to parse it in place (privately, so
+// lines can be null-terminated where they lie without changing the file).
+// Return NULL (to stream it instead) if it isn't one or can't be mapped.
+char *mapFile(FILE *handle, size_t *length)
+{
+  struct stat info;
+  int fd = fileno(handle);
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+  {
+    return NULL;
+  }
+  void *data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    return NULL;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  *length = info.st_size;
+  return (char *)data;
+}
+#endif
+
+int compareNames(const void *a, const void *b)
+{
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+void addPath(char ***paths, int *numPaths, int *capacity, char *path)
+{
+  if (*numPaths == *capacity)
+  {
+    *capacity *= 2;
+    *paths = realloc(*paths, sizeof(char *) * *capacity);
+  }
+  (*paths)[(*numPaths)++] = path;
+}
+
+// List the files in a directory, in name order. Return NULL if it can't
+// be opened.
+char **listDirectory(const char *name, int *numPaths)
+{
+  DIR *dir = opendir(name);
+  if (!dir)
+  {
+    return NULL;
+  }
+  *numPaths = 0;
+  int capacity = 16;
+  char **paths = malloc(sizeof(char *) * capacity);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] == '.')
+    {
+      continue;
+    }
+    char *path = malloc(strlen(name) + strlen(entry->d_name) + 2);
+    strcpy(path, name);
+    strcat(path, DIR_SEPARATOR);
+    strcat(path, entry->d_name);
+    struct stat info;
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+      free(path);
+      continue;
+    }
+    addPath(&paths, numPaths, &capacity, path);
+  }
+  closedir(dir);
+  qsort(paths, *numPaths, sizeof(char *), compareNames);
+  return paths;
+}
+
+// Read the paths listed in a file, one per line. Return NULL if it can't
+// be opened.
+char **readManifest(const char *name, int *numPaths)
+{
+  FILE *manifest = fopen(name, "r");
+  if (!manifest)
+  {
+    return NULL;
+  }
+  *numPaths = 0;
+  int capacity = 16;
+  char **paths = malloc(sizeof(char *) * capacity);
+  char line[4096];
+  while (fgets(line, sizeof(line), manifest) != NULL)
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0')
+    {
+      continue;
+    }
+    char *path = malloc(strlen(line) + 1);
+    strcpy(path, line);
+    addPath(&paths, numPaths, &capacity, path);
+  }
+  fclose(manifest);
+  return paths;
+}
+
+// Parse every file in the input directory (in name order), or listed in
+// the input file, as a filing whose ID is the file name up to its
+// extension. Write each filing's outcome to a summary in the output
+// directory.
+int runBatch(CLI_CONTEXT *cli)
+{
+  struct stat info;
+  int isDirectory = stat(cli->name, &info) == 0 && S_ISDIR(info.st_mode);
+  int numFilings = 0;
+  char **paths = isDirectory ? listDirectory(cli->name, &numFilings) : readManifest(cli->name, &numFilings);
+  if (paths == NULL)
+  {
+    fprintf(stderr, "Couldn't open %s: %s\n", isDirectory ? "directory" : "file", cli->name);
+    return 2;
+  }
+
+  char **filingIds = malloc(sizeof(char *) * (numFilings > 0 ? numFilings : 1));
+  for (int i = 0; i < numFilings; i++)
+  {
+    char *name = strrchr(paths[i], DIR_SEPARATOR_CHAR);
+    name = name != NULL ? name + 1 : paths[i];
+    int length = strcspn(name, ".");
+    filingIds[i] = malloc(length + 1);
+    strncpy(filingIds[i], name, length);
+    filingIds[i][length] = '\0';
+  }
+
+  int *statuses = malloc(sizeof(int) * (numFilings > 0 ? numFilings : 1));
+  int jobs = cli->jobs > 0 ? cli->jobs : defaultBatchJobs();
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  int failures = parseBatch(persistentMemory, paths, filingIds, numFilings, cli->outputDirectory, cli->includeFilingId, cli->silent, cli->warn, 1, cli->compression, cli->compressionLevel, jobs, statuses);
+  freePersistentMemoryContext(persistentMemory);
+
+  char *summaryPath = malloc(strlen(cli->outputDirectory) + strlen(BATCH_SUMMARY) + 1);
+  strcpy(summaryPath, cli->outputDirectory);
+  strcat(summaryPath, BATCH_SUMMARY);
+  mkdir_p(cli->outputDirectory);
+  writeBatchSummary(summaryPath, paths, filingIds, statuses, numFilings);
+  free(summaryPath);
+
+  for (int i = 0; i < numFilings; i++)
+  {
+    free(paths[i]);
+    free(filingIds[i]);
+  }
+  free(paths);
+  free(filingIds);
+  free(statuses);
+
+  if (failures > 0)
+  {
+    fprintf(stderr, "Parsing failed for %d of %d filings\n", failures, numFilings);
+    return 3;
+  }
+  if (!cli->silent)
+  {
+    printf("Done; parsed %d filings!\n", numFilings);
+  }
+  return 0;
+}
+
+// The running server, to stop on a signal
+FEC_SERVER *runningServer = NULL;
+
+void stopServer(int signalNumber)
+{
+  (void)signalNumber;
+  if (runningServer != NULL)
+  {
+    stopFecServer(runningServer);
+  }
+}
+
+// Serve parse jobs (see serve.h) on a socket until interrupted, or from
+// stdin until it ends, replying on stdout
+int runServe(CLI_CONTEXT *cli)
+{
+  int jobs = cli->jobs > 0 ? cli->jobs : defaultBatchJobs();
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_SERVER *server = newFecServer(persistentMemory, jobs, cli->includeFilingId, cli->warn);
+  int result = 0;
+  if (cli->name != NULL)
+  {
+    runningServer = server;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    if (!cli->silent)
+    {
+      printf("Serving on %s\n", cli->name);
+      fflush(stdout);
+    }
+    result = serveFecSocket(server, cli->name) ? 0 : 2;
+    runningServer = NULL;
+  }
+  else
+  {
+    serveFecJobs(server, stdin, stdout);
+  }
+  freeFecServer(server);
+  freePersistentMemoryContext(persistentMemory);
+  return result;
+}
+
+// Merge the parts of a filing parsed by byte range in its output directory
+int runMerge(CLI_CONTEXT *cli)
+{
+  char *directory = malloc(strlen(cli->outputDirectory) + strlen(cli->fecId) + 1);
+  strcpy(directory, cli->outputDirectory);
+  strcat(directory, cli->fecId);
+  int parts = mergeFecParts(directory);
+  free(directory);
+  if (parts < 0)
+  {
+    fprintf(stderr, "Merging parts failed\n");
+    return 3;
+  }
+  if (parts == 0)
+  {
+    fprintf(stderr, "No parts to merge for filing ID %s\n", cli->fecId);
+    return 2;
+  }
+  if (!cli->silent)
+  {
+    printf("Done; merged %d parts!\n", parts);
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[])
 {
   // Determine whether the input is piped
@@ -61,6 +313,48 @@ int main(int argc, char *argv[])
     exit(0);
   }
 
+  if (!compressionAvailable(cli->compression))
+  {
+    fprintf(stderr, "Compressed output isn't available in this build\n");
+    freeCliContext(cli);
+    exit(1);
+  }
+
+  if (cli->range && cli->compression != COMPRESSION_NONE)
+  {
+    fprintf(stderr, "Parts of a filing can't be compressed, as they're merged first\n");
+    freeCliContext(cli);
+    exit(1);
+  }
+
+  if (cli->serve && (cli->compression != COMPRESSION_NONE || cli->range || cli->merge || cli->batch))
+  {
+    fprintf(stderr, "A server only takes the --jobs, --include-filing-id, --silent and --warn flags\n");
+    freeCliContext(cli);
+    exit(1);
+  }
+
+  if (cli->serve)
+  {
+    int result = runServe(cli);
+    freeCliContext(cli);
+    return result;
+  }
+
+  if (cli->merge)
+  {
+    int result = runMerge(cli);
+    freeCliContext(cli);
+    return result;
+  }
+
+  if (cli->batch)
+  {
+    int result = runBatch(cli);
+    freeCliContext(cli);
+    return result;
+  }
+
   // Run the program
   if (!cli->silent)
   {
@@ -93,20 +387,64 @@ int main(int argc, char *argv[])
   PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
   // Initialize FEC context
   FEC_CONTEXT *fec = newFecContext(persistentMemory, ((BufferRead)(&readBuffer)), BUFFERSIZE, NULL, BUFFERSIZE, NULL, 1, handle, cli->fecId, cli->outputDirectory, cli->includeFilingId, cli->silent, cli->warn);
+  setOutputCompression(fec, cli->compression, cli->compressionLevel, defaultCompressionWorkers());
+  if (cli->asyncOutput)
+  {
+    startAsyncOutput(fec, ASYNC_QUEUE_LENGTH);
+  }
+
+  // Parse files in place in memory where possible (piped input streams)
+  char *mapped = NULL;
+  size_t mappedLength = 0;
+#ifdef HAS_MMAP
+  if (!cli->piped)
+  {
+    mapped = mapFile(handle, &mappedLength);
+  }
+#endif
+  if (mapped != NULL)
+  {
+    setWritableInputRegion(fec, mapped, mappedLength, 1);
+  }
+  else if (cli->readAhead)
+  {
+    startInputReadAhead(fec);
+  }
 
   // Parse the fec file
-  int fecParseResult = parseFec(fec);
+  int fecParseResult;
+  char *partDirectory = NULL;
+  if (cli->range)
+  {
+    // Write the part to its own directory, to be merged with the others
+    partDirectory = partDirectoryName(cli->fecId, cli->rangeStart);
+    setOutputDirectoryName(fec, partDirectory);
+    fecParseResult = parseFecRange(fec, cli->rangeStart, cli->rangeEnd, cli->rangeVersion);
+  }
+  else
+  {
+    int threads = cli->threads > 0 ? cli->threads : defaultBatchJobs();
+    fecParseResult = parseFecParallel(fec, threads);
+  }
 
   // Clear up memory
   freeFecContext(fec);
+  free(partDirectory);
+#ifdef HAS_MMAP
+  if (mapped != NULL)
+  {
+    munmap(mapped, mappedLength);
+  }
+#endif
   freePersistentMemoryContext(persistentMemory);
-  freeCliContext(cli);
 
   // Close file handles
   if (!cli->piped)
   {
     fclose(handle);
   }
+  int silent = cli->silent;
+  freeCliContext(cli);
 
   if (!fecParseResult)
   {
@@ -114,7 +452,7 @@ int main(int argc, char *argv[])
     return 3;
   }
 
-  if (!cli->silent)
+  if (!silent)
   {
     printf("Done; parsing successful!\n");
   }
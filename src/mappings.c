@@ -0,0 +1,103 @@
+#include "mappings.h"
+
+int matchVersionPatterns(const char *version, int versionLength, unsigned char *matches)
+{
+  unsigned char matched[NUM_VERSION_PATTERNS] = {0};
+  int numMatches = 0;
+
+  // Regexes are searched for anywhere in the version, so run the automaton
+  // from each position (including the end, for regexes matching empty strings)
+  for (int start = 0; start <= versionLength; start++)
+  {
+    int state = start == 0 ? 1 : 2;
+    int position = start;
+    while (1)
+    {
+      for (int i = versionAcceptOffsets[state]; i < versionAcceptOffsets[state + 1]; i++)
+      {
+        if (!matched[versionAccepts[i]])
+        {
+          matched[versionAccepts[i]] = 1;
+          matches[numMatches++] = versionAccepts[i];
+        }
+      }
+      if (position == versionLength)
+      {
+        break;
+      }
+      state = versionTransitions[state][versionByteClasses[(unsigned char)version[position++]]];
+      if (state == 0)
+      {
+        break;
+      }
+    }
+  }
+  return numMatches;
+}
+
+int lookupFormClass(const char *formType, int formTypeLength)
+{
+  int state = 0;
+  for (int i = 0; i < formTypeLength; i++)
+  {
+    state = formTransitions[state][formByteClasses[(unsigned char)formType[i]]];
+  }
+  return formStateClasses[state];
+}
+
+// Each version regex knows its first row for the form class; the first row
+// overall is the smallest of these
+int firstHeaderRow(const unsigned char *matches, int numMatches, int formClass)
+{
+  int row = -1;
+  for (int i = 0; i < numMatches; i++)
+  {
+    int candidate = headerDispatch[matches[i]][formClass];
+    if (candidate != -1 && (row == -1 || candidate < row))
+    {
+      row = candidate;
+    }
+  }
+  return row;
+}
+
+void initVersionMappings(VERSION_MAPPINGS *mappings, const char *version, int versionLength)
+{
+  unsigned char matches[NUM_VERSION_PATTERNS];
+  int numMatches = matchVersionPatterns(version, versionLength, matches);
+  for (int formClass = 0; formClass < NUM_FORM_CLASSES; formClass++)
+  {
+    mappings->rows[formClass] = firstHeaderRow(matches, numMatches, formClass);
+  }
+}
+
+int lookupVersionMapping(const VERSION_MAPPINGS *mappings, const char *formType, int formTypeLength, const char **columnTypes)
+{
+  int formClass = lookupFormClass(formType, formTypeLength);
+  int row = mappings->rows[formClass];
+  if (row != -1)
+  {
+    *columnTypes = headerTypeStrings[headerTypes[row][formClass]];
+  }
+  return row;
+}
+
+int lookupHeaderMapping(const char *version, int versionLength, const char *formType, int formTypeLength, const char **columnTypes)
+{
+  // Only resolve the rows for the form class of the form type
+  unsigned char matches[NUM_VERSION_PATTERNS];
+  int numMatches = matchVersionPatterns(version, versionLength, matches);
+  int formClass = lookupFormClass(formType, formTypeLength);
+  int row = firstHeaderRow(matches, numMatches, formClass);
+  if (row != -1)
+  {
+    *columnTypes = headerTypeStrings[headerTypes[row][formClass]];
+  }
+  return row;
+}
+
+int lookupHeaderRow(const char *version, int versionLength, const char *formType, int formTypeLength)
+{
+  const char *columnTypes;
+  return lookupHeaderMapping(version, versionLength, formType, formTypeLength, &columnTypes);
+}
@@ -5,3 +5,35 @@
 // Functions to operate on mappings
 static int numHeaders = sizeof(headers) / sizeof(headers[0]);
 static int numTypes = sizeof(types) / sizeof(types[0]);
+
+// Collect the header version regexes (indices into headerDispatch) matching
+// the version into matches, which must hold NUM_VERSION_PATTERNS entries.
+// Returns the number of matches.
+int matchVersionPatterns(const char *version, int versionLength, unsigned char *matches);
+
+// Return the form class of the form type (a column of headerDispatch)
+int lookupFormClass(const char *formType, int formTypeLength);
+
+// The header rows available to a single version, resolved once per filing
+struct version_mappings
+{
+  short rows[NUM_FORM_CLASSES]; // first matching row per form class, or -1
+};
+typedef struct version_mappings VERSION_MAPPINGS;
+
+// Keep only the header rows whose version regex matches the version
+void initVersionMappings(VERSION_MAPPINGS *mappings, const char *version, int versionLength);
+
+// Return the index of the first row in headers matching the form type among
+// the version's rows (or -1 if there is none), setting columnTypes to the
+// type of each column in the row when matched
+int lookupVersionMapping(const VERSION_MAPPINGS *mappings, const char *formType, int formTypeLength, const char **columnTypes);
+
+// Return the index of the first row in headers whose version and form type
+// regexes match, or -1 if there is none. Equivalent to testing each row's
+// regexes in order, without running any regexes.
+int lookupHeaderRow(const char *version, int versionLength, const char *formType, int formTypeLength);
+
+// Like lookupHeaderRow, also setting columnTypes to the type of each column in
+// the row (as the types table resolves them for the form type) when matched
+int lookupHeaderMapping(const char *version, int versionLength, const char *formType, int formTypeLength, const char **columnTypes);
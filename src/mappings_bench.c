@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mappings.h"
+#include "pcre/pcre.h"
+
+// Benchmarks resolving the header mapping for (version, form type) pairs, as
+// lookupMappings does whenever the form type changes from one line to the next.
+// "version" only resolves the form type, as the version is resolved per filing.
+
+typedef struct
+{
+  const char *version;
+  const char *formType;
+} LOOKUP;
+
+// Form types alternating as they do in a typical F3X filing
+const LOOKUP lookups[] = {
+    {"8.3", "F3XN"},
+    {"8.3", "SA11AI"},
+    {"8.3", "SA17"},
+    {"8.3", "SB23"},
+    {"8.3", "SA11AI"},
+    {"8.3", "SB21B"},
+    {"8.3", "SC/10"},
+    {"8.3", "SD10"},
+    {"8.3", "SE"},
+    {"8.3", "TEXT"},
+    {"8.4", "SA11AI"},
+    {"8.4", "SB23"},
+    {"6.4", "SA11AI"},
+    {"6.4", "SB23"},
+    {"5.3", "SA11AI"},
+    {"P3.4", "SA11AI"},
+};
+const int numLookups = sizeof(lookups) / sizeof(lookups[0]);
+
+pcre *versionRegexes[sizeof(headers) / sizeof(headers[0])];
+pcre *formTypeRegexes[sizeof(headers) / sizeof(headers[0])];
+
+// The previous approach: test each row's regexes in order
+int regexLookup(int index)
+{
+  const char *version = lookups[index].version;
+  const char *formType = lookups[index].formType;
+  for (int i = 0; i < numHeaders; i++)
+  {
+    if (pcre_exec(versionRegexes[i], NULL, version, strlen(version), 0, 0, NULL, 0) >= 0 &&
+        pcre_exec(formTypeRegexes[i], NULL, formType, strlen(formType), 0, 0, NULL, 0) >= 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int dispatchLookup(int index)
+{
+  const char *version = lookups[index].version;
+  const char *formType = lookups[index].formType;
+  return lookupHeaderRow(version, strlen(version), formType, strlen(formType));
+}
+
+// Version mappings for each lookup, as initialized once per filing
+VERSION_MAPPINGS versionMappings[sizeof(lookups) / sizeof(lookups[0])];
+
+int versionLookup(int index)
+{
+  const char *formType = lookups[index].formType;
+  const char *columnTypes;
+  return lookupVersionMapping(&versionMappings[index], formType, strlen(formType), &columnTypes);
+}
+
+// Run lookups for about a second and return the number of lookups per second
+double benchmark(const char *name, int (*lookup)(int))
+{
+  long count = 0;
+  long checksum = 0;
+  clock_t start = clock();
+  clock_t elapsed;
+  do
+  {
+    for (int i = 0; i < 1000; i++)
+    {
+      checksum += lookup((count + i) % numLookups);
+    }
+    count += 1000;
+    elapsed = clock() - start;
+  } while (elapsed < CLOCKS_PER_SEC);
+
+  double perSecond = count / ((double)elapsed / CLOCKS_PER_SEC);
+  printf("%-10s %14.0f lookups/s (checksum %ld)\n", name, perSecond, checksum);
+  return perSecond;
+}
+
+int main()
+{
+  const char *error;
+  int errorOffset;
+  for (int i = 0; i < numHeaders; i++)
+  {
+    versionRegexes[i] = pcre_compile(headers[i][0], PCRE_CASELESS, &error, &errorOffset, NULL);
+    formTypeRegexes[i] = pcre_compile(headers[i][1], PCRE_CASELESS, &error, &errorOffset, NULL);
+  }
+
+  for (int i = 0; i < numLookups; i++)
+  {
+    initVersionMappings(&versionMappings[i], lookups[i].version, strlen(lookups[i].version));
+  }
+
+  // Both approaches must agree before comparing them
+  for (int i = 0; i < numLookups; i++)
+  {
+    if (regexLookup(i) != dispatchLookup(i) || regexLookup(i) != versionLookup(i))
+    {
+      fprintf(stderr, "Mismatch for version %s and form type %s\n", lookups[i].version, lookups[i].formType);
+      return 1;
+    }
+  }
+
+  printf("\nMapping lookup benchmark\n");
+  double before = benchmark("regex", regexLookup);
+  double after = benchmark("dispatch", dispatchLookup);
+  printf("Speedup: %.1fx\n", after / before);
+  double perVersion = benchmark("version", versionLookup);
+  printf("Speedup with per-filing version mappings: %.1fx\n", perVersion / before);
+
+  for (int i = 0; i < numHeaders; i++)
+  {
+    pcre_free(versionRegexes[i]);
+    pcre_free(formTypeRegexes[i]);
+  }
+  return 0;
+}
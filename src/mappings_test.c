@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include "minunit.h"
+#include "fec.h"
+#include "mappings.h"
+#include "memory.h"
+#include "sink.h"
+#include "pcre/pcre.h"
+
+int tests_run = 0;
+
+const char *versions[] = {"", "1", "2", "2.02", "3", "3.00", "5.0", "5.1", "5.2", "5.3", "6.1", "6.2", "6.3", "6.4", "7.0", "8.0", "8.1", "8.2", "8.3", "8.4", "8.5", "9", "P1", "P2.2", "P2.6", "P3", "P3.4", "p3.4", "x5.1", "8.35.1", "8.3\n"};
+const char *formTypes[] = {"", "hdr", "HDR", "hdr\n", "hdrx", "f1n", "f1a", "f13a", "f132", "f133", "f1m", "f1ma", "f1mx", "f1s", "f2", "f2n", "f24", "f24a", "f24x", "f3n", "F3XN", "f3x", "f3xa", "f3xt", "f3p", "f3pn", "f3ps", "f3p31", "f3s", "f3z", "f3zt", "f3z1", "f4n", "f5n", "f56", "f57", "f6", "f65", "f7n", "f76", "f8", "f8ii", "f8iii", "f9", "f91", "f94", "f99", "f10", "f105", "h1", "h2", "h3", "h4", "h5", "h6", "sa11ai", "SA17", "sb23", "sb29", "sc/10", "sc1/10", "sd10", "se", "sf", "sl", "text", "zz"};
+
+// The first matching row, determined by running every regex in order
+int regexHeaderRow(pcre **versionRegexes, pcre **formTypeRegexes, const char *version, const char *formType)
+{
+  for (int i = 0; i < numHeaders; i++)
+  {
+    if (pcre_exec(versionRegexes[i], NULL, version, strlen(version), 0, 0, NULL, 0) >= 0 &&
+        pcre_exec(formTypeRegexes[i], NULL, formType, strlen(formType), 0, 0, NULL, 0) >= 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static char *testLookupMatchesRegexes()
+{
+  pcre *versionRegexes[sizeof(headers) / sizeof(headers[0])];
+  pcre *formTypeRegexes[sizeof(headers) / sizeof(headers[0])];
+  const char *error;
+  int errorOffset;
+  for (int i = 0; i < numHeaders; i++)
+  {
+    versionRegexes[i] = pcre_compile(headers[i][0], PCRE_CASELESS, &error, &errorOffset, NULL);
+    formTypeRegexes[i] = pcre_compile(headers[i][1], PCRE_CASELESS, &error, &errorOffset, NULL);
+  }
+
+  int mismatches = 0;
+  for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++)
+  {
+    VERSION_MAPPINGS versionMappings;
+    initVersionMappings(&versionMappings, versions[v], strlen(versions[v]));
+
+    for (size_t f = 0; f < sizeof(formTypes) / sizeof(formTypes[0]); f++)
+    {
+      int expected = regexHeaderRow(versionRegexes, formTypeRegexes, versions[v], formTypes[f]);
+      int actual = lookupHeaderRow(versions[v], strlen(versions[v]), formTypes[f], strlen(formTypes[f]));
+      const char *columnTypes;
+      if (lookupVersionMapping(&versionMappings, formTypes[f], strlen(formTypes[f]), &columnTypes) != actual)
+      {
+        printf("Version mappings mismatch for version \"%s\" and form type \"%s\"\n", versions[v], formTypes[f]);
+        mismatches++;
+      }
+      if (expected != actual)
+      {
+        printf("Mismatch for version \"%s\" and form type \"%s\": expected %d, got %d\n", versions[v], formTypes[f], expected, actual);
+        mismatches++;
+      }
+    }
+  }
+
+  for (int i = 0; i < numHeaders; i++)
+  {
+    pcre_free(versionRegexes[i]);
+    pcre_free(formTypeRegexes[i]);
+  }
+
+  mu_assert("Expected dispatch to match the regexes", mismatches == 0);
+  return 0;
+}
+
+// The column types of a row, determined by running every type regex in order
+void regexColumnTypes(pcre **typeRegexes, const char *version, const char *formType, int row, char *columnTypes)
+{
+  const char *column = headers[row][2];
+  int numColumns = 0;
+  while (*column != 0)
+  {
+    int columnLength = strcspn(column, ",");
+    columnTypes[numColumns] = 's';
+    for (int j = 0; j < numTypes; j++)
+    {
+      if (pcre_exec(typeRegexes[j * 3], NULL, version, strlen(version), 0, 0, NULL, 0) >= 0 &&
+          pcre_exec(typeRegexes[j * 3 + 1], NULL, formType, strlen(formType), 0, 0, NULL, 0) >= 0 &&
+          pcre_exec(typeRegexes[j * 3 + 2], NULL, column, columnLength, 0, 0, NULL, 0) >= 0)
+      {
+        columnTypes[numColumns] = types[j][3][0];
+        break;
+      }
+    }
+    numColumns++;
+    column += column[columnLength] == ',' ? columnLength + 1 : columnLength;
+  }
+  if (numColumns == 0)
+  {
+    // Rows without columns still have a form type column
+    columnTypes[numColumns++] = 's';
+  }
+  columnTypes[numColumns] = 0;
+}
+
+static char *testColumnTypesMatchRegexes()
+{
+  pcre *typeRegexes[sizeof(types) / sizeof(types[0]) * 3];
+  const char *error;
+  int errorOffset;
+  for (int i = 0; i < numTypes * 3; i++)
+  {
+    typeRegexes[i] = pcre_compile(types[i / 3][i % 3], PCRE_CASELESS, &error, &errorOffset, NULL);
+  }
+
+  int mismatches = 0;
+  char expected[4096];
+  for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++)
+  {
+    for (size_t f = 0; f < sizeof(formTypes) / sizeof(formTypes[0]); f++)
+    {
+      const char *actual;
+      int row = lookupHeaderMapping(versions[v], strlen(versions[v]), formTypes[f], strlen(formTypes[f]), &actual);
+      if (row == -1)
+      {
+        continue;
+      }
+      regexColumnTypes(typeRegexes, versions[v], formTypes[f], row, expected);
+      if (strcmp(expected, actual) != 0 || (int)strlen(actual) != headerNumFields[row])
+      {
+        printf("Mismatch for version \"%s\" and form type \"%s\": expected %s, got %s\n", versions[v], formTypes[f], expected, actual);
+        mismatches++;
+      }
+    }
+  }
+
+  for (int i = 0; i < numTypes * 3; i++)
+  {
+    pcre_free(typeRegexes[i]);
+  }
+
+  mu_assert("Expected column types to match the regexes", mismatches == 0);
+  return 0;
+}
+
+static char *testKnownRows()
+{
+  int row = lookupHeaderRow("8.3", 3, "SA11AI", 6);
+  mu_assert("Expected a row for 8.3 SA11AI", row != -1);
+  const char *expected = "form_type,filer_committee_id_number,transaction_id,";
+  mu_assert("Expected SA headers", strncmp(headers[row][2], expected, strlen(expected)) == 0);
+
+  mu_assert("Expected no row for an unknown form type", lookupHeaderRow("8.3", 3, "zz", 2) == -1);
+  mu_assert("Expected no row for an unknown version", lookupHeaderRow("", 0, "sa11ai", 6) == -1);
+  return 0;
+}
+
+static char *testMappingCache()
+{
+  PERSISTENT_MEMORY_CONTEXT *context = newPersistentMemoryContext();
+  MAPPING_CACHE *cache = context->catalog->cache;
+
+  mu_assert("Expected a miss on an empty cache", lookupMappingCache(cache, "8.3", 3, "SA11AI", 6) == NULL);
+  MAPPING_CACHE_ENTRY *entry = addMappingCache(cache, "8.3", 3, "SA11AI", 6);
+  mu_assert("Expected new entries to be unmatched", entry->found == 0);
+
+  // Add enough entries to grow the buckets
+  char formType[16];
+  for (int i = 0; i < 1000; i++)
+  {
+    sprintf(formType, "SA%d", i);
+    addMappingCache(cache, "8.3", 3, formType, strlen(formType));
+  }
+
+  mu_assert("Expected the same entry back", lookupMappingCache(cache, "8.3", 3, "SA11AI", 6) == entry);
+  mu_assert("Expected versions to be distinguished", lookupMappingCache(cache, "8.4", 3, "SA11AI", 6) == NULL);
+  mu_assert("Expected form types to be distinguished", lookupMappingCache(cache, "8.3", 3, "SA11A", 5) == NULL);
+  mu_assert("Expected to find grown entries", lookupMappingCache(cache, "8.3", 3, "SA999", 5) != NULL);
+  mu_assert("Expected 2 hits", getMappingCacheHits(context) == 2);
+  mu_assert("Expected 3 misses", getMappingCacheMisses(context) == 3);
+
+  freePersistentMemoryContext(context);
+  return 0;
+}
+
+static char *testMappingCacheEviction()
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  MAPPING_CACHE *cache = persistentMemory->catalog->cache;
+  cache->maxEntries = 16;
+
+  // Rows with unique form types, unmatched or matched by their prefix,
+  // between rows of a form type that's looked up throughout
+  char *filing = malloc(64 * 64 + 64);
+  int length = sprintf(filing, "HDR\034FEC\0348.3\034FECfile\0348.3.0.4\034\0340\n");
+  for (int i = 0; i < 64; i++)
+  {
+    length += sprintf(filing + length, "ZZ%d\034junk\nSA11AI%d\034C00123456\nSB23\034C00123456\n", i, i);
+  }
+
+  OUTPUT_SINK *sink = newMemorySink();
+  FEC_CONTEXT *ctx = newFecContext(persistentMemory, NULL, 0, NULL, 4096, NULL, 0, NULL, "1", NULL, 0, 1, 0);
+  setOutputSink(ctx, sink);
+  setInputRegion(ctx, filing, length);
+  mu_assert("Expected the filing to parse", parseFec(ctx) == 1);
+  mu_assert("Expected every prefix match written", ctx->writeContext->nfiles == 66);
+  freeFecContext(ctx);
+  freeOutputSink(sink);
+  free(filing);
+
+  mu_assert("Expected the cache to stay bounded", cache->numEntries == 16);
+  mu_assert("Expected a form type in use to stay cached", lookupMappingCache(cache, "8.3", 3, "SB23", 4) != NULL);
+  mu_assert("Expected old junk to be evicted", lookupMappingCache(cache, "8.3", 3, "ZZ0", 3) == NULL);
+
+  // Evicting from a cache of one entry
+  cache->maxEntries = 1;
+  addMappingCache(cache, "8.3", 3, "SA11AI", 6);
+  mu_assert("Expected one entry", cache->numEntries == 1 && cache->oldest == cache->newest);
+  mu_assert("Expected the newest entry kept", lookupMappingCache(cache, "8.3", 3, "SA11AI", 6) != NULL);
+  freePersistentMemoryContext(persistentMemory);
+  return 0;
+}
+
+static char *testMappingCatalog()
+{
+  MAPPING_CATALOG *catalog = newMappingCatalog();
+  PERSISTENT_MEMORY_CONTEXT *first = newScratchMemoryContext(catalog);
+  PERSISTENT_MEMORY_CONTEXT *second = newScratchMemoryContext(catalog);
+  mu_assert("Expected a reference per context and the creator", catalog->references == 3);
+  mu_assert("Expected separate scratch memory", first->line != second->line && first->bufferPool != second->bufferPool);
+
+  addMappingCache(first->catalog->cache, "8.3", 3, "SA11AI", 6);
+  mu_assert("Expected mappings resolved by one context to be shared", lookupMappingCache(second->catalog->cache, "8.3", 3, "SA11AI", 6) != NULL);
+  mu_assert("Expected a hit for every context", getMappingCacheHits(first) == 1 && getMappingCatalogHits(catalog) == 1);
+
+  // The catalog outlives its creator's reference while contexts use it
+  releaseMappingCatalog(catalog);
+  freePersistentMemoryContext(first);
+  mu_assert("Expected the last context to keep the catalog", second->catalog->references == 1);
+  mu_assert("Expected the catalog to still be usable", getMappingCacheMisses(second) == 0);
+  freePersistentMemoryContext(second);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testLookupMatchesRegexes);
+  mu_run_test(testColumnTypesMatchRegexes);
+  mu_run_test(testKnownRows);
+  mu_run_test(testMappingCache);
+  mu_run_test(testMappingCacheEviction);
+  mu_run_test(testMappingCatalog);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nMappings tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", tests_run);
+
+  return result != 0;
+}
@@ -1,8 +1,14 @@
 #include "memory.h"
+#include "writer.h"
 #include "string.h"
 
 const size_t DEFAULT_STRING_SIZE = 256;
 
+// Output buffers start this small and grow as their files are written,
+// up to each context's output buffer size, within the budget
+const int OUTPUT_BUFFER_INITIAL_SIZE = 4096;
+const long DEFAULT_OUTPUT_BUFFER_BUDGET = 16 * 1024 * 1024;
+
 STRING *newString(size_t size)
 {
   STRING *s = malloc(sizeof(STRING));
@@ -68,89 +74,322 @@ void copyString(STRING *src, STRING *dst)
   strcpy(dst->str, src->str);
 }
 
-PERSISTENT_MEMORY_CONTEXT *newPersistentMemoryContext()
-{
-  PERSISTENT_MEMORY_CONTEXT *ctx = malloc(sizeof(PERSISTENT_MEMORY_CONTEXT));
-  ctx->rawLine = newString(DEFAULT_STRING_SIZE);
-  ctx->line = newString(DEFAULT_STRING_SIZE);
-  ctx->bufferLine = newString(DEFAULT_STRING_SIZE);
-
-  // Initialize all regular expressions
-  ctx->headerVersions = malloc(sizeof(pcre *) * numHeaders);
-  ctx->headerFormTypes = malloc(sizeof(pcre *) * numHeaders);
-  ctx->typeVersions = malloc(sizeof(pcre *) * numTypes);
-  ctx->typeFormTypes = malloc(sizeof(pcre *) * numTypes);
-  ctx->typeHeaders = malloc(sizeof(pcre *) * numTypes);
+const size_t DEFAULT_MAPPING_CACHE_BUCKETS = 64;
+// Far more than the (version, form type) pairs real filings use
+const size_t DEFAULT_MAPPING_CACHE_ENTRIES = 4096;
 
-  // Iterate and initialize all header regexes
-  const char *error;
-  int errorOffset;
+MAPPING_CACHE *newMappingCache()
+{
+  MAPPING_CACHE *cache = malloc(sizeof(MAPPING_CACHE));
+  cache->numBuckets = DEFAULT_MAPPING_CACHE_BUCKETS;
+  cache->buckets = calloc(cache->numBuckets, sizeof(MAPPING_CACHE_ENTRY *));
+  cache->numEntries = 0;
+  cache->maxEntries = DEFAULT_MAPPING_CACHE_ENTRIES;
+  cache->oldest = NULL;
+  cache->newest = NULL;
+  cache->hits = 0;
+  cache->misses = 0;
+#ifdef HAS_PTHREADS
+  pthread_mutex_init(&cache->lock, NULL);
+#endif
+  return cache;
+}
 
-  for (int i = 0; i < numHeaders; i++)
+void freeMappingCache(MAPPING_CACHE *cache)
+{
+  for (size_t i = 0; i < cache->numBuckets; i++)
   {
-    ctx->headerVersions[i] = pcre_compile(headers[i][0], PCRE_CASELESS, &error, &errorOffset, NULL);
-    if (ctx->headerVersions[i] == NULL)
-    {
-      fprintf(stderr, "Regex header version compilation for \"%s\" failed at offset %d: %s\n", headers[i][0], errorOffset, error);
-      exit(1);
-    }
-    ctx->headerFormTypes[i] = pcre_compile(headers[i][1], PCRE_CASELESS, &error, &errorOffset, NULL);
-    if (ctx->headerFormTypes[i] == NULL)
+    MAPPING_CACHE_ENTRY *entry = cache->buckets[i];
+    while (entry != NULL)
     {
-      fprintf(stderr, "Regex header form type compilation for \"%s\" failed at offset %d: %s\n", headers[i][1], errorOffset, error);
-      exit(1);
+      MAPPING_CACHE_ENTRY *next = entry->next;
+      free(entry->version);
+      free(entry->formType);
+      free(entry);
+      entry = next;
     }
   }
+  free(cache->buckets);
+#ifdef HAS_PTHREADS
+  pthread_mutex_destroy(&cache->lock);
+#endif
+  free(cache);
+}
+
+void lockMappingCache(MAPPING_CACHE *cache)
+{
+#ifdef HAS_PTHREADS
+  pthread_mutex_lock(&cache->lock);
+#endif
+}
 
-  // Iterate and initialize all type regexes
-  for (int i = 0; i < numTypes; i++)
+void unlockMappingCache(MAPPING_CACHE *cache)
+{
+#ifdef HAS_PTHREADS
+  pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+// FNV-1a hash of the version and form type
+unsigned long hashMappingKey(const char *version, int versionLength, const char *formType, int formTypeLength)
+{
+  unsigned long hash = 2166136261u;
+  for (int i = 0; i < versionLength; i++)
   {
-    ctx->typeVersions[i] = pcre_compile(types[i][0], PCRE_CASELESS, &error, &errorOffset, NULL);
-    if (ctx->typeVersions[i] == NULL)
-    {
-      fprintf(stderr, "Regex type version compilation for \"%s\" failed at offset %d: %s\n", types[i][0], errorOffset, error);
-      exit(1);
-    }
-    ctx->typeFormTypes[i] = pcre_compile(types[i][1], PCRE_CASELESS, &error, &errorOffset, NULL);
-    if (ctx->typeFormTypes[i] == NULL)
+    hash = (hash ^ (unsigned char)version[i]) * 16777619u;
+  }
+  // Separate the version from the form type
+  hash = (hash ^ 0xff) * 16777619u;
+  for (int i = 0; i < formTypeLength; i++)
+  {
+    hash = (hash ^ (unsigned char)formType[i]) * 16777619u;
+  }
+  return hash;
+}
+
+MAPPING_CACHE_ENTRY *lookupMappingCache(MAPPING_CACHE *cache, const char *version, int versionLength, const char *formType, int formTypeLength)
+{
+  unsigned long hash = hashMappingKey(version, versionLength, formType, formTypeLength);
+  MAPPING_CACHE_ENTRY *entry = cache->buckets[hash % cache->numBuckets];
+  while (entry != NULL)
+  {
+    if (entry->hash == hash && entry->versionLength == versionLength && entry->formTypeLength == formTypeLength &&
+        memcmp(entry->version, version, versionLength) == 0 && memcmp(entry->formType, formType, formTypeLength) == 0)
     {
-      fprintf(stderr, "Regex type form type compilation for \"%s\" failed at offset %d: %s\n", types[i][1], errorOffset, error);
-      exit(1);
+      cache->hits++;
+      entry->used = 1;
+      return entry;
     }
-    ctx->typeHeaders[i] = pcre_compile(types[i][2], PCRE_CASELESS, &error, &errorOffset, NULL);
-    if (ctx->typeHeaders[i] == NULL)
+    entry = entry->next;
+  }
+  cache->misses++;
+  return NULL;
+}
+
+// Copy a substring into a newly allocated, null-terminated string
+char *copySubstring(const char *str, int length)
+{
+  char *copy = malloc(length + 1);
+  if (length > 0)
+  {
+    memcpy(copy, str, length);
+  }
+  copy[length] = 0;
+  return copy;
+}
+
+// Evict the oldest entry that hasn't been looked up since it was last up
+// for eviction, moving the ones that have to the back of the line
+void evictMappingCache(MAPPING_CACHE *cache)
+{
+  MAPPING_CACHE_ENTRY *entry = cache->oldest;
+  while (entry->used && entry != cache->newest)
+  {
+    entry->used = 0;
+    cache->oldest = entry->newer;
+    entry->newer = NULL;
+    cache->newest->newer = entry;
+    cache->newest = entry;
+    entry = cache->oldest;
+  }
+  cache->oldest = entry->newer;
+  if (cache->newest == entry)
+  {
+    cache->newest = NULL;
+  }
+
+  MAPPING_CACHE_ENTRY **link = &cache->buckets[entry->hash % cache->numBuckets];
+  while (*link != entry)
+  {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  free(entry->version);
+  free(entry->formType);
+  free(entry);
+  cache->numEntries--;
+}
+
+MAPPING_CACHE_ENTRY *addMappingCache(MAPPING_CACHE *cache, const char *version, int versionLength, const char *formType, int formTypeLength)
+{
+  while (cache->numEntries > 0 && cache->numEntries >= cache->maxEntries)
+  {
+    evictMappingCache(cache);
+  }
+
+  // Double the buckets to keep chains short
+  if (cache->numEntries >= cache->numBuckets)
+  {
+    size_t numBuckets = cache->numBuckets * 2;
+    MAPPING_CACHE_ENTRY **buckets = calloc(numBuckets, sizeof(MAPPING_CACHE_ENTRY *));
+    for (size_t i = 0; i < cache->numBuckets; i++)
     {
-      fprintf(stderr, "Regex type header compilation for \"%s\" failed at offset %d: %s\n", types[i][2], errorOffset, error);
-      exit(1);
+      MAPPING_CACHE_ENTRY *entry = cache->buckets[i];
+      while (entry != NULL)
+      {
+        MAPPING_CACHE_ENTRY *next = entry->next;
+        entry->next = buckets[entry->hash % numBuckets];
+        buckets[entry->hash % numBuckets] = entry;
+        entry = next;
+      }
     }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->numBuckets = numBuckets;
   }
 
-  return ctx;
+  MAPPING_CACHE_ENTRY *entry = malloc(sizeof(MAPPING_CACHE_ENTRY));
+  entry->version = copySubstring(version, versionLength);
+  entry->versionLength = versionLength;
+  entry->formType = copySubstring(formType, formTypeLength);
+  entry->formTypeLength = formTypeLength;
+  entry->hash = hashMappingKey(version, versionLength, formType, formTypeLength);
+  entry->found = 0;
+  entry->headers = NULL;
+  entry->types = NULL;
+  entry->numFields = 0;
+  entry->used = 0;
+
+  entry->newer = NULL;
+  if (cache->newest != NULL)
+  {
+    cache->newest->newer = entry;
+  }
+  else
+  {
+    cache->oldest = entry;
+  }
+  cache->newest = entry;
+  entry->next = cache->buckets[entry->hash % cache->numBuckets];
+  cache->buckets[entry->hash % cache->numBuckets] = entry;
+  cache->numEntries++;
+  return entry;
 }
 
-void freePersistentMemoryContext(PERSISTENT_MEMORY_CONTEXT *context)
+long getMappingCatalogHits(MAPPING_CATALOG *catalog)
 {
-  freeString(context->rawLine);
-  freeString(context->line);
-  freeString(context->bufferLine);
+  lockMappingCache(catalog->cache);
+  long hits = catalog->cache->hits;
+  unlockMappingCache(catalog->cache);
+  return hits;
+}
+
+long getMappingCatalogMisses(MAPPING_CATALOG *catalog)
+{
+  lockMappingCache(catalog->cache);
+  long misses = catalog->cache->misses;
+  unlockMappingCache(catalog->cache);
+  return misses;
+}
+
+long getMappingCacheHits(PERSISTENT_MEMORY_CONTEXT *context)
+{
+  return getMappingCatalogHits(context->catalog);
+}
+
+long getMappingCacheMisses(PERSISTENT_MEMORY_CONTEXT *context)
+{
+  return getMappingCatalogMisses(context->catalog);
+}
+
+void setOutputBufferBudget(PERSISTENT_MEMORY_CONTEXT *context, long budget)
+{
+  context->bufferPool->budget = budget;
+}
+
+long getPeakBufferedBytes(PERSISTENT_MEMORY_CONTEXT *context)
+{
+  return context->bufferPool->peakBufferedBytes;
+}
+
+long getEarlyBufferFlushes(PERSISTENT_MEMORY_CONTEXT *context)
+{
+  return context->bufferPool->earlyFlushes;
+}
+
+MAPPING_CATALOG *newMappingCatalog()
+{
+  const char *error;
+  int errorOffset;
+  pcre *f99TextStart = pcre_compile("^\\s*\\[BEGIN ?TEXT\\]\\s*$", PCRE_CASELESS, &error, &errorOffset, NULL);
+  if (f99TextStart == NULL)
+  {
+    fprintf(stderr, "Regex f99 text start compilation failed at offset %d: %s\n", errorOffset, error);
+    return NULL;
+  }
+  pcre *f99TextEnd = pcre_compile("^\\s*\\[END ?TEXT\\]\\s*$", PCRE_CASELESS, &error, &errorOffset, NULL);
+  if (f99TextEnd == NULL)
+  {
+    fprintf(stderr, "Regex f99 text end compilation failed at offset %d: %s\n", errorOffset, error);
+    pcre_free(f99TextStart);
+    return NULL;
+  }
+
+  MAPPING_CATALOG *catalog = malloc(sizeof(MAPPING_CATALOG));
+  catalog->cache = newMappingCache();
+  catalog->f99TextStart = f99TextStart;
+  catalog->f99TextEnd = f99TextEnd;
+  catalog->references = 1;
+  return catalog;
+}
+
+void retainMappingCatalog(MAPPING_CATALOG *catalog)
+{
+  lockMappingCache(catalog->cache);
+  catalog->references++;
+  unlockMappingCache(catalog->cache);
+}
 
-  // Free all regexes
-  for (int i = 0; i < numHeaders; i++)
+void releaseMappingCatalog(MAPPING_CATALOG *catalog)
+{
+  lockMappingCache(catalog->cache);
+  int references = --catalog->references;
+  unlockMappingCache(catalog->cache);
+  if (references > 0)
   {
-    pcre_free(context->headerVersions[i]);
-    pcre_free(context->headerFormTypes[i]);
+    return;
   }
-  for (int i = 0; i < numTypes; i++)
+  freeMappingCache(catalog->cache);
+  pcre_free(catalog->f99TextStart);
+  pcre_free(catalog->f99TextEnd);
+  free(catalog);
+}
+
+PERSISTENT_MEMORY_CONTEXT *newScratchMemoryContext(MAPPING_CATALOG *catalog)
+{
+  PERSISTENT_MEMORY_CONTEXT *ctx = malloc(sizeof(PERSISTENT_MEMORY_CONTEXT));
+  ctx->rawLine = newString(DEFAULT_STRING_SIZE);
+  ctx->line = newString(DEFAULT_STRING_SIZE);
+  ctx->bufferLine = newString(DEFAULT_STRING_SIZE);
+  ctx->row = newString(DEFAULT_STRING_SIZE);
+  retainMappingCatalog(catalog);
+  ctx->catalog = catalog;
+  ctx->bufferPool = newBufferPool(DEFAULT_OUTPUT_BUFFER_BUDGET, OUTPUT_BUFFER_INITIAL_SIZE);
+
+  return ctx;
+}
+
+PERSISTENT_MEMORY_CONTEXT *newPersistentMemoryContext()
+{
+  MAPPING_CATALOG *catalog = newMappingCatalog();
+  if (catalog == NULL)
   {
-    pcre_free(context->typeVersions[i]);
-    pcre_free(context->typeFormTypes[i]);
-    pcre_free(context->typeHeaders[i]);
+    exit(1);
   }
-  free(context->headerVersions);
-  free(context->headerFormTypes);
-  free(context->typeVersions);
-  free(context->typeFormTypes);
-  free(context->typeHeaders);
+  PERSISTENT_MEMORY_CONTEXT *ctx = newScratchMemoryContext(catalog);
+  // The context holds the only reference
+  releaseMappingCatalog(catalog);
+  return ctx;
+}
+
+void freePersistentMemoryContext(PERSISTENT_MEMORY_CONTEXT *context)
+{
+  freeString(context->rawLine);
+  freeString(context->line);
+  freeString(context->bufferLine);
+  freeString(context->row);
+  releaseMappingCatalog(context->catalog);
+  freeBufferPool(context->bufferPool);
 
   free(context);
 }
@@ -2,9 +2,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "pcre/pcre.h"
 #include "export.h"
+#include "compat.h"
 #include "mappings.h"
+#include "pcre/pcre.h"
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+#endif
 
 extern const size_t DEFAULT_STRING_SIZE;
 struct string_type
@@ -31,20 +35,132 @@ int growStringTo(STRING *str, size_t newSize);
 
 void copyString(STRING *src, STRING *dst);
 
+// A resolved header mapping for a (version, form type) pair
+struct mapping_cache_entry
+{
+  char *version;
+  int versionLength;
+  char *formType;
+  int formTypeLength;
+  unsigned long hash;
+
+  int found;           // false if no header mapping matched (a negative entry)
+  const char *headers; // pointer to static CSV header row info
+  const char *types;   // pointer to static string where each char indicates types
+  int numFields;
+
+  int used; // looked up since it was last up for eviction
+  struct mapping_cache_entry *next;  // next entry in the same bucket
+  struct mapping_cache_entry *newer; // next entry in eviction order
+};
+typedef struct mapping_cache_entry MAPPING_CACHE_ENTRY;
+
+// A hash map of resolved mappings that persists across filings. Every
+// form type looked up gets an entry (matched or not), so it holds at most
+// maxEntries, evicting ones that haven't been looked up lately to make
+// room; filings full of junk form types can't grow it without bound.
+struct mapping_cache
+{
+  MAPPING_CACHE_ENTRY **buckets;
+  size_t numBuckets;
+  size_t numEntries;
+  size_t maxEntries;
+
+  // Entries oldest first, in the order they're up for eviction. Entries
+  // looked up since get another pass instead of being evicted.
+  MAPPING_CACHE_ENTRY *oldest;
+  MAPPING_CACHE_ENTRY *newest;
+
+  // Counts of lookups that were (or weren't) already resolved
+  long hits;
+  long misses;
+
+#ifdef HAS_PTHREADS
+  // Held from a lookup until a missing mapping is resolved, so contexts
+  // on several threads can share the cache
+  pthread_mutex_t lock;
+#endif
+};
+typedef struct mapping_cache MAPPING_CACHE;
+
+// What every parse looks up but never changes once built: the compiled
+// regexes, and the cache of resolved mappings (which is locked). One
+// catalog can be shared by parses on many threads, each with its own
+// scratch memory (a persistent memory context). Reference counted, so
+// it's freed once every context using it (and its creator) releases it.
+struct mapping_catalog
+{
+  MAPPING_CACHE *cache;
+  pcre *f99TextStart;
+  pcre *f99TextEnd;
+
+  int references; // guarded by the cache's lock
+};
+typedef struct mapping_catalog MAPPING_CATALOG;
+
+// Scratch memory for parsing one filing at a time, reused from filing to
+// filing. Only one parse may use it at once.
 struct persistent_memory_context
 {
   STRING *rawLine;
   STRING *line;
   STRING *bufferLine;
+  STRING *row; // an output row, written to its file once complete
 
-  pcre **headerVersions;
-  pcre **headerFormTypes;
-  pcre **typeVersions;
-  pcre **typeFormTypes;
-  pcre **typeHeaders;
+  MAPPING_CATALOG *catalog;
+  struct buffer_pool *bufferPool; // output buffers for every context (see writer.h)
 };
 typedef struct persistent_memory_context PERSISTENT_MEMORY_CONTEXT;
 
+// Create a mapping catalog, holding one reference to it. Return NULL if
+// its regexes can't be compiled.
+EXPORT MAPPING_CATALOG *newMappingCatalog();
+
+EXPORT void retainMappingCatalog(MAPPING_CATALOG *catalog);
+
+// Release a reference to the catalog, freeing it if it was the last
+EXPORT void releaseMappingCatalog(MAPPING_CATALOG *catalog);
+
+EXPORT long getMappingCatalogHits(MAPPING_CATALOG *catalog);
+
+EXPORT long getMappingCatalogMisses(MAPPING_CATALOG *catalog);
+
+// Create scratch memory for parsing on one thread using a shared catalog
+// (holding a reference to it until the context is freed)
+EXPORT PERSISTENT_MEMORY_CONTEXT *newScratchMemoryContext(MAPPING_CATALOG *catalog);
+
+// Create scratch memory with a catalog of its own
 EXPORT PERSISTENT_MEMORY_CONTEXT *newPersistentMemoryContext();
 
+// Free the context's scratch memory and release its catalog
 EXPORT void freePersistentMemoryContext(PERSISTENT_MEMORY_CONTEXT *context);
+
+// Lock the cache from a lookup until any missing mapping has been added
+// and resolved (a no-op without threads)
+void lockMappingCache(MAPPING_CACHE *cache);
+
+void unlockMappingCache(MAPPING_CACHE *cache);
+
+// Return the cached mapping for the version and form type, or NULL if it
+// hasn't been resolved yet. Counts a hit or miss. The entry may be evicted
+// once the cache is unlocked, so read it before then.
+MAPPING_CACHE_ENTRY *lookupMappingCache(MAPPING_CACHE *cache, const char *version, int versionLength, const char *formType, int formTypeLength);
+
+// Add an unresolved (not found) entry for the version and form type to the
+// cache and return it, to be filled in by the caller. Evicts an entry first
+// if the cache is full.
+MAPPING_CACHE_ENTRY *addMappingCache(MAPPING_CACHE *cache, const char *version, int versionLength, const char *formType, int formTypeLength);
+
+EXPORT long getMappingCacheHits(PERSISTENT_MEMORY_CONTEXT *context);
+
+EXPORT long getMappingCacheMisses(PERSISTENT_MEMORY_CONTEXT *context);
+
+// Set the most memory output buffers may take at once (across every FEC
+// context using this persistent memory) before files are flushed early
+EXPORT void setOutputBufferBudget(PERSISTENT_MEMORY_CONTEXT *context, long budget);
+
+// Return the most memory output buffers have taken at once
+EXPORT long getPeakBufferedBytes(PERSISTENT_MEMORY_CONTEXT *context);
+
+// Return the number of output buffers flushed early to stay in budget
+EXPORT long getEarlyBufferFlushes(PERSISTENT_MEMORY_CONTEXT *context);
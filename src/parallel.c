@@ -0,0 +1,380 @@
+#include "parallel.h"
+#include "compat.h"
+#include "sink.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAS_PTHREADS
+#include <pthread.h>
+#endif
+
+// Chunks are at least big enough to be worth a thread, and small enough
+// that the few in memory at once (see PARALLEL_WINDOW) stay small
+#define PARALLEL_MIN_CHUNK (1 << 20)
+#define PARALLEL_MAX_CHUNK (64 << 20)
+#define PARALLEL_CHUNKS_PER_THREAD 4
+
+// How many chunks per thread may be parsed ahead of the one being merged
+#define PARALLEL_WINDOW 2
+
+// Whitespace the F99 text regexes allow before the opening bracket
+static inline int isTextMarginChar(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// Any text parseF99Text reads is within a block, as it begins text at a
+// line matching the start regex and reads to the first matching the end
+// regex
+int findTextBlocks(FEC_CONTEXT *ctx, const char *data, size_t bodyStart, size_t length, TEXT_BLOCK **blocks)
+{
+  int numBlocks = 0;
+  int capacity = 0;
+  int inText = 0;
+  *blocks = NULL;
+  const char *end = data + length;
+  const char *bracket = data + bodyStart;
+  while (bracket < end && (bracket = memchr(bracket, '[', end - bracket)) != NULL)
+  {
+    // Only lines with nothing but whitespace before the bracket can match
+    const char *lineStart = bracket;
+    while (lineStart > data + bodyStart && isTextMarginChar(lineStart[-1]))
+    {
+      lineStart--;
+    }
+    if (lineStart > data + bodyStart && lineStart[-1] != '\n')
+    {
+      bracket++;
+      continue;
+    }
+    const char *newline = findNewline(bracket, end);
+    const char *lineEnd = newline != NULL ? newline + 1 : end;
+    int lineLength = lineEnd - lineStart;
+
+    if (!inText && pcre_exec(ctx->f99TextStart, NULL, lineStart, lineLength, 0, 0, NULL, 0) >= 0)
+    {
+      if (numBlocks == capacity)
+      {
+        capacity = capacity == 0 ? 16 : capacity * 2;
+        *blocks = realloc(*blocks, sizeof(TEXT_BLOCK) * capacity);
+      }
+      (*blocks)[numBlocks].start = lineStart - data;
+      (*blocks)[numBlocks].end = length;
+      numBlocks++;
+      inText = 1;
+    }
+    else if (inText && pcre_exec(ctx->f99TextEnd, NULL, lineStart, lineLength, 0, 0, NULL, 0) >= 0)
+    {
+      (*blocks)[numBlocks - 1].end = lineEnd - data;
+      inText = 0;
+    }
+    bracket = lineEnd;
+  }
+  return numBlocks;
+}
+
+// parseF99Text stops at a line starting with a printable character other
+// than "[" and leaves it to be parsed as a row, so the row before can't
+// take it
+size_t nextChunkStart(const char *data, size_t offset, size_t length, TEXT_BLOCK *blocks, int numBlocks, int *block)
+{
+  if (offset >= length)
+  {
+    return length;
+  }
+  if (data[offset - 1] != '\n')
+  {
+    const char *newline = findNewline(data + offset, data + length);
+    if (newline == NULL)
+    {
+      return length;
+    }
+    offset = newline + 1 - data;
+  }
+  while (offset < length)
+  {
+    while (*block < numBlocks && blocks[*block].end <= offset)
+    {
+      (*block)++;
+    }
+    if (*block < numBlocks && blocks[*block].start <= offset)
+    {
+      // Text blocks end at the end of a line
+      offset = blocks[*block].end;
+      continue;
+    }
+    size_t first = offset;
+    while (first < length && (data[first] == ' ' || data[first] == '\t'))
+    {
+      first++;
+    }
+    unsigned char c = first < length ? data[first] : 0;
+    if (c > ' ' && c < 127 && c != '[')
+    {
+      return offset;
+    }
+    const char *newline = findNewline(data + first, data + length);
+    if (newline == NULL)
+    {
+      return length;
+    }
+    offset = newline + 1 - data;
+  }
+  return length;
+}
+
+#ifdef HAS_PTHREADS
+struct parallel_chunk
+{
+  size_t start;
+  size_t end;
+  OUTPUT_SINK *output; // the chunk's output files, once parsed
+  long *rows;          // the rows in each of its output files
+};
+typedef struct parallel_chunk PARALLEL_CHUNK;
+
+struct parallel_run
+{
+  FEC_CONTEXT *ctx; // the filing's context, with its header parsed
+  PARALLEL_CHUNK *chunks;
+  int numChunks;
+  int nextChunk;    // the next chunk to parse
+  int mergedChunks; // chunks appended to the filing's output so far
+  int window;       // how far parsing may get ahead of merging
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+typedef struct parallel_run PARALLEL_RUN;
+
+struct parallel_worker
+{
+  PARALLEL_RUN *run;
+  pthread_t thread;
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+};
+typedef struct parallel_worker PARALLEL_WORKER;
+
+// Parse a chunk of the filing into a new memory sink, with a context
+// of its own using the filing's version, and count its rows
+OUTPUT_SINK *parseChunk(FEC_CONTEXT *ctx, PERSISTENT_MEMORY_CONTEXT *persistentMemory, PARALLEL_CHUNK *chunk)
+{
+  OUTPUT_SINK *output = newMemorySink();
+  FEC_CONTEXT *chunkCtx = newFecContext(persistentMemory, NULL, 0, NULL, ctx->writeContext->bufferSize, NULL, 0, NULL, ctx->filingId, NULL, ctx->includeFilingId, ctx->silent, ctx->warn);
+  setOutputSink(chunkCtx, output);
+  if (ctx->version != NULL)
+  {
+    setVersionString(chunkCtx, ctx->version, ctx->versionLength);
+  }
+  // Read from the chunk's start to the end of the input, so any F99 text
+  // of the chunk's last row is read the same as in a whole parse
+  setInputRegion(chunkCtx, ctx->buffer->region, ctx->buffer->regionLength);
+  chunkCtx->buffer->regionPos = chunk->start;
+  parseFecBody(chunkCtx, chunk->end);
+  flushWriteContext(chunkCtx->writeContext);
+  // The sink has the files in the order they were opened, as does the
+  // write context
+  WRITE_CONTEXT *writeContext = chunkCtx->writeContext;
+  chunk->rows = malloc(sizeof(long) * (writeContext->nfiles > 0 ? writeContext->nfiles : 1));
+  for (int i = 0; i < writeContext->nfiles; i++)
+  {
+    chunk->rows[i] = writeContext->files[i]->rows;
+  }
+  freeFecContext(chunkCtx);
+  return output;
+}
+
+// Append a chunk's output files to the filing's. Each file the filing
+// already has continues without the chunk's header row.
+void mergeChunk(FEC_CONTEXT *ctx, PARALLEL_CHUNK *chunk)
+{
+  OUTPUT_SINK *output = chunk->output;
+  for (int i = 0; i < getMemorySinkNumFiles(output); i++)
+  {
+    char *filename, *extension, *contents;
+    int length = getMemorySinkFile(output, i, &filename, &extension, &contents);
+    int opened;
+    OUTPUT_FILE *file = openFile(ctx->writeContext, filename, extension, &opened);
+    char *start = contents;
+    if (!opened)
+    {
+      char *newline = memchr(contents, '\n', length);
+      start = newline != NULL ? newline + 1 : contents + length;
+    }
+    writeFileN(ctx->writeContext, file, start, length - (int)(start - contents));
+    file->rows += chunk->rows[i];
+  }
+}
+
+void *parseChunks(void *data)
+{
+  PARALLEL_WORKER *worker = (PARALLEL_WORKER *)data;
+  PARALLEL_RUN *run = worker->run;
+  pthread_mutex_lock(&run->lock);
+  while (1)
+  {
+    // Wait for merging to catch up, so few chunks are held in memory
+    while (run->nextChunk < run->numChunks && run->nextChunk >= run->mergedChunks + run->window)
+    {
+      pthread_cond_wait(&run->changed, &run->lock);
+    }
+    if (run->nextChunk >= run->numChunks)
+    {
+      break;
+    }
+    PARALLEL_CHUNK *chunk = &run->chunks[run->nextChunk++];
+    pthread_mutex_unlock(&run->lock);
+    OUTPUT_SINK *output = parseChunk(run->ctx, worker->persistentMemory, chunk);
+    pthread_mutex_lock(&run->lock);
+    chunk->output = output;
+    pthread_cond_broadcast(&run->changed);
+  }
+  pthread_mutex_unlock(&run->lock);
+  return NULL;
+}
+
+// Split the body into chunks, returning the number of them
+int splitBody(FEC_CONTEXT *ctx, size_t chunkSize, PARALLEL_CHUNK **chunks)
+{
+  const char *data = ctx->buffer->region;
+  size_t length = ctx->buffer->regionLength;
+  size_t bodyStart = ctx->buffer->regionPos;
+  TEXT_BLOCK *blocks;
+  int numBlocks = findTextBlocks(ctx, data, bodyStart, length, &blocks);
+
+  int numChunks = 0;
+  int capacity = 0;
+  int block = 0;
+  *chunks = NULL;
+  size_t start = bodyStart;
+  while (start < length)
+  {
+    size_t end = chunkSize < length - start ? nextChunkStart(data, start + chunkSize, length, blocks, numBlocks, &block) : length;
+    if (numChunks == capacity)
+    {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      *chunks = realloc(*chunks, sizeof(PARALLEL_CHUNK) * capacity);
+    }
+    (*chunks)[numChunks].start = start;
+    (*chunks)[numChunks].end = end;
+    (*chunks)[numChunks].output = NULL;
+    (*chunks)[numChunks].rows = NULL;
+    numChunks++;
+    start = end;
+  }
+  free(blocks);
+  return numChunks;
+}
+
+// Parse the body of a filing whose header has been parsed in chunks on
+// worker threads, merging their output on this thread
+void parseBodyChunks(FEC_CONTEXT *ctx, int threads, size_t chunkSize)
+{
+  // Chunks read the region as it is, without the header's line view
+  releaseLineView(ctx->buffer);
+  if (chunkSize == 0)
+  {
+    chunkSize = (ctx->buffer->regionLength - ctx->buffer->regionPos) / ((size_t)threads * PARALLEL_CHUNKS_PER_THREAD);
+    chunkSize = chunkSize < PARALLEL_MIN_CHUNK ? PARALLEL_MIN_CHUNK : (chunkSize > PARALLEL_MAX_CHUNK ? PARALLEL_MAX_CHUNK : chunkSize);
+  }
+  PARALLEL_RUN run = {ctx, NULL, 0, 0, 0, threads * PARALLEL_WINDOW};
+  run.numChunks = splitBody(ctx, chunkSize, &run.chunks);
+  if (run.numChunks <= 1)
+  {
+    free(run.chunks);
+    parseFecBody(ctx, SIZE_MAX);
+    return;
+  }
+  if (threads > run.numChunks)
+  {
+    threads = run.numChunks;
+  }
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_cond_init(&run.changed, NULL);
+
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = ctx->persistentMemory;
+  PARALLEL_WORKER *workers = malloc(sizeof(PARALLEL_WORKER) * threads);
+  int started = 0;
+  for (int i = 0; i < threads; i++)
+  {
+    workers[i].run = &run;
+    workers[i].persistentMemory = newScratchMemoryContext(persistentMemory->catalog);
+    setOutputBufferBudget(workers[i].persistentMemory, persistentMemory->bufferPool->budget / threads);
+    if (pthread_create(&workers[i].thread, NULL, parseChunks, &workers[i]) != 0)
+    {
+      freePersistentMemoryContext(workers[i].persistentMemory);
+      break;
+    }
+    started++;
+  }
+
+  if (started == 0)
+  {
+    // Parse on this thread instead, from the start of the body
+    parseFecBody(ctx, SIZE_MAX);
+  }
+  else
+  {
+    // Merge each chunk in order as soon as it's parsed
+    for (int i = 0; i < run.numChunks; i++)
+    {
+      pthread_mutex_lock(&run.lock);
+      while (run.chunks[i].output == NULL)
+      {
+        pthread_cond_wait(&run.changed, &run.lock);
+      }
+      pthread_mutex_unlock(&run.lock);
+
+      mergeChunk(ctx, &run.chunks[i]);
+      freeOutputSink(run.chunks[i].output);
+      free(run.chunks[i].rows);
+
+      pthread_mutex_lock(&run.lock);
+      run.mergedChunks++;
+      pthread_cond_broadcast(&run.changed);
+      pthread_mutex_unlock(&run.lock);
+    }
+  }
+
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(workers[i].thread, NULL);
+    // Count every worker's output buffers in the filing's context's stats
+    BUFFER_POOL *pool = workers[i].persistentMemory->bufferPool;
+    persistentMemory->bufferPool->peakBufferedBytes += pool->peakBufferedBytes;
+    persistentMemory->bufferPool->earlyFlushes += pool->earlyFlushes;
+    freePersistentMemoryContext(workers[i].persistentMemory);
+  }
+  free(workers);
+  free(run.chunks);
+  pthread_mutex_destroy(&run.lock);
+  pthread_cond_destroy(&run.changed);
+}
+#endif
+
+int parseFecChunked(FEC_CONTEXT *ctx, int threads, size_t chunkSize)
+{
+#ifdef HAS_PTHREADS
+  if (ctx->buffer->region != NULL && !ctx->writeContext->useCustomLine && threads >= 1)
+  {
+    if (!parseFecHeader(ctx))
+    {
+      return 0;
+    }
+    parseBodyChunks(ctx, threads, chunkSize);
+
+    // Write out everything buffered, so the sink has the whole output
+    return flushWriteContext(ctx->writeContext);
+  }
+#endif
+  return parseFec(ctx);
+}
+
+int parseFecParallel(FEC_CONTEXT *ctx, int threads)
+{
+  if (threads < 2)
+  {
+    return parseFec(ctx);
+  }
+  return parseFecChunked(ctx, threads, 0);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "export.h"
+#include "fec.h"
+
+// Parse one filing on up to threads threads. The header is parsed first
+// (for the version), then the rest of the input is split at line
+// boundaries into chunks, which are parsed in parallel into memory and
+// appended to the context's output files in order, so the output is the
+// same as parseFec's (though warnings may be printed out of order). A
+// chunk never starts inside F99 text, or on a line the F99 text of the
+// row before could take. Only input in memory (see setInputRegion) can
+// be split; otherwise, with fewer than two threads, with a custom line
+// function or without threads, the filing is parsed with parseFec.
+// Return 0 if the filing couldn't be parsed.
+EXPORT int parseFecParallel(FEC_CONTEXT *ctx, int threads);
+
+// Parse like parseFecParallel, splitting the input into chunks of about
+// chunkSize bytes (0 to pick a size for the number of threads), even
+// with one thread (exposed for testing)
+int parseFecChunked(FEC_CONTEXT *ctx, int threads, size_t chunkSize);
+
+// A range of the input that might be F99 text
+struct text_block
+{
+  size_t start;
+  size_t end;
+};
+typedef struct text_block TEXT_BLOCK;
+
+// Find every range of a region input (from the body start) that could be
+// F99 text: from each line that could begin text through the next line
+// that ends it (or the end of the input). Set blocks to a new array of
+// them, and return how many there are.
+int findTextBlocks(FEC_CONTEXT *ctx, const char *data, size_t bodyStart, size_t length, TEXT_BLOCK **blocks);
+
+// Return the start of the first line from offset (moving past a partial
+// line) that a filing can be split at, or length if there's none: a line
+// outside F99 text, starting with a printable character other than "["
+// after any spaces, which is always parsed as a row. Blocks before the
+// block index are past, which is kept for the next call with a later
+// offset.
+size_t nextChunkStart(const char *data, size_t offset, size_t length, TEXT_BLOCK *blocks, int numBlocks, int *block);
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parallel.h"
+#include "sink.h"
+
+// Benchmarks parsing one very large (synthetic) filing from memory split
+// across 1 to 32 threads, with output discarded, to show how parsing
+// scales with threads (while merging output in order on one thread)
+
+const int NUM_ROWS = 1000000;
+const int ROUNDS = 3;
+const int MAX_THREADS = 32;
+
+const char *filingHeader = "HDR\x1c" "FEC\x1c" "8.3\x1c" "NGP8\x1c\x1c\x1c\x1c\n"
+                           "F3N\x1c" "C00123456\x1c" "Committee to Elect\x1c" "PO Box 4146\x1c\x1c" "Saint Paul\x1c" "MN\x1c" "55104\x1c" "MN\x1c\x1c" "Q3\x1c\x1c" "20210701\x1c" "20210930\x1c" "Clark\x1c" "Samuel\n";
+
+const char *filingRows[] = {
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4265\x1c\x1c\x1c" "IND\x1c\x1c" "Smith\x1c" "Jane\x1c\x1c\x1c\x1c" "123 Main St\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "P2022\x1c\x1c" "20210805\x1c" "1000.00\x1c" "1000.00\x1c\x1c" "Engineer\x1c" "Acme Corporation\n",
+    "SA11AI\x1c" "C00123456\x1c" "SA11AI.4266\x1c\x1c\x1c" "IND\x1c\x1c" "Johnson-Whitaker\x1c" "Christopher\x1c" "A\x1c\x1c\x1c" "4500 Connecticut Avenue NW\x1c" "Apt 1201\x1c" "Washington\x1c" "DC\x1c" "20008\x1c" "P2022\x1c\x1c" "20210812\x1c" "250.00\x1c" "750.00\x1c\x1c" "Attorney\x1c" "Covington, Burling and Partners LLP\n",
+    "SB17\x1c" "C00123456\x1c" "SB17.1187\x1c\x1c\x1c" "ORG\x1c" "Print Shop \"Express\"\x1c\x1c\x1c\x1c\x1c" "1 Industrial Way\x1c\x1c" "Springfield\x1c" "VA\x1c" "22150\x1c" "20210910\x1c" "2000.00\x1c\x1c" "Yard signs, \"Vote\" banners\n",
+};
+
+// Every so often, a row with F99 text after it (which chunks can't split)
+const int TEXT_EVERY = 10000;
+const char *textRow = "F99\x1c" "C00123456\x1c" "Committee to Elect\x1c" "PO Box 4146\x1c\x1c" "Saint Paul\x1c" "MN\x1c" "55104\x1c" "Clark\x1c" "Samuel\x1c\x1c\x1c\x1c" "20211015\x1c" "MST\n"
+                      "[BEGINTEXT]\n"
+                      "Miscellaneous text, continued\n"
+                      "\n"
+                      "over a few lines.\n"
+                      "[ENDTEXT]\n";
+
+double wallTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Return the throughput in bytes per second
+double benchmark(const char *data, size_t length, int threads)
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  double seconds = 0;
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    OUTPUT_SINK *sink = newNullSink();
+    double start = wallTime();
+    FEC_CONTEXT *fec = newFecContext(persistentMemory, NULL, 0, NULL, 65536, NULL, 0, NULL, "1", NULL, 0, 1, 0);
+    setOutputSink(fec, sink);
+    setInputRegion(fec, data, length);
+    parseFecParallel(fec, threads);
+    freeFecContext(fec);
+    seconds += wallTime() - start;
+    freeOutputSink(sink);
+  }
+  freePersistentMemoryContext(persistentMemory);
+  return (double)length * ROUNDS / seconds;
+}
+
+int main()
+{
+  // Generate the filing
+  int numRowTypes = sizeof(filingRows) / sizeof(filingRows[0]);
+  size_t length = strlen(filingHeader);
+  for (int i = 0; i < NUM_ROWS; i++)
+  {
+    length += strlen(i % TEXT_EVERY == 0 ? textRow : filingRows[i % numRowTypes]);
+  }
+  char *data = malloc(length + 1);
+  char *end = stpcpy(data, filingHeader);
+  for (int i = 0; i < NUM_ROWS; i++)
+  {
+    end = stpcpy(end, i % TEXT_EVERY == 0 ? textRow : filingRows[i % numRowTypes]);
+  }
+
+  printf("\nParallel filing parsing benchmark (%d rows, %.0f MB)\n", NUM_ROWS, length / 1e6);
+  double serial = 0;
+  char name[32];
+  for (int threads = 1; threads <= MAX_THREADS; threads *= 2)
+  {
+    double bytesPerSecond = benchmark(data, length, threads);
+    if (threads == 1)
+    {
+      serial = bytesPerSecond;
+    }
+    sprintf(name, "%d thread%s", threads, threads == 1 ? "" : "s");
+    printf("%-12s %7.1f MB/s (%.2fx)\n", name, bytesPerSecond / 1e6, bytesPerSecond / serial);
+  }
+  free(data);
+  return 0;
+}
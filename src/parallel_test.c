@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "parallel.h"
+#include "sink.h"
+
+int tests_run = 0;
+
+// A filing with F99 text in every form parseF99Text reads: after rows
+// with too few fields, with blank lines before it, and left unterminated
+// at the end, as well as text-like lines that aren't text (only at the
+// end, as lines without a form type print errors)
+const char *HEADER_LINE = "HDR\034FEC\0348.3\034FECfile\0348.3.0.4\034\0340\n";
+const char *BODY_LINES =
+    "F99\034C00123456\034Some Committee\0341 Main St\034\034Town\034VA\03422222\034Doe\034John\034\034\034\03420220101\034MST\n"
+    "[BEGINTEXT]\n"
+    "This is some \"quoted\" text, with commas\n"
+    "\n"
+    "SA11AI\034looks like a row, but is text\n"
+    "[ENDTEXT]\n"
+    "F99\034C00123456\034Other\0341 Main St\034\034Town\034VA\03422222\034Doe\034John\034\034\034\03420220101\034MST\n"
+    "\n"
+    "  \t\n"
+    "  [BEGIN TEXT]  \n"
+    "More text here\n"
+    "  [END TEXT]\n"
+    "SA11AI\034C00123456\034IND\034\034Smith\034Jane\034\034\034\0341 St\034\034Town\034VA\03422222\034P2022\034\03420220102\034100.50\034250.756\03415\034\034Employer\034Occ\n"
+    "SA11AI\034C00123456\034IND\034\034Short\n"
+    "\n"
+    "\t\n"
+    "SA11AI\034C00123456\034IND\034\034Doe\034Jim\034\034\034\0341 St\034\034Town\034VA\03422222\034P2022\034\03420220103\03475\034300\03415\034\034Employer\034Occ\r\n"
+    "SB23\034C00123456\034ORG\034Vendor\r\n";
+const char *FOOTER_LINES =
+    "[not text]\n"
+    "[BEGIN TEXT]\n"
+    "Text with no row before it\n"
+    "[END TEXT]\n"
+    "F99\034C00123456\034Last\0341 Main St\034\034Town\034VA\03422222\034Doe\034John\034\034\034\03420220101\034MST\n"
+    "[BEGIN TEXT]\n"
+    "Text running to the end of the filing\n";
+
+// Parse a filing from memory into a memory sink, serially if threads is 0
+// or else in chunks of chunkSize bytes. Set parsed to parsing's result,
+// and rows to the rows counted in every file.
+OUTPUT_SINK *parseToMemory(const char *data, size_t length, int threads, size_t chunkSize, int *parsed, long *rows)
+{
+  OUTPUT_SINK *sink = newMemorySink();
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_CONTEXT *ctx = newFecContext(persistentMemory, NULL, 0, NULL, 4096, NULL, 0, NULL, "1", NULL, 1, 1, 0);
+  setOutputSink(ctx, sink);
+  setInputRegion(ctx, data, length);
+  *parsed = threads == 0 ? parseFec(ctx) : parseFecChunked(ctx, threads, chunkSize);
+  *rows = 0;
+  for (int i = 0; i < ctx->writeContext->nfiles; i++)
+  {
+    *rows += ctx->writeContext->files[i]->rows;
+  }
+  freeFecContext(ctx);
+  freePersistentMemoryContext(persistentMemory);
+  return sink;
+}
+
+// Check that a parse in chunks wrote exactly the same files (and counted
+// the same rows) as a serial one
+char *compareParses(const char *data, size_t length, int threads, size_t chunkSize)
+{
+  int serialParsed, chunkedParsed;
+  long serialRows, chunkedRows;
+  OUTPUT_SINK *expected = parseToMemory(data, length, 0, 0, &serialParsed, &serialRows);
+  OUTPUT_SINK *actual = parseToMemory(data, length, threads, chunkSize, &chunkedParsed, &chunkedRows);
+  int same = serialParsed == chunkedParsed && serialRows == chunkedRows && getMemorySinkNumFiles(expected) == getMemorySinkNumFiles(actual);
+  for (int i = 0; same && i < getMemorySinkNumFiles(expected); i++)
+  {
+    // Merged in order, files are even opened in the same order
+    char *expectedName, *actualName, *extension, *expectedContents, *actualContents;
+    int expectedLength = getMemorySinkFile(expected, i, &expectedName, &extension, &expectedContents);
+    int actualLength = getMemorySinkFile(actual, i, &actualName, &extension, &actualContents);
+    same = strcmp(expectedName, actualName) == 0 && expectedLength == actualLength && memcmp(expectedContents, actualContents, expectedLength) == 0;
+  }
+  freeOutputSink(expected);
+  freeOutputSink(actual);
+  mu_assert("Expected the same output files in chunks", same);
+  return 0;
+}
+
+static char *testTextAcrossChunks()
+{
+  // Repeat the body so there's plenty of boundaries to split at
+  size_t bodyLength = strlen(BODY_LINES);
+  size_t length = strlen(HEADER_LINE) + 20 * bodyLength + strlen(FOOTER_LINES);
+  char *data = malloc(length + 1);
+  strcpy(data, HEADER_LINE);
+  for (int i = 0; i < 20; i++)
+  {
+    strcat(data, BODY_LINES);
+  }
+  strcat(data, FOOTER_LINES);
+
+  // Every chunk size from a line to the whole body
+  size_t chunkSizes[] = {1, 7, 50, 333, 1000, length};
+  int threads[] = {1, 2, 3, 8};
+  char *result = 0;
+  for (int i = 0; result == 0 && i < 6; i++)
+  {
+    for (int j = 0; result == 0 && j < 4; j++)
+    {
+      result = compareParses(data, length, threads[j], chunkSizes[i]);
+    }
+  }
+  free(data);
+  return result;
+}
+
+// Run from the repository root, like the benchmarks
+#define NUM_FIXTURES 6
+char *FIXTURES[NUM_FIXTURES] = {
+    "python/tests/fixtures/13360.fec",
+    "python/tests/fixtures/1527862.fec",
+    "python/tests/fixtures/1544132.fec",
+    "python/tests/fixtures/1550126.fec",
+    "python/tests/fixtures/1550548.fec",
+    "python/tests/fixtures/filing_invalid_version.fec",
+};
+
+static char *testFixtures()
+{
+  for (int i = 0; i < NUM_FIXTURES; i++)
+  {
+    FILE *file = fopen(FIXTURES[i], "rb");
+    mu_assert("Expected the fixture to open", file != NULL);
+    fseek(file, 0, SEEK_END);
+    size_t length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(length);
+    length = fread(data, 1, length, file);
+    fclose(file);
+
+    char *result = compareParses(data, length, 4, 4096);
+    if (result == 0)
+    {
+      // With the chunk size picked for the threads
+      result = compareParses(data, length, 4, 0);
+    }
+    free(data);
+    if (result != 0)
+    {
+      return result;
+    }
+  }
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testTextAcrossChunks);
+  mu_run_test(testFixtures);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nParallel parsing tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n\n", tests_run);
+
+  return result != 0;
+}
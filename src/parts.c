@@ -0,0 +1,278 @@
+#include "parts.h"
+#include "compat.h"
+#include "parallel.h"
+#include "writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef __wasm__
+#include <dirent.h>
+#endif
+
+#define MERGE_BUFFER_SIZE 65536
+
+// Read the filing's version (and where its header ends) from its header,
+// without writing the header out. Return 0 if it can't be parsed.
+int readRangeVersion(FEC_CONTEXT *ctx, size_t *bodyStart)
+{
+  FEC_CONTEXT *header = newFecContext(ctx->persistentMemory, NULL, 0, NULL, ctx->writeContext->bufferSize, NULL, 0, NULL, ctx->filingId, NULL, 0, 1, 0);
+  setInputRegion(header, ctx->buffer->region, ctx->buffer->regionLength);
+  int parsed = parseFecHeader(header);
+  if (parsed && header->version != NULL)
+  {
+    setVersionString(ctx, header->version, header->versionLength);
+  }
+  *bodyStart = header->buffer->regionPos;
+  freeFecContext(header);
+  return parsed;
+}
+
+int parseFecRange(FEC_CONTEXT *ctx, size_t start, size_t end, const char *version)
+{
+  const char *data = ctx->buffer->region;
+  size_t length = ctx->buffer->regionLength;
+  if (data == NULL)
+  {
+    fprintf(stderr, "Parsing a byte range needs input in memory\n");
+    return 0;
+  }
+
+  size_t bodyStart;
+  if (start == 0)
+  {
+    if (!parseFecHeader(ctx))
+    {
+      return 0;
+    }
+    bodyStart = ctx->buffer->regionPos;
+  }
+  else if (version != NULL)
+  {
+    setVersionString(ctx, version, strlen(version));
+    const char *newline = findNewline(data, data + length);
+    bodyStart = newline != NULL ? (size_t)(newline + 1 - data) : length;
+  }
+  else if (!readRangeVersion(ctx, &bodyStart))
+  {
+    return 0;
+  }
+
+  // Move both ends to where any part would start
+  releaseLineView(ctx->buffer);
+  TEXT_BLOCK *blocks;
+  int numBlocks = findTextBlocks(ctx, data, bodyStart, length, &blocks);
+  int block = 0;
+  end = end < start ? start : end;
+  size_t from = start <= bodyStart ? bodyStart : nextChunkStart(data, start, length, blocks, numBlocks, &block);
+  size_t to = end <= bodyStart ? bodyStart : nextChunkStart(data, end, length, blocks, numBlocks, &block);
+  free(blocks);
+
+  if (from < to)
+  {
+    ctx->buffer->regionPos = from;
+    parseFecBody(ctx, to);
+  }
+
+  // Write out everything buffered, so the sink has the whole output
+  return flushWriteContext(ctx->writeContext);
+}
+
+char *partDirectoryName(char *filingId, size_t start)
+{
+  char *name = malloc(strlen(filingId) + strlen(DIR_SEPARATOR PART_DIRECTORY_PREFIX) + 21);
+  sprintf(name, "%s" DIR_SEPARATOR PART_DIRECTORY_PREFIX "%016llu", filingId, (unsigned long long)start);
+  return name;
+}
+
+#ifndef __wasm__
+// The output files merged so far (relative to the filing's directory)
+struct merged_files
+{
+  char **paths;
+  int numPaths;
+  int capacity;
+};
+typedef struct merged_files MERGED_FILES;
+
+// Return whether a file has already been started in the merge, adding it
+// if not
+int alreadyMerged(MERGED_FILES *merged, const char *path)
+{
+  for (int i = 0; i < merged->numPaths; i++)
+  {
+    if (strcmp(merged->paths[i], path) == 0)
+    {
+      return 1;
+    }
+  }
+  if (merged->numPaths == merged->capacity)
+  {
+    merged->capacity = merged->capacity == 0 ? 16 : merged->capacity * 2;
+    merged->paths = realloc(merged->paths, sizeof(char *) * merged->capacity);
+  }
+  merged->paths[merged->numPaths] = malloc(strlen(path) + 1);
+  strcpy(merged->paths[merged->numPaths++], path);
+  return 0;
+}
+
+// Append a part file to a merged output file (creating it if it's the
+// first part with the file), without its header row if it's not the
+// first. Return 0 if either file couldn't be opened.
+int appendPartFile(const char *partPath, const char *mergedPath, int skipHeader)
+{
+  FILE *part = fopen(partPath, "rb");
+  if (part == NULL)
+  {
+    fprintf(stderr, "Couldn't open part file: %s\n", partPath);
+    return 0;
+  }
+  FILE *output = fopen(mergedPath, skipHeader ? "ab" : "wb");
+  if (output == NULL)
+  {
+    fprintf(stderr, "Couldn't open merged file: %s\n", mergedPath);
+    fclose(part);
+    return 0;
+  }
+  if (skipHeader)
+  {
+    int c;
+    while ((c = fgetc(part)) != EOF && c != '\n')
+    {
+    }
+  }
+  char *buffer = malloc(MERGE_BUFFER_SIZE);
+  size_t bytesRead;
+  while ((bytesRead = fread(buffer, 1, MERGE_BUFFER_SIZE, part)) > 0)
+  {
+    fwrite(buffer, 1, bytesRead, output);
+  }
+  free(buffer);
+  fclose(part);
+  return fclose(output) == 0;
+}
+
+// Append every file in a part directory (under the relative path within
+// it) to the merged output files. Return 0 on any failure.
+int mergePartDirectory(const char *filingDirectory, const char *partDirectory, const char *relativePath, MERGED_FILES *merged)
+{
+  char *directoryPath = malloc(strlen(partDirectory) + strlen(relativePath) + 2);
+  sprintf(directoryPath, "%s%s", partDirectory, relativePath);
+  DIR *dir = opendir(directoryPath);
+  free(directoryPath);
+  if (dir == NULL)
+  {
+    return 0;
+  }
+  int success = 1;
+  struct dirent *entry;
+  while (success && (entry = readdir(dir)) != NULL)
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+    {
+      continue;
+    }
+    char *relative = malloc(strlen(relativePath) + strlen(entry->d_name) + 2);
+    sprintf(relative, "%s" DIR_SEPARATOR "%s", relativePath, entry->d_name);
+    char *partPath = malloc(strlen(partDirectory) + strlen(relative) + 1);
+    sprintf(partPath, "%s%s", partDirectory, relative);
+
+    // Form types with slashes (e.g. SC/10) have subdirectories
+    struct stat info;
+    if (stat(partPath, &info) == 0 && S_ISDIR(info.st_mode))
+    {
+      success = mergePartDirectory(filingDirectory, partDirectory, relative, merged);
+    }
+    else
+    {
+      char *mergedPath = malloc(strlen(filingDirectory) + strlen(relative) + 1);
+      sprintf(mergedPath, "%s%s", filingDirectory, relative);
+      char *separator = strrchr(mergedPath, DIR_SEPARATOR_CHAR);
+      *separator = '\0';
+      mkdir_p(mergedPath);
+      *separator = DIR_SEPARATOR_CHAR;
+      success = appendPartFile(partPath, mergedPath, alreadyMerged(merged, relative));
+      free(mergedPath);
+    }
+    free(relative);
+    free(partPath);
+  }
+  closedir(dir);
+  return success;
+}
+
+int comparePartNames(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int mergeFecParts(const char *filingDirectory)
+{
+  // Work with the directory without a trailing separator
+  char *directory = malloc(strlen(filingDirectory) + 1);
+  strcpy(directory, filingDirectory);
+  size_t length = strlen(directory);
+  while (length > 1 && directory[length - 1] == DIR_SEPARATOR_CHAR)
+  {
+    directory[--length] = '\0';
+  }
+
+  DIR *dir = opendir(directory);
+  if (dir == NULL)
+  {
+    fprintf(stderr, "Couldn't open directory: %s\n", directory);
+    free(directory);
+    return -1;
+  }
+  char **parts = NULL;
+  int numParts = 0;
+  int capacity = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (strncmp(entry->d_name, PART_DIRECTORY_PREFIX, strlen(PART_DIRECTORY_PREFIX)) != 0)
+    {
+      continue;
+    }
+    if (numParts == capacity)
+    {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      parts = realloc(parts, sizeof(char *) * capacity);
+    }
+    parts[numParts] = malloc(strlen(entry->d_name) + 1);
+    strcpy(parts[numParts++], entry->d_name);
+  }
+  closedir(dir);
+  // Zero padded offsets sort in order as strings
+  qsort(parts, numParts, sizeof(char *), comparePartNames);
+
+  MERGED_FILES merged = {NULL, 0, 0};
+  int success = 1;
+  for (int i = 0; success && i < numParts; i++)
+  {
+    char *partDirectory = malloc(length + strlen(parts[i]) + 2);
+    sprintf(partDirectory, "%s" DIR_SEPARATOR "%s", directory, parts[i]);
+    success = mergePartDirectory(directory, partDirectory, "", &merged);
+    free(partDirectory);
+  }
+
+  for (int i = 0; i < numParts; i++)
+  {
+    free(parts[i]);
+  }
+  free(parts);
+  for (int i = 0; i < merged.numPaths; i++)
+  {
+    free(merged.paths[i]);
+  }
+  free(merged.paths);
+  free(directory);
+  return success ? numParts : -1;
+}
+#else
+int mergeFecParts(const char *filingDirectory)
+{
+  fprintf(stderr, "Merging parts isn't available in this build\n");
+  return -1;
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "export.h"
+#include "fec.h"
+
+// The prefix of the directory (within a filing's output directory) that
+// holds the output of each part of a filing parsed by byte range
+#define PART_DIRECTORY_PREFIX "part-"
+
+// Parse only the rows of a filing (read from a region, see
+// setInputRegion) that lie in a byte range, so parts of one filing can
+// be parsed independently (e.g. on different machines) and merged with
+// mergeFecParts. The range is moved to line boundaries the same way
+// wherever it starts or ends, so adjoining ranges take every row exactly
+// once: from the first line that can start a part at or after start,
+// through the line before the first that can at or after end (see
+// nextChunkStart). F99 text is read with its row, even past end.
+//
+// The filing's version is given, or NULL to read it from the header,
+// and the header itself is only parsed (and written) by the range
+// starting at 0. Given a version, the header is taken to be the first
+// line, as in every filing version after the legacy multiline header.
+// Return 0 if the version couldn't be read or output couldn't be written.
+EXPORT int parseFecRange(FEC_CONTEXT *ctx, size_t start, size_t end, const char *version);
+
+// Return the name of the output directory for the part of a filing
+// starting at start (within the filing's own), in a new allocation, e.g.
+// 1234/part-0000000001048576 (zero padded, so parts sort in order). Pass
+// it to setOutputDirectoryName.
+EXPORT char *partDirectoryName(char *filingId, size_t start);
+
+// Merge the output of every part of a filing in the filing's output
+// directory, in order, into whole output files there: each form's part
+// files are concatenated, keeping only the first part's header row. The
+// part directories are left in place. Return the number of parts merged,
+// or -1 if a file couldn't be read or written.
+EXPORT int mergeFecParts(const char *filingDirectory);
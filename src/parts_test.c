@@ -0,0 +1,215 @@
+#define _XOPEN_SOURCE 500
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "parts.h"
+
+int tests_run = 0;
+
+// Run from the repository root, like the benchmarks
+const char *WHOLE_DIRECTORY = "parts_test_whole/";
+const char *PARTS_DIRECTORY = "parts_test_parts/";
+
+// A filing with F99 text that parts can't split
+const char *TEXT_FILING_HEADER = "HDR\034FEC\0348.3\034FECfile\0348.3.0.4\034\0340\n";
+const char *TEXT_FILING_BODY =
+    "F99\034C00123456\034Some Committee\0341 Main St\034\034Town\034VA\03422222\034Doe\034John\034\034\034\03420220101\034MST\n"
+    "\n"
+    "[BEGINTEXT]\n"
+    "Text, with \"quotes\"\n"
+    "SA11AI\034looks like a row, but is text\n"
+    "[ENDTEXT]\n"
+    "SA11AI\034C00123456\034IND\034\034Smith\034Jane\034\034\034\0341 St\034\034Town\034VA\03422222\034P2022\034\03420220102\034100.50\034250.756\03415\034\034Employer\034Occ\n"
+    "SC/10\034C00123456\034Lender\n";
+
+int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+void removeDirectory(const char *path)
+{
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Read a whole file into a new buffer. Return its length, or -1 if it
+// can't be read.
+long readWhole(const char *path, char **contents)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    return -1;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  *contents = malloc(length + 1);
+  length = fread(*contents, 1, length, file);
+  fclose(file);
+  return length;
+}
+
+// Compare every file under the whole parse's directory with the merged
+// file at the same place under the parts' directory
+int comparedFiles;
+int differentFiles;
+int compareEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  if (flag != FTW_F)
+  {
+    return 0;
+  }
+  char mergedPath[512];
+  sprintf(mergedPath, "%s%s", PARTS_DIRECTORY, path + strlen(WHOLE_DIRECTORY));
+  char *expected = NULL;
+  char *actual = NULL;
+  long expectedLength = readWhole(path, &expected);
+  long actualLength = readWhole(mergedPath, &actual);
+  if (actualLength != expectedLength || memcmp(expected, actual, expectedLength) != 0)
+  {
+    differentFiles++;
+  }
+  comparedFiles++;
+  free(expected);
+  free(actual);
+  return 0;
+}
+
+// Parse a filing whole, as well as in parts split at the offsets and
+// merged, and check the output is the same. Return the number of parts
+// merged, or -1 on a difference.
+int compareParts(const char *data, size_t length, char *filingId, size_t *offsets, int numOffsets, const char *version)
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_CONTEXT *ctx = newFecContext(persistentMemory, NULL, 0, NULL, 4096, NULL, 1, NULL, filingId, (char *)WHOLE_DIRECTORY, 1, 1, 0);
+  setInputRegion(ctx, data, length);
+  parseFec(ctx);
+  freeFecContext(ctx);
+
+  size_t start = 0;
+  for (int i = 0; i <= numOffsets; i++)
+  {
+    size_t end = i < numOffsets ? offsets[i] : length;
+    char *partDirectory = partDirectoryName(filingId, start);
+    ctx = newFecContext(persistentMemory, NULL, 0, NULL, 4096, NULL, 1, NULL, filingId, (char *)PARTS_DIRECTORY, 1, 1, 0);
+    setOutputDirectoryName(ctx, partDirectory);
+    setInputRegion(ctx, data, length);
+    parseFecRange(ctx, start, end, version);
+    freeFecContext(ctx);
+    free(partDirectory);
+    start = end;
+  }
+  freePersistentMemoryContext(persistentMemory);
+
+  char filingDirectory[256];
+  sprintf(filingDirectory, "%s%s", PARTS_DIRECTORY, filingId);
+  int parts = mergeFecParts(filingDirectory);
+
+  comparedFiles = 0;
+  differentFiles = 0;
+  nftw(WHOLE_DIRECTORY, compareEntry, 16, FTW_PHYS);
+  removeDirectory(WHOLE_DIRECTORY);
+  removeDirectory(PARTS_DIRECTORY);
+  return comparedFiles > 0 && differentFiles == 0 ? parts : -1;
+}
+
+#define NUM_FIXTURES 5
+char *FIXTURES[NUM_FIXTURES] = {
+    "python/tests/fixtures/13360.fec",
+    "python/tests/fixtures/1527862.fec",
+    "python/tests/fixtures/1544132.fec",
+    "python/tests/fixtures/1550126.fec",
+    "python/tests/fixtures/1550548.fec",
+};
+char *FIXTURE_IDS[NUM_FIXTURES] = {"13360", "1527862", "1544132", "1550126", "1550548"};
+
+static char *testFixtureParts()
+{
+  for (int i = 0; i < NUM_FIXTURES; i++)
+  {
+    char *data = NULL;
+    long length = readWhole(FIXTURES[i], &data);
+    mu_assert("Expected the fixture to be read", length > 0);
+
+    // Split into one, two and seven parts at arbitrary offsets (mid-line)
+    mu_assert("Expected one part to match", compareParts(data, length, FIXTURE_IDS[i], NULL, 0, NULL) == 1);
+    size_t half[] = {length / 2 + 17};
+    mu_assert("Expected two parts to match", compareParts(data, length, FIXTURE_IDS[i], half, 1, NULL) == 2);
+    size_t sevenths[6];
+    for (int j = 0; j < 6; j++)
+    {
+      sevenths[j] = length / 7 * (j + 1) - 3;
+    }
+    mu_assert("Expected seven parts to match", compareParts(data, length, FIXTURE_IDS[i], sevenths, 6, NULL) == 7);
+    free(data);
+  }
+  return 0;
+}
+
+static char *testTextParts()
+{
+  size_t bodyLength = strlen(TEXT_FILING_BODY);
+  size_t length = strlen(TEXT_FILING_HEADER) + 10 * bodyLength;
+  char *data = malloc(length + 1);
+  strcpy(data, TEXT_FILING_HEADER);
+  for (int i = 0; i < 10; i++)
+  {
+    strcat(data, TEXT_FILING_BODY);
+  }
+
+  // A part at every few bytes, with the version given, so some parts
+  // start in F99 text and most have no rows (so write no directory)
+  size_t offsets[200];
+  int numOffsets = 0;
+  for (size_t offset = 5; offset < length && numOffsets < 200; offset += 11)
+  {
+    offsets[numOffsets++] = offset;
+  }
+  int parts = compareParts(data, length, "1", offsets, numOffsets, "8.3");
+  free(data);
+  mu_assert("Expected parts split in F99 text to match", parts > 1 && parts < numOffsets);
+  return 0;
+}
+
+static char *testInvalidVersion()
+{
+  char *data = NULL;
+  long length = readWhole("python/tests/fixtures/filing_invalid_version.fec", &data);
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_CONTEXT *ctx = newFecContext(persistentMemory, NULL, 0, NULL, 4096, NULL, 0, NULL, "invalid", NULL, 0, 1, 0);
+  setInputRegion(ctx, data, length);
+  int parsed = parseFecRange(ctx, length / 2, length, NULL);
+  freeFecContext(ctx);
+  freePersistentMemoryContext(persistentMemory);
+  free(data);
+  mu_assert("Expected a part to fail without a readable version", parsed == 0);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testFixtureParts);
+  mu_run_test(testTextParts);
+  mu_run_test(testInvalidVersion);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nByte range parsing tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n\n", tests_run);
+
+  return result != 0;
+}
@@ -0,0 +1,624 @@
+#include "serve.h"
+#include "batch.h"
+#include "compat.h"
+#include "fec.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAS_PTHREADS
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#define SERVE_BUFFER_SIZE 65536
+#define SERVE_DEFAULT_OUTPUT "output" DIR_SEPARATOR
+#define SERVE_MAX_FIELDS 16
+// How long to wait for a connection before checking for a stop
+#define SERVE_POLL_MILLISECONDS 200
+
+const char *SERVE_STATUS_NAMES[] = {"parsed", "failed", "unreadable", "invalid"};
+
+// Where the replies to the jobs from one input go
+struct serve_connection
+{
+  FILE *output;
+  int pending;  // jobs not yet replied to
+  int failures; // jobs that weren't parsed
+#ifdef HAS_PTHREADS
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+#endif
+};
+typedef struct serve_connection SERVE_CONNECTION;
+
+struct serve_job
+{
+  char *line;
+  long number;
+  SERVE_CONNECTION *connection;
+  struct serve_job *next;
+};
+typedef struct serve_job SERVE_JOB;
+
+struct serve_worker
+{
+  FEC_SERVER *server;
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+  STRING *reply;
+#ifdef HAS_PTHREADS
+  pthread_t thread;
+#endif
+};
+typedef struct serve_worker SERVE_WORKER;
+
+struct fec_server
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory;
+  int includeFilingId;
+  int warn;
+
+  SERVE_WORKER *workers;
+  int numWorkers; // started worker threads (none to run jobs in place)
+
+#ifdef HAS_PTHREADS
+  int stopRequested; // set atomically, from any thread or a signal handler
+
+  // Jobs waiting for a worker, oldest first
+  SERVE_JOB *head;
+  SERVE_JOB *tail;
+  int stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t available;
+
+  // Open socket connections, shut for reading on a stop
+  int *sockets;
+  int numSockets;
+  int socketsCapacity;
+  pthread_cond_t closed;
+#endif
+};
+
+// Append formatted text to a reply at its length
+void appendReply(STRING *reply, size_t *length, const char *format, ...)
+{
+  while (1)
+  {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(reply->str + *length, reply->n - *length, format, args);
+    va_end(args);
+    if (needed < 0)
+    {
+      return;
+    }
+    if (*length + needed < reply->n)
+    {
+      *length += needed;
+      return;
+    }
+    growStringTo(reply, (*length + needed + 1) * 2);
+  }
+}
+
+// Set the reply to a job with its outcome, and the rows in each of the
+// files its context wrote (if it got one)
+void setReply(STRING *reply, long number, int status, FEC_CONTEXT *fec)
+{
+  size_t length = 0;
+  long rows = 0;
+  WRITE_CONTEXT *writeContext = fec != NULL ? fec->writeContext : NULL;
+  for (int i = 0; writeContext != NULL && i < writeContext->nfiles; i++)
+  {
+    rows += writeContext->files[i]->rows;
+  }
+  appendReply(reply, &length, "%ld\t%s\t%ld\t", number, SERVE_STATUS_NAMES[status], rows);
+  for (int i = 0; writeContext != NULL && i < writeContext->nfiles; i++)
+  {
+    OUTPUT_FILE *file = writeContext->files[i];
+    appendReply(reply, &length, "%s%s=%ld", i > 0 ? "," : "", file->filename, file->rows);
+  }
+  appendReply(reply, &length, "\n");
+}
+
+// Run a job (changing its line), setting the reply to it. Return its
+// outcome.
+int runServeJob(FEC_SERVER *server, PERSISTENT_MEMORY_CONTEXT *persistentMemory, char *line, long number, STRING *reply)
+{
+  // Split the job into its fields
+  char *fields[SERVE_MAX_FIELDS];
+  int numFields = 1;
+  fields[0] = line;
+  char *tab;
+  while (numFields < SERVE_MAX_FIELDS && (tab = strchr(fields[numFields - 1], '\t')) != NULL)
+  {
+    *tab = '\0';
+    fields[numFields++] = tab + 1;
+  }
+  if (strchr(fields[numFields - 1], '\t') != NULL || fields[0][0] == '\0')
+  {
+    setReply(reply, number, SERVE_INVALID, NULL);
+    return SERVE_INVALID;
+  }
+
+  char *path = fields[0];
+  char *outputDirectory = numFields > 1 && fields[1][0] != '\0' ? fields[1] : SERVE_DEFAULT_OUTPUT;
+  char *filingId = NULL;
+  int includeFilingId = server->includeFilingId;
+  int warn = server->warn;
+  for (int i = 2; i < numFields; i++)
+  {
+    if (strncmp(fields[i], "id=", 3) == 0 && fields[i][3] != '\0')
+    {
+      filingId = fields[i] + 3;
+    }
+    else if (strcmp(fields[i], "include-filing-id") == 0)
+    {
+      includeFilingId = 1;
+    }
+    else if (strcmp(fields[i], "warn") == 0)
+    {
+      warn = 1;
+    }
+    else
+    {
+      fprintf(stderr, "Unknown job option: %s\n", fields[i]);
+      setReply(reply, number, SERVE_INVALID, NULL);
+      return SERVE_INVALID;
+    }
+  }
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Couldn't open file: %s\n", path);
+    setReply(reply, number, BATCH_UNREADABLE, NULL);
+    return BATCH_UNREADABLE;
+  }
+
+  // The filing ID is the file's name up to its extension by default
+  char *name = strrchr(path, DIR_SEPARATOR_CHAR);
+  name = name != NULL ? name + 1 : path;
+  int idLength = filingId != NULL ? strlen(filingId) : strcspn(name, ".");
+  char *id = malloc(idLength + 1);
+  strncpy(id, filingId != NULL ? filingId : name, idLength);
+  id[idLength] = '\0';
+
+  // Output directories end with a separator
+  size_t directoryLength = strlen(outputDirectory);
+  int addSeparator = outputDirectory[directoryLength - 1] != DIR_SEPARATOR_CHAR;
+  char *directory = malloc(directoryLength + 2);
+  strcpy(directory, outputDirectory);
+  if (addSeparator)
+  {
+    strcat(directory, DIR_SEPARATOR);
+  }
+
+  // Jobs are always silent, as replies may be going to stdout
+  FEC_CONTEXT *fec = newFecContext(persistentMemory, ((BufferRead)(&readBuffer)), SERVE_BUFFER_SIZE, NULL, SERVE_BUFFER_SIZE, NULL, 1, file, id, directory, includeFilingId, 1, warn);
+  int status = parseFec(fec) ? BATCH_PARSED : BATCH_FAILED;
+  setReply(reply, number, status, fec);
+  freeFecContext(fec);
+  fclose(file);
+  free(directory);
+  free(id);
+  return status;
+}
+
+// Read a line of any length into the string, without its line ending.
+// Return 0 at the end of the input.
+int readJobLine(FILE *input, STRING *line)
+{
+  size_t length = 0;
+  line->str[0] = '\0';
+  while (fgets(line->str + length, line->n - length, input) != NULL)
+  {
+    length += strlen(line->str + length);
+    if (length > 0 && line->str[length - 1] == '\n')
+    {
+      break;
+    }
+    if (length + 1 == line->n)
+    {
+      growString(line);
+    }
+  }
+  if (length == 0)
+  {
+    return 0;
+  }
+  line->str[strcspn(line->str, "\r\n")] = '\0';
+  return 1;
+}
+
+// Send the reply to a job, counting it as done
+void finishServeJob(SERVE_CONNECTION *connection, int status, STRING *reply)
+{
+#ifdef HAS_PTHREADS
+  pthread_mutex_lock(&connection->lock);
+#endif
+  fputs(reply->str, connection->output);
+  fflush(connection->output);
+  if (status != BATCH_PARSED)
+  {
+    connection->failures++;
+  }
+  connection->pending--;
+#ifdef HAS_PTHREADS
+  if (connection->pending == 0)
+  {
+    pthread_cond_broadcast(&connection->done);
+  }
+  pthread_mutex_unlock(&connection->lock);
+#endif
+}
+
+#ifdef HAS_PTHREADS
+void *serveWorker(void *data)
+{
+  SERVE_WORKER *worker = (SERVE_WORKER *)data;
+  FEC_SERVER *server = worker->server;
+  pthread_mutex_lock(&server->lock);
+  while (1)
+  {
+    while (server->head == NULL && !server->stopping)
+    {
+      pthread_cond_wait(&server->available, &server->lock);
+    }
+    SERVE_JOB *job = server->head;
+    if (job == NULL)
+    {
+      break;
+    }
+    server->head = job->next;
+    if (server->head == NULL)
+    {
+      server->tail = NULL;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    int status = runServeJob(server, worker->persistentMemory, job->line, job->number, worker->reply);
+    finishServeJob(job->connection, status, worker->reply);
+    free(job->line);
+    free(job);
+
+    pthread_mutex_lock(&server->lock);
+  }
+  pthread_mutex_unlock(&server->lock);
+  return NULL;
+}
+
+void queueServeJob(FEC_SERVER *server, SERVE_CONNECTION *connection, char *line, long number)
+{
+  SERVE_JOB *job = (SERVE_JOB *)malloc(sizeof(SERVE_JOB));
+  job->line = malloc(strlen(line) + 1);
+  strcpy(job->line, line);
+  job->number = number;
+  job->connection = connection;
+  job->next = NULL;
+
+  pthread_mutex_lock(&connection->lock);
+  connection->pending++;
+  pthread_mutex_unlock(&connection->lock);
+
+  pthread_mutex_lock(&server->lock);
+  if (server->tail != NULL)
+  {
+    server->tail->next = job;
+  }
+  else
+  {
+    server->head = job;
+  }
+  server->tail = job;
+  pthread_cond_signal(&server->available);
+  pthread_mutex_unlock(&server->lock);
+}
+#endif
+
+FEC_SERVER *newFecServer(PERSISTENT_MEMORY_CONTEXT *persistentMemory, int jobs, int includeFilingId, int warn)
+{
+  FEC_SERVER *server = (FEC_SERVER *)malloc(sizeof(FEC_SERVER));
+  server->persistentMemory = persistentMemory;
+  server->includeFilingId = includeFilingId;
+  server->warn = warn;
+  server->numWorkers = 0;
+  server->workers = NULL;
+#ifdef HAS_PTHREADS
+  server->stopRequested = 0;
+  server->head = NULL;
+  server->tail = NULL;
+  server->stopping = 0;
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->available, NULL);
+  server->sockets = NULL;
+  server->numSockets = 0;
+  server->socketsCapacity = 0;
+  pthread_cond_init(&server->closed, NULL);
+
+  jobs = jobs > 0 ? jobs : 1;
+  server->workers = (SERVE_WORKER *)malloc(sizeof(SERVE_WORKER) * jobs);
+  for (int i = 0; i < jobs; i++)
+  {
+    SERVE_WORKER *worker = &server->workers[i];
+    worker->server = server;
+    worker->persistentMemory = newScratchMemoryContext(persistentMemory->catalog);
+    setOutputBufferBudget(worker->persistentMemory, persistentMemory->bufferPool->budget / jobs);
+    worker->reply = newString(DEFAULT_STRING_SIZE);
+    if (pthread_create(&worker->thread, NULL, serveWorker, worker) != 0)
+    {
+      // Jobs are run in place if no worker started
+      freePersistentMemoryContext(worker->persistentMemory);
+      freeString(worker->reply);
+      break;
+    }
+    server->numWorkers++;
+  }
+#endif
+  return server;
+}
+
+int serveFecJobs(FEC_SERVER *server, FILE *input, FILE *output)
+{
+  SERVE_CONNECTION connection;
+  connection.output = output;
+  connection.pending = 0;
+  connection.failures = 0;
+#ifdef HAS_PTHREADS
+  pthread_mutex_init(&connection.lock, NULL);
+  pthread_cond_init(&connection.done, NULL);
+#endif
+
+  STRING *line = newString(DEFAULT_STRING_SIZE);
+  STRING *reply = newString(DEFAULT_STRING_SIZE);
+  long number = 0;
+  while (readJobLine(input, line))
+  {
+    if (line->str[0] == '\0')
+    {
+      continue;
+    }
+    number++;
+#ifdef HAS_PTHREADS
+    if (server->numWorkers > 0)
+    {
+      queueServeJob(server, &connection, line->str, number);
+      continue;
+    }
+#endif
+    connection.pending++;
+    int status = runServeJob(server, server->persistentMemory, line->str, number, reply);
+    finishServeJob(&connection, status, reply);
+  }
+  freeString(line);
+  freeString(reply);
+
+#ifdef HAS_PTHREADS
+  // Wait for the replies to every job
+  pthread_mutex_lock(&connection.lock);
+  while (connection.pending > 0)
+  {
+    pthread_cond_wait(&connection.done, &connection.lock);
+  }
+  pthread_mutex_unlock(&connection.lock);
+  pthread_mutex_destroy(&connection.lock);
+  pthread_cond_destroy(&connection.done);
+#endif
+  return connection.failures;
+}
+
+#ifdef HAS_PTHREADS
+void stopFecServer(FEC_SERVER *server)
+{
+  __atomic_store_n(&server->stopRequested, 1, __ATOMIC_SEQ_CST);
+}
+
+struct serve_socket
+{
+  FEC_SERVER *server;
+  int fd;
+};
+typedef struct serve_socket SERVE_SOCKET;
+
+// Serve the jobs sent on a connection
+void *serveConnection(void *data)
+{
+  SERVE_SOCKET *serveSocket = (SERVE_SOCKET *)data;
+  FEC_SERVER *server = serveSocket->server;
+  int fd = serveSocket->fd;
+  free(serveSocket);
+
+  int outputFd = dup(fd);
+  FILE *input = fdopen(fd, "r");
+  FILE *output = outputFd >= 0 ? fdopen(outputFd, "w") : NULL;
+  if (input != NULL && output != NULL)
+  {
+    serveFecJobs(server, input, output);
+  }
+  if (output != NULL)
+  {
+    fclose(output);
+  }
+  else if (outputFd >= 0)
+  {
+    close(outputFd);
+  }
+
+  // Stop tracking the socket before closing it, so it isn't shut once
+  // its descriptor is reused
+  pthread_mutex_lock(&server->lock);
+  for (int i = 0; i < server->numSockets; i++)
+  {
+    if (server->sockets[i] == fd)
+    {
+      server->sockets[i] = server->sockets[--server->numSockets];
+      break;
+    }
+  }
+  pthread_cond_broadcast(&server->closed);
+  pthread_mutex_unlock(&server->lock);
+  if (input != NULL)
+  {
+    fclose(input);
+  }
+  else
+  {
+    close(fd);
+  }
+  return NULL;
+}
+
+// Start serving a new connection, on a thread of its own unless jobs
+// are run in place (as they share the persistent memory, connections
+// are then served one at a time). Return 0 if its thread couldn't start.
+int startConnection(FEC_SERVER *server, int fd)
+{
+  pthread_mutex_lock(&server->lock);
+  if (server->numSockets == server->socketsCapacity)
+  {
+    server->socketsCapacity = server->socketsCapacity == 0 ? 16 : server->socketsCapacity * 2;
+    server->sockets = realloc(server->sockets, sizeof(int) * server->socketsCapacity);
+  }
+  server->sockets[server->numSockets++] = fd;
+  pthread_mutex_unlock(&server->lock);
+
+  SERVE_SOCKET *serveSocket = (SERVE_SOCKET *)malloc(sizeof(SERVE_SOCKET));
+  serveSocket->server = server;
+  serveSocket->fd = fd;
+  if (server->numWorkers == 0)
+  {
+    serveConnection(serveSocket);
+    return 1;
+  }
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, serveConnection, serveSocket) != 0)
+  {
+    free(serveSocket);
+    pthread_mutex_lock(&server->lock);
+    server->numSockets--;
+    pthread_mutex_unlock(&server->lock);
+    close(fd);
+    return 0;
+  }
+  pthread_detach(thread);
+  return 1;
+}
+
+int serveFecSocket(FEC_SERVER *server, const char *path)
+{
+  struct sockaddr_un address;
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    fprintf(stderr, "Socket path is too long: %s\n", path);
+    return 0;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  // Replace a socket left by an earlier server, but never another file
+  struct stat existing;
+  if (lstat(path, &existing) == 0)
+  {
+    if (!S_ISSOCK(existing.st_mode))
+    {
+      fprintf(stderr, "Not replacing a file that isn't a socket: %s\n", path);
+      return 0;
+    }
+    unlink(path);
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    fprintf(stderr, "Couldn't open socket: %s\n", path);
+    return 0;
+  }
+  // Jobs read and write any path the server can, so only its own user
+  // may connect (set before listening, so no one connects first)
+  if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || chmod(path, S_IRUSR | S_IWUSR) != 0 || listen(listener, SOMAXCONN) != 0)
+  {
+    fprintf(stderr, "Couldn't listen on socket: %s\n", path);
+    close(listener);
+    return 0;
+  }
+
+  // Clients that hang up before their replies shouldn't end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!__atomic_load_n(&server->stopRequested, __ATOMIC_SEQ_CST))
+  {
+    struct pollfd pending = {listener, POLLIN, 0};
+    if (poll(&pending, 1, SERVE_POLL_MILLISECONDS) <= 0)
+    {
+      continue;
+    }
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0)
+    {
+      if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+      {
+        fprintf(stderr, "Couldn't accept a connection: %s\n", path);
+      }
+      continue;
+    }
+    startConnection(server, fd);
+  }
+  close(listener);
+  unlink(path);
+
+  // Take no more jobs, and wait for the replies to those already sent
+  pthread_mutex_lock(&server->lock);
+  for (int i = 0; i < server->numSockets; i++)
+  {
+    shutdown(server->sockets[i], SHUT_RD);
+  }
+  while (server->numSockets > 0)
+  {
+    pthread_cond_wait(&server->closed, &server->lock);
+  }
+  pthread_mutex_unlock(&server->lock);
+  return 1;
+}
+#else
+int serveFecSocket(FEC_SERVER *server, const char *path)
+{
+  fprintf(stderr, "Serving on a socket isn't available in this build\n");
+  return 0;
+}
+
+void stopFecServer(FEC_SERVER *server)
+{
+}
+#endif
+
+void freeFecServer(FEC_SERVER *server)
+{
+#ifdef HAS_PTHREADS
+  pthread_mutex_lock(&server->lock);
+  server->stopping = 1;
+  pthread_cond_broadcast(&server->available);
+  pthread_mutex_unlock(&server->lock);
+  for (int i = 0; i < server->numWorkers; i++)
+  {
+    pthread_join(server->workers[i].thread, NULL);
+    // Count every worker's output buffers in the shared context's stats
+    BUFFER_POOL *pool = server->workers[i].persistentMemory->bufferPool;
+    server->persistentMemory->bufferPool->peakBufferedBytes += pool->peakBufferedBytes;
+    server->persistentMemory->bufferPool->earlyFlushes += pool->earlyFlushes;
+    freePersistentMemoryContext(server->workers[i].persistentMemory);
+    freeString(server->workers[i].reply);
+  }
+  pthread_mutex_destroy(&server->lock);
+  pthread_cond_destroy(&server->available);
+  pthread_cond_destroy(&server->closed);
+  free(server->sockets);
+#endif
+  free(server->workers);
+  free(server);
+}
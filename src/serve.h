@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+#include "export.h"
+#include "memory.h"
+
+// The outcome of a job: one of a batch's (BATCH_PARSED, ... see batch.h)
+// or that the job itself couldn't be read
+#define SERVE_INVALID 3
+
+// A long-running parser taking jobs one per line, so the mappings it
+// resolves (and its scratch memory) are reused from filing to filing
+// rather than set up by a new process for each. A job is tab separated:
+//
+//   <input path>[\t<output directory>[\t<option>...]]
+//
+// with the output directory output/ if not given, and options
+// id=<filing id> (else the input file's name up to its extension),
+// include-filing-id and warn. Each job gets a reply line:
+//
+//   <job number>\t<status>\t<rows>\t<file>=<rows>[,<file>=<rows>...]
+//
+// numbering jobs from 1 in the order they were sent (replies come back
+// as jobs finish, so may be out of order), with the status parsed,
+// failed, unreadable or invalid, the rows written in all, and the rows
+// in each output file (by form type) the job wrote.
+typedef struct fec_server FEC_SERVER;
+
+// Create a server parsing jobs on up to jobs worker threads (on the
+// thread serving them, without threads), each with its own scratch
+// memory and a share of the output buffer budget but sharing the
+// persistent memory's mapping catalog. Jobs include filing IDs and warn
+// by default if set.
+EXPORT FEC_SERVER *newFecServer(PERSISTENT_MEMORY_CONTEXT *persistentMemory, int jobs, int includeFilingId, int warn);
+
+// Serve the jobs read from input, replying to each on output, until
+// input ends and every job has been replied to. Several inputs can be
+// served at once on different threads. Return the number of jobs that
+// weren't parsed.
+EXPORT int serveFecJobs(FEC_SERVER *server, FILE *input, FILE *output);
+
+// Listen on a Unix domain socket at the path (replacing a socket left
+// there, but no other file), serving the jobs sent on each connection,
+// until stopFecServer is called. The socket is only open to the server's
+// own user, as jobs read and write files with its permissions. Return 0
+// if the socket couldn't be opened or sockets aren't available.
+EXPORT int serveFecSocket(FEC_SERVER *server, const char *path);
+
+// Ask serveFecSocket to stop once the jobs it has been sent are replied
+// to (safe to call from another thread or a signal handler)
+EXPORT void stopFecServer(FEC_SERVER *server);
+
+// Stop the workers and free the server
+EXPORT void freeFecServer(FEC_SERVER *server);
@@ -0,0 +1,86 @@
+#define _XOPEN_SOURCE 500
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fec.h"
+#include "serve.h"
+
+// Benchmarks the time each small filing takes to parse as a job sent to
+// a server (its mappings already resolved) vs as it would in a new run
+// of the CLI, setting up a persistent memory context first (not counting
+// the process starting, which only adds to that)
+
+const int NUM_JOBS = 500;
+const char *FILING = "python/tests/fixtures/13360.fec";
+const char *OUTPUT_DIRECTORY = "serve_bench_output/";
+
+double wallTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+void removeDirectory(const char *path)
+{
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Return the seconds per filing parsed from scratch
+double benchmarkCold()
+{
+  double start = wallTime();
+  for (int i = 0; i < NUM_JOBS; i++)
+  {
+    FILE *file = fopen(FILING, "r");
+    PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+    FEC_CONTEXT *fec = newFecContext(persistentMemory, ((BufferRead)(&readBuffer)), 65536, NULL, 65536, NULL, 1, file, "13360", (char *)OUTPUT_DIRECTORY, 0, 1, 0);
+    parseFec(fec);
+    freeFecContext(fec);
+    freePersistentMemoryContext(persistentMemory);
+    fclose(file);
+  }
+  return (wallTime() - start) / NUM_JOBS;
+}
+
+// Return the seconds per job served, one at a time
+double benchmarkServed()
+{
+  FILE *input = tmpfile();
+  FILE *output = tmpfile();
+  for (int i = 0; i < NUM_JOBS; i++)
+  {
+    fprintf(input, "%s\t%s\n", FILING, OUTPUT_DIRECTORY);
+  }
+  rewind(input);
+
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_SERVER *server = newFecServer(persistentMemory, 1, 0, 0);
+  double start = wallTime();
+  serveFecJobs(server, input, output);
+  double seconds = wallTime() - start;
+  freeFecServer(server);
+  freePersistentMemoryContext(persistentMemory);
+  fclose(input);
+  fclose(output);
+  return seconds / NUM_JOBS;
+}
+
+int main()
+{
+  printf("\nServer job latency benchmark (%d jobs of %s)\n", NUM_JOBS, FILING);
+  double cold = benchmarkCold();
+  removeDirectory(OUTPUT_DIRECTORY);
+  double served = benchmarkServed();
+  removeDirectory(OUTPUT_DIRECTORY);
+  printf("%-12s %8.3f ms/filing\n", "New context", cold * 1e3);
+  printf("%-12s %8.3f ms/filing (%.1fx faster)\n", "Served", served * 1e3, cold / served);
+  return 0;
+}
@@ -0,0 +1,259 @@
+#define _XOPEN_SOURCE 500
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "minunit.h"
+#include "batch.h"
+#include "serve.h"
+
+int tests_run = 0;
+
+// Run from the repository root, like the benchmarks
+const char *OUTPUT_DIRECTORY = "serve_test_output";
+const char *SOCKET_PATH = "serve_test.sock";
+
+// Jobs covering each outcome, and the replies expected to them (in job
+// order, though they may come back in any)
+const char *JOBS =
+    "python/tests/fixtures/13360.fec\tserve_test_output\n"
+    "python/tests/fixtures/1550126.fec\tserve_test_output/\tid=77\tinclude-filing-id\n"
+    "\n"
+    "python/tests/fixtures/missing.fec\tserve_test_output\n"
+    "python/tests/fixtures/13360.fec\tserve_test_output\tunknown-option\n"
+    "\tserve_test_output\n"
+    "python/tests/fixtures/1527862.fec\tserve_test_output\tid=1527862\twarn\n";
+#define NUM_REPLIES 6
+const char *REPLIES[NUM_REPLIES] = {
+    "1\tparsed\t153\theader=1,F3XA=1,SA11A1=139,SA17=1,SB23=8,SB29=3",
+    "2\tparsed\t25\theader=1,F3A=1,SA11AI=4,SA13A=1,SB17=14,SC/10=2,SC2/10=1,SD10=1",
+    "3\tunreadable\t0\t",
+    "4\tinvalid\t0\t",
+    "5\tinvalid\t0\t",
+    "6\tparsed\t2970\theader=1,F3PN=1,SA18=2192,SA20A=32,SB23=364,SB28A=377,SB28C=2,SB29=1",
+};
+
+int removeEntry(const char *path, const struct stat *info, int flag, struct FTW *ftw)
+{
+  return remove(path);
+}
+
+void removeDirectory(const char *path)
+{
+  nftw(path, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Check that every expected reply was read (in any order), and nothing else
+int checkReplies(FILE *replies)
+{
+  int seen[NUM_REPLIES] = {0};
+  int numReplies = 0;
+  char line[1024];
+  rewind(replies);
+  while (fgets(line, sizeof(line), replies) != NULL)
+  {
+    line[strcspn(line, "\n")] = '\0';
+    int matched = 0;
+    for (int i = 0; i < NUM_REPLIES; i++)
+    {
+      if (!seen[i] && strcmp(line, REPLIES[i]) == 0)
+      {
+        seen[i] = matched = 1;
+        break;
+      }
+    }
+    if (!matched)
+    {
+      printf("Unexpected reply: %s\n", line);
+      return 0;
+    }
+    numReplies++;
+  }
+  return numReplies == NUM_REPLIES;
+}
+
+// Check that a job's output is the same as a filing parsed on its own
+int sameAsParsed(const char *path, char *filingId, const char *filename)
+{
+  FILE *file = fopen(path, "r");
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_CONTEXT *ctx = newFecContext(persistentMemory, ((BufferRead)(&readBuffer)), 4096, NULL, 4096, NULL, 1, file, filingId, "serve_test_expected/", 0, 1, 0);
+  parseFec(ctx);
+  freeFecContext(ctx);
+  freePersistentMemoryContext(persistentMemory);
+  fclose(file);
+
+  char expectedPath[256], actualPath[256];
+  sprintf(expectedPath, "serve_test_expected/%s/%s", filingId, filename);
+  sprintf(actualPath, "%s/%s/%s", OUTPUT_DIRECTORY, filingId, filename);
+  FILE *expected = fopen(expectedPath, "rb");
+  FILE *actual = fopen(actualPath, "rb");
+  int same = expected != NULL && actual != NULL;
+  while (same)
+  {
+    int c = fgetc(expected);
+    same = c == fgetc(actual);
+    if (c == EOF)
+    {
+      break;
+    }
+  }
+  if (expected != NULL)
+  {
+    fclose(expected);
+  }
+  if (actual != NULL)
+  {
+    fclose(actual);
+  }
+  removeDirectory("serve_test_expected");
+  return same;
+}
+
+static char *testServeJobs()
+{
+  for (int jobs = 1; jobs <= 3; jobs += 2)
+  {
+    FILE *input = tmpfile();
+    FILE *output = tmpfile();
+    fputs(JOBS, input);
+    rewind(input);
+
+    PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+    FEC_SERVER *server = newFecServer(persistentMemory, jobs, 0, 0);
+    int failures = serveFecJobs(server, input, output);
+    freeFecServer(server);
+    freePersistentMemoryContext(persistentMemory);
+
+    int replied = checkReplies(output);
+    int same = sameAsParsed("python/tests/fixtures/13360.fec", "13360", "SA11A1.csv");
+    fclose(input);
+    fclose(output);
+    removeDirectory(OUTPUT_DIRECTORY);
+    mu_assert("Expected three jobs not to parse", failures == 3);
+    mu_assert("Expected a reply to every job", replied);
+    mu_assert("Expected a job's output to match parsing its filing", same);
+  }
+  return 0;
+}
+
+// Serve on the socket until stopped
+void *runSocketServer(void *data)
+{
+  serveFecSocket((FEC_SERVER *)data, SOCKET_PATH);
+  return NULL;
+}
+
+// Send the jobs on a new connection, and read the replies to them
+int sendJobs(FILE *replies)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, SOCKET_PATH);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  int connected = 0;
+  for (int attempt = 0; attempt < 500 && !connected; attempt++)
+  {
+    // Wait for the server to start listening
+    connected = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    if (!connected)
+    {
+      usleep(10000);
+    }
+  }
+  if (!connected)
+  {
+    close(fd);
+    return 0;
+  }
+  write(fd, JOBS, strlen(JOBS));
+  shutdown(fd, SHUT_WR);
+  char buffer[1024];
+  ssize_t length;
+  while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    fwrite(buffer, 1, length, replies);
+  }
+  close(fd);
+  return 1;
+}
+
+static char *testServeSocket()
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_SERVER *server = newFecServer(persistentMemory, 2, 0, 0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, runSocketServer, server);
+
+  // Two connections, one after the other
+  FILE *first = tmpfile();
+  FILE *second = tmpfile();
+  int sent = sendJobs(first) && sendJobs(second);
+  struct stat info;
+  int private = stat(SOCKET_PATH, &info) == 0 && (info.st_mode & 0777) == 0600;
+  stopFecServer(server);
+  pthread_join(thread, NULL);
+  freeFecServer(server);
+  freePersistentMemoryContext(persistentMemory);
+
+  int replied = checkReplies(first) && checkReplies(second);
+  int removed = access(SOCKET_PATH, F_OK) != 0;
+  fclose(first);
+  fclose(second);
+  removeDirectory(OUTPUT_DIRECTORY);
+  mu_assert("Expected to connect to the socket", sent);
+  mu_assert("Expected only the server's user to be able to connect", private);
+  mu_assert("Expected a reply to every job on every connection", replied);
+  mu_assert("Expected the socket to be removed once stopped", removed);
+  return 0;
+}
+
+static char *testServeKeepsFile()
+{
+  FILE *file = fopen(SOCKET_PATH, "w");
+  fputs("not a socket", file);
+  fclose(file);
+
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_SERVER *server = newFecServer(persistentMemory, 1, 0, 0);
+  int served = serveFecSocket(server, SOCKET_PATH);
+  freeFecServer(server);
+  freePersistentMemoryContext(persistentMemory);
+
+  int kept = access(SOCKET_PATH, F_OK) == 0;
+  remove(SOCKET_PATH);
+  mu_assert("Expected not to serve on a path with another file", !served);
+  mu_assert("Expected the file at the path to be kept", kept);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testServeJobs);
+  mu_run_test(testServeSocket);
+  mu_run_test(testServeKeepsFile);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nServe tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n\n", tests_run);
+
+  return result != 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * Detection of the SIMD instruction sets used by vectorized code paths.
+ *
+ * SSE2 (x86-64) and NEON (AArch64) are part of the base instruction sets, so
+ * they're used whenever the target has them. AVX2 isn't, so functions using it
+ * are compiled with a target attribute and only called if cpuSupportsAvx2().
+ * Define NO_SIMD to only use the portable scalar paths.
+ */
+#pragma once
+
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_SSE2
+#define SIMD_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif !defined(NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Whether the CPU running the code supports AVX2
+static inline int cpuSupportsAvx2()
+{
+#ifdef SIMD_AVX2
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return 0;
+#endif
+}
+
+// Set resolved to the implementation cached in a static function pointer,
+// selecting it with select() (and caching it) the first time. Threads may
+// race to select it, so the pointer is only read and written atomically.
+#define RESOLVE_ONCE(resolved, cached, select)                   \
+  do                                                             \
+  {                                                              \
+    (resolved) = __atomic_load_n(&(cached), __ATOMIC_ACQUIRE);   \
+    if ((resolved) == NULL)                                      \
+    {                                                            \
+      (resolved) = select();                                     \
+      __atomic_store_n(&(cached), (resolved), __ATOMIC_RELEASE); \
+    }                                                            \
+  } while (0)
@@ -0,0 +1,592 @@
+#include "sink.h"
+#include "uring.h"
+#include <stdint.h>
+#include <string.h>
+#if !defined(_WIN32) && !defined(__wasm__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAS_FD_SINK
+#endif
+
+OUTPUT_SINK *newSink()
+{
+  OUTPUT_SINK *sink = (OUTPUT_SINK *)malloc(sizeof(OUTPUT_SINK));
+  sink->open = NULL;
+  sink->write = NULL;
+  sink->swap = NULL;
+  sink->flush = NULL;
+  sink->close = NULL;
+  sink->free = NULL;
+  sink->state = NULL;
+  return sink;
+}
+
+void freeOutputSink(OUTPUT_SINK *sink)
+{
+  if (sink->free != NULL)
+  {
+    sink->free(sink);
+  }
+  free(sink);
+}
+
+// File sink
+
+int fileSinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  (void)sink;
+  char *fullpath = outputFilePath(context, file);
+  file->sinkFile = fopen(fullpath, "w");
+  free(fullpath);
+  return file->sinkFile != NULL;
+}
+
+void fileSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  (void)sink;
+  if (file->sinkFile != NULL)
+  {
+    fwrite(contents, 1, numBytes, (FILE *)file->sinkFile);
+  }
+}
+
+void fileSinkFlush(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  (void)sink;
+  if (file->sinkFile != NULL)
+  {
+    fflush((FILE *)file->sinkFile);
+  }
+}
+
+void fileSinkClose(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  (void)sink;
+  if (file->sinkFile != NULL)
+  {
+    fclose((FILE *)file->sinkFile);
+  }
+}
+
+OUTPUT_SINK *newFileSink()
+{
+  OUTPUT_SINK *sink = newSink();
+  sink->open = fileSinkOpen;
+  sink->write = fileSinkWrite;
+  sink->flush = fileSinkFlush;
+  sink->close = fileSinkClose;
+  return sink;
+}
+
+// Fd sink
+
+#ifdef HAS_FD_SINK
+int fdSinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  (void)sink;
+  char *fullpath = outputFilePath(context, file);
+  int fd = open(fullpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  free(fullpath);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  // Store the fd itself as the handle (offset so fd 0 isn't NULL)
+  file->sinkFile = (void *)(intptr_t)(fd + 1);
+  return 1;
+}
+
+void fdSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  (void)sink;
+  if (file->sinkFile == NULL)
+  {
+    return;
+  }
+  int fd = (int)(intptr_t)file->sinkFile - 1;
+  while (numBytes > 0)
+  {
+    ssize_t written = write(fd, contents, numBytes);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      fprintf(stderr, "Couldn't write output file: %s%s\n", file->filename, file->extension);
+      return;
+    }
+    contents += written;
+    numBytes -= written;
+  }
+}
+
+void fdSinkClose(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  (void)sink;
+  if (file->sinkFile != NULL)
+  {
+    close((int)(intptr_t)file->sinkFile - 1);
+  }
+}
+
+OUTPUT_SINK *newFdSink()
+{
+  OUTPUT_SINK *sink = newSink();
+  sink->open = fdSinkOpen;
+  sink->write = fdSinkWrite;
+  sink->close = fdSinkClose;
+  return sink;
+}
+#else
+OUTPUT_SINK *newFdSink()
+{
+  return newFileSink();
+}
+#endif
+
+// io_uring sink
+
+#if defined(HAS_FD_SINK) && defined(HAS_IO_URING)
+// How many writes to queue before submitting them together
+#define URING_SINK_BATCH 16
+#define URING_SINK_ENTRIES 64
+// How many buffers of completed writes to keep to hand back
+#define URING_SINK_SPARES URING_SINK_ENTRIES
+
+struct uring_file
+{
+  int fd;
+  char *name;      // for messages, as the output file may be freed first
+  uint64_t offset; // where the next write goes
+  int pending;     // writes submitted but not completed
+  int closed;      // to free once its last write completes
+};
+typedef struct uring_file URING_FILE;
+
+// A write in flight, owning its buffer until it completes
+struct uring_write
+{
+  URING_FILE *file;
+  char *contents;
+  int numBytes;
+  int capacity; // to keep the buffer as a spare, or 0 to free it
+  uint64_t offset;
+};
+typedef struct uring_write URING_WRITE;
+
+struct uring_sink
+{
+  URING *ring;
+  int unsubmitted; // writes queued since the last submit
+  int failed;      // waiting on the ring failed, so writes go directly
+
+  // Buffers of completed writes, to swap for full ones
+  char **spares;
+  int *spareSizes;
+  int numSpares;
+};
+typedef struct uring_sink URING_SINK;
+
+void freeUringFile(URING_FILE *uringFile)
+{
+  close(uringFile->fd);
+  free(uringFile->name);
+  free(uringFile);
+}
+
+// Return a spare buffer of the given capacity (most recently kept
+// first), or NULL if there isn't one
+char *takeUringSpare(URING_SINK *uringSink, int capacity)
+{
+  for (int i = uringSink->numSpares - 1; i >= 0; i--)
+  {
+    if (uringSink->spareSizes[i] == capacity)
+    {
+      char *spare = uringSink->spares[i];
+      uringSink->numSpares--;
+      uringSink->spares[i] = uringSink->spares[uringSink->numSpares];
+      uringSink->spareSizes[i] = uringSink->spareSizes[uringSink->numSpares];
+      return spare;
+    }
+  }
+  return NULL;
+}
+
+// Finish a completed write, writing any remainder directly if it was
+// short or failed (as on kernels without io_uring writes)
+void completeUringWrite(URING_SINK *uringSink, URING_WRITE *write, int result)
+{
+  URING_FILE *uringFile = write->file;
+  int written = result > 0 ? result : 0;
+  while (written < write->numBytes)
+  {
+    ssize_t n = pwrite(uringFile->fd, write->contents + written, write->numBytes - written, write->offset + written);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      fprintf(stderr, "Couldn't write output file: %s\n", uringFile->name);
+      break;
+    }
+    written += n;
+  }
+  if (write->capacity > 0 && uringSink->numSpares < URING_SINK_SPARES)
+  {
+    uringSink->spares[uringSink->numSpares] = write->contents;
+    uringSink->spareSizes[uringSink->numSpares] = write->capacity;
+    uringSink->numSpares++;
+  }
+  else
+  {
+    free(write->contents);
+  }
+  uringFile->pending--;
+  if (uringFile->closed && uringFile->pending == 0)
+  {
+    freeUringFile(uringFile);
+  }
+  free(write);
+}
+
+// Wait for one write to complete. Return 0 if there are none, or the
+// ring failed (leaving the writes in flight to it).
+int waitUringWrite(URING_SINK *uringSink)
+{
+  uint64_t tag;
+  int result;
+  if (uringSink->failed)
+  {
+    return 0;
+  }
+  if (!uringWait(uringSink->ring, &tag, &result))
+  {
+    uringSink->failed = uringPending(uringSink->ring) > 0;
+    return 0;
+  }
+  completeUringWrite(uringSink, (URING_WRITE *)(uintptr_t)tag, result);
+  return 1;
+}
+
+int uringSinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  (void)sink;
+  char *fullpath = outputFilePath(context, file);
+  int fd = open(fullpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+  {
+    free(fullpath);
+    return 0;
+  }
+  URING_FILE *uringFile = (URING_FILE *)malloc(sizeof(URING_FILE));
+  uringFile->fd = fd;
+  uringFile->name = fullpath;
+  uringFile->offset = 0;
+  uringFile->pending = 0;
+  uringFile->closed = 0;
+  file->sinkFile = uringFile;
+  return 1;
+}
+
+// Queue a write of a buffer the sink now owns (keeping it as a spare
+// once written if capacity is set, else freeing it)
+void queueUringWrite(URING_SINK *uringSink, URING_FILE *uringFile, char *contents, int numBytes, int capacity)
+{
+  URING *ring = uringSink->ring;
+  while (!uringHasSpace(ring) && waitUringWrite(uringSink))
+  {
+    uringSink->unsubmitted = 0; // waiting submits them
+  }
+
+  // Writes go to explicit offsets, so they can complete in any order
+  URING_WRITE *write = (URING_WRITE *)malloc(sizeof(URING_WRITE));
+  write->file = uringFile;
+  write->contents = contents;
+  write->numBytes = numBytes;
+  write->capacity = capacity;
+  write->offset = uringFile->offset;
+  uringFile->offset += numBytes;
+  uringFile->pending++;
+  if (!uringSink->failed && uringHasSpace(ring))
+  {
+    uringWrite(ring, uringFile->fd, write->contents, numBytes, write->offset, (uint64_t)(uintptr_t)write);
+    if (++uringSink->unsubmitted == URING_SINK_BATCH)
+    {
+      uringSubmit(ring);
+      uringSink->unsubmitted = 0;
+    }
+  }
+  else
+  {
+    // The ring failed; write directly
+    completeUringWrite(uringSink, write, 0);
+  }
+}
+
+// Write a copy of a buffer its writer will reuse
+void uringSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  URING_FILE *uringFile = (URING_FILE *)file->sinkFile;
+  if (uringFile == NULL)
+  {
+    return;
+  }
+  char *copy = malloc(numBytes);
+  memcpy(copy, contents, numBytes);
+  queueUringWrite((URING_SINK *)sink->state, uringFile, copy, numBytes, 0);
+}
+
+// Write a full buffer as it is, handing back a written one
+char *uringSinkSwap(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *buffer, int length, int capacity)
+{
+  URING_SINK *uringSink = (URING_SINK *)sink->state;
+  URING_FILE *uringFile = (URING_FILE *)file->sinkFile;
+  if (uringFile == NULL)
+  {
+    return buffer;
+  }
+  queueUringWrite(uringSink, uringFile, buffer, length, capacity);
+  char *empty = takeUringSpare(uringSink, capacity);
+  return empty != NULL ? empty : malloc(capacity);
+}
+
+// Wait for all of a file's writes to land
+void uringSinkFlush(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  URING_FILE *uringFile = (URING_FILE *)file->sinkFile;
+  URING_SINK *uringSink = (URING_SINK *)sink->state;
+  uringSink->unsubmitted = 0; // waiting submits them
+  while (uringFile != NULL && uringFile->pending > 0 && waitUringWrite(uringSink))
+  {
+  }
+  if (uringFile != NULL && uringFile->pending > 0)
+  {
+    fprintf(stderr, "Couldn't finish writing output file: %s\n", uringFile->name);
+    file->context->writeFailed = 1;
+  }
+}
+
+void uringSinkClose(OUTPUT_SINK *sink, OUTPUT_FILE *file)
+{
+  URING_FILE *uringFile = (URING_FILE *)file->sinkFile;
+  if (uringFile != NULL)
+  {
+    uringSinkFlush(sink, file);
+    // Writes the ring still has in flight free the file as they complete
+    uringFile->closed = 1;
+    if (uringFile->pending == 0)
+    {
+      freeUringFile(uringFile);
+    }
+    file->sinkFile = NULL;
+  }
+}
+
+void uringSinkFree(OUTPUT_SINK *sink)
+{
+  URING_SINK *uringSink = (URING_SINK *)sink->state;
+  while (waitUringWrite(uringSink))
+  {
+  }
+  // If the ring failed with writes in flight, it (and their buffers and
+  // files) can't be freed while the kernel may still use them
+  if (!uringSink->failed)
+  {
+    freeUring(uringSink->ring);
+  }
+  for (int i = 0; i < uringSink->numSpares; i++)
+  {
+    free(uringSink->spares[i]);
+  }
+  free(uringSink->spares);
+  free(uringSink->spareSizes);
+  free(uringSink);
+}
+
+OUTPUT_SINK *newUringSink()
+{
+  URING *ring = newUring(URING_SINK_ENTRIES);
+  if (ring == NULL)
+  {
+    return newFdSink();
+  }
+  OUTPUT_SINK *sink = newSink();
+  URING_SINK *uringSink = (URING_SINK *)malloc(sizeof(URING_SINK));
+  uringSink->ring = ring;
+  uringSink->unsubmitted = 0;
+  uringSink->failed = 0;
+  uringSink->spares = (char **)malloc(sizeof(char *) * URING_SINK_SPARES);
+  uringSink->spareSizes = (int *)malloc(sizeof(int) * URING_SINK_SPARES);
+  uringSink->numSpares = 0;
+  sink->state = uringSink;
+  sink->open = uringSinkOpen;
+  sink->write = uringSinkWrite;
+  sink->swap = uringSinkSwap;
+  sink->flush = uringSinkFlush;
+  sink->close = uringSinkClose;
+  sink->free = uringSinkFree;
+  return sink;
+}
+#else
+OUTPUT_SINK *newUringSink()
+{
+  return newFdSink();
+}
+#endif
+
+// Memory sink
+
+struct memory_file
+{
+  char *filename;
+  char *extension;
+  STRING *contents;
+  int length;
+};
+typedef struct memory_file MEMORY_FILE;
+
+struct memory_sink
+{
+  MEMORY_FILE **files;
+  int nfiles;
+  int capacity;
+};
+typedef struct memory_sink MEMORY_SINK;
+
+int memorySinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  (void)context;
+  MEMORY_SINK *memory = (MEMORY_SINK *)sink->state;
+  if (memory->nfiles == memory->capacity)
+  {
+    memory->capacity = memory->capacity == 0 ? 16 : memory->capacity * 2;
+    memory->files = (MEMORY_FILE **)realloc(memory->files, sizeof(MEMORY_FILE *) * memory->capacity);
+  }
+  MEMORY_FILE *memoryFile = (MEMORY_FILE *)malloc(sizeof(MEMORY_FILE));
+  memoryFile->filename = malloc(strlen(file->filename) + 1);
+  strcpy(memoryFile->filename, file->filename);
+  memoryFile->extension = malloc(strlen(file->extension) + 1);
+  strcpy(memoryFile->extension, file->extension);
+  memoryFile->contents = newString(DEFAULT_STRING_SIZE);
+  memoryFile->contents->str[0] = 0;
+  memoryFile->length = 0;
+  memory->files[memory->nfiles++] = memoryFile;
+  file->sinkFile = memoryFile;
+  return 1;
+}
+
+void memorySinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  (void)sink;
+  MEMORY_FILE *memoryFile = (MEMORY_FILE *)file->sinkFile;
+  size_t needed = memoryFile->length + numBytes + 1;
+  if (needed > memoryFile->contents->n)
+  {
+    // Grow geometrically so appending stays linear
+    growStringTo(memoryFile->contents, needed > memoryFile->contents->n * 2 ? needed : memoryFile->contents->n * 2);
+  }
+  memcpy(memoryFile->contents->str + memoryFile->length, contents, numBytes);
+  memoryFile->length += numBytes;
+  memoryFile->contents->str[memoryFile->length] = 0;
+}
+
+void memorySinkFree(OUTPUT_SINK *sink)
+{
+  MEMORY_SINK *memory = (MEMORY_SINK *)sink->state;
+  for (int i = 0; i < memory->nfiles; i++)
+  {
+    free(memory->files[i]->filename);
+    free(memory->files[i]->extension);
+    freeString(memory->files[i]->contents);
+    free(memory->files[i]);
+  }
+  free(memory->files);
+  free(memory);
+}
+
+OUTPUT_SINK *newMemorySink()
+{
+  OUTPUT_SINK *sink = newSink();
+  MEMORY_SINK *memory = (MEMORY_SINK *)malloc(sizeof(MEMORY_SINK));
+  memory->files = NULL;
+  memory->nfiles = 0;
+  memory->capacity = 0;
+  sink->state = memory;
+  sink->open = memorySinkOpen;
+  sink->write = memorySinkWrite;
+  sink->free = memorySinkFree;
+  return sink;
+}
+
+int getMemorySinkNumFiles(OUTPUT_SINK *sink)
+{
+  return ((MEMORY_SINK *)sink->state)->nfiles;
+}
+
+int getMemorySinkFile(OUTPUT_SINK *sink, int index, char **filename, char **extension, char **contents)
+{
+  MEMORY_FILE *memoryFile = ((MEMORY_SINK *)sink->state)->files[index];
+  *filename = memoryFile->filename;
+  *extension = memoryFile->extension;
+  *contents = memoryFile->contents->str;
+  return memoryFile->length;
+}
+
+// Null sink
+
+int nullSinkOpen(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  (void)sink;
+  (void)context;
+  (void)file;
+  return 1;
+}
+
+void nullSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  (void)sink;
+  (void)file;
+  (void)contents;
+  (void)numBytes;
+}
+
+OUTPUT_SINK *newNullSink()
+{
+  OUTPUT_SINK *sink = newSink();
+  sink->open = nullSinkOpen;
+  sink->write = nullSinkWrite;
+  return sink;
+}
+
+// Callback sink
+
+struct callback_sink
+{
+  CustomWriteFunction customWriteFunction;
+};
+typedef struct callback_sink CALLBACK_SINK;
+
+void callbackSinkWrite(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes)
+{
+  ((CALLBACK_SINK *)sink->state)->customWriteFunction(file->filename, file->extension, contents, numBytes);
+}
+
+void callbackSinkFree(OUTPUT_SINK *sink)
+{
+  free(sink->state);
+}
+
+OUTPUT_SINK *newCallbackSink(CustomWriteFunction customWriteFunction)
+{
+  OUTPUT_SINK *sink = newSink();
+  CALLBACK_SINK *callback = (CALLBACK_SINK *)malloc(sizeof(CALLBACK_SINK));
+  callback->customWriteFunction = customWriteFunction;
+  sink->state = callback;
+  sink->open = nullSinkOpen;
+  sink->write = callbackSinkWrite;
+  sink->free = callbackSinkFree;
+  return sink;
+}
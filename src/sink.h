@@ -0,0 +1,43 @@
+#pragma once
+
+#include "export.h"
+#include "writer.h"
+
+// Built-in output sinks (see OUTPUT_SINK in writer.h). File and fd sinks
+// write under the write context's output directory and filing ID.
+
+// An empty sink (with no functions or state) to fill in
+OUTPUT_SINK *newSink();
+
+// Write each output file through a buffered stdio file
+EXPORT OUTPUT_SINK *newFileSink();
+
+// Write each output file straight to a raw file descriptor, skipping
+// stdio's second copy of every buffer (a file sink where fds aren't
+// available)
+EXPORT OUTPUT_SINK *newFdSink();
+
+// Write each output file like an fd sink, but queue the writes on an
+// io_uring and submit them in batches, only waiting for them when a file
+// is flushed or closed (an fd sink where io_uring isn't available)
+EXPORT OUTPUT_SINK *newUringSink();
+
+// Keep each output file in a growable memory buffer, to be read after
+// parsing (with getMemorySinkFile) until the sink is freed
+EXPORT OUTPUT_SINK *newMemorySink();
+
+// Discard all output (to measure parsing alone)
+EXPORT OUTPUT_SINK *newNullSink();
+
+// Pass output to a custom write function as each buffer fills
+EXPORT OUTPUT_SINK *newCallbackSink(CustomWriteFunction customWriteFunction);
+
+EXPORT void freeOutputSink(OUTPUT_SINK *sink);
+
+// The number of output files in a memory sink
+EXPORT int getMemorySinkNumFiles(OUTPUT_SINK *sink);
+
+// Get the filename, extension and contents of an output file in a memory
+// sink (in the order the files were opened). Return the length of the
+// contents, which are null terminated.
+EXPORT int getMemorySinkFile(OUTPUT_SINK *sink, int index, char **filename, char **extension, char **contents);
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "writer.h"
+#include "sink.h"
+
+int tests_run = 0;
+
+char *testExt = ".csv";
+
+// Write a few rows to two files, with a buffer small enough to flush often
+void writeRows(WRITE_CONTEXT *ctx)
+{
+  int opened;
+  OUTPUT_FILE *first = openFile(ctx, "F3", testExt, &opened);
+  OUTPUT_FILE *second = openFile(ctx, "SA11AI", testExt, &opened);
+  writeFileString(ctx, first, "form_type,amount\n");
+  writeFileString(ctx, second, "form_type,name\n");
+  for (int i = 0; i < 10; i++)
+  {
+    writeFileString(ctx, second, "SA11AI,Smith\n");
+  }
+  writeFileString(ctx, first, "F3,100.00\n");
+}
+
+// Read a file in full into a string
+int readFile(const char *path, char *contents, int size)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    return -1;
+  }
+  int length = fread(contents, 1, size - 1, file);
+  contents[length] = 0;
+  fclose(file);
+  return length;
+}
+
+char expectedSA11AI[200];
+
+void initExpected()
+{
+  strcpy(expectedSA11AI, "form_type,name\n");
+  for (int i = 0; i < 10; i++)
+  {
+    strcat(expectedSA11AI, "SA11AI,Smith\n");
+  }
+}
+
+static char *testMemorySink()
+{
+  initExpected();
+  OUTPUT_SINK *sink = newMemorySink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 8, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  writeRows(ctx);
+  flushWriteContext(ctx);
+
+  // The output is complete once flushed, in the order files were opened
+  char *filename;
+  char *extension;
+  char *contents;
+  mu_assert("Expected two files", getMemorySinkNumFiles(sink) == 2);
+  int length = getMemorySinkFile(sink, 0, &filename, &extension, &contents);
+  mu_assert("Expected the first file to be F3", strcmp(filename, "F3") == 0 && strcmp(extension, testExt) == 0);
+  mu_assert("Expected the F3 contents", strcmp(contents, "form_type,amount\nF3,100.00\n") == 0 && length == 27);
+  length = getMemorySinkFile(sink, 1, &filename, &extension, &contents);
+  mu_assert("Expected the second file to be SA11AI", strcmp(filename, "SA11AI") == 0);
+  mu_assert("Expected the SA11AI contents", strcmp(contents, expectedSA11AI) == 0 && length == (int)strlen(expectedSA11AI));
+
+  // The sink outlives the write context
+  freeWriteContext(ctx);
+  mu_assert("Expected the files to be kept", getMemorySinkNumFiles(sink) == 2);
+  freeOutputSink(sink);
+  return 0;
+}
+
+static char *testNullSink()
+{
+  OUTPUT_SINK *sink = newNullSink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 8, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  writeRows(ctx);
+  freeWriteContext(ctx);
+  freeOutputSink(sink);
+  return 0;
+}
+
+// Write rows to files through a sink (with buffers from a pool and
+// written on an I/O thread, if set) and check what's on disk
+static char *checkFileOutput(OUTPUT_SINK *sink, char *filingId, BUFFER_POOL *pool, int async)
+{
+  initExpected();
+  char contents[500];
+  char path[200];
+  WRITE_CONTEXT *ctx = newWriteContext("sink_test_output/", filingId, 0, 8, NULL, NULL);
+  setWriteContextSink(ctx, sink);
+  if (pool != NULL)
+  {
+    setWriteContextPool(ctx, pool);
+  }
+  if (async)
+  {
+    startAsyncWriter(ctx, 2);
+  }
+  writeRows(ctx);
+  freeWriteContext(ctx);
+  freeOutputSink(sink);
+
+  sprintf(path, "sink_test_output/%s/F3.csv", filingId);
+  mu_assert("Expected the F3 file", readFile(path, contents, sizeof(contents)) == 27);
+  mu_assert("Expected the F3 contents", strcmp(contents, "form_type,amount\nF3,100.00\n") == 0);
+  remove(path);
+  sprintf(path, "sink_test_output/%s/SA11AI.csv", filingId);
+  mu_assert("Expected the SA11AI file", readFile(path, contents, sizeof(contents)) > 0);
+  mu_assert("Expected the SA11AI contents", strcmp(contents, expectedSA11AI) == 0);
+  remove(path);
+  sprintf(path, "sink_test_output/%s", filingId);
+  remove(path);
+  return 0;
+}
+
+static char *testFileSink()
+{
+  return checkFileOutput(newFileSink(), "file", NULL, 0);
+}
+
+static char *testFdSink()
+{
+  return checkFileOutput(newFdSink(), "fd", NULL, 0);
+}
+
+static char *testUringSink()
+{
+  char *result = checkFileOutput(newUringSink(), "uring", NULL, 0);
+
+  // Buffers handed to the ring are swapped for written ones, including
+  // pooled buffers of several sizes and from an I/O thread
+  BUFFER_POOL *pool = newBufferPool(1 << 20, 2);
+  for (int async = 0; result == 0 && async <= 1; async++)
+  {
+    result = checkFileOutput(newUringSink(), "uring", pool, async);
+  }
+  freeBufferPool(pool);
+  remove("sink_test_output");
+  return result;
+}
+
+char callbackOutput[500];
+
+void writeToOutput(char *filename, char *extension, char *contents, int numBytes)
+{
+  if (strcmp(filename, "SA11AI") == 0)
+  {
+    strncat(callbackOutput, contents, numBytes);
+  }
+}
+
+static char *testCallbackSink()
+{
+  initExpected();
+  callbackOutput[0] = 0;
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 8, writeToOutput, NULL);
+  writeRows(ctx);
+  freeWriteContext(ctx);
+  mu_assert("Expected the callback to get all the output", strcmp(callbackOutput, expectedSA11AI) == 0);
+  return 0;
+}
+
+static char *all_tests()
+{
+  mu_run_test(testMemorySink);
+  mu_run_test(testNullSink);
+  mu_run_test(testFileSink);
+  mu_run_test(testFdSink);
+  mu_run_test(testUringSink);
+  mu_run_test(testCallbackSink);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  printf("\nSink tests\n");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    printf("%s\n", result);
+  }
+  else
+  {
+    printf("ALL TESTS PASSED\n");
+  }
+  printf("Tests run: %d\n", tests_run);
+
+  return result != 0;
+}
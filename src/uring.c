@@ -0,0 +1,266 @@
+#include "uring.h"
+#include <stdlib.h>
+
+#ifdef HAS_IO_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring
+{
+  int fd;
+  unsigned entries;
+  unsigned queued;   // in the submission ring but not yet submitted
+  unsigned inFlight; // submitted but not yet completed
+
+  // Submission ring (the kernel consumes from head, we fill at tail)
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+
+  // Completion ring (the kernel fills at tail, we consume from head)
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+};
+
+URING *newUring(unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+
+  URING *ring = (URING *)malloc(sizeof(URING));
+  ring->fd = fd;
+  ring->entries = params.sq_entries;
+  ring->queued = 0;
+  ring->inFlight = 0;
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  // Newer kernels map both rings at once
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cqRingSize > ring->sqRingSize)
+    {
+      ring->sqRingSize = ring->cqRingSize;
+    }
+    ring->cqRingSize = ring->sqRingSize;
+  }
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ring->cqRing = ring->sqRing;
+  if (ring->sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  }
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    if (ring->sqRing != MAP_FAILED)
+    {
+      munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing)
+    {
+      munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqes != MAP_FAILED)
+    {
+      munmap(ring->sqes, ring->sqesSize);
+    }
+    close(fd);
+    free(ring);
+    return NULL;
+  }
+
+  char *sq = (char *)ring->sqRing;
+  ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  char *cq = (char *)ring->cqRing;
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return ring;
+}
+
+int uringHasSpace(URING *ring)
+{
+  // Keep completions from ever overflowing by bounding what's in flight
+  return ring->queued + ring->inFlight < ring->entries;
+}
+
+int uringPending(URING *ring)
+{
+  return ring->queued + ring->inFlight;
+}
+
+void queueOperation(URING *ring, int opcode, int fd, const char *buffer, unsigned length, uint64_t offset, uint64_t tag)
+{
+  unsigned tail = *ring->sqTail;
+  unsigned index = tail & ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = length;
+  sqe->off = offset;
+  sqe->user_data = tag;
+  ring->sqArray[index] = index;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+void uringRead(URING *ring, int fd, char *buffer, unsigned length, uint64_t offset, uint64_t tag)
+{
+  queueOperation(ring, IORING_OP_READ, fd, buffer, length, offset, tag);
+}
+
+void uringWrite(URING *ring, int fd, const char *buffer, unsigned length, uint64_t offset, uint64_t tag)
+{
+  queueOperation(ring, IORING_OP_WRITE, fd, buffer, length, offset, tag);
+}
+
+// Submit what's queued, optionally waiting for at least one completion
+int enterRing(URING *ring, unsigned minComplete)
+{
+  while (1)
+  {
+    int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return 0;
+    }
+    ring->queued -= submitted;
+    ring->inFlight += submitted;
+    return 1;
+  }
+}
+
+int uringSubmit(URING *ring)
+{
+  if (ring->queued == 0)
+  {
+    return 1;
+  }
+  return enterRing(ring, 0);
+}
+
+int uringWait(URING *ring, uint64_t *tag, int *result)
+{
+  if (ring->queued == 0 && ring->inFlight == 0)
+  {
+    return 0;
+  }
+  while (1)
+  {
+    unsigned head = *ring->cqHead;
+    if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+      *tag = cqe->user_data;
+      *result = cqe->res;
+      __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+      ring->inFlight--;
+      return 1;
+    }
+    if (!enterRing(ring, 1))
+    {
+      return 0;
+    }
+  }
+}
+
+void freeUring(URING *ring)
+{
+  munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing != ring->sqRing)
+  {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+  free(ring);
+}
+#else
+URING *newUring(unsigned entries)
+{
+  (void)entries;
+  return NULL;
+}
+
+int uringHasSpace(URING *ring)
+{
+  (void)ring;
+  return 0;
+}
+
+int uringPending(URING *ring)
+{
+  (void)ring;
+  return 0;
+}
+
+void uringRead(URING *ring, int fd, char *buffer, unsigned length, uint64_t offset, uint64_t tag)
+{
+  (void)ring;
+  (void)fd;
+  (void)buffer;
+  (void)length;
+  (void)offset;
+  (void)tag;
+}
+
+void uringWrite(URING *ring, int fd, const char *buffer, unsigned length, uint64_t offset, uint64_t tag)
+{
+  (void)ring;
+  (void)fd;
+  (void)buffer;
+  (void)length;
+  (void)offset;
+  (void)tag;
+}
+
+int uringSubmit(URING *ring)
+{
+  (void)ring;
+  return 0;
+}
+
+int uringWait(URING *ring, uint64_t *tag, int *result)
+{
+  (void)ring;
+  (void)tag;
+  (void)result;
+  return 0;
+}
+
+void freeUring(URING *ring)
+{
+  (void)ring;
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A minimal wrapper around a Linux io_uring (without liburing), for
+// queueing reads and writes and submitting them in batches
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING
+#endif
+#endif
+
+typedef struct uring URING;
+
+// Set up a ring with room for entries operations in flight. Return NULL
+// if io_uring isn't available (not Linux, too old a kernel, or blocked).
+URING *newUring(unsigned entries);
+
+// Return whether another operation can be queued before waiting for one
+// to complete
+int uringHasSpace(URING *ring);
+
+// Return the number of operations queued or submitted but not completed
+int uringPending(URING *ring);
+
+// Queue a read or write at an offset in a file, to be submitted with the
+// next uringSubmit or uringWait. The tag is returned with its completion.
+void uringRead(URING *ring, int fd, char *buffer, unsigned length, uint64_t offset, uint64_t tag);
+
+void uringWrite(URING *ring, int fd, const char *buffer, unsigned length, uint64_t offset, uint64_t tag);
+
+// Submit all queued operations. Return 0 on failure.
+int uringSubmit(URING *ring);
+
+// Submit all queued operations and wait for one to complete, setting its
+// tag and result (bytes transferred, or a negative errno). Return 0 on
+// failure.
+int uringWait(URING *ring, uint64_t *tag, int *result);
+
+void freeUring(URING *ring);
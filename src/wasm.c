@@ -11,3 +11,14 @@ void wasmFec(int bufferSize)
   freeFecContext(fec);
   freePersistentMemoryContext(persistentMemory);
 }
+
+// Parse a filing already copied into the wasm heap, without read callbacks
+void wasmFecRegion(const char *data, int length, int bufferSize)
+{
+  PERSISTENT_MEMORY_CONTEXT *persistentMemory = newPersistentMemoryContext();
+  FEC_CONTEXT *fec = newFecContext(persistentMemory, NULL, 0, ((CustomWriteFunction)(&wasmBufferWrite)), bufferSize, NULL, 0, NULL, NULL, NULL, 0, 1, 0);
+  setInputRegion(fec, data, length);
+  parseFec(fec);
+  freeFecContext(fec);
+  freePersistentMemoryContext(persistentMemory);
+}
@@ -1,5 +1,8 @@
 #include "memory.h"
 #include "writer.h"
+#include "sink.h"
+#include "async.h"
+#include "compress.h"
 #include <string.h>
 #include <limits.h>
 #include <sys/stat.h>
@@ -88,7 +91,7 @@ void normalize_filename(char *filename)
 BUFFER_FILE *newBufferFile(int bufferSize)
 {
   BUFFER_FILE *bufferFile = (BUFFER_FILE *)malloc(sizeof(BUFFER_FILE));
-  bufferFile->buffer = malloc(bufferSize);
+  bufferFile->buffer = bufferSize > 0 ? malloc(bufferSize) : NULL;
   bufferFile->bufferPos = 0;
   bufferFile->bufferSize = bufferSize;
   return bufferFile;
@@ -100,31 +103,109 @@ void freeBufferFile(BUFFER_FILE *bufferFile)
   free(bufferFile);
 }
 
+BUFFER_POOL *newBufferPool(long budget, int initialSize)
+{
+  BUFFER_POOL *pool = (BUFFER_POOL *)malloc(sizeof(BUFFER_POOL));
+  pool->budget = budget;
+  pool->initialSize = initialSize;
+  pool->bufferedBytes = 0;
+  pool->peakBufferedBytes = 0;
+  pool->earlyFlushes = 0;
+  pool->idleBuffers = NULL;
+  pool->idleSizes = NULL;
+  pool->numIdle = 0;
+  pool->idleCapacity = 0;
+  pool->idleBytes = 0;
+  pool->lruHead = NULL;
+  pool->lruTail = NULL;
+  return pool;
+}
+
+void freeBufferPool(BUFFER_POOL *pool)
+{
+  for (int i = 0; i < pool->numIdle; i++)
+  {
+    free(pool->idleBuffers[i]);
+  }
+  free(pool->idleBuffers);
+  free(pool->idleSizes);
+  free(pool);
+}
+
 WRITE_CONTEXT *newWriteContext(char *outputDirectory, char *filingId, int writeToFile, int bufferSize, CustomWriteFunction customWriteFunction, CustomLineFunction customLineFunction)
 {
   WRITE_CONTEXT *context = (WRITE_CONTEXT *)malloc(sizeof(WRITE_CONTEXT));
   context->outputDirectory = outputDirectory;
   context->filingId = filingId;
-  context->writeToFile = writeToFile;
   context->bufferSize = bufferSize;
-  context->filenames = NULL;
-  context->extensions = NULL;
-  context->bufferFiles = NULL;
   context->files = NULL;
   context->nfiles = 0;
-  context->lastname = NULL;
-  context->lastBufferFile = NULL;
-  context->lastfile = NULL;
+  context->filesCapacity = 0;
+  context->numFileBuckets = 16;
+  context->fileBuckets = calloc(context->numFileBuckets, sizeof(OUTPUT_FILE *));
+  context->lastFile = NULL;
   context->local = 0;
   context->localBuffer = NULL;
   context->useCustomLine = customLineFunction != NULL;
   context->customLineBuffer = context->useCustomLine ? newString(DEFAULT_STRING_SIZE) : NULL;
-  context->customWriteFunction = customWriteFunction;
+  if (customWriteFunction != NULL)
+  {
+    context->sink = newCallbackSink(customWriteFunction);
+  }
+  else if (writeToFile)
+  {
+    context->sink = newFileSink();
+  }
+  else
+  {
+    context->sink = newNullSink();
+  }
+  context->ownsSink = 1;
+  context->asyncWriter = NULL;
+  context->pool = NULL;
+  context->writeFailed = 0;
   context->customLineFunction = customLineFunction;
   initializeCustomWriteContext(context);
   return context;
 }
 
+void setWriteContextSink(WRITE_CONTEXT *context, OUTPUT_SINK *sink)
+{
+  if (context->ownsSink)
+  {
+    freeOutputSink(context->sink);
+  }
+  context->sink = sink;
+  context->ownsSink = 0;
+}
+
+int setWriteContextCompression(WRITE_CONTEXT *context, int format, int level, int workers)
+{
+  if (format == COMPRESSION_NONE)
+  {
+    return 1;
+  }
+  OUTPUT_SINK *sink = newCompressingSink(context->sink, context->ownsSink, format, level, workers);
+  if (sink == NULL)
+  {
+    return 0;
+  }
+  context->sink = sink;
+  context->ownsSink = 1;
+  return 1;
+}
+
+void setWriteContextPool(WRITE_CONTEXT *context, BUFFER_POOL *pool)
+{
+  context->pool = pool;
+}
+
+int startAsyncWriter(WRITE_CONTEXT *context, int queueLength)
+{
+  context->asyncWriter = newAsyncWriter(context, queueLength);
+  return context->asyncWriter != NULL;
+}
+
 void initializeLocalWriteContext(WRITE_CONTEXT *writeContext, STRING *line)
 {
   writeContext->local = 1;
@@ -153,121 +234,369 @@ void endLine(WRITE_CONTEXT *writeContext, char *types)
     return;
   }
 
-  writeContext->customLineFunction(writeContext->lastname, writeContext->customLineBuffer->str, types);
+  writeContext->customLineFunction(writeContext->lastFile != NULL ? writeContext->lastFile->filename : NULL, writeContext->customLineBuffer->str, types);
   writeContext->customLineBufferPosition = 0;
   // Ensure the line is empty
   writeContext->customLineBuffer->str[0] = 0;
 }
 
-int getFile(WRITE_CONTEXT *context, char *filename, const char *extension)
+// FNV-1a hash of a filename
+unsigned long hashFilename(const char *filename)
 {
-  if ((context->lastname != NULL) && (strcmp(context->lastname, filename) == 0))
+  unsigned long hash = 2166136261u;
+  for (const char *c = filename; *c; c++)
   {
-    // Same file as last time, just write to it
-    return 0;
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
   }
+  return hash;
+}
 
-  // Different file than last time, open it
-  if (context->filenames == NULL)
+OUTPUT_FILE *lookupFile(WRITE_CONTEXT *context, char *filename, unsigned long hash)
+{
+  OUTPUT_FILE *file = context->fileBuckets[hash % context->numFileBuckets];
+  while (file != NULL)
   {
-    // No files open, so open the file
-    context->filenames = (char **)malloc(sizeof(char *));
-    context->extensions = (char **)malloc(sizeof(char *));
-    context->bufferFiles = (BUFFER_FILE **)malloc(sizeof(BUFFER_FILE *));
-    if (context->writeToFile)
+    if (file->hash == hash && strcmp(file->filename, filename) == 0)
     {
-      context->files = (FILE **)malloc(sizeof(FILE *));
+      return file;
     }
+    file = file->next;
+  }
+  return NULL;
+}
+
+void addFile(WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  if (context->nfiles == context->filesCapacity)
+  {
+    context->filesCapacity = context->filesCapacity == 0 ? 16 : context->filesCapacity * 2;
+    context->files = (OUTPUT_FILE **)realloc(context->files, sizeof(OUTPUT_FILE *) * context->filesCapacity);
+  }
+  context->files[context->nfiles++] = file;
+
+  // Double the buckets to keep chains short
+  if (context->nfiles > context->numFileBuckets)
+  {
+    int numBuckets = context->numFileBuckets * 2;
+    OUTPUT_FILE **buckets = calloc(numBuckets, sizeof(OUTPUT_FILE *));
+    for (int i = 0; i < context->nfiles - 1; i++)
+    {
+      OUTPUT_FILE *existing = context->files[i];
+      existing->next = buckets[existing->hash % numBuckets];
+      buckets[existing->hash % numBuckets] = existing;
+    }
+    free(context->fileBuckets);
+    context->fileBuckets = buckets;
+    context->numFileBuckets = numBuckets;
+  }
+  file->next = context->fileBuckets[file->hash % context->numFileBuckets];
+  context->fileBuckets[file->hash % context->numFileBuckets] = file;
+}
+
+// Take a file out of its pool's least recently used list (if it's in it)
+void unlinkPooledFile(BUFFER_POOL *pool, OUTPUT_FILE *file)
+{
+  if (file->poolPrev == NULL && pool->lruHead != file)
+  {
+    return;
+  }
+  if (file->poolPrev != NULL)
+  {
+    file->poolPrev->poolNext = file->poolNext;
+  }
+  else
+  {
+    pool->lruHead = file->poolNext;
+  }
+  if (file->poolNext != NULL)
+  {
+    file->poolNext->poolPrev = file->poolPrev;
+  }
+  else
+  {
+    pool->lruTail = file->poolPrev;
+  }
+  file->poolPrev = NULL;
+  file->poolNext = NULL;
+}
+
+// Mark a file holding a pool buffer as the most recently used
+void touchPooledFile(WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  BUFFER_POOL *pool = context->pool;
+  if (pool == NULL || file->bufferFile->buffer == NULL || pool->lruTail == file)
+  {
+    return;
+  }
+  unlinkPooledFile(pool, file);
+  file->poolPrev = pool->lruTail;
+  if (pool->lruTail != NULL)
+  {
+    pool->lruTail->poolNext = file;
   }
   else
   {
-    // See if file is already open
-    for (int i = 0; i < context->nfiles; i++)
+    pool->lruHead = file;
+  }
+  pool->lruTail = file;
+}
+
+void addBufferedBytes(BUFFER_POOL *pool, long bytes)
+{
+  pool->bufferedBytes += bytes;
+  if (pool->bufferedBytes > pool->peakBufferedBytes)
+  {
+    pool->peakBufferedBytes = pool->bufferedBytes;
+  }
+}
+
+void releaseIdleBuffer(BUFFER_POOL *pool, char *buffer, int size)
+{
+  if (pool->numIdle == pool->idleCapacity)
+  {
+    pool->idleCapacity = pool->idleCapacity == 0 ? 16 : pool->idleCapacity * 2;
+    pool->idleBuffers = (char **)realloc(pool->idleBuffers, sizeof(char *) * pool->idleCapacity);
+    pool->idleSizes = (int *)realloc(pool->idleSizes, sizeof(int) * pool->idleCapacity);
+  }
+  pool->idleBuffers[pool->numIdle] = buffer;
+  pool->idleSizes[pool->numIdle] = size;
+  pool->numIdle++;
+  pool->idleBytes += size;
+}
+
+char *takeIdleBuffer(BUFFER_POOL *pool, int size)
+{
+  for (int i = pool->numIdle - 1; i >= 0; i--)
+  {
+    if (pool->idleSizes[i] == size)
     {
-      if (strcmp(context->filenames[i], filename) == 0)
-      {
-        // Write to existing file
-        context->lastname = context->filenames[i];
-        context->lastBufferFile = context->bufferFiles[i];
-        if (context->writeToFile)
-        {
-          context->lastfile = context->files[i];
-        }
-        return 0;
-      }
+      char *buffer = pool->idleBuffers[i];
+      pool->numIdle--;
+      pool->idleBuffers[i] = pool->idleBuffers[pool->numIdle];
+      pool->idleSizes[i] = pool->idleSizes[pool->numIdle];
+      pool->idleBytes -= size;
+      return buffer;
     }
+  }
+  return NULL;
+}
+
+void bufferFlush(WRITE_CONTEXT *context, OUTPUT_FILE *file);
 
-    // File is not open, open it
-    context->filenames = (char **)realloc(context->filenames, sizeof(char *) * (context->nfiles + 1));
-    context->extensions = (char **)realloc(context->extensions, sizeof(char *) * (context->nfiles + 1));
-    context->bufferFiles = (BUFFER_FILE **)realloc(context->bufferFiles, sizeof(BUFFER_FILE *) * (context->nfiles + 1));
-    if (context->writeToFile)
+// Make room in the pool's budget for another bytes of buffers, first by
+// freeing unused buffers and then by flushing the least recently used
+// files (other than the one that needs the room) and freeing theirs.
+// Return 0 if there isn't enough to free.
+int reservePoolBytes(BUFFER_POOL *pool, long bytes, OUTPUT_FILE *except)
+{
+  // Don't flush anything if it wouldn't make enough room
+  if (except->bufferFile->bufferSize + bytes > pool->budget)
+  {
+    return 0;
+  }
+  while (pool->bufferedBytes + pool->idleBytes + bytes > pool->budget)
+  {
+    if (pool->numIdle > 0)
+    {
+      pool->numIdle--;
+      pool->idleBytes -= pool->idleSizes[pool->numIdle];
+      free(pool->idleBuffers[pool->numIdle]);
+      continue;
+    }
+    OUTPUT_FILE *victim = pool->lruHead;
+    if (victim == except)
     {
-      context->files = (FILE **)realloc(context->files, sizeof(FILE *) * (context->nfiles + 1));
+      victim = victim->poolNext;
     }
+    if (victim == NULL)
+    {
+      return 0;
+    }
+    BUFFER_FILE *bufferFile = victim->bufferFile;
+    bufferFlush(victim->context, victim);
+    unlinkPooledFile(pool, victim);
+    pool->bufferedBytes -= bufferFile->bufferSize;
+    free(bufferFile->buffer);
+    bufferFile->buffer = NULL;
+    bufferFile->bufferSize = 0;
+    pool->earlyFlushes++;
   }
-  // Open and write to file
-  context->filenames[context->nfiles] = malloc(strlen(filename) + 1);
-  context->extensions[context->nfiles] = malloc(strlen(extension) + 1);
-  context->bufferFiles[context->nfiles] = newBufferFile(context->bufferSize);
-  strcpy(context->filenames[context->nfiles], filename);
-  strcpy(context->extensions[context->nfiles], extension);
-  // Derive the full path to the file
-
-  if (context->writeToFile)
-  {
-    // Ensure the directory exists (will silently fail if it does)
-    char *fullpath = (char *)malloc(sizeof(char) * (strlen(context->outputDirectory) + strlen(filename) + 1 + strlen(context->filingId) + strlen(extension) + 1));
-    strcpy(fullpath, context->outputDirectory);
-    strcat(fullpath, context->filingId);
-    mkdir_p(fullpath);
-
-    // Add the normalized filename to path
-    strcat(fullpath, DIR_SEPARATOR);
-    char *normalizedFilename = malloc(strlen(filename) + 1);
-    strcpy(normalizedFilename, filename);
-    normalize_filename(normalizedFilename);
-    strcat(fullpath, normalizedFilename);
-    strcat(fullpath, extension);
-
-    context->files[context->nfiles] = fopen(fullpath, "w");
-    // Free the derived file paths
-    free(normalizedFilename);
-    free(fullpath);
-  }
-  context->lastname = context->filenames[context->nfiles];
-  context->lastBufferFile = context->bufferFiles[context->nfiles];
-  if (context->writeToFile)
-  {
-    context->lastfile = context->files[context->nfiles];
-  }
-  context->nfiles++;
   return 1;
 }
 
-void bufferFlush(WRITE_CONTEXT *context, char *filename, const char *extension, FILE *file, BUFFER_FILE *bufferFile)
+// Give a file without a buffer the pool's initial size of buffer. It's
+// taken even over budget, as the write can't go anywhere else.
+void takePoolBuffer(WRITE_CONTEXT *context, OUTPUT_FILE *file)
 {
+  BUFFER_POOL *pool = context->pool;
+  BUFFER_FILE *bufferFile = file->bufferFile;
+  int size = pool->initialSize < context->bufferSize ? pool->initialSize : context->bufferSize;
+  bufferFile->buffer = takeIdleBuffer(pool, size);
+  if (bufferFile->buffer == NULL)
+  {
+    reservePoolBytes(pool, size, file);
+    bufferFile->buffer = malloc(size);
+  }
+  bufferFile->bufferSize = size;
+  addBufferedBytes(pool, size);
+  touchPooledFile(context, file);
+}
+
+// Double a full pooled buffer (up to the context's buffer size), keeping
+// its contents. Return 0 if it can't grow, so should be flushed instead.
+int growPoolBuffer(WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  BUFFER_POOL *pool = context->pool;
+  BUFFER_FILE *bufferFile = file->bufferFile;
+  if (pool == NULL || bufferFile->bufferSize >= context->bufferSize)
+  {
+    return 0;
+  }
+  int size = bufferFile->bufferSize * 2 < context->bufferSize ? bufferFile->bufferSize * 2 : context->bufferSize;
+  char *buffer = takeIdleBuffer(pool, size);
+  if (buffer != NULL)
+  {
+    memcpy(buffer, bufferFile->buffer, bufferFile->bufferPos);
+    releaseIdleBuffer(pool, bufferFile->buffer, bufferFile->bufferSize);
+  }
+  else
+  {
+    if (!reservePoolBytes(pool, size - bufferFile->bufferSize, file))
+    {
+      return 0;
+    }
+    buffer = realloc(bufferFile->buffer, size);
+  }
+  addBufferedBytes(pool, size - bufferFile->bufferSize);
+  bufferFile->buffer = buffer;
+  bufferFile->bufferSize = size;
+  touchPooledFile(context, file);
+  return 1;
+}
+
+OUTPUT_FILE *openFile(WRITE_CONTEXT *context, char *filename, const char *extension, int *opened)
+{
+  *opened = 0;
+  if ((context->lastFile != NULL) && (strcmp(context->lastFile->filename, filename) == 0))
+  {
+    // Same file as last time, just write to it
+    return context->lastFile;
+  }
+
+  // Different file than last time, see if it's already open
+  unsigned long hash = hashFilename(filename);
+  OUTPUT_FILE *file = lookupFile(context, filename, hash);
+  if (file != NULL)
+  {
+    // Write to existing file
+    context->lastFile = file;
+    touchPooledFile(context, file);
+    return file;
+  }
+
+  // File is not open, open it
+  file = (OUTPUT_FILE *)malloc(sizeof(OUTPUT_FILE));
+  file->filename = malloc(strlen(filename) + 1);
+  file->extension = malloc(strlen(extension) + 1);
+  // Pooled buffers are taken on the first write
+  file->bufferFile = newBufferFile(context->pool != NULL ? 0 : context->bufferSize);
+  file->sinkFile = NULL;
+  file->rows = 0;
+  file->hash = hash;
+  file->context = context;
+  file->poolPrev = NULL;
+  file->poolNext = NULL;
+  strcpy(file->filename, filename);
+  strcpy(file->extension, extension);
+  if (!context->sink->open(context->sink, context, file))
+  {
+    fprintf(stderr, "Couldn't open output file: %s%s\n", filename, extension);
+  }
+  addFile(context, file);
+  context->lastFile = file;
+  *opened = 1;
+  return file;
+}
+
+int getFile(WRITE_CONTEXT *context, char *filename, const char *extension)
+{
+  int opened;
+  openFile(context, filename, extension, &opened);
+  return opened;
+}
+
+char *outputFilePath(WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  // Ensure the directory exists (will silently fail if it does)
+  char *fullpath = (char *)malloc(sizeof(char) * (strlen(context->outputDirectory) + strlen(file->filename) + 1 + strlen(context->filingId) + strlen(file->extension) + 1));
+  strcpy(fullpath, context->outputDirectory);
+  strcat(fullpath, context->filingId);
+  mkdir_p(fullpath);
+
+  // Add the normalized filename to path
+  strcat(fullpath, DIR_SEPARATOR);
+  char *normalizedFilename = malloc(strlen(file->filename) + 1);
+  strcpy(normalizedFilename, file->filename);
+  normalize_filename(normalizedFilename);
+  strcat(fullpath, normalizedFilename);
+  strcat(fullpath, file->extension);
+  free(normalizedFilename);
+  return fullpath;
+}
+
+void bufferFlush(WRITE_CONTEXT *context, OUTPUT_FILE *file)
+{
+  BUFFER_FILE *bufferFile = file->bufferFile;
   if (bufferFile->bufferPos == 0)
   {
     return;
   }
-  if (context->customWriteFunction != NULL)
+  if (context->asyncWriter != NULL)
   {
-    // Write to a custom write function
-    context->customWriteFunction(filename, (char *)extension, bufferFile->buffer, bufferFile->bufferPos);
+    // Swap in an empty buffer while the full one is written
+    bufferFile->buffer = asyncWrite(context->asyncWriter, file, bufferFile->buffer, bufferFile->bufferPos, bufferFile->bufferSize);
   }
-  if (context->writeToFile)
+  else if (context->sink->swap != NULL)
   {
-    fwrite(bufferFile->buffer, 1, bufferFile->bufferPos, file);
+    bufferFile->buffer = context->sink->swap(context->sink, file, bufferFile->buffer, bufferFile->bufferPos, bufferFile->bufferSize);
+  }
+  else
+  {
+    context->sink->write(context->sink, file, bufferFile->buffer, bufferFile->bufferPos);
   }
   bufferFile->bufferPos = 0;
 }
 
-void bufferWrite(WRITE_CONTEXT *context, char *filename, const char *extension, FILE *file, BUFFER_FILE *bufferFile, char *string, int nchars)
+int flushWriteContext(WRITE_CONTEXT *context)
 {
+  for (int i = 0; i < context->nfiles; i++)
+  {
+    bufferFlush(context, context->files[i]);
+  }
+  if (context->asyncWriter != NULL)
+  {
+    drainAsyncWriter(context->asyncWriter);
+  }
+  for (int i = 0; i < context->nfiles; i++)
+  {
+    if (context->sink->flush != NULL)
+    {
+      context->sink->flush(context->sink, context->files[i]);
+    }
+  }
+  return !context->writeFailed;
+}
+
+void bufferWrite(WRITE_CONTEXT *context, OUTPUT_FILE *file, char *string, int nchars)
+{
+  BUFFER_FILE *bufferFile = file->bufferFile;
   int offset = 0;
   while (nchars > 0)
   {
+    if (bufferFile->buffer == NULL)
+    {
+      takePoolBuffer(context, file);
+    }
     int bytesToWrite = nchars;
     int remaining = bufferFile->bufferSize - bufferFile->bufferPos;
     if (bytesToWrite > remaining)
@@ -279,23 +608,27 @@ void bufferWrite(WRITE_CONTEXT *context, char *filename, const char *extension,
     memcpy(bufferFile->buffer + bufferFile->bufferPos, string + offset, bytesToWrite);
     bufferFile->bufferPos += bytesToWrite;
 
-    // Flush if needed
-    if (bufferFile->bufferPos >= bufferFile->bufferSize)
+    // Grow or flush if needed
+    if (bufferFile->bufferPos >= bufferFile->bufferSize && !growPoolBuffer(context, file))
     {
-      bufferFlush(context, filename, extension, file, bufferFile);
+      bufferFlush(context, file);
+      touchPooledFile(context, file);
     }
     nchars -= bytesToWrite;
     offset += bytesToWrite;
   }
 }
 
-void writeN(WRITE_CONTEXT *context, char *filename, const char *extension, char *string, int nchars)
+void writeFileN(WRITE_CONTEXT *context, OUTPUT_FILE *file, char *string, int nchars)
 {
+  if (nchars <= 0)
+  {
+    return;
+  }
   if (context->local == 0)
   {
     // Write to file
-    getFile(context, filename, extension);
-    bufferWrite(context, filename, extension, context->lastfile, context->lastBufferFile, string, nchars);
+    bufferWrite(context, file, string, nchars);
 
     if (context->useCustomLine)
     {
@@ -314,78 +647,141 @@ void writeN(WRITE_CONTEXT *context, char *filename, const char *extension, char
   else
   {
     // Write to local buffer
-    int newPosition = context->localBufferPosition + nchars;
-    if (newPosition + 1 > context->localBuffer->n)
-    {
-      growStringTo(context->localBuffer, newPosition + 1);
-    }
-    memcpy(context->localBuffer->str + context->localBufferPosition, string, nchars);
-    context->localBufferPosition = newPosition;
-    // Add null terminator
-    context->localBuffer->str[context->localBufferPosition] = 0;
+    memcpy(reserveLocal(context, nchars), string, nchars);
+    commitLocal(context, nchars);
   }
 }
 
-void writeString(WRITE_CONTEXT *context, char *filename, const char *extension, char *string)
+char *reserveLocal(WRITE_CONTEXT *context, int nchars)
 {
-  writeN(context, filename, extension, string, strlen(string));
+  if (context->localBufferPosition + nchars + 1 > context->localBuffer->n)
+  {
+    growStringTo(context->localBuffer, context->localBufferPosition + nchars + 1);
+  }
+  return context->localBuffer->str + context->localBufferPosition;
 }
 
-void writeChar(WRITE_CONTEXT *context, char *filename, const char *extension, char c)
+void commitLocal(WRITE_CONTEXT *context, int nchars)
+{
+  context->localBufferPosition += nchars;
+  // Add null terminator
+  context->localBuffer->str[context->localBufferPosition] = 0;
+}
+
+void writeFileString(WRITE_CONTEXT *context, OUTPUT_FILE *file, char *string)
+{
+  writeFileN(context, file, string, strlen(string));
+}
+
+void writeFileChar(WRITE_CONTEXT *context, OUTPUT_FILE *file, char c)
 {
   if (context->local == 0 && (!context->useCustomLine))
   {
-    // Write to file
-    getFile(context, filename, extension);
-    bufferWrite(context, filename, extension, context->lastfile, context->lastBufferFile, &c, 1);
+    // Write to file, directly if there's room in its buffer
+    BUFFER_FILE *bufferFile = file->bufferFile;
+    if (bufferFile->bufferPos + 1 < bufferFile->bufferSize)
+    {
+      bufferFile->buffer[bufferFile->bufferPos++] = c;
+      return;
+    }
+    bufferWrite(context, file, &c, 1);
   }
-  else
+  else if (context->local)
   {
     // Write to local buffer
+    *reserveLocal(context, 1) = c;
+    commitLocal(context, 1);
+  }
+  else
+  {
     char str[] = {c};
-    writeN(context, filename, extension, str, 1);
+    writeFileN(context, file, str, 1);
   }
 }
 
-void writeDouble(WRITE_CONTEXT *context, char *filename, const char *extension, double d)
+void writeFileDouble(WRITE_CONTEXT *context, OUTPUT_FILE *file, double d)
 {
   // Write to local buffer
   char str[100]; // should be able to fit any double
   sprintf(str, NUMBER_FORMAT, d);
-  writeString(context, filename, extension, str);
+  writeFileString(context, file, str);
+}
+
+// Look up the output file for writes by name (local write contexts have none)
+OUTPUT_FILE *fileForWrite(WRITE_CONTEXT *context, char *filename, const char *extension)
+{
+  if (context->local)
+  {
+    return NULL;
+  }
+  int opened;
+  return openFile(context, filename, extension, &opened);
+}
+
+void writeN(WRITE_CONTEXT *context, char *filename, const char *extension, char *string, int nchars)
+{
+  writeFileN(context, fileForWrite(context, filename, extension), string, nchars);
+}
+
+void writeString(WRITE_CONTEXT *context, char *filename, const char *extension, char *string)
+{
+  writeN(context, filename, extension, string, strlen(string));
+}
+
+void writeChar(WRITE_CONTEXT *context, char *filename, const char *extension, char c)
+{
+  writeFileChar(context, fileForWrite(context, filename, extension), c);
+}
+
+void writeDouble(WRITE_CONTEXT *context, char *filename, const char *extension, double d)
+{
+  writeFileDouble(context, fileForWrite(context, filename, extension), d);
 }
 
 void freeWriteContext(WRITE_CONTEXT *context)
 {
+  // Flush out any remaining file contents
   for (int i = 0; i < context->nfiles; i++)
   {
-    // Flush out any remaining file contents
-    bufferFlush(context, context->filenames[i], context->extensions[i], context->writeToFile ? context->files[i] : NULL, context->bufferFiles[i]);
+    bufferFlush(context, context->files[i]);
+  }
+  if (context->asyncWriter != NULL)
+  {
+    freeAsyncWriter(context->asyncWriter);
+  }
+  for (int i = 0; i < context->nfiles; i++)
+  {
+    OUTPUT_FILE *file = context->files[i];
+    if (context->sink->flush != NULL)
+    {
+      context->sink->flush(context->sink, file);
+    }
+    if (context->sink->close != NULL)
+    {
+      context->sink->close(context->sink, file);
+    }
 
-    // Free memory structures for each file
-    free(context->filenames[i]);
-    free(context->extensions[i]);
-    freeBufferFile(context->bufferFiles[i]);
-    if (context->writeToFile)
+    // Free memory structures for each file, keeping pooled buffers
+    if (context->pool != NULL && file->bufferFile->buffer != NULL)
     {
-      fclose(context->files[i]);
+      unlinkPooledFile(context->pool, file);
+      context->pool->bufferedBytes -= file->bufferFile->bufferSize;
+      releaseIdleBuffer(context->pool, file->bufferFile->buffer, file->bufferFile->bufferSize);
+      file->bufferFile->buffer = NULL;
     }
-  }
-  if (context->filenames != NULL)
-  {
-    free(context->filenames);
+    free(file->filename);
+    free(file->extension);
+    freeBufferFile(file->bufferFile);
+    free(file);
   }
   if (context->files != NULL)
   {
     free(context->files);
   }
-  if (context->bufferFiles != NULL)
-  {
-    free(context->bufferFiles);
-  }
-  if (context->extensions != NULL)
+  free(context->fileBuckets);
+  if (context->ownsSink)
   {
-    free(context->extensions);
+    freeOutputSink(context->sink);
   }
   if (context->customLineBuffer != NULL)
   {
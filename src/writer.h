@@ -16,46 +16,194 @@ struct buffer_file
 };
 typedef struct buffer_file BUFFER_FILE;
 
+typedef struct write_context WRITE_CONTEXT;
+
+// An open output file, which writes can go to directly once
+// it's been looked up by name
+struct output_file
+{
+  char *filename;
+  char *extension;
+  BUFFER_FILE *bufferFile;
+  void *sinkFile; // the sink's handle for the file, if it needs one
+  long rows;      // rows written to the file, not counting its header row
+  unsigned long hash;
+  struct output_file *next; // next file in the same hash bucket
+
+  // With a buffer pool, the context the file belongs to and its place
+  // among the files holding pool buffers (least recently used first)
+  WRITE_CONTEXT *context;
+  struct output_file *poolPrev;
+  struct output_file *poolNext;
+};
+typedef struct output_file OUTPUT_FILE;
+
+// A shared source of output buffers, held to a memory budget across every
+// write context using it. A file's buffer starts small and doubles each
+// time it fills (up to the context's buffer size), so rarely written form
+// types only take a little memory. When holding another buffer would go
+// over the budget, the least recently used files are flushed early and
+// their buffers freed. Buffers of freed write contexts are kept to reuse.
+// A pool isn't thread safe; share it only between contexts on one thread.
+struct buffer_pool
+{
+  long budget;
+  int initialSize;
+  long bufferedBytes;     // held by output files
+  long peakBufferedBytes; // the most held by output files at once
+  long earlyFlushes;      // buffers flushed to stay in budget
+
+  // Unused buffers kept to reuse, in the order they were released
+  char **idleBuffers;
+  int *idleSizes;
+  int numIdle;
+  int idleCapacity;
+  long idleBytes;
+
+  // Files holding a buffer, least recently used first
+  OUTPUT_FILE *lruHead;
+  OUTPUT_FILE *lruTail;
+};
+typedef struct buffer_pool BUFFER_POOL;
+
+// Where the buffered contents of output files go (see sink.h for the
+// built-in sinks). Each output file is opened once, written in chunks
+// as its buffer fills, flushed at the end of a parse and closed when
+// the write context is freed.
+typedef struct output_sink OUTPUT_SINK;
+struct output_sink
+{
+  // Prepare to write a newly opened output file (setting file->sinkFile
+  // if needed). Return 0 if the file couldn't be opened.
+  int (*open)(OUTPUT_SINK *sink, WRITE_CONTEXT *context, OUTPUT_FILE *file);
+  void (*write)(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *contents, int numBytes);
+  // Optional: write a full buffer (of capacity bytes) by taking it over
+  // rather than copying it, and return an empty buffer of the same
+  // capacity to fill next. Used in place of write for output buffers.
+  char *(*swap)(OUTPUT_SINK *sink, OUTPUT_FILE *file, char *buffer, int length, int capacity);
+  void (*flush)(OUTPUT_SINK *sink, OUTPUT_FILE *file); // optional
+  void (*close)(OUTPUT_SINK *sink, OUTPUT_FILE *file); // optional
+  void (*free)(OUTPUT_SINK *sink);                     // optional, frees state
+  void *state;
+};
+
 struct write_context
 {
   int bufferSize;
   char *outputDirectory;
   char *filingId;
-  char **filenames;
-  char **extensions;
-  BUFFER_FILE **bufferFiles;
-  FILE **files;
+  OUTPUT_FILE **files; // in the order they were opened
   int nfiles;
-  char *lastname;
-  BUFFER_FILE *lastBufferFile;
-  FILE *lastfile;
+  int filesCapacity;
+  OUTPUT_FILE **fileBuckets; // files hashed by filename
+  int numFileBuckets;
+  OUTPUT_FILE *lastFile;
   int local;
   STRING *localBuffer;
   int localBufferPosition;
   int useCustomLine;
   STRING *customLineBuffer;
   int customLineBufferPosition;
-  int writeToFile;
-  CustomWriteFunction customWriteFunction;
+  OUTPUT_SINK *sink;
+  int ownsSink; // whether the sink was made for (and is freed with) the context
+  struct async_writer *asyncWriter; // writes full buffers on an I/O thread, if started
+  BUFFER_POOL *pool;                // where output buffers come from, if set
+  int writeFailed;                  // set by a sink when output couldn't be written
   CustomLineFunction customLineFunction;
 };
-typedef struct write_context WRITE_CONTEXT;
 
+// Create a buffer file (without a buffer yet if bufferSize is 0)
 BUFFER_FILE *newBufferFile(int bufferSize);
 
 void freeBufferFile(BUFFER_FILE *bufferFile);
 
+// Create a buffer pool holding at most budget bytes of output buffers
+// (other than any one buffer a file needs to make progress), with each
+// file's buffer starting at initialSize bytes
+BUFFER_POOL *newBufferPool(long budget, int initialSize);
+
+// Free a buffer pool once no write context is using it
+void freeBufferPool(BUFFER_POOL *pool);
+
+// Keep an unused buffer in a pool to reuse
+void releaseIdleBuffer(BUFFER_POOL *pool, char *buffer, int size);
+
+// Return an unused buffer of the given size from a pool (most recently
+// released first), or NULL if there isn't one
+char *takeIdleBuffer(BUFFER_POOL *pool, int size);
+
+// Create a directory and any missing parents. Return -1 on failure.
+int mkdir_p(const char *path);
+
+// Create a write context whose output files go to a custom write function
+// if one is given, else to files under the output directory if writeToFile
+// is set, else nowhere
 WRITE_CONTEXT *newWriteContext(char *outputDirectory, char *filingId, int writeToFile, int bufferSize, CustomWriteFunction customWriteFunction, CustomLineFunction customLineFunction);
 
+// Send output files to a sink (owned by the caller) instead of the one
+// newWriteContext made. Must be called before any file is opened.
+void setWriteContextSink(WRITE_CONTEXT *context, OUTPUT_SINK *sink);
+
+// Compress output files (with a compressing sink, see compress.h) in a
+// format at a level (0 for the format's default), on up to workers
+// threads, writing them to the current sink. Must be called before any
+// file is opened, and after any setWriteContextSink. Return 0 (and leave
+// output uncompressed) if the format isn't available or the level is
+// past its highest.
+int setWriteContextCompression(WRITE_CONTEXT *context, int format, int level, int workers);
+
+// Take output buffers from a pool (owned by the caller, which must
+// outlive the context) instead of giving every file a full buffer.
+// Must be called before any file is opened.
+void setWriteContextPool(WRITE_CONTEXT *context, BUFFER_POOL *pool);
+
+// Hand full buffers to an I/O thread that writes them to the sink, with
+// up to queueLength buffers in flight, so the caller doesn't wait on
+// writes. Must be called before any file is opened. Return 0 (and keep
+// writing synchronously) if threads aren't available.
+int startAsyncWriter(WRITE_CONTEXT *context, int queueLength);
+
 void initializeLocalWriteContext(WRITE_CONTEXT *writeContext, STRING *line);
 
 void initializeCustomWriteContext(WRITE_CONTEXT *writeContext);
 
 void endLine(WRITE_CONTEXT *writeContext, char *types);
 
+// Return the output file with the given name, opening it if it isn't
+// open yet. Set opened to 1 if it's newly created for writing, else 0.
+OUTPUT_FILE *openFile(WRITE_CONTEXT *context, char *filename, const char *extension, int *opened);
+
+// Return the full path of an output file under the output directory (in
+// a new allocation), creating the directory if needed
+char *outputFilePath(WRITE_CONTEXT *context, OUTPUT_FILE *file);
+
+// Write out all buffered output and flush the sink, so output is
+// complete (but files stay open for more writes). Return 0 if any output
+// couldn't be written.
+int flushWriteContext(WRITE_CONTEXT *context);
+
 // Return 0 if file is cached, or 1 if it is newly created for writing
 int getFile(WRITE_CONTEXT *context, char *filename, const char *extension);
 
+// Write to an output file from openFile without looking it up again
+// (or, for a local write context, to the local buffer with a null file)
+void writeFileN(WRITE_CONTEXT *context, OUTPUT_FILE *file, char *string, int nchars);
+
+void writeFileString(WRITE_CONTEXT *context, OUTPUT_FILE *file, char *string);
+
+void writeFileChar(WRITE_CONTEXT *context, OUTPUT_FILE *file, char c);
+
+void writeFileDouble(WRITE_CONTEXT *context, OUTPUT_FILE *file, double d);
+
+// Return where the next nchars of a local write context go, growing the
+// local buffer to fit them (and a null terminator). Fill them in directly,
+// then call commitLocal with the number actually written.
+char *reserveLocal(WRITE_CONTEXT *context, int nchars);
+
+void commitLocal(WRITE_CONTEXT *context, int nchars);
+
+// Write to an output file by name
+
 void writeN(WRITE_CONTEXT *context, char *filename, const char *extension, char *string, int nchars);
 
 void writeString(WRITE_CONTEXT *context, char *filename, const char *extension, char *string);
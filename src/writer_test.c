@@ -2,6 +2,7 @@
 #include <string.h>
 #include "minunit.h"
 #include "writer.h"
+#include "sink.h"
 
 int tests_run = 0;
 
@@ -142,12 +143,117 @@ static char *testLineBuffer()
   return 0;
 }
 
+static char *testManyFiles()
+{
+  resetOutput();
+
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 300, writeToFile, writeToLine);
+
+  // Open enough files to grow the file table a few times
+  char filename[20];
+  OUTPUT_FILE *files[100];
+  for (int i = 0; i < 100; i++)
+  {
+    int opened;
+    sprintf(filename, "file%d", i);
+    files[i] = openFile(ctx, filename, testExt, &opened);
+    mu_assert("expected file to be newly opened", opened == 1);
+  }
+  mu_assert("expected 100 files", ctx->nfiles == 100);
+
+  // Every file should be found again by name
+  for (int i = 99; i >= 0; i--)
+  {
+    int opened;
+    sprintf(filename, "file%d", i);
+    mu_assert("expected the same file back", openFile(ctx, filename, testExt, &opened) == files[i]);
+    mu_assert("expected file to be cached", opened == 0);
+    mu_assert("expected getFile to find the file", getFile(ctx, filename, testExt) == 0);
+  }
+
+  // Writes through a handle and by name go to the same file
+  writeFileString(ctx, files[42], "hi ");
+  writeString(ctx, "file42", testExt, "there");
+  freeWriteContext(ctx);
+  mu_assert("expected file contents to be \"hi there\"", strcmp(outputFile, "hi there") == 0);
+
+  return 0;
+}
+
+// Write interleaved lines to a few files, the second opened (file0)
+// written far more than the rest
+void writeUnevenly(WRITE_CONTEXT *ctx)
+{
+  char filename[20];
+  char line[50];
+  int opened;
+  for (int i = 0; i < 2000; i++)
+  {
+    sprintf(filename, "file%d", i % 40 == 0 ? (i / 40) % 4 + 1 : 0);
+    sprintf(line, "line %d\n", i);
+    writeFileString(ctx, openFile(ctx, filename, testExt, &opened), line);
+  }
+}
+
+static char *testBufferPool()
+{
+  OUTPUT_SINK *expected = newMemorySink();
+  WRITE_CONTEXT *ctx = newWriteContext(NULL, NULL, 0, 1024, NULL, NULL);
+  setWriteContextSink(ctx, expected);
+  writeUnevenly(ctx);
+  freeWriteContext(ctx);
+
+  // Two contexts share a pool too small for all their files' buffers
+  BUFFER_POOL *pool = newBufferPool(1000, 16);
+  OUTPUT_SINK *sinks[] = {newMemorySink(), newMemorySink()};
+  WRITE_CONTEXT *contexts[2];
+  for (int i = 0; i < 2; i++)
+  {
+    contexts[i] = newWriteContext(NULL, NULL, 0, 1024, NULL, NULL);
+    setWriteContextSink(contexts[i], sinks[i]);
+    setWriteContextPool(contexts[i], pool);
+  }
+  writeUnevenly(contexts[0]);
+  writeUnevenly(contexts[1]);
+
+  // The busiest file's buffer grows, while the others stay small
+  mu_assert("expected the busy file's buffer to grow", contexts[1]->files[1]->bufferFile->bufferSize >= 512);
+  mu_assert("expected a rarely written file's buffer to stay small", contexts[1]->files[0]->bufferFile->bufferSize <= 128);
+  mu_assert("expected files to be flushed early", pool->earlyFlushes > 0);
+  mu_assert("expected the pool to stay in budget", pool->peakBufferedBytes <= 1000);
+  freeWriteContext(contexts[0]);
+  freeWriteContext(contexts[1]);
+
+  // Every file is still written in full
+  for (int i = 0; i < 2; i++)
+  {
+    mu_assert("expected the same number of files", getMemorySinkNumFiles(expected) == getMemorySinkNumFiles(sinks[i]));
+    for (int j = 0; j < getMemorySinkNumFiles(expected); j++)
+    {
+      char *expectedName, *actualName, *extension, *expectedContents, *actualContents;
+      int expectedLength = getMemorySinkFile(expected, j, &expectedName, &extension, &expectedContents);
+      int actualLength = getMemorySinkFile(sinks[i], j, &actualName, &extension, &actualContents);
+      mu_assert("expected the same file", strcmp(expectedName, actualName) == 0);
+      mu_assert("expected the same contents", expectedLength == actualLength && memcmp(expectedContents, actualContents, expectedLength) == 0);
+    }
+    freeOutputSink(sinks[i]);
+  }
+
+  // Freed contexts' buffers are kept to reuse
+  mu_assert("expected unused buffers to be kept", pool->numIdle > 0 && pool->bufferedBytes == 0);
+  freeBufferPool(pool);
+  freeOutputSink(expected);
+  return 0;
+}
+
 static char *all_tests()
 {
   mu_run_test(testWriter);
   mu_run_test(testWriterEndOnBufferSize);
   mu_run_test(testWriterMassiveBuffer);
   mu_run_test(testLineBuffer);
+  mu_run_test(testManyFiles);
+  mu_run_test(testBufferPool);
   return 0;
 }
 